@@ -0,0 +1,869 @@
+/**
+ * AsyncFileIO.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <functional>
+#include <set>
+
+#if defined( __linux__ ) && defined( HAVE_LINUX_IO_URING_H ) && defined( STATX_BASIC_STATS )
+#  define USE_IO_URING 1
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/sysmacros.h>
+#endif
+
+#include "AsyncFileIO.h"
+
+
+// The length of one read or write: sqe->len is 32 bits, cqe->res is a
+// signed 32 bit result
+
+#define MAX_RW_SIZE     ( 1 << 30 )
+
+// Room for reading past the size that stat() reported: The read that
+// hits the end of the file then does not need a buffer of its own
+
+#define READ_SLACK      4096
+
+
+#ifdef USE_IO_URING
+
+/**
+ * Minimal io_uring: Just enough to submit a batch of operations and wait
+ * until all of them are done.
+ **/
+struct AsyncFileIO::Ring
+{
+    typedef std::function<void( size_t index, struct io_uring_sqe * sqe )> Prepare;
+
+    Ring():
+        fd( -1 ),
+        entries( 0 ),
+        failed( false ),
+        sq_ptr( MAP_FAILED ),
+        cq_ptr( MAP_FAILED ),
+        sqes( (struct io_uring_sqe *) MAP_FAILED )
+        {}
+
+    ~Ring();
+
+    /**
+     * Set up the ring. Return 'true' if success, 'false' if error.
+     **/
+    bool setup( unsigned queue_depth );
+
+    /**
+     * Execute 'count' operations, each of them set up by 'prepare', and
+     * wait until all of them are done. Return the result of each one
+     * (>= 0 for success, -errno for error) in 'results_ret'.
+     *
+     * If io_uring_enter() fails for any other reason than being
+     * interrupted or temporarily busy, the ring can no longer be used:
+     * All operations that did not complete get -ECANCELED, and this and
+     * all later calls return 'false'. The caller is expected to do those
+     * operations with plain system calls instead.
+     **/
+    bool run( size_t count, Prepare prepare, vector<int> & results_ret );
+
+    int                     fd;
+    unsigned                entries;
+    bool                    failed;
+
+    void *                  sq_ptr;
+    size_t                  sq_size;
+    void *                  cq_ptr;
+    size_t                  cq_size;
+    struct io_uring_sqe *   sqes;
+    size_t                  sqes_size;
+
+    unsigned *              sq_tail;
+    unsigned *              sq_mask;
+    unsigned *              sq_array;
+    unsigned *              cq_head;
+    unsigned *              cq_tail;
+    unsigned *              cq_mask;
+    struct io_uring_cqe *   cqes;
+};
+
+
+AsyncFileIO::Ring::~Ring()
+{
+    if ( sqes != MAP_FAILED )
+        munmap( sqes, sqes_size );
+
+    if ( cq_ptr != MAP_FAILED && cq_ptr != sq_ptr )
+        munmap( cq_ptr, cq_size );
+
+    if ( sq_ptr != MAP_FAILED )
+        munmap( sq_ptr, sq_size );
+
+    if ( fd >= 0 )
+        close( fd );
+}
+
+
+bool AsyncFileIO::Ring::setup( unsigned queue_depth )
+{
+    struct io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+
+    fd = syscall( __NR_io_uring_setup, queue_depth, &params );
+
+    if ( fd < 0 )
+        return false;
+
+    entries = params.sq_entries;
+    sq_size = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+    cq_size = params.cq_off.cqes  + params.cq_entries * sizeof( struct io_uring_cqe );
+
+    bool single_mmap = ( params.features & IORING_FEAT_SINGLE_MMAP );
+
+    if ( single_mmap )
+        sq_size = cq_size = std::max( sq_size, cq_size );
+
+    sq_ptr = mmap( 0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQ_RING );
+
+    if ( sq_ptr == MAP_FAILED )
+        return false;
+
+    if ( single_mmap )
+        cq_ptr = sq_ptr;
+    else
+    {
+        cq_ptr = mmap( 0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_CQ_RING );
+
+        if ( cq_ptr == MAP_FAILED )
+            return false;
+    }
+
+    sqes_size = params.sq_entries * sizeof( struct io_uring_sqe );
+    sqes = (struct io_uring_sqe *)
+        mmap( 0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              fd, IORING_OFF_SQES );
+
+    if ( sqes == MAP_FAILED )
+        return false;
+
+    char * sq = (char *) sq_ptr;
+    char * cq = (char *) cq_ptr;
+
+    sq_tail  = (unsigned *) ( sq + params.sq_off.tail         );
+    sq_mask  = (unsigned *) ( sq + params.sq_off.ring_mask    );
+    sq_array = (unsigned *) ( sq + params.sq_off.array        );
+    cq_head  = (unsigned *) ( cq + params.cq_off.head         );
+    cq_tail  = (unsigned *) ( cq + params.cq_off.tail         );
+    cq_mask  = (unsigned *) ( cq + params.cq_off.ring_mask    );
+    cqes     = (struct io_uring_cqe *) ( cq + params.cq_off.cqes );
+
+    return true;
+}
+
+
+bool AsyncFileIO::Ring::run( size_t count, Prepare prepare, vector<int> & results_ret )
+{
+    results_ret.assign( count, -ECANCELED );
+
+    if ( failed )
+        return false;
+
+    for ( size_t next = 0; next < count; )
+    {
+        unsigned batch = std::min( (size_t) entries, count - next );
+        unsigned tail  = *sq_tail; // Only we write this
+
+        for ( unsigned i=0; i < batch; ++i )
+        {
+            unsigned index = ( tail + i ) & *sq_mask;
+            struct io_uring_sqe * sqe = &sqes[ index ];
+
+            memset( sqe, 0, sizeof( *sqe ) );
+            prepare( next + i, sqe );
+            sqe->user_data = next + i;
+            sq_array[ index ] = index;
+        }
+
+        __atomic_store_n( sq_tail, tail + batch, __ATOMIC_RELEASE );
+
+        unsigned to_submit = batch;
+        unsigned done      = 0;
+
+        while ( done < batch )
+        {
+            int result = syscall( __NR_io_uring_enter, fd, to_submit, 1,
+                                  IORING_ENTER_GETEVENTS, 0, 0 );
+            int error  = result < 0 ? errno : 0;
+
+            if ( result > 0 )
+                to_submit -= std::min( (unsigned) result, to_submit );
+
+            // Collect whatever is completed, even after EINTR or EBUSY
+
+            unsigned head = *cq_head;
+            unsigned end  = __atomic_load_n( cq_tail, __ATOMIC_ACQUIRE );
+
+            for ( ; head != end; ++head )
+            {
+                struct io_uring_cqe * cqe = &cqes[ head & *cq_mask ];
+                results_ret[ cqe->user_data ] = cqe->res;
+                ++done;
+            }
+
+            __atomic_store_n( cq_head, head, __ATOMIC_RELEASE );
+
+            if ( error && error != EINTR && error != EAGAIN && error != EBUSY && done < batch )
+            {
+                // Trying again would fail the same way forever
+
+                failed = true;
+                return false;
+            }
+        }
+
+        next += batch;
+    }
+
+    return true;
+}
+
+
+/**
+ * Return 'true' if 'result' of an io_uring operation means that the kernel
+ * does not support the operation.
+ **/
+static bool unsupported( int result )
+{
+    return result == -EINVAL || result == -EOPNOTSUPP;
+}
+
+
+/**
+ * Fill 'stat_ret' from 'stx'.
+ **/
+static void fill_file_stat( const struct statx & stx, FileStat & stat_ret )
+{
+    stat_ret.valid      = true;
+    stat_ret.dev        = makedev( stx.stx_dev_major, stx.stx_dev_minor );
+    stat_ret.ino        = stx.stx_ino;
+    stat_ret.size       = stx.stx_size;
+    stat_ret.mtime_sec  = stx.stx_mtime.tv_sec;
+    stat_ret.mtime_nsec = stx.stx_mtime.tv_nsec;
+}
+
+
+static void fill_file_stat( const struct stat & st, FileStat & stat_ret )
+{
+    stat_ret.valid      = true;
+    stat_ret.dev        = st.st_dev;
+    stat_ret.ino        = st.st_ino;
+    stat_ret.size       = st.st_size;
+    stat_ret.mtime_sec  = st.st_mtim.tv_sec;
+    stat_ret.mtime_nsec = st.st_mtim.tv_nsec;
+}
+
+
+static const char empty_path[] = "";
+
+#else // ! USE_IO_URING
+
+struct AsyncFileIO::Ring {};
+
+#endif
+
+
+
+AsyncFileIO::AsyncFileIO( unsigned queue_depth ):
+    ring( 0 )
+{
+#ifdef USE_IO_URING
+    ring = new Ring();
+
+    if ( ! ring->setup( queue_depth ) )
+    {
+        delete ring;
+        ring = 0;
+    }
+#else
+    (void) queue_depth;
+#endif
+}
+
+
+AsyncFileIO::~AsyncFileIO()
+{
+    delete ring;
+}
+
+
+bool AsyncFileIO::read_files( vector<ReadRequest> & requests )
+{
+    for ( size_t i=0; i < requests.size(); ++i )
+    {
+        ReadRequest & request = requests[i];
+
+        request.content.clear();
+        request.stat    = FileStat();
+        request.success = false;
+        request.error   = 0;
+    }
+
+#ifdef USE_IO_URING
+
+    if ( ! ring )
+        return read_files_fallback( requests );
+
+    size_t              count = requests.size();
+    vector<int>         fds;
+    vector<int>         results;
+    vector<size_t>      open_files;     // indexes in 'requests'
+    vector<ReadRequest> fallback;
+    vector<size_t>      fallback_index;
+
+    ring->run( count, [&]( size_t i, struct io_uring_sqe * sqe )
+        {
+            sqe->opcode     = IORING_OP_OPENAT;
+            sqe->fd         = AT_FDCWD;
+            sqe->addr       = (uintptr_t) requests[i].filename.c_str();
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        }, fds );
+
+    for ( size_t i=0; i < count; ++i )
+    {
+        if ( fds[i] >= 0 )
+            open_files.push_back( i );
+        else if ( unsupported( fds[i] ) )
+        {
+            fallback.push_back( requests[i] );
+            fallback_index.push_back( i );
+        }
+        else
+            requests[i].error = -fds[i];
+    }
+
+
+    // Get the size of each file from its file descriptor
+
+    vector<struct statx> stx( open_files.size() );
+
+    ring->run( open_files.size(), [&]( size_t i, struct io_uring_sqe * sqe )
+        {
+            sqe->opcode      = IORING_OP_STATX;
+            sqe->fd          = fds[ open_files[i] ];
+            sqe->addr        = (uintptr_t) empty_path;
+            sqe->len         = STATX_BASIC_STATS;
+            sqe->off         = (uintptr_t) &stx[i];
+            sqe->statx_flags = AT_EMPTY_PATH;
+        }, results );
+
+    vector<size_t> to_read; // indexes in 'open_files'
+
+    for ( size_t i=0; i < open_files.size(); ++i )
+    {
+        ReadRequest & request = requests[ open_files[i] ];
+        int           fd      = fds[ open_files[i] ];
+
+        if ( results[i] == 0 )
+            fill_file_stat( stx[i], request.stat );
+        else
+        {
+            struct stat st;
+
+            if ( fstat( fd, &st ) == 0 )
+                fill_file_stat( st, request.stat );
+        }
+
+        if ( request.stat.size > 0 )
+        {
+            request.content.resize( request.stat.size + READ_SLACK );
+            to_read.push_back( i );
+        }
+        else
+        {
+            // Empty, or a file that does not know its size (e.g. in /proc):
+            // Read it the conventional way.
+
+            char buffer[ 4096 ];
+            ssize_t len;
+
+            while ( ( len = ::read( fd, buffer, sizeof( buffer ) ) ) > 0 ||
+                    ( len < 0 && errno == EINTR ) )
+            {
+                if ( len > 0 )
+                    request.content.append( buffer, len );
+            }
+
+            request.success = ( len == 0 );
+            request.error   = len < 0 ? errno : 0;
+        }
+    }
+
+
+    // Read everything in one go, and then keep reading just like
+    // FileIO::read_file() until each read returns 0: A read may be short,
+    // and a file may have changed since its size was taken.
+
+    vector<size_t> bytes_read( to_read.size(), 0 );
+    vector<size_t> pending;         // indexes in 'to_read'
+    vector<size_t> still_pending;
+
+    for ( size_t i=0; i < to_read.size(); ++i )
+        pending.push_back( i );
+
+    while ( ! pending.empty() )
+    {
+        ring->run( pending.size(), [&]( size_t i, struct io_uring_sqe * sqe )
+            {
+                size_t        index   = open_files[ to_read[ pending[i] ] ];
+                ReadRequest & request = requests[ index ];
+                size_t        offset  = bytes_read[ pending[i] ];
+
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd     = fds[ index ];
+                sqe->addr   = (uintptr_t) &request.content[ offset ];
+                sqe->len    = std::min( request.content.size() - offset, (size_t) MAX_RW_SIZE );
+                sqe->off    = offset;
+            }, results );
+
+        still_pending.clear();
+
+        for ( size_t i=0; i < pending.size(); ++i )
+        {
+            ReadRequest & request = requests[ open_files[ to_read[ pending[i] ] ] ];
+            size_t &      offset  = bytes_read[ pending[i] ];
+
+            if ( results[i] > 0 )
+            {
+                offset += results[i];
+
+                if ( offset == request.content.size() ) // It grew
+                    request.content.resize( 2 * request.content.size() );
+
+                still_pending.push_back( pending[i] );
+            }
+            else if ( results[i] == 0 )
+            {
+                request.content.resize( offset );
+                request.success = true;
+            }
+            else if ( results[i] == -EINTR || results[i] == -EAGAIN )
+            {
+                still_pending.push_back( pending[i] );
+            }
+            else
+            {
+                request.content.clear();
+                request.error = -results[i];
+            }
+        }
+
+        pending.swap( still_pending );
+    }
+
+    ring->run( open_files.size(), [&]( size_t i, struct io_uring_sqe * sqe )
+        {
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd     = fds[ open_files[i] ];
+        }, results );
+
+    for ( size_t i=0; i < open_files.size(); ++i )
+    {
+        if ( unsupported( results[i] ) || results[i] == -ECANCELED )
+            close( fds[ open_files[i] ] );
+    }
+
+
+    if ( ring->failed )
+    {
+        // Everything that did not get through before the ring failed is
+        // read with plain system calls, and so is everything from now on
+
+        for ( size_t i=0; i < count; ++i )
+        {
+            if ( ! requests[i].success && requests[i].error == ECANCELED )
+            {
+                fallback.push_back( requests[i] );
+                fallback_index.push_back( i );
+            }
+        }
+
+        delete ring;
+        ring = 0;
+    }
+
+
+    // Files for which the kernel does not support io_uring_prep_openat()
+
+    read_files_fallback( fallback );
+
+    for ( size_t i=0; i < fallback.size(); ++i )
+        std::swap( requests[ fallback_index[i] ], fallback[i] );
+
+    bool success = true;
+
+    for ( size_t i=0; i < count; ++i )
+    {
+        if ( ! requests[i].success )
+            success = false;
+    }
+
+    return success;
+
+#else
+
+    return read_files_fallback( requests );
+
+#endif
+}
+
+
+bool AsyncFileIO::read_files_fallback( vector<ReadRequest> & requests )
+{
+    bool success = true;
+
+    for ( size_t i=0; i < requests.size(); ++i )
+    {
+        ReadRequest & request = requests[i];
+
+        request.success = FileIO::read_file( request.filename,
+                                             request.content,
+                                             &request.stat );
+        request.error = request.success ? 0 : errno;
+
+        if ( ! request.success )
+            success = false;
+    }
+
+    return success;
+}
+
+
+bool AsyncFileIO::write_files( vector<WriteRequest> & requests,
+                               bool                   atomic,
+                               FsyncPolicy            fsync_policy )
+{
+    for ( size_t i=0; i < requests.size(); ++i )
+    {
+        requests[i].stat    = FileStat();
+        requests[i].success = false;
+        requests[i].error   = 0;
+    }
+
+#ifdef USE_IO_URING
+
+    if ( ! ring )
+        return write_files_fallback( requests, atomic, fsync_policy );
+
+    size_t           count = requests.size();
+    string_vec       targets( count );
+    string_vec       paths( count );   // what is actually opened
+    vector<string>   buffers( count );
+    vector<int>      fds;
+    vector<int>      results;
+    vector<size_t>   open_files;        // indexes in 'requests'
+    vector<char>     failed( count, 0 );
+    vector<WriteRequest> fallback;
+    vector<size_t>   fallback_index;
+
+    for ( size_t i=0; i < count; ++i )
+    {
+        targets[i] = atomic ? FileIO::resolve_symlink( requests[i].filename ) : requests[i].filename;
+        paths[i]   = atomic ? FileIO::temp_name( targets[i] ) : targets[i];
+
+        const string_vec & lines = requests[i].lines;
+        buffers[i].reserve( FileIO::output_size( lines ) );
+
+        for ( size_t j=0; j < lines.size(); ++j )
+        {
+            buffers[i] += lines[j];
+            buffers[i] += '\n';
+        }
+    }
+
+    ring->run( count, [&]( size_t i, struct io_uring_sqe * sqe )
+        {
+            sqe->opcode     = IORING_OP_OPENAT;
+            sqe->fd         = AT_FDCWD;
+            sqe->addr       = (uintptr_t) paths[i].c_str();
+            sqe->len        = 0666;
+            sqe->open_flags = O_WRONLY | O_CREAT | O_CLOEXEC |
+                ( atomic ? O_EXCL : O_TRUNC );
+        }, fds );
+
+    for ( size_t i=0; i < count; ++i )
+    {
+        if ( fds[i] >= 0 )
+        {
+            open_files.push_back( i );
+
+            if ( atomic )
+                FileIO::copy_owner_and_mode( targets[i], fds[i] );
+        }
+        else if ( unsupported( fds[i] ) || ( atomic && fds[i] == -EEXIST ) )
+        {
+            fallback.push_back( requests[i] );
+            fallback_index.push_back( i );
+        }
+        else
+        {
+            requests[i].error = -fds[i];
+            failed[i] = true;
+        }
+    }
+
+    ring->run( open_files.size(), [&]( size_t i, struct io_uring_sqe * sqe )
+        {
+            size_t index = open_files[i];
+
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd     = fds[ index ];
+            sqe->addr   = (uintptr_t) buffers[ index ].data();
+            sqe->len    = std::min( buffers[ index ].size(), (size_t) MAX_RW_SIZE );
+            sqe->off    = 0;
+        }, results );
+
+    for ( size_t i=0; i < open_files.size(); ++i )
+    {
+        size_t index = open_files[i];
+        int    fd    = fds[ index ];
+
+        if ( results[i] < 0 )
+        {
+            requests[ index ].error = -results[i];
+            failed[ index ] = true;
+            continue;
+        }
+
+        // Complete a short write
+
+        size_t written = results[i];
+
+        while ( written < buffers[ index ].size() )
+        {
+            ssize_t len = pwrite( fd, buffers[ index ].data() + written,
+                                  buffers[ index ].size() - written, written );
+            if ( len < 0 )
+            {
+                if ( errno == EINTR )
+                    continue;
+
+                requests[ index ].error = errno;
+                failed[ index ] = true;
+                break;
+            }
+
+            written += len;
+        }
+    }
+
+    if ( atomic && fsync_policy != FSYNC_NONE )
+    {
+        ring->run( open_files.size(), [&]( size_t i, struct io_uring_sqe * sqe )
+            {
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd     = fds[ open_files[i] ];
+            }, results );
+
+        for ( size_t i=0; i < open_files.size(); ++i )
+        {
+            size_t index = open_files[i];
+
+            if ( unsupported( results[i] ) )
+                results[i] = fsync( fds[ index ] ) == 0 ? 0 : -errno;
+
+            if ( results[i] < 0 && ! failed[ index ] )
+            {
+                requests[ index ].error = -results[i];
+                failed[ index ] = true;
+            }
+        }
+    }
+
+    ring->run( open_files.size(), [&]( size_t i, struct io_uring_sqe * sqe )
+        {
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd     = fds[ open_files[i] ];
+        }, results );
+
+    for ( size_t i=0; i < open_files.size(); ++i )
+    {
+        size_t index = open_files[i];
+
+        if ( unsupported( results[i] ) || results[i] == -ECANCELED )
+            results[i] = close( fds[ index ] ) == 0 ? 0 : -errno;
+
+        if ( results[i] < 0 && ! failed[ index ] )
+        {
+            requests[ index ].error = -results[i];
+            failed[ index ] = true;
+        }
+    }
+
+    if ( atomic )
+    {
+        // Rename the temporary files that were written completely into
+        // place, and get rid of the others
+
+        vector<size_t> to_rename;
+
+        for ( size_t i=0; i < open_files.size(); ++i )
+        {
+            if ( failed[ open_files[i] ] )
+                unlink( paths[ open_files[i] ].c_str() );
+            else
+                to_rename.push_back( open_files[i] );
+        }
+
+        ring->run( to_rename.size(), [&]( size_t i, struct io_uring_sqe * sqe )
+            {
+                sqe->opcode       = IORING_OP_RENAMEAT;
+                sqe->fd           = AT_FDCWD;
+                sqe->addr         = (uintptr_t) paths  [ to_rename[i] ].c_str();
+                sqe->len          = AT_FDCWD;
+                sqe->off          = (uintptr_t) targets[ to_rename[i] ].c_str();
+                sqe->rename_flags = 0;
+            }, results );
+
+        std::set<string> dirs;
+
+        for ( size_t i=0; i < to_rename.size(); ++i )
+        {
+            size_t index = to_rename[i];
+
+            if ( unsupported( results[i] ) )
+            {
+                results[i] = ::rename( paths[ index ].c_str(), targets[ index ].c_str() ) == 0 ?
+                    0 : -errno;
+            }
+
+            if ( results[i] < 0 )
+            {
+                unlink( paths[ index ].c_str() );
+                requests[ index ].error = -results[i];
+                failed[ index ] = true;
+            }
+            else
+            {
+                dirs.insert( FileIO::dir_name( targets[ index ] ) );
+            }
+        }
+
+        if ( fsync_policy == FSYNC_FILE_AND_DIR )
+        {
+            for ( std::set<string>::const_iterator it = dirs.begin(); it != dirs.end(); ++it )
+                FileIO::sync_dir( *it );
+        }
+    }
+
+
+    // Get the stat() information of the files that were written
+
+    vector<struct statx> stx( open_files.size() );
+
+    ring->run( open_files.size(), [&]( size_t i, struct io_uring_sqe * sqe )
+        {
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd     = AT_FDCWD;
+            sqe->addr   = (uintptr_t) requests[ open_files[i] ].filename.c_str();
+            sqe->len    = STATX_BASIC_STATS;
+            sqe->off    = (uintptr_t) &stx[i];
+        }, results );
+
+    for ( size_t i=0; i < open_files.size(); ++i )
+    {
+        WriteRequest & request = requests[ open_files[i] ];
+
+        if ( failed[ open_files[i] ] )
+            continue;
+
+        request.success = true;
+
+        if ( results[i] == 0 )
+            fill_file_stat( stx[i], request.stat );
+        else
+            FileIO::stat( request.filename, request.stat );
+    }
+
+    if ( ring->failed )
+    {
+        // Everything that did not get through before the ring failed is
+        // written again with plain system calls, and so is everything from
+        // now on. Temporary files of those were already removed above.
+
+        for ( size_t i=0; i < count; ++i )
+        {
+            if ( ! requests[i].success && requests[i].error == ECANCELED )
+            {
+                fallback.push_back( requests[i] );
+                fallback_index.push_back( i );
+            }
+        }
+
+        delete ring;
+        ring = 0;
+    }
+
+    write_files_fallback( fallback, atomic, fsync_policy );
+
+    for ( size_t i=0; i < fallback.size(); ++i )
+        std::swap( requests[ fallback_index[i] ], fallback[i] );
+
+    bool success = true;
+
+    for ( size_t i=0; i < count; ++i )
+    {
+        if ( ! requests[i].success )
+            success = false;
+    }
+
+    return success;
+
+#else
+
+    return write_files_fallback( requests, atomic, fsync_policy );
+
+#endif
+}
+
+
+bool AsyncFileIO::write_files_fallback( vector<WriteRequest> & requests,
+                                        bool                   atomic,
+                                        FsyncPolicy            fsync_policy )
+{
+    bool success = true;
+
+    for ( size_t i=0; i < requests.size(); ++i )
+    {
+        WriteRequest & request = requests[i];
+
+        if ( atomic )
+            request.success = FileIO::write_file_atomic( request.filename, request.lines, fsync_policy );
+        else
+            request.success = FileIO::write_file( request.filename, request.lines );
+
+        request.error = request.success ? 0 : errno;
+
+        if ( request.success )
+            FileIO::stat( request.filename, request.stat );
+        else
+            success = false;
+    }
+
+    return success;
+}
@@ -0,0 +1,147 @@
+/**
+ * AsyncFileIO.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef AsyncFileIO_h
+#define AsyncFileIO_h
+
+#include <boost/noncopyable.hpp>
+
+#include "FileIO.h"
+
+#define DEFAULT_QUEUE_DEPTH     256
+
+
+/**
+ * Read and write many files at once with as few system calls as possible.
+ *
+ * On Linux, this uses io_uring: All files are opened with one system call,
+ * then all of them are stat()ed with one more, read or written with one
+ * more, and so on (for up to the queue depth files at a time). Where
+ * io_uring is not available (not Linux, an old kernel, or disabled with
+ * the kernel.io_uring_disabled sysctl), or if the kernel does not support
+ * one of the operations, this falls back to the plain system calls of
+ * FileIO for each file.
+ *
+ * An instance of this class must only be used by one thread at a time.
+ *
+ * Example:
+ *
+ *     AsyncFileIO io;
+ *     vector<AsyncFileIO::ReadRequest> requests;
+ *
+ *     for ( size_t i=0; i < filenames.size(); ++i )
+ *         requests.push_back( AsyncFileIO::ReadRequest( filenames[i] ) );
+ *
+ *     io.read_files( requests );
+ *
+ *     for ( size_t i=0; i < requests.size(); ++i )
+ *     {
+ *         files[i]->parse_file_content( requests[i].filename,
+ *                                       requests[i].content,
+ *                                       requests[i].stat );
+ *     }
+ **/
+class AsyncFileIO: private boost::noncopyable
+{
+public:
+
+    /**
+     * One file to read.
+     **/
+    struct ReadRequest
+    {
+        ReadRequest( const string & filename = "" ):
+            filename( filename ),
+            success( false ),
+            error( 0 )
+            {}
+
+        string   filename;
+        string   content;   // result
+        FileStat stat;      // result
+        bool     success;   // result
+        int      error;     // result: errno if not successful
+    };
+
+    /**
+     * One file to write.
+     **/
+    struct WriteRequest
+    {
+        WriteRequest( const string & filename = "" ):
+            filename( filename ),
+            success( false ),
+            error( 0 )
+            {}
+
+        string     filename;
+        string_vec lines;   // each one is written with a newline
+        FileStat   stat;    // result: of the file that was written
+        bool       success; // result
+        int        error;   // result: errno if not successful
+    };
+
+    /**
+     * Constructor. 'queue_depth' is the maximum number of files that are
+     * handled in one system call.
+     **/
+    AsyncFileIO( unsigned queue_depth = DEFAULT_QUEUE_DEPTH );
+
+    /**
+     * Destructor.
+     **/
+    virtual ~AsyncFileIO();
+
+    /**
+     * Return 'true' if io_uring is used, 'false' if plain system calls are
+     * used for each file. If io_uring fails in the middle of a call, the
+     * files that were not done yet are read or written with plain system
+     * calls in the same call, and plain system calls are used from then on.
+     **/
+    bool get_using_io_uring() const { return ring != 0; }
+
+    /**
+     * Read all files in 'requests'. Return 'true' if all of them could be
+     * read, 'false' if there was any error.
+     **/
+    bool read_files( vector<ReadRequest> & requests );
+
+    /**
+     * Write all files in 'requests'. If 'atomic' is 'true', each file is
+     * written to a temporary file which is synced according to
+     * 'fsync_policy' and then renamed, just like
+     * FileIO::write_file_atomic() does.
+     *
+     * Return 'true' if all of them could be written, 'false' if there was
+     * any error.
+     **/
+    bool write_files( vector<WriteRequest> & requests,
+                      bool                   atomic       = false,
+                      FsyncPolicy            fsync_policy = FSYNC_FILE );
+
+
+protected:
+
+    /**
+     * Read or write the files of all requests with the plain system calls
+     * of FileIO.
+     **/
+    bool read_files_fallback ( vector<ReadRequest>  & requests );
+    bool write_files_fallback( vector<WriteRequest> & requests,
+                               bool                   atomic,
+                               FsyncPolicy            fsync_policy );
+
+    /**
+     * io_uring instance; defined in AsyncFileIO.cc.
+     **/
+    struct Ring;
+
+    Ring * ring;    // 0 if not available
+};
+
+
+#endif // AsyncFileIO_h
@@ -0,0 +1,214 @@
+/**
+ * BasicCommentedConfigFile.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef BasicCommentedConfigFile_h
+#define BasicCommentedConfigFile_h
+
+#include <string.h>
+
+#include "CommentedConfigFile.h"
+
+
+/**
+ * Set of characters that is known at compile time, e.g. the whitespace
+ * characters: CharSet<' ', '\t'>::contains( c ) compiles to nothing more
+ * than comparing 'c' with each of them.
+ **/
+template<char... Chars> struct CharSet;
+
+template<> struct CharSet<>
+{
+    static constexpr bool contains( char c ) { return false; }
+};
+
+template<char First, char... Rest> struct CharSet<First, Rest...>
+{
+    static constexpr bool contains( char c )
+        { return c == First || CharSet<Rest...>::contains( c ); }
+};
+
+
+/**
+ * Sequence of characters that is known at compile time, e.g. the comment
+ * marker: CharSequence<'/', '/'>.
+ **/
+template<char... Chars> struct CharSequence;
+
+template<> struct CharSequence<>
+{
+    static constexpr size_t size() { return 0; }
+
+    static constexpr bool matches( const char * str ) { return true; }
+};
+
+template<char First, char... Rest> struct CharSequence<First, Rest...>
+{
+    static constexpr size_t size() { return 1 + sizeof...( Rest ); }
+
+    /**
+     * Return 'true' if 'str', which has at least size() characters, starts
+     * with this sequence.
+     **/
+    static constexpr bool matches( const char * str )
+        { return *str == First && CharSequence<Rest...>::matches( str + 1 ); }
+
+    /**
+     * Return the position of the first occurrence of this sequence
+     * between 'begin' and 'end' or 'end' if there is none.
+     **/
+    static const char * find( const char * begin, const char * end )
+        {
+            while ( (size_t) ( end - begin ) >= size() )
+            {
+                begin = (const char *) memchr( begin, First, end - begin - size() + 1 );
+
+                if ( ! begin )
+                    return end;
+
+                if ( CharSequence<Rest...>::matches( begin + 1 ) )
+                    return begin;
+
+                ++begin;
+            }
+
+            return end;
+        }
+
+    /**
+     * Return this sequence as a string.
+     **/
+    static string str() { return string( { First, Rest... } ); }
+};
+
+
+/**
+ * Traits for the syntax of the usual Linux config files: Comments start
+ * with "#", and whitespace is blanks and tabs.
+ *
+ * Traits for other syntaxes need the same two typedefs.
+ **/
+struct HashCommentTraits
+{
+    typedef CharSequence<'#'>     CommentMarker;
+    typedef CharSet<' ', '\t'>    Whitespace;
+};
+
+
+/**
+ * Variant of a CommentedConfigFile class (by default CommentedConfigFile
+ * itself, but also ColumnConfigFile or any other derived class) with a
+ * comment marker and whitespace characters that are fixed at compile time
+ * in 'Traits'.
+ *
+ * This replaces the generic string operations that the parser uses to
+ * classify lines and to find line comments with plain comparisons of
+ * characters that the compiler knows. Other than that, it behaves exactly
+ * like 'Base' with the comment marker of 'Traits'; in particular,
+ * set_comment_marker() has no effect on parsing.
+ *
+ * Example:
+ *
+ *     struct SlashCommentTraits
+ *     {
+ *         typedef CharSequence<'/', '/'> CommentMarker;
+ *         typedef CharSet<' ', '\t'>     Whitespace;
+ *     };
+ *
+ *     BasicCommentedConfigFile<HashCommentTraits, ColumnConfigFile> fstab;
+ *     BasicCommentedConfigFile<SlashCommentTraits> other;
+ **/
+template<class Traits, class Base = CommentedConfigFile>
+class BasicCommentedConfigFile: public Base
+{
+public:
+
+    typedef typename Traits::CommentMarker  CommentMarker;
+    typedef typename Traits::Whitespace     Whitespace;
+    typedef typename Base::LineType         LineType;
+
+    /**
+     * Constructor.
+     **/
+    BasicCommentedConfigFile()
+        { Base::set_comment_marker( CommentMarker::str() ); }
+
+    /**
+     * Destructor.
+     **/
+    virtual ~BasicCommentedConfigFile() {}
+
+
+protected:
+
+    /**
+     * Reimplemented from CommentedConfigFile.
+     **/
+    virtual LineType classify_line( const string & line )
+        {
+            const char * pos = line.data();
+            const char * end = pos + line.size();
+
+            while ( pos != end && Whitespace::contains( *pos ) )
+                ++pos;
+
+            if ( pos == end )
+                return Base::EMPTY_LINE;
+
+            if ( (size_t) ( end - pos ) >= CommentMarker::size() &&
+                 CommentMarker::matches( pos ) )
+            {
+                return Base::COMMENT_LINE;
+            }
+
+            return Base::CONTENT_LINE;
+        }
+
+    /**
+     * Reimplemented from CommentedConfigFile.
+     **/
+    virtual bool is_comment_line( const string & line )
+        { return classify_line( line ) == Base::COMMENT_LINE; }
+
+    /**
+     * Reimplemented from CommentedConfigFile.
+     **/
+    virtual bool is_empty_line( const string & line )
+        { return classify_line( line ) == Base::EMPTY_LINE; }
+
+    /**
+     * Reimplemented from CommentedConfigFile. Just like there, the
+     * character before the comment marker is taken to be a separator and
+     * is not part of the content.
+     **/
+    virtual void split_off_comment( const string & line,
+                                    string & content_ret,
+                                    string & comment_ret )
+        {
+            const char * begin  = line.data();
+            const char * end    = begin + line.size();
+            const char * marker = CommentMarker::find( begin, end );
+            const char * content_end = end;
+
+            if ( marker == end )
+                comment_ret.clear();
+            else
+            {
+                comment_ret.assign( marker, end );
+
+                if ( marker != begin )
+                    content_end = marker - 1;
+            }
+
+            while ( content_end != begin && Whitespace::contains( content_end[-1] ) )
+                --content_end;
+
+            content_ret.assign( begin, content_end );
+        }
+};
+
+
+#endif // BasicCommentedConfigFile_h
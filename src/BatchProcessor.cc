@@ -0,0 +1,202 @@
+/**
+ * BatchProcessor.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include "AsyncFileIO.h"
+#include "BatchProcessor.h"
+#include "Diff.h"
+#include "ThreadPool.h"
+
+typedef std::unique_lock<std::mutex> Lock;
+
+
+BatchProcessor::BatchProcessor( int thread_count ):
+    thread_count( thread_count ),
+    max_in_flight( DEFAULT_MAX_IN_FLIGHT ),
+    diff_enabled( true ),
+    write_enabled( true ),
+    async_io( false ),
+    pool( 0 ),
+    failed_count( 0 ),
+    in_flight( 0 )
+{
+}
+
+
+BatchProcessor::~BatchProcessor()
+{
+}
+
+
+bool BatchProcessor::run( const string_vec & filenames, Transform transform )
+{
+    ThreadPool thread_pool( thread_count );
+
+    this->pool      = &thread_pool;
+    this->transform = transform;
+    failed_count    = 0;
+    in_flight       = 0;
+
+    results.assign( filenames.size(), Result() );
+
+    // With async_io, read the files in chunks of half of max_in_flight, so
+    // the workers have the other half to parse and transform while the
+    // next chunk is read.
+
+    AsyncFileIO  async_file_io;
+    int          chunk_size = async_io ? std::max( max_in_flight / 2, 1 ) : 1;
+
+    for ( size_t start = 0; start < filenames.size(); start += chunk_size )
+    {
+        size_t end = std::min( start + chunk_size, filenames.size() );
+        int    count = end - start;
+
+        {
+            Lock lock( mutex );
+
+            while ( in_flight + count > max_in_flight )
+                slot_free.wait( lock );
+
+            in_flight += count;
+        }
+
+        vector<AsyncFileIO::ReadRequest> requests;
+
+        for ( size_t i = start; i < end; ++i )
+        {
+            results[i].filename = filenames[i];
+
+            if ( async_io )
+                requests.push_back( AsyncFileIO::ReadRequest( filenames[i] ) );
+        }
+
+        if ( async_io )
+            async_file_io.read_files( requests );
+
+        for ( size_t i = start; i < end; ++i )
+        {
+            Job * job = new Job( i );
+
+            if ( async_io )
+            {
+                AsyncFileIO::ReadRequest & request = requests[ i - start ];
+
+                job->prefetched = true;
+
+                if ( request.success )
+                {
+                    job->content.swap( request.content );
+                    job->stat = request.stat;
+                }
+            }
+
+            thread_pool.submit( [this, job]() { read_stage( job ); } );
+        }
+    }
+
+    thread_pool.wait();
+    this->pool = 0;
+
+    return failed_count == 0;
+}
+
+
+void BatchProcessor::read_stage( Job * job )
+{
+    job->file = file_factory ? file_factory() : new CommentedConfigFile();
+
+    bool success = false;
+
+    if ( job->file )
+    {
+        const string & filename = results[ job->index ].filename;
+
+        if ( job->prefetched )
+        {
+            // A file that could not be read is empty, just like with read()
+
+            success = ! filename.empty() &&
+                job->file->parse_file_content( filename, job->content, job->stat );
+            string().swap( job->content );
+        }
+        else
+            success = job->file->read( filename );
+    }
+
+    if ( ! success )
+    {
+        finish( job, STAGE_READ );
+        return;
+    }
+
+    if ( diff_enabled )
+        job->orig_lines = job->file->format_lines();
+
+    pool->submit( [this, job]() { transform_stage( job ); } );
+}
+
+
+void BatchProcessor::transform_stage( Job * job )
+{
+    if ( transform && ! transform( job->file ) )
+    {
+        finish( job, STAGE_TRANSFORM );
+        return;
+    }
+
+    if ( ! job->file->is_modified() )
+    {
+        finish( job, STAGE_NONE );
+        return;
+    }
+
+    pool->submit( [this, job]() { write_stage( job ); } );
+}
+
+
+void BatchProcessor::write_stage( Job * job )
+{
+    Result & result = results[ job->index ];
+    result.modified = true;
+
+    if ( diff_enabled )
+        result.diff = Diff::diff( job->orig_lines, job->file->format_lines() );
+
+    if ( write_enabled )
+    {
+        if ( ! job->file->write() )
+        {
+            finish( job, STAGE_WRITE );
+            return;
+        }
+
+        result.written = ! job->file->get_write_skipped();
+    }
+
+    finish( job, STAGE_NONE );
+}
+
+
+void BatchProcessor::finish( Job * job, Stage failed_stage )
+{
+    Result & result = results[ job->index ];
+
+    result.success      = ( failed_stage == STAGE_NONE );
+    result.failed_stage = failed_stage;
+
+    if ( ! result.success )
+        ++failed_count;
+
+    delete job;
+
+    Lock lock( mutex );
+
+    if ( result_callback )
+        result_callback( result );
+
+    --in_flight;
+    slot_free.notify_one();
+}
@@ -0,0 +1,256 @@
+/**
+ * BatchProcessor.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef BatchProcessor_h
+#define BatchProcessor_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <boost/noncopyable.hpp>
+
+#include "CommentedConfigFile.h"
+
+#define DEFAULT_MAX_IN_FLIGHT   64
+
+class ThreadPool;
+
+
+/**
+ * Engine to read, transform, diff and write a large number of config files
+ * in parallel.
+ *
+ * Each file goes through these stages:
+ *
+ *   - read and parse
+ *   - transform (with the callback passed to run())
+ *   - format, diff against what was read, and write back if modified
+ *
+ * Each stage of each file is a separate task for a work-stealing thread
+ * pool, so reading some files overlaps with transforming or writing
+ * others. The number of files that are in memory at the same time is
+ * limited by max_in_flight; a file is deleted as soon as it is done, and
+ * only its Result is kept.
+ *
+ * Example:
+ *
+ *     BatchProcessor batch;
+ *
+ *     batch.run( filenames, []( CommentedConfigFile * file )
+ *         {
+ *             file->remove_if( ... );
+ *             return true;
+ *         } );
+ *
+ *     for ( size_t i=0; i < batch.get_results().size(); ++i )
+ *         ...
+ **/
+class BatchProcessor: private boost::noncopyable
+{
+public:
+
+    /**
+     * Stage of processing a file.
+     **/
+    enum Stage
+    {
+        STAGE_NONE,
+        STAGE_READ,
+        STAGE_TRANSFORM,
+        STAGE_WRITE
+    };
+
+    /**
+     * Result of processing one file.
+     **/
+    struct Result
+    {
+        Result():
+            success( false ),
+            failed_stage( STAGE_NONE ),
+            modified( false ),
+            written( false )
+            {}
+
+        string      filename;
+        bool        success;
+        Stage       failed_stage;   // if not successful
+        bool        modified;       // by the transform
+        bool        written;
+        string_vec  diff;           // if diff_enabled and modified
+    };
+
+    /**
+     * Callback to change one file. This is called from the worker threads,
+     * i.e. for several files at the same time. Return 'true' if success,
+     * 'false' if error; files with errors are not written.
+     **/
+    typedef std::function<bool( CommentedConfigFile * file )> Transform;
+
+    /**
+     * Factory for the file objects, e.g. to use a ColumnConfigFile or a
+     * derived class. This is called from the worker threads.
+     **/
+    typedef std::function<CommentedConfigFile *()> FileFactory;
+
+    /**
+     * Callback that is called as soon as a file is done. The calls are
+     * serialized, but they come from the worker threads.
+     **/
+    typedef std::function<void( const Result & result )> ResultCallback;
+
+    /**
+     * Constructor. 'thread_count' 0 means one thread for each CPU.
+     **/
+    BatchProcessor( int thread_count = 0 );
+
+    /**
+     * Destructor.
+     **/
+    virtual ~BatchProcessor();
+
+    /**
+     * Process all of 'filenames' with 'transform' and wait until all are
+     * done. Return 'true' if all files were processed successfully,
+     * 'false' if there was any error.
+     **/
+    bool run( const string_vec & filenames, Transform transform );
+
+    /**
+     * Return the results of the last run() in the order of its filenames.
+     **/
+    const vector<Result> & get_results() const { return results; }
+
+    /**
+     * Return the number of files that failed in the last run().
+     **/
+    int get_failed_count() const { return failed_count; }
+
+    /**
+     * Set the factory for the file objects. By default, plain
+     * CommentedConfigFile objects are used.
+     **/
+    void set_file_factory( FileFactory factory ) { file_factory = factory; }
+
+    /**
+     * Set a callback that is called whenever a file is done.
+     **/
+    void set_result_callback( ResultCallback callback ) { result_callback = callback; }
+
+    /**
+     * Return the maximum number of files that are processed at the same
+     * time (default: DEFAULT_MAX_IN_FLIGHT).
+     **/
+    int get_max_in_flight() const { return max_in_flight; }
+
+    /**
+     * Set the maximum number of files that are processed at the same
+     * time. This limits the memory usage.
+     **/
+    void set_max_in_flight( int max ) { max_in_flight = std::max( max, 1 ); }
+
+    /**
+     * Return 'true' if a diff is created for each modified file (default:
+     * 'true').
+     **/
+    bool get_diff_enabled() const { return diff_enabled; }
+
+    /**
+     * Enable or disable creating diffs.
+     **/
+    void set_diff_enabled( bool enabled = true ) { diff_enabled = enabled; }
+
+    /**
+     * Return 'true' if modified files are written back (default: 'true').
+     **/
+    bool get_write_enabled() const { return write_enabled; }
+
+    /**
+     * Enable or disable writing modified files back, e.g. for a dry run
+     * that only creates the diffs.
+     **/
+    void set_write_enabled( bool enabled = true ) { write_enabled = enabled; }
+
+    /**
+     * Return 'true' if the files are read in batches with AsyncFileIO
+     * (default: 'false').
+     **/
+    bool get_async_io() const { return async_io; }
+
+    /**
+     * Enable or disable reading the files in batches of half of
+     * max_in_flight files with AsyncFileIO, i.e. with io_uring where
+     * available. The batches are read by the thread that called run()
+     * while the worker threads parse, transform and write the files of the
+     * previous batch.
+     **/
+    void set_async_io( bool enabled = true ) { async_io = enabled; }
+
+
+protected:
+
+    /**
+     * One file that is being processed.
+     **/
+    struct Job
+    {
+        Job( int index ): index( index ), file( 0 ), prefetched( false ) {}
+        ~Job() { delete file; }
+
+        int                   index;    // in 'results'
+        CommentedConfigFile * file;
+        string_vec            orig_lines;
+
+        // Only with async_io
+
+        bool                  prefetched;
+        string                content;
+        FileStat              stat;
+    };
+
+    /**
+     * The stages of processing a file. Each one submits the next one to
+     * the thread pool or calls finish().
+     **/
+    void read_stage     ( Job * job );
+    void transform_stage( Job * job );
+    void write_stage    ( Job * job );
+
+    /**
+     * Finish processing a file: Report the result and delete the job.
+     **/
+    void finish( Job * job, Stage failed_stage );
+
+
+    //
+    // Data members
+    //
+
+    int                     thread_count;
+    int                     max_in_flight;
+    bool                    diff_enabled;
+    bool                    write_enabled;
+    bool                    async_io;
+    FileFactory             file_factory;
+    ResultCallback          result_callback;
+
+    // Only during run()
+
+    ThreadPool *            pool;
+    Transform               transform;
+    vector<Result>          results;
+    std::atomic<int>        failed_count;
+
+    int                     in_flight;
+    std::mutex              mutex;      // for 'in_flight' and the callback
+    std::condition_variable slot_free;
+};
+
+
+#endif // BatchProcessor_h
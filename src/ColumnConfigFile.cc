@@ -6,13 +6,15 @@
  **/
 
 #include <iostream>
-#include <boost/algorithm/string/classification.hpp>
-#include <boost/algorithm/string/split.hpp>
+#include <algorithm>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 #include "ColumnConfigFile.h"
 
 
-#define WHITESPACE                      " \t"
 #define DEFAULT_MAX_COLUMN_WIDTH        40
 
 using std::cout;
@@ -20,36 +22,72 @@ using std::endl;
 
 
 string ColumnConfigFile::Entry::format()
+{
+    return format_columns( dynamic_cast<ColumnConfigFile *>( get_parent() ) );
+}
+
+
+string ColumnConfigFile::Entry::format_columns( ColumnConfigFile * col_parent ) const
 {
     string result;
+    result.reserve( get_formatted_size( col_parent ) );
+    append_columns( col_parent, result );
+
+    return result;
+}
+
+
+size_t ColumnConfigFile::Entry::get_formatted_size( ColumnConfigFile * col_parent ) const
+{
+    bool   pad   = col_parent && col_parent->get_pad_columns();
+    int    count = get_column_count();
+    size_t size  = 0;
+
+    for ( int i=0; i < count; ++i )
+    {
+        // Just like in append_columns(): No separator before empty
+        // leading columns
+
+        if ( size > 0 )
+            size += 2;
+
+        size_t width = get_column_ref( i ).size();
 
-    for ( size_t i=0; i < columns.size(); ++i )
+        if ( pad && i < count - 1 )
+            width = std::max( width, (size_t) col_parent->get_column_width( i ) );
+
+        size += width;
+    }
+
+    return size;
+}
+
+
+void ColumnConfigFile::Entry::append_columns( ColumnConfigFile * col_parent, string & text ) const
+{
+    bool   pad   = col_parent && col_parent->get_pad_columns();
+    int    count = get_column_count();
+    size_t start = text.size();
+
+    for ( int i=0; i < count; ++i )
     {
-        if ( ! result.empty() )
-            result += "  ";
+        if ( text.size() > start )
+            text += "  ";
 
-        string col = columns[i];
+        string_ref col = get_column_ref( i );
+        text.append( col.data(), col.size() );
 
-        if ( get_parent() )
+        if ( pad && i < count - 1 )
         {
-            ColumnConfigFile * col_parent = dynamic_cast<ColumnConfigFile *>( get_parent() );
+            size_t field_width = col_parent->get_column_width( i );
 
-            if ( col_parent && col_parent->get_pad_columns() )
+            if ( col.size() < field_width )
             {
-                size_t field_width = col_parent->get_column_width( i );
-
-                if ( col.size() < field_width && i < columns.size() - 1 )
-                {
-                    // Pad to desired width
-                    col += string( field_width - col.size(), ' ' );
-                }
+                // Pad to desired width
+                text.append( field_width - col.size(), ' ' );
             }
         }
-
-        result += col;
     }
-
-    return result;
 }
 
 
@@ -57,8 +95,31 @@ bool ColumnConfigFile::Entry::parse( const string & line, int line_no )
 {
     (void) line_no;
 
-    set_content( line );
-    columns = split( line );
+    ColumnConfigFile * col_parent = row >= 0 ?
+        static_cast<ColumnConfigFile *>( get_parent() ) : 0;
+
+    columns_changing();
+
+    if ( col_parent )
+        col_parent->unstore_columns( this, false );
+
+    owned_columns.reset();
+    CommentedConfigFile::Entry::set_content( line );
+
+    if ( uses_default_split() )
+    {
+        find_columns( get_content(), spans );
+    }
+    else
+    {
+        ColumnSpanVec().swap( spans );
+        owned_columns.reset( new string_vec( split( get_content() ) ) );
+    }
+
+    if ( col_parent )
+        col_parent->store_columns( this );
+
+    columns_changed();
 
     return true;
 }
@@ -66,23 +127,273 @@ bool ColumnConfigFile::Entry::parse( const string & line, int line_no )
 
 string_vec ColumnConfigFile::Entry::split( const string & line ) const
 {
+    ColumnSpanVec spans;
+    find_columns( line, spans );
+
     string_vec fields;
+    fields.reserve( spans.size() );
 
-    boost::split( fields,
-                  line,
-                  boost::is_any_of( WHITESPACE ),
-                  boost::token_compress_on );
+    for ( size_t i=0; i < spans.size(); ++i )
+        fields.push_back( line.substr( spans[i].offset, spans[i].size ) );
 
     return fields;
 }
 
 
+bool ColumnConfigFile::Entry::uses_default_split() const
+{
+    if ( typeid( *this ) == typeid( ColumnConfigFile::Entry ) )
+        return true;
+
+#if defined( __GNUC__ ) && ! defined( __clang__ )
+
+    // GCC can tell which function a virtual call would go to: Compare
+    // that with the one for a plain entry
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpmf-conversions"
+
+    typedef string_vec ( * SplitFunction )( const Entry *, const string & );
+
+    static const Entry plain_entry;
+    static const SplitFunction default_split =
+        (SplitFunction) ( plain_entry.*( &Entry::split ) );
+
+    return (SplitFunction) ( this->*( &Entry::split ) ) == default_split;
+
+#pragma GCC diagnostic pop
+
+#else
+
+    // Derived classes might override split(): Always call it
+
+    return false;
+
+#endif
+}
+
+
+void ColumnConfigFile::Entry::set_column( int i, const string & new_value )
+{
+    if ( get_column_ref( i ) == new_value )
+        return;
+
+    columns_changing();
+
+    if ( row >= 0 )
+    {
+        get_store()->set( row, i, new_value );
+    }
+    else
+    {
+        own_columns();
+        (*owned_columns)[i] = new_value;
+    }
+
+    columns_changed();
+    set_modified();
+}
+
+
+void ColumnConfigFile::Entry::add_column( const string & new_value )
+{
+    columns_changing();
+
+    if ( row >= 0 )
+    {
+        int count = get_column_count();
+        get_store()->set_column_count( row, count + 1 );
+        get_store()->set( row, count, new_value );
+    }
+    else
+    {
+        own_columns();
+        owned_columns->push_back( new_value );
+    }
+
+    columns_changed();
+    set_modified();
+}
+
+
+void ColumnConfigFile::Entry::set_column_count( int count )
+{
+    if ( count == get_column_count() )
+        return;
+
+    columns_changing();
+
+    if ( row >= 0 )
+    {
+        get_store()->set_column_count( row, count );
+    }
+    else
+    {
+        own_columns();
+        owned_columns->resize( count );
+    }
+
+    columns_changed();
+    set_modified();
+}
+
+
+void ColumnConfigFile::Entry::set_content( const string & new_content )
+{
+    own_columns();
+    CommentedConfigFile::Entry::set_content( new_content );
+}
+
+
+void ColumnConfigFile::Entry::own_columns()
+{
+    if ( owned_columns || row >= 0 )
+        return;
+
+    owned_columns.reset( new string_vec() );
+    owned_columns->reserve( spans.size() );
+
+    for ( size_t i=0; i < spans.size(); ++i )
+    {
+        const ColumnSpan & span = spans[i];
+        owned_columns->push_back( get_content().substr( span.offset, span.size ) );
+    }
+
+    ColumnSpanVec().swap( spans );
+}
+
+
+bool ColumnConfigFile::Entry::save_cache_fields( string_vec & fields_ret ) const
+{
+    if ( typeid( *this ) != typeid( ColumnConfigFile::Entry ) )
+        return false;
+
+    fields_ret.clear();
+
+    for ( int i=0; i < get_column_count(); ++i )
+        fields_ret.push_back( get_column( i ) );
+
+    return true;
+}
+
+
+bool ColumnConfigFile::Entry::load_cache_fields( const string_vec & fields )
+{
+    if ( typeid( *this ) != typeid( ColumnConfigFile::Entry ) )
+        return false;
+
+    // Use the columns from the content if they are the same, which they
+    // are unless they were changed without changing the content
+
+    ColumnConfigFile * col_parent = row >= 0 ?
+        static_cast<ColumnConfigFile *>( get_parent() ) : 0;
+
+    columns_changing();
+
+    if ( col_parent )
+        col_parent->unstore_columns( this, false );
+
+    owned_columns.reset();
+    find_columns( get_content(), spans );
+    bool same = spans.size() == fields.size();
+
+    for ( size_t i=0; i < fields.size() && same; ++i )
+        same = get_column_ref( i ) == fields[i];
+
+    if ( ! same )
+    {
+        ColumnSpanVec().swap( spans );
+        owned_columns.reset( new string_vec( fields ) );
+    }
+
+    if ( col_parent )
+        col_parent->store_columns( this );
+
+    columns_changed();
+
+    return true;
+}
+
+
+void ColumnConfigFile::find_columns( const string & line, ColumnSpanVec & spans_ret )
+{
+    // This gives the same result as boost::split() with token_compress_on.
+    // Every change between whitespace and non-whitespace ends or starts a
+    // column; with SSE2, the changes are found for 16 characters at once.
+
+    const char * data          = line.data();
+    size_t       size          = line.size();
+    size_t       pos           = 0;
+    uint32_t     start         = 0;     // of the current column
+    bool         in_whitespace = false;
+
+    spans_ret.clear();
+
+#ifdef __SSE2__
+    const __m128i blank = _mm_set1_epi8( ' ' );
+    const __m128i tab   = _mm_set1_epi8( '\t' );
+
+    for ( ; pos + 16 <= size; pos += 16 )
+    {
+        __m128i  chunk = _mm_loadu_si128( (const __m128i *) ( data + pos ) );
+        uint32_t ws    = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( chunk, blank ),
+                                                           _mm_cmpeq_epi8( chunk, tab ) ) );
+
+        // Bit i: Character i is whitespace, but the one before it is not,
+        // or the other way round
+
+        uint32_t changes = ( ws ^ ( ( ws << 1 ) | in_whitespace ) ) & 0xffff;
+
+        while ( changes )
+        {
+            uint32_t bit = __builtin_ctz( changes );
+            uint32_t at  = pos + bit;
+
+            if ( ws & ( 1u << bit ) )
+                spans_ret.push_back( { start, at - start } );
+            else
+                start = at;
+
+            changes &= changes - 1;
+        }
+
+        in_whitespace = ws & 0x8000;
+    }
+#endif
+
+    for ( ; pos < size; ++pos )
+    {
+        bool ws = data[ pos ] == ' ' || data[ pos ] == '\t';
+
+        if ( ws != in_whitespace )
+        {
+            if ( ws )
+                spans_ret.push_back( { start, (uint32_t) pos - start } );
+            else
+                start = pos;
+
+            in_whitespace = ws;
+        }
+    }
+
+    if ( in_whitespace )
+        spans_ret.push_back( { (uint32_t) size, 0 } );
+    else
+        spans_ret.push_back( { start, (uint32_t) size - start } );
+}
+
+
 
 
 ColumnConfigFile::ColumnConfigFile():
     CommentedConfigFile(),
     max_column_width( DEFAULT_MAX_COLUMN_WIDTH ),
-    pad_columns( true )
+    pad_columns( true ),
+    width_counts_valid( false ),
+    column_widths_valid( false ),
+    populating( false ),
+    populate_all( false ),
+    unstored_entries( false )
 {
 
 }
@@ -94,17 +405,15 @@ ColumnConfigFile::~ColumnConfigFile()
 }
 
 
-string_vec ColumnConfigFile::format_lines()
+void ColumnConfigFile::prepare_formatting()
 {
     calc_column_widths();
-
-    return CommentedConfigFile::format_lines();
 }
 
 
 int ColumnConfigFile::get_column_width( int column )
 {
-    if ( column_widths.empty() )
+    if ( ! width_counts_valid || ! column_widths_valid || ! unpopulated.empty() )
         calc_column_widths();
 
     if ( column < 0 || column >= (int) column_widths.size() )
@@ -128,64 +437,856 @@ void ColumnConfigFile::set_max_column_width( int column, int new_size )
     if ( column >= (int) max_column_widths.size() )
         max_column_widths.resize( column+1 );
 
-    max_column_widths[ column ] = new_size;
+    if ( max_column_widths[ column ] != new_size )
+    {
+        max_column_widths[ column ] = new_size;
+        column_widths_valid = false;
+        clear_format_cache();
+    }
+}
+
+
+void ColumnConfigFile::update_columns()
+{
+    if ( width_counts_valid )
+        populate_new_entries();
+    else
+        rebuild_column_width_counts();
 }
 
 
 void ColumnConfigFile::calc_column_widths()
 {
-    column_widths.clear();
+    // If the counts are not valid, update_columns() populates all entries
+    // anyway while counting them again
+
+    if ( populate_all && width_counts_valid )
+        populate_all_entries();
+
+    update_columns();
+
+    vector<int> old_column_widths;
+    old_column_widths.swap( column_widths );
+
+    if ( pad_columns )
+    {
+        int columns = width_counts.size();
+
+        while ( columns > 0 && width_counts[ columns-1 ].total == 0 )
+            --columns;
+
+        column_widths.resize( columns );
+
+        for ( int col=0; col < columns; ++col )
+        {
+            const vector<int> & count = width_counts[ col ].count;
+            int width = (int) count.size() - 1;
+            int max   = get_max_column_width( col );
+
+            // Only take the widths of the column items into account that
+            // are not wider than the maximum for this column; otherwise we
+            // will always end up with the maximum width for any column that
+            // has just one item the maximum width, but for that one item the
+            // maximum will be exceeded anyway (otherwise we'd have to cut if
+            // off which we clearly can't). So oversize column items should
+            // not be part of this calculation; we want to know the widths of
+            // the "normal" items only.
+
+            if ( max > 0 )
+                width = std::min( width, max );
+
+            while ( width > 0 && count[ width ] == 0 )
+                --width;
+
+            column_widths[ col ] = std::max( width, 0 );
+        }
+    }
+
+    column_widths_valid = true;
+
+    // The entries cache their formatted lines; if any column width
+    // changed, all of them need to be formatted again.
+
+    if ( column_widths != old_column_widths )
+        clear_format_cache();
+
+#if 0
+    for ( size_t col=0; col < column_widths.size(); ++col )
+        cout << "Col " << col << " width: " << column_widths[col] << endl;
+#endif
+}
 
-    if ( ! pad_columns )
-        return;
 
-    int columns = 0;
+void ColumnConfigFile::rebuild_column_width_counts()
+{
+    invalidate_column_width_counts();
+    width_counts_valid = true;
+    populating         = true;
 
     for ( int i=0; i < get_entry_count(); ++i )
     {
         ColumnConfigFile::Entry * entry =
-            dynamic_cast<ColumnConfigFile::Entry*>( get_entry( i ) );
+            dynamic_cast<ColumnConfigFile::Entry*>( CommentedConfigFile::get_entry( i ) );
 
         if ( entry )
         {
+            if ( column_store && entry->row < 0 )
+                store_columns( entry );
+
+            entry->widths_counted    = false;
+            entry->unpopulated_index = -1;
             entry->populate_columns();
-            columns = std::max( entry->get_column_count(), columns );
+
+            if ( entry->row < 0 )
+                count_column_widths( entry, 1 );
+
+            entry->widths_counted    = true;
         }
     }
 
-    column_widths.resize( columns );
+    populating = false;
 
-    for ( int i=0; i < get_entry_count(); ++i )
+    if ( column_store )
     {
-        ColumnConfigFile::Entry * entry =
-            dynamic_cast<ColumnConfigFile::Entry*>( get_entry( i ) );
+        unstored_entries = false;
+        count_stored_column_widths();
+    }
+}
 
-        if ( entry )
+
+void ColumnConfigFile::count_stored_column_widths()
+{
+    // The sizes of each column of all rows are next to each other
+
+    int columns = column_store->get_max_column_count();
+
+    if ( columns > (int) width_counts.size() )
+        width_counts.resize( columns );
+
+    for ( int col=0; col < columns; ++col )
+    {
+        const vector<uint32_t> & sizes  = column_store->get_sizes( col );
+        ColumnWidthCounts &      counts = width_counts[ col ];
+
+        for ( size_t row=0; row < sizes.size(); ++row )
         {
-            for ( int col=0; col < entry->get_column_count(); ++col )
-            {
-                int width = entry->get_column( col ).size();
-                int max   = get_max_column_width( col );
-
-                // Only take the width of this column of this entry into
-                // account if it is not wider than the maximum for this column;
-                // otherwise we will always end up with the maximum width for
-                // any column that has just one item the maximum width, but for
-                // that one item the maximum will be exceeded anyway (otherwise
-                // we'd have to cut if off which we clearly can't). So oversize
-                // column items should not be part of this calculation; we want
-                // to know the widths of the "normal" items only.
-
-                if ( max == 0 || width <= max )
-                    column_widths[ col ] = std::max( column_widths[ col ], width );
-            }
+            uint32_t width = sizes[ row ];
+
+            if ( width == ColumnStore::NO_VALUE )
+                continue;
+
+            if ( width >= counts.count.size() )
+                counts.count.resize( width + 1 );
+
+            ++counts.count[ width ];
+            ++counts.total;
         }
     }
 
-#if 0
+    column_widths_valid = false;
+}
+
+
+void ColumnConfigFile::count_column_widths( ColumnConfigFile::Entry * entry, int delta )
+{
+    if ( ! width_counts_valid )
+        return;
+
+    int columns = entry->get_column_count();
+
+    if ( columns > (int) width_counts.size() )
+        width_counts.resize( columns );
+
     for ( int col=0; col < columns; ++col )
-        cout << "Col " << col << " width: " << column_widths[col] << endl;
-#endif
+    {
+        ColumnWidthCounts & counts = width_counts[ col ];
+        size_t width = entry->get_column_ref( col ).size();
+
+        if ( width >= counts.count.size() )
+            counts.count.resize( width + 1 );
+
+        counts.count[ width ] += delta;
+        counts.total          += delta;
+
+        while ( ! counts.count.empty() && counts.count.back() == 0 )
+            counts.count.pop_back();
+    }
+
+    column_widths_valid = false;
+}
+
+
+void ColumnConfigFile::invalidate_column_width_counts()
+{
+    // This must not touch any entries: They might already be deleted
+
+    width_counts.clear();
+    unpopulated.clear();
+    width_counts_valid  = false;
+    column_widths_valid = false;
+}
+
+
+void ColumnConfigFile::populate_new_entries()
+{
+    vector<ColumnConfigFile::Entry *> pending;
+    pending.swap( unpopulated );
+
+    for ( size_t i=0; i < pending.size(); ++i )
+    {
+        if ( pending[i] )
+            pending[i]->unpopulated_index = -1;
+    }
+
+    populating = true;
+    populate_columns_of( pending );
+    populating = false;
+}
+
+
+void ColumnConfigFile::populate_all_entries()
+{
+    for ( size_t i=0; i < unpopulated.size(); ++i )
+    {
+        if ( unpopulated[i] )
+            unpopulated[i]->unpopulated_index = -1;
+    }
+
+    unpopulated.clear();
+    populating = true;
+    populate_columns_of_all();
+    populating = false;
+}
+
+
+void ColumnConfigFile::populate_columns_of_all()
+{
+    for ( int i=0; i < get_entry_count(); ++i )
+    {
+        ColumnConfigFile::Entry * entry = get_entry( i );
+
+        if ( entry )
+            entry->populate_columns();
+    }
+}
+
+
+void ColumnConfigFile::populate_columns_of( const vector<ColumnConfigFile::Entry *> & pending )
+{
+    for ( size_t i=0; i < pending.size(); ++i )
+    {
+        if ( pending[i] )
+            pending[i]->populate_columns();
+    }
+}
+
+
+void ColumnConfigFile::add_unpopulated( ColumnConfigFile::Entry * entry )
+{
+    if ( entry->unpopulated_index >= 0 )
+        return;
+
+    entry->unpopulated_index = unpopulated.size();
+    unpopulated.push_back( entry );
+}
+
+
+void ColumnConfigFile::remove_unpopulated( ColumnConfigFile::Entry * entry )
+{
+    int index = entry->unpopulated_index;
+
+    if ( index >= 0 && index < (int) unpopulated.size() && unpopulated[ index ] == entry )
+        unpopulated[ index ] = 0;
+
+    entry->unpopulated_index = -1;
+}
+
+
+void ColumnConfigFile::entry_added( CommentedConfigFile::Entry * entry )
+{
+    CommentedConfigFile::entry_added( entry );
+
+    ColumnConfigFile::Entry * col_entry = dynamic_cast<ColumnConfigFile::Entry *>( entry );
+
+    if ( ! col_entry )
+        return;
+
+    if ( ! column_indexes.empty() )
+    {
+        // Just like the key index, the column indexes need the columns
+        // right away
+
+        ensure_parsed( col_entry );
+        add_to_column_indexes( col_entry );
+        col_entry->indexed = true;
+    }
+
+    if ( column_store )
+    {
+        if ( col_entry->is_parsed() )
+            store_columns( col_entry );
+        else
+            unstored_entries = true;
+    }
+
+    if ( ! width_counts_valid )
+        return;
+
+    if ( ! col_entry->is_parsed() )
+    {
+        // Not parsing it just for counting; this is lazy_parse, so it is
+        // very likely that many more of them are coming.
+
+        invalidate_column_width_counts();
+        return;
+    }
+
+    count_column_widths( col_entry, 1 );
+    col_entry->widths_counted = true;
+    add_unpopulated( col_entry );
+}
+
+
+void ColumnConfigFile::entry_removed( CommentedConfigFile::Entry * entry )
+{
+    CommentedConfigFile::entry_removed( entry );
+
+    ColumnConfigFile::Entry * col_entry = dynamic_cast<ColumnConfigFile::Entry *>( entry );
+
+    if ( ! col_entry )
+        return;
+
+    remove_unpopulated( col_entry );
+
+    if ( col_entry->widths_counted )
+    {
+        count_column_widths( col_entry, -1 );
+        col_entry->widths_counted = false;
+    }
+
+    if ( col_entry->indexed )
+    {
+        remove_from_column_indexes( col_entry );
+        col_entry->indexed = false;
+    }
+
+    if ( col_entry->row >= 0 )
+        unstore_columns( col_entry );
+}
+
+
+void ColumnConfigFile::entry_columns_changing( ColumnConfigFile::Entry * entry )
+{
+    if ( entry->widths_counted )
+        count_column_widths( entry, -1 );
+
+    if ( entry->indexed )
+        remove_from_column_indexes( entry );
+}
+
+
+void ColumnConfigFile::entry_columns_changed( ColumnConfigFile::Entry * entry )
+{
+    if ( entry->widths_counted )
+        count_column_widths( entry, 1 );
+
+    if ( entry->indexed )
+        add_to_column_indexes( entry );
+}
+
+
+void ColumnConfigFile::entry_modified( CommentedConfigFile::Entry * entry )
+{
+    CommentedConfigFile::entry_modified( entry );
+
+    if ( ! width_counts_valid || populating )
+        return;
+
+    ColumnConfigFile::Entry * col_entry = dynamic_cast<ColumnConfigFile::Entry *>( entry );
+
+    if ( col_entry && col_entry->widths_counted )
+        add_unpopulated( col_entry );
+}
+
+
+void ColumnConfigFile::entries_cleared()
+{
+    CommentedConfigFile::entries_cleared();
+    invalidate_column_width_counts();
+
+    if ( column_store )
+    {
+        column_store->clear();
+        row_entries.clear();
+        unstored_entries = false;
+    }
+
+    for ( ColumnIndexMap::iterator it = column_indexes.begin(); it != column_indexes.end(); ++it )
+    {
+        it->second.hash.clear();
+        it->second.ordered.clear();
+        it->second.duplicates = 0;
+    }
+}
+
+
+size_t ColumnConfigFile::get_entry_line_size( CommentedConfigFile::Entry * entry )
+{
+    // Only plain ColumnConfigFile::Entry objects are known to use
+    // ColumnConfigFile::Entry::format()
+
+    if ( typeid( *entry ) != typeid( ColumnConfigFile::Entry ) || is_written_verbatim( entry ) )
+        return CommentedConfigFile::get_entry_line_size( entry );
+
+    if ( ! entry->validate() )
+        return string::npos;
+
+    return get_column_line_size( static_cast<ColumnConfigFile::Entry *>( entry ) );
+}
+
+
+void ColumnConfigFile::append_entry_line( CommentedConfigFile::Entry * entry, string & text )
+{
+    if ( typeid( *entry ) != typeid( ColumnConfigFile::Entry ) || is_written_verbatim( entry ) )
+        CommentedConfigFile::append_entry_line( entry, text );
+    else
+        append_column_line( static_cast<ColumnConfigFile::Entry *>( entry ), text );
+}
+
+
+size_t ColumnConfigFile::get_column_line_size( ColumnConfigFile::Entry * entry )
+{
+    size_t size = entry->get_formatted_size( this );
+
+    if ( ! entry->get_line_comment().empty() )
+        size += 1 + entry->get_line_comment().size();
+
+    return size;
+}
+
+
+void ColumnConfigFile::append_column_line( ColumnConfigFile::Entry * entry, string & text )
+{
+    entry->append_columns( this, text );
+
+    if ( ! entry->get_line_comment().empty() )
+    {
+        text += ' ';
+        text += entry->get_line_comment();
+    }
+}
+
+
+void ColumnConfigFile::set_columnar_storage( bool enabled )
+{
+    if ( enabled == get_columnar_storage() )
+        return;
+
+    if ( enabled )
+    {
+        column_store.reset( new ColumnStore() );
+        unstored_entries = true;
+        store_new_entries();
+    }
+    else
+    {
+        for ( size_t row=0; row < row_entries.size(); ++row )
+        {
+            if ( row_entries[ row ] )
+                unstore_columns( row_entries[ row ] );
+        }
+
+        column_store.reset();
+        row_entries.clear();
+        unstored_entries = false;
+    }
+}
+
+
+void ColumnConfigFile::store_columns( ColumnConfigFile::Entry * entry )
+{
+    int row   = column_store->add_row();
+    int count = entry->get_column_count();
+
+    column_store->set_column_count( row, count );
+
+    for ( int col=0; col < count; ++col )
+        column_store->set( row, col, entry->get_column_ref( col ) );
+
+    entry->row = row;
+    entry->owned_columns.reset();
+    ColumnSpanVec().swap( entry->spans );
+
+    if ( row >= (int) row_entries.size() )
+        row_entries.resize( row + 1 );
+
+    row_entries[ row ] = entry;
+}
+
+
+void ColumnConfigFile::unstore_columns( ColumnConfigFile::Entry * entry, bool keep_columns )
+{
+    int row = entry->row;
+
+    if ( keep_columns )
+    {
+        string_vec * columns = new string_vec();
+        columns->reserve( entry->get_column_count() );
+
+        for ( int col=0; col < entry->get_column_count(); ++col )
+            columns->push_back( entry->get_column( col ) );
+
+        entry->owned_columns.reset( columns );
+    }
+
+    column_store->remove_row( row );
+    row_entries[ row ] = 0;
+    entry->row = -1;
+}
+
+
+void ColumnConfigFile::store_new_entries()
+{
+    if ( ! column_store || ! unstored_entries )
+        return;
+
+    for ( int i=0; i < get_entry_count(); ++i )
+    {
+        ColumnConfigFile::Entry * entry =
+            dynamic_cast<ColumnConfigFile::Entry*>( CommentedConfigFile::get_entry( i ) );
+
+        if ( entry && entry->row < 0 )
+            store_columns( entry );
+    }
+
+    unstored_entries = false;
+}
+
+
+bool ColumnConfigFile::add_column_index( int column, ColumnIndexType type )
+{
+    if ( column < 0 )
+        return false;
+
+    // Derived entries might only have their columns after this
+
+    update_columns();
+
+    ColumnIndex index;
+    index.type = type;
+
+    for ( int i=0; i < get_entry_count(); ++i )
+    {
+        ColumnConfigFile::Entry * entry = get_entry( i );
+
+        if ( entry )
+            add_to_column_index( column, index, entry );
+    }
+
+    if ( type == UNIQUE_HASH_INDEX && index.duplicates > 0 )
+        return false;
+
+    column_indexes[ column ] = std::move( index );
+
+    for ( int i=0; i < get_entry_count(); ++i )
+    {
+        ColumnConfigFile::Entry * entry = get_entry( i );
+
+        if ( entry )
+            entry->indexed = true;
+    }
+
+    return true;
+}
+
+
+void ColumnConfigFile::remove_column_index( int column )
+{
+    if ( column_indexes.erase( column ) == 0 || ! column_indexes.empty() )
+        return;
+
+    for ( int i=0; i < get_entry_count(); ++i )
+    {
+        ColumnConfigFile::Entry * entry = get_entry( i );
+
+        if ( entry )
+            entry->indexed = false;
+    }
+}
+
+
+int ColumnConfigFile::get_duplicate_count( int column ) const
+{
+    ColumnIndexMap::const_iterator it = column_indexes.find( column );
+
+    if ( it == column_indexes.end() || it->second.type != UNIQUE_HASH_INDEX )
+        return -1;
+
+    return it->second.duplicates;
+}
+
+
+void ColumnConfigFile::add_to_column_index( int                       column,
+                                            ColumnIndex &             index,
+                                            ColumnConfigFile::Entry * entry )
+{
+    if ( column >= entry->get_column_count() )
+        return;
+
+    string value = entry->get_column( column );
+
+    if ( index.type == ORDERED_INDEX )
+    {
+        index.ordered.insert( std::make_pair( value, entry ) );
+    }
+    else
+    {
+        if ( index.type == UNIQUE_HASH_INDEX && index.hash.count( value ) > 0 )
+            ++index.duplicates;
+
+        index.hash.insert( std::make_pair( value, entry ) );
+    }
+}
+
+
+void ColumnConfigFile::remove_from_column_index( int                       column,
+                                                 ColumnIndex &             index,
+                                                 ColumnConfigFile::Entry * entry )
+{
+    if ( column >= entry->get_column_count() )
+        return;
+
+    string value = entry->get_column( column );
+
+    if ( index.type == ORDERED_INDEX )
+    {
+        std::pair<ColumnIndex::OrderedMap::iterator, ColumnIndex::OrderedMap::iterator> range =
+            index.ordered.equal_range( value );
+
+        for ( ColumnIndex::OrderedMap::iterator it = range.first; it != range.second; ++it )
+        {
+            if ( it->second == entry )
+            {
+                index.ordered.erase( it );
+                break;
+            }
+        }
+    }
+    else
+    {
+        std::pair<ColumnIndex::HashMap::iterator, ColumnIndex::HashMap::iterator> range =
+            index.hash.equal_range( value );
+
+        for ( ColumnIndex::HashMap::iterator it = range.first; it != range.second; ++it )
+        {
+            if ( it->second == entry )
+            {
+                index.hash.erase( it );
+
+                if ( index.type == UNIQUE_HASH_INDEX && index.hash.count( value ) > 0 )
+                    --index.duplicates;
+
+                break;
+            }
+        }
+    }
+}
+
+
+void ColumnConfigFile::add_to_column_indexes( ColumnConfigFile::Entry * entry )
+{
+    for ( ColumnIndexMap::iterator it = column_indexes.begin(); it != column_indexes.end(); ++it )
+        add_to_column_index( it->first, it->second, entry );
+}
+
+
+void ColumnConfigFile::remove_from_column_indexes( ColumnConfigFile::Entry * entry )
+{
+    for ( ColumnIndexMap::iterator it = column_indexes.begin(); it != column_indexes.end(); ++it )
+        remove_from_column_index( it->first, it->second, entry );
+}
+
+
+template<class Iterator>
+vector<ColumnConfigFile::Entry *>
+ColumnConfigFile::sorted_entries( Iterator begin, Iterator end ) const
+{
+    vector<ColumnConfigFile::Entry *> result;
+
+    for ( Iterator it = begin; it != end; ++it )
+        result.push_back( it->second );
+
+    std::sort( result.begin(), result.end(),
+               [this]( ColumnConfigFile::Entry * a, ColumnConfigFile::Entry * b )
+               { return get_index_of( a ) < get_index_of( b ); } );
+
+    return result;
+}
+
+
+vector<ColumnConfigFile::Entry *>
+ColumnConfigFile::find_entries_if( int column, std::function<bool( string_ref )> predicate )
+{
+    vector<ColumnConfigFile::Entry *> result;
+
+    if ( column < 0 )
+        return result;
+
+    if ( column_store )
+    {
+        store_new_entries();
+
+        for ( int row=0; row < column_store->get_row_count(); ++row )
+        {
+            if ( row_entries[ row ] &&
+                 column < column_store->get_column_count( row ) &&
+                 predicate( column_store->get( row, column ) ) )
+            {
+                result.push_back( row_entries[ row ] );
+            }
+        }
+
+        // The rows are in no particular order
+
+        std::sort( result.begin(), result.end(),
+                   [this]( ColumnConfigFile::Entry * a, ColumnConfigFile::Entry * b )
+                   { return get_index_of( a ) < get_index_of( b ); } );
+    }
+    else
+    {
+        for ( int i=0; i < get_entry_count(); ++i )
+        {
+            ColumnConfigFile::Entry * entry = get_entry( i );
+
+            if ( entry && column < entry->get_column_count() &&
+                 predicate( entry->get_column_ref( column ) ) )
+            {
+                result.push_back( entry );
+            }
+        }
+    }
+
+    return result;
+}
+
+
+ColumnConfigFile::Entry * ColumnConfigFile::find_entry( int column, const string & value )
+{
+    vector<ColumnConfigFile::Entry *> found = find_entries( column, value );
+
+    return found.empty() ? 0 : found.front();
+}
+
+
+vector<ColumnConfigFile::Entry *>
+ColumnConfigFile::find_entries( int column, const string & value )
+{
+    update_columns();
+
+    ColumnIndexMap::iterator it = column_indexes.find( column );
+
+    if ( it != column_indexes.end() )
+    {
+        ColumnIndex & index = it->second;
+
+        if ( index.type == ORDERED_INDEX )
+        {
+            std::pair<ColumnIndex::OrderedMap::iterator, ColumnIndex::OrderedMap::iterator> range =
+                index.ordered.equal_range( value );
+
+            return sorted_entries( range.first, range.second );
+        }
+        else
+        {
+            std::pair<ColumnIndex::HashMap::iterator, ColumnIndex::HashMap::iterator> range =
+                index.hash.equal_range( value );
+
+            return sorted_entries( range.first, range.second );
+        }
+    }
+
+    if ( column_store )
+    {
+        // The same as find_entries_if(), but comparing the sizes first
+        // without even looking at the values
+
+        store_new_entries();
+
+        vector<int> rows;
+        column_store->find( column, value, rows );
+
+        vector<ColumnConfigFile::Entry *> result;
+
+        for ( size_t i=0; i < rows.size(); ++i )
+            result.push_back( row_entries[ rows[i] ] );
+
+        std::sort( result.begin(), result.end(),
+                   [this]( ColumnConfigFile::Entry * a, ColumnConfigFile::Entry * b )
+                   { return get_index_of( a ) < get_index_of( b ); } );
+
+        return result;
+    }
+
+    return find_entries_if( column, [&value]( string_ref col ) { return col == value; } );
+}
+
+
+vector<ColumnConfigFile::Entry *>
+ColumnConfigFile::find_range( int column, const string & from, const string & to )
+{
+    update_columns();
+
+    ColumnIndexMap::iterator it = column_indexes.find( column );
+
+    if ( it != column_indexes.end() && it->second.type == ORDERED_INDEX )
+    {
+        if ( ! ( from < to ) )
+            return vector<ColumnConfigFile::Entry *>();
+
+        ColumnIndex::OrderedMap & ordered = it->second.ordered;
+
+        return sorted_entries( ordered.lower_bound( from ), ordered.lower_bound( to ) );
+    }
+
+    return find_entries_if( column, [&from, &to]( string_ref col )
+                            { return col >= string_ref( from ) && col < string_ref( to ); } );
+}
+
+
+vector<ColumnConfigFile::Entry *>
+ColumnConfigFile::find_prefix( int column, const string & prefix )
+{
+    update_columns();
+
+    ColumnIndexMap::iterator it = column_indexes.find( column );
+
+    if ( it != column_indexes.end() && it->second.type == ORDERED_INDEX )
+    {
+        ColumnIndex::OrderedMap & ordered = it->second.ordered;
+        ColumnIndex::OrderedMap::iterator begin = ordered.lower_bound( prefix );
+        ColumnIndex::OrderedMap::iterator end   = begin;
+
+        while ( end != ordered.end() && end->first.compare( 0, prefix.size(), prefix ) == 0 )
+            ++end;
+
+        return sorted_entries( begin, end );
+    }
+
+    return find_entries_if( column, [&prefix]( string_ref col )
+                            { return col.starts_with( string_ref( prefix ) ); } );
+}
+
+
+int ColumnConfigFile::replace_in_column( int column,
+                                         const string & old_value,
+                                         const string & new_value )
+{
+    vector<ColumnConfigFile::Entry *> found = find_entries( column, old_value );
+
+    for ( size_t i=0; i < found.size(); ++i )
+        found[i]->set_column( column, new_value );
+
+    return found.size();
 }
 
 
@@ -8,7 +8,16 @@
 #ifndef ColumnConfigFile_h
 #define ColumnConfigFile_h
 
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <boost/container/small_vector.hpp>
+#include <boost/utility/string_ref.hpp>
+
 #include "CommentedConfigFile.h"
+#include "ColumnStore.h"
+
+#define COLUMN_SPANS_INLINE     8
 
 
 /**
@@ -32,10 +41,63 @@ class ColumnConfigFile: public CommentedConfigFile
 {
 public:
 
+    typedef boost::string_ref string_ref;
+
+    /**
+     * Position of one column in a line.
+     **/
+    struct ColumnSpan
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    /**
+     * Column positions of one line. Up to COLUMN_SPANS_INLINE of them are
+     * stored inside the entry itself.
+     **/
+    typedef boost::container::small_vector<ColumnSpan, COLUMN_SPANS_INLINE> ColumnSpanVec;
+
+    /**
+     * Find the columns of 'line' in one pass and return their positions
+     * in 'spans_ret'. Columns are separated by any number of blanks and
+     * tabs; leading or trailing whitespace results in an empty first or
+     * last column.
+     **/
+    static void find_columns( const string & line, ColumnSpanVec & spans_ret );
+
+    /**
+     * Type of an index on a column.
+     **/
+    enum ColumnIndexType
+    {
+        HASH_INDEX,             // value -> entries
+        UNIQUE_HASH_INDEX,      // value -> entry; see add_column_index()
+        ORDERED_INDEX           // also for find_range() and find_prefix()
+    };
+
+
+    /**
+     * Entry with columns.
+     *
+     * The columns are not copied when parsing: They are just positions in
+     * the content. Only set_column() and the other methods that change
+     * columns give an entry its own copy of them.
+     *
+     * With columnar storage enabled in the parent, the columns are in the
+     * parent's ColumnStore instead, and the entry looks them up by its row
+     * there. It still keeps its content.
+     **/
     class Entry: public CommentedConfigFile::Entry
     {
     public:
-	Entry() {}
+	Entry():
+            widths_counted( false ),
+            indexed( false ),
+            unpopulated_index( -1 ),
+            row( -1 )
+            {}
+
 	virtual ~Entry() {}
 
 	/**
@@ -45,10 +107,37 @@ public:
 	 **/
 	virtual string format();
 
+        /**
+         * Format the columns, padded to the column widths of 'col_parent'
+         * if it has column padding enabled. format() calls this with its
+         * parent; this is useful for classes that already know their
+         * parent without a dynamic_cast.
+         **/
+        string format_columns( ColumnConfigFile * col_parent ) const;
+
+        /**
+         * Return the exact size of what format_columns() returns for
+         * 'col_parent' without formatting anything.
+         **/
+        size_t get_formatted_size( ColumnConfigFile * col_parent ) const;
+
+        /**
+         * Append what format_columns() returns for 'col_parent' to 'text'
+         * without any temporary string.
+         **/
+        void append_columns( ColumnConfigFile * col_parent, string & text ) const;
+
         /**
          * Populate the columns. This is called just prior to calculating the
          * column widths and formatting the columns. Derived classes can use
          * this to fill the columns with values from any other fields.
+         *
+         * This is only called for entries that are new or that were
+         * modified since then, so derived classes have to call
+         * set_modified() when those fields change. If they can't, the
+         * parent can call it for all entries with set_populate_all(), but
+         * column queries like find_entries() only populate the new and
+         * modified entries in any case.
          **/
         virtual void populate_columns() {}
 
@@ -61,41 +150,134 @@ public:
 	 **/
 	virtual bool parse( const string & line, int line_no = -1 );
 
+        /**
+         * Store the columns for a ParseCache. Derived classes only get
+         * this if they override it themselves since they might parse more
+         * than the columns.
+         *
+         * Reimplemented from CommentedConfigFile.
+         **/
+        virtual bool save_cache_fields( string_vec & fields_ret ) const;
+
+        /**
+         * Restore the columns from a ParseCache.
+         *
+         * Reimplemented from CommentedConfigFile.
+         **/
+        virtual bool load_cache_fields( const string_vec & fields );
+
+        /**
+         * Set the string content of this entry. This does not change the
+         * columns.
+         *
+         * Reimplemented from CommentedConfigFile.
+         **/
+        virtual void set_content( const string & new_content );
+
 	/**
 	 * Return the number of columns for this entry.
 	 **/
-	int get_column_count() const { return columns.size(); }
+	int get_column_count() const
+            {
+                if ( row >= 0 )
+                    return get_store()->get_column_count( row );
+
+                return owned_columns ? owned_columns->size() : spans.size();
+            }
+
+	/**
+	 * Return one of the columns for this entry without copying it. This
+	 * is only valid until the entry is changed; with columnar storage,
+	 * until any entry of the parent is changed.
+	 **/
+	string_ref get_column_ref( int i ) const
+            {
+                if ( row >= 0 )
+                    return get_store()->get( row, i );
+
+                if ( owned_columns )
+                    return string_ref( (*owned_columns)[i] );
+
+                return string_ref( get_content().data() + spans[i].offset, spans[i].size );
+            }
 
 	/**
 	 * Return one of the columns for this entry.
 	 **/
-	const string & get_column( int i ) const { return columns[i]; }
+	string get_column( int i ) const { return get_column_ref( i ).to_string(); }
 
 	/**
 	 * Set a new value for column no. 'i'.
 	 **/
-	void set_column( int i, const string & new_value )
-	    { columns[i] = new_value; }
+	void set_column( int i, const string & new_value );
 
-	void add_column( const string & new_value )
-	    { columns.push_back( new_value ); }
+        /**
+         * Add a column with value 'new_value' at the end.
+         **/
+	void add_column( const string & new_value );
 
     protected:
 
 	/**
 	 * Split a line into fields and return them.
+	 *
+	 * The default finds the columns with find_columns() and does not
+	 * create any strings; parse() only calls this if a derived class
+	 * overrides it.
 	 **/
 	virtual string_vec split( const string & line ) const;
 
+        /**
+         * Return 'true' if split() is known not to be overridden, so
+         * parse() can use find_columns() directly.
+         **/
+        bool uses_default_split() const;
+
         /**
          * Set the number of columns
          **/
-        void set_column_count( int count )
-            { columns.resize( count ); }
+        void set_column_count( int count );
+
+        /**
+         * Copy the columns from the content to this entry's own strings
+         * before they are changed. This does nothing with columnar
+         * storage.
+         **/
+        void own_columns();
+
+        /**
+         * Return the parent's column store. This may only be called if
+         * the columns are stored there.
+         **/
+        ColumnStore * get_store() const
+            { return static_cast<ColumnConfigFile *>( get_parent() )->column_store.get(); }
+
+        /**
+         * Take the columns out of the parent's column width counts and
+         * column indexes before they change and add them again afterwards.
+         **/
+        void columns_changing()
+            {
+                if ( widths_counted || indexed )
+                    static_cast<ColumnConfigFile *>( get_parent() )->entry_columns_changing( this );
+            }
+
+        void columns_changed()
+            {
+                if ( widths_counted || indexed )
+                    static_cast<ColumnConfigFile *>( get_parent() )->entry_columns_changed( this );
+            }
 
     private:
 
-	string_vec columns;
+        friend class ColumnConfigFile;
+
+	ColumnSpanVec                 spans;          // in the content
+        std::unique_ptr<string_vec>   owned_columns;  // once changed
+        bool                          widths_counted; // in the parent
+        bool                          indexed;        // in the parent
+        int                           unpopulated_index; // in the parent
+        int                           row;            // in the parent's column store
     };
 
 
@@ -109,14 +291,6 @@ public:
      **/
     virtual Entry * create_entry() { return new ColumnConfigFile::Entry(); }
 
-    /**
-     * Format the entire file as string lines, including header, footer and all
-     * other comments.
-     *
-     * Reimplemented from CommentedConfigFile.
-     **/
-    virtual string_vec format_lines();
-
     /**
      * Return 'true' if columns should be padded upon output, i.e. they should
      * get the same widths so they neatly line up. The default is 'true'.
@@ -129,11 +303,132 @@ public:
     /**
      * Enable or disable column padding.
      **/
-    void set_pad_columns( bool do_pad ) { pad_columns = do_pad; }
+    void set_pad_columns( bool do_pad )
+        {
+            if ( do_pad != pad_columns )
+            {
+                pad_columns = do_pad;
+                column_widths_valid = false;
+                clear_format_cache();
+            }
+        }
+
+    /**
+     * Return 'true' if Entry::populate_columns() is called for all entries
+     * whenever the column widths are needed. The default is 'false'.
+     **/
+    bool get_populate_all() const { return populate_all; }
+
+    /**
+     * Enable or disable calling Entry::populate_columns() for all entries
+     * whenever the column widths are needed instead of only for the
+     * entries that are new or were modified since the last time. This is
+     * for entries that change what populate_columns() uses without calling
+     * set_modified(); it costs going through all entries every time a
+     * large file is formatted, even after changing only one of them.
+     **/
+    void set_populate_all( bool enabled = true ) { populate_all = enabled; }
+
+    /**
+     * Return 'true' if the columns of all entries are stored in one
+     * ColumnStore, column by column, instead of in each entry. The default
+     * is 'false'.
+     **/
+    bool get_columnar_storage() const { return column_store != 0; }
+
+    /**
+     * Enable or disable columnar storage. This moves the columns of all
+     * entries.
+     *
+     * With columnar storage, the values of one column of all entries are
+     * packed into one buffer. This makes scanning a column, like for
+     * calculating the column widths or for find_entries(), much more
+     * cache-friendly for large files.
+     *
+     * This needs more memory, not less: The entries keep their content,
+     * and the store has another copy of the columns.
+     **/
+    void set_columnar_storage( bool enabled = true );
+
+    /**
+     * Add an index of type 'type' on column no. 'column' or change the
+     * type of an existing one. The index is maintained automatically
+     * whenever entries are added, removed, parsed or their columns change,
+     * so find_entry(), find_entries(), find_range() and find_prefix() for
+     * that column no longer have to look at every entry.
+     *
+     * For UNIQUE_HASH_INDEX, this fails if any two entries have the same
+     * value in that column; it is not added then. If that happens later,
+     * get_duplicate_count() tells.
+     *
+     * Return 'true' if success, 'false' if error.
+     **/
+    bool add_column_index( int column, ColumnIndexType type = HASH_INDEX );
+
+    /**
+     * Remove the index on column no. 'column' if there is one.
+     **/
+    void remove_column_index( int column );
+
+    /**
+     * Return 'true' if there is an index on column no. 'column'.
+     **/
+    bool has_column_index( int column ) const
+        { return column_indexes.find( column ) != column_indexes.end(); }
+
+    /**
+     * Return the number of entries that have the same value in column no.
+     * 'column' as another entry (not counting the first one with each
+     * value) if there is a UNIQUE_HASH_INDEX on that column, or -1 if
+     * there is none.
+     **/
+    int get_duplicate_count( int column ) const;
+
+    /**
+     * Return the first entry whose column no. 'column' is 'value' or 0 if
+     * there is none.
+     **/
+    ColumnConfigFile::Entry * find_entry( int column, const string & value );
+
+    /**
+     * Return the entries whose column no. 'column' is 'value' in the order
+     * of the entries.
+     **/
+    vector<ColumnConfigFile::Entry *> find_entries( int column, const string & value );
+
+    /**
+     * Return the entries whose column no. 'column' is at least 'from' and
+     * less than 'to' in the order of the entries. This is fast with an
+     * ORDERED_INDEX on that column.
+     **/
+    vector<ColumnConfigFile::Entry *> find_range( int column,
+                                                  const string & from,
+                                                  const string & to );
+
+    /**
+     * Return the entries whose column no. 'column' starts with 'prefix' in
+     * the order of the entries. This is fast with an ORDERED_INDEX on that
+     * column.
+     **/
+    vector<ColumnConfigFile::Entry *> find_prefix( int column, const string & prefix );
+
+    // The base class versions by key are still there
+
+    using CommentedConfigFile::find_entry;
+    using CommentedConfigFile::find_entries;
+
+    /**
+     * Set column no. 'column' of all entries where it is 'old_value' to
+     * 'new_value'. Return the number of entries that were changed.
+     **/
+    int replace_in_column( int column, const string & old_value, const string & new_value );
 
     /**
      * Return the best column width for a column. If a maximum width for this
      * column is set, this returns no more than the maximum width.
+     *
+     * The widths are maintained incrementally as entries and their columns
+     * change, so this does not have to look at all entries.
      **/
     virtual int get_column_width( int column );
 
@@ -163,12 +458,204 @@ public:
 
 protected:
 
+    /**
+     * Calculate the column widths before formatting.
+     *
+     * Reimplemented from CommentedConfigFile.
+     **/
+    virtual void prepare_formatting();
+
+    /**
+     * Bring the column widths up to date: Populate the columns of the new
+     * and modified entries (or, with populate_all, of all entries) and
+     * take the widths from the column width counts.
+     **/
     void calc_column_widths();
 
-    vector<int> column_widths;
-    vector<int> max_column_widths;
-    int         max_column_width;
-    bool        pad_columns;
+    /**
+     * Call populate_columns() for the entries that need it. This counts
+     * the column widths of all entries first if that was not done yet.
+     **/
+    void update_columns();
+
+    /**
+     * Count the widths of all columns of all entries again.
+     **/
+    void rebuild_column_width_counts();
+
+    /**
+     * Count the widths of all columns in the column store.
+     **/
+    void count_stored_column_widths();
+
+    /**
+     * Add the widths of the columns of 'entry' to the column width counts
+     * ('delta' 1) or remove them from there ('delta' -1).
+     **/
+    void count_column_widths( ColumnConfigFile::Entry * entry, int delta );
+
+    /**
+     * Discard the column width counts so they are counted again the next
+     * time they are needed.
+     **/
+    void invalidate_column_width_counts();
+
+    /**
+     * Call populate_columns() for the entries that are new or modified
+     * since the last time.
+     **/
+    void populate_new_entries();
+
+    /**
+     * Call populate_columns() for all entries.
+     **/
+    void populate_all_entries();
+
+    /**
+     * Call populate_columns() for all entries or for those in 'pending'
+     * that are not 0. The callers take care of the bookkeeping.
+     *
+     * Derived classes that know the exact type of their entries at compile
+     * time can override these to call it without a dynamic_cast and
+     * without virtual dispatch; see TypedConfigFile.
+     **/
+    virtual void populate_columns_of_all();
+    virtual void populate_columns_of( const vector<ColumnConfigFile::Entry *> & pending );
+
+    /**
+     * Add 'entry' to the entries that need populate_columns() or remove it
+     * from there.
+     **/
+    void add_unpopulated( ColumnConfigFile::Entry * entry );
+    void remove_unpopulated( ColumnConfigFile::Entry * entry );
+
+    /**
+     * Reimplemented from CommentedConfigFile to maintain the column width
+     * counts.
+     **/
+    virtual void entry_added( CommentedConfigFile::Entry * entry );
+    virtual void entry_removed( CommentedConfigFile::Entry * entry );
+    virtual void entry_modified( CommentedConfigFile::Entry * entry );
+    virtual void entries_cleared();
+
+    /**
+     * Reimplemented from CommentedConfigFile to calculate the size of the
+     * line of a plain ColumnConfigFile::Entry from the column widths and
+     * write it directly to the text.
+     **/
+    virtual size_t get_entry_line_size( CommentedConfigFile::Entry * entry );
+    virtual void append_entry_line( CommentedConfigFile::Entry * entry, string & text );
+
+    /**
+     * Return the size of the line of 'entry' with its columns formatted
+     * by ColumnConfigFile::Entry::format() and its line comment.
+     **/
+    size_t get_column_line_size( ColumnConfigFile::Entry * entry );
+
+    /**
+     * Append the line of 'entry' with its columns formatted by
+     * ColumnConfigFile::Entry::format() and its line comment to 'text'.
+     **/
+    void append_column_line( ColumnConfigFile::Entry * entry, string & text );
+
+    /**
+     * Notifications from 'entry' that its columns are about to change or
+     * just changed.
+     **/
+    void entry_columns_changing( ColumnConfigFile::Entry * entry );
+    void entry_columns_changed( ColumnConfigFile::Entry * entry );
+
+    /**
+     * An index on one column.
+     **/
+    struct ColumnIndex
+    {
+        ColumnIndex(): type( HASH_INDEX ), duplicates( 0 ) {}
+
+        typedef std::unordered_multimap<string, ColumnConfigFile::Entry *> HashMap;
+        typedef std::multimap<string, ColumnConfigFile::Entry *>           OrderedMap;
+
+        ColumnIndexType type;
+        HashMap         hash;           // unless ORDERED_INDEX
+        OrderedMap      ordered;        // only ORDERED_INDEX
+        int             duplicates;     // only UNIQUE_HASH_INDEX
+    };
+
+    typedef std::map<int, ColumnIndex> ColumnIndexMap;
+
+    /**
+     * Add 'entry' to the index on column no. 'column' or remove it from
+     * there.
+     **/
+    void add_to_column_index( int column, ColumnIndex & index, ColumnConfigFile::Entry * entry );
+    void remove_from_column_index( int column, ColumnIndex & index, ColumnConfigFile::Entry * entry );
+
+    /**
+     * Add 'entry' to all column indexes or remove it from all of them.
+     **/
+    void add_to_column_indexes( ColumnConfigFile::Entry * entry );
+    void remove_from_column_indexes( ColumnConfigFile::Entry * entry );
+
+    /**
+     * Return the entries of the index entries from 'begin' to 'end' in the
+     * order of the entries.
+     **/
+    template<class Iterator>
+    vector<ColumnConfigFile::Entry *> sorted_entries( Iterator begin, Iterator end ) const;
+
+    /**
+     * Return the entries whose column no. 'column' matches 'predicate'
+     * without any index.
+     **/
+    vector<ColumnConfigFile::Entry *> find_entries_if( int column,
+                                                       std::function<bool( string_ref )> predicate );
+
+    /**
+     * Move the columns of 'entry' to a new row in the column store.
+     **/
+    void store_columns( ColumnConfigFile::Entry * entry );
+
+    /**
+     * Remove the row of 'entry' from the column store. If 'keep_columns'
+     * is 'true', the entry gets its own copy of the columns first.
+     **/
+    void unstore_columns( ColumnConfigFile::Entry * entry, bool keep_columns = true );
+
+    /**
+     * Move the columns of the entries that are not in the column store yet
+     * to it. This parses them if needed.
+     **/
+    void store_new_entries();
+
+
+    /**
+     * Number of column items of each width in one column.
+     **/
+    struct ColumnWidthCounts
+    {
+        ColumnWidthCounts(): total( 0 ) {}
+
+        vector<int> count;      // index: width
+        int         total;
+    };
+
+    vector<int>                         column_widths;
+    vector<int>                         max_column_widths;
+    int                                 max_column_width;
+    bool                                pad_columns;
+
+    vector<ColumnWidthCounts>           width_counts;
+    bool                                width_counts_valid;
+    bool                                column_widths_valid;
+    vector<ColumnConfigFile::Entry *>   unpopulated; // may contain 0
+    bool                                populating;
+    bool                                populate_all;
+
+    std::unique_ptr<ColumnStore>        column_store;
+    vector<ColumnConfigFile::Entry *>   row_entries; // by row in column_store
+    bool                                unstored_entries;
+
+    ColumnIndexMap                      column_indexes;
 };
 
 #endif // ColumnConfigFile_h
@@ -0,0 +1,183 @@
+/**
+ * ColumnStore.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <string.h>
+
+#include "ColumnStore.h"
+
+
+// Don't bother compacting columns with less unused bytes than this
+
+#define MIN_GARBAGE     4096
+
+
+const uint32_t ColumnStore::NO_VALUE;
+
+
+ColumnStore::ColumnStore()
+{
+
+}
+
+
+ColumnStore::~ColumnStore()
+{
+
+}
+
+
+int ColumnStore::add_row()
+{
+    if ( ! free_rows.empty() )
+    {
+        int row = free_rows.back();
+        free_rows.pop_back();
+        row_columns[ row ] = 0;
+
+        return row;
+    }
+
+    for ( size_t i=0; i < columns.size(); ++i )
+    {
+        columns[i].offsets.push_back( 0 );
+        columns[i].sizes.push_back( NO_VALUE );
+    }
+
+    row_columns.push_back( 0 );
+
+    return row_columns.size() - 1;
+}
+
+
+void ColumnStore::remove_row( int row )
+{
+    if ( row < 0 || row >= (int) row_columns.size() || row_columns[ row ] < 0 )
+        return;
+
+    set_column_count( row, 0 );
+    row_columns[ row ] = -1;
+    free_rows.push_back( row );
+}
+
+
+void ColumnStore::clear()
+{
+    columns.clear();
+    row_columns.clear();
+    free_rows.clear();
+}
+
+
+void ColumnStore::set_column_count( int row, int count )
+{
+    int old_count = row_columns[ row ];
+
+    if ( count > (int) columns.size() )
+    {
+        size_t old_columns = columns.size();
+        columns.resize( count );
+
+        for ( size_t i = old_columns; i < columns.size(); ++i )
+        {
+            columns[i].offsets.resize( row_columns.size(), 0 );
+            columns[i].sizes.resize( row_columns.size(), NO_VALUE );
+        }
+    }
+
+    for ( int i = count; i < old_count; ++i )
+    {
+        columns[i].garbage += columns[i].sizes[ row ];
+        columns[i].offsets[ row ] = 0;
+        columns[i].sizes  [ row ] = NO_VALUE;
+    }
+
+    for ( int i = old_count; i < count; ++i )
+    {
+        columns[i].offsets[ row ] = 0;
+        columns[i].sizes  [ row ] = 0;
+    }
+
+    row_columns[ row ] = count;
+}
+
+
+void ColumnStore::set( int row, int column, string_ref value )
+{
+    Column & col      = columns[ column ];
+    uint32_t old_size = col.sizes[ row ];
+
+    if ( value.size() <= old_size )
+    {
+        // Overwrite the old value; 'value' might be in the same buffer
+
+        memmove( &col.bytes[ col.offsets[ row ] ], value.data(), value.size() );
+        col.garbage += old_size - value.size();
+    }
+    else
+    {
+        if ( value.data() >= col.bytes.data() &&
+             value.data() <  col.bytes.data() + col.bytes.size() )
+        {
+            // Appending might move the buffer that 'value' points into
+
+            string copy = value.to_string();
+            set( row, column, copy );
+            return;
+        }
+
+        col.garbage       += old_size;
+        col.offsets[ row ] = col.bytes.size();
+        col.bytes.append( value.data(), value.size() );
+    }
+
+    col.sizes[ row ] = value.size();
+
+    if ( col.garbage > MIN_GARBAGE && col.garbage > col.bytes.size() / 2 )
+        compact( column );
+}
+
+
+void ColumnStore::find( int column, string_ref value, vector<int> & rows_ret ) const
+{
+    if ( column < 0 || column >= (int) columns.size() )
+        return;
+
+    const Column &           col   = columns[ column ];
+    const vector<uint32_t> & sizes = col.sizes;
+    const char *             bytes = col.bytes.data();
+
+    for ( size_t row=0; row < sizes.size(); ++row )
+    {
+        if ( sizes[ row ] == value.size() &&
+             memcmp( bytes + col.offsets[ row ], value.data(), value.size() ) == 0 )
+        {
+            rows_ret.push_back( row );
+        }
+    }
+}
+
+
+void ColumnStore::compact( int column )
+{
+    Column & col = columns[ column ];
+    string   bytes;
+
+    bytes.reserve( col.bytes.size() - col.garbage );
+
+    for ( size_t row=0; row < col.sizes.size(); ++row )
+    {
+        if ( col.sizes[ row ] == NO_VALUE )
+            continue;
+
+        uint32_t offset = bytes.size();
+        bytes.append( col.bytes, col.offsets[ row ], col.sizes[ row ] );
+        col.offsets[ row ] = offset;
+    }
+
+    col.bytes.swap( bytes );
+    col.garbage = 0;
+}
@@ -0,0 +1,153 @@
+/**
+ * ColumnStore.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef ColumnStore_h
+#define ColumnStore_h
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+
+using std::string;
+using std::vector;
+
+
+/**
+ * Table of strings that is stored column by column: The values of each
+ * column of all rows are packed into one buffer with an offset and a size
+ * for each row, so scanning one column only touches that column's memory.
+ *
+ * Rows keep their number until they are removed; the numbers of removed
+ * rows are used again for new rows. Each row can have a different number
+ * of columns.
+ *
+ * Changing a value overwrites the old one if the new one fits; otherwise
+ * it is appended to the buffer. A column is compacted when more than half
+ * of its buffer is no longer used.
+ **/
+class ColumnStore: private boost::noncopyable
+{
+public:
+
+    typedef boost::string_ref string_ref;
+
+    /**
+     * Size of a column that a row does not have in get_sizes().
+     **/
+    static const uint32_t NO_VALUE = 0xFFFFFFFF;
+
+    /**
+     * Constructor.
+     **/
+    ColumnStore();
+
+    /**
+     * Destructor.
+     **/
+    virtual ~ColumnStore();
+
+    /**
+     * Add a row without any columns and return its number.
+     **/
+    int add_row();
+
+    /**
+     * Remove row no. 'row'. Its number may be used again for another row.
+     **/
+    void remove_row( int row );
+
+    /**
+     * Remove all rows.
+     **/
+    void clear();
+
+    /**
+     * Return the number of rows, including removed ones whose numbers were
+     * not used again yet.
+     **/
+    int get_row_count() const { return row_columns.size(); }
+
+    /**
+     * Return the number of columns of row no. 'row'.
+     **/
+    int get_column_count( int row ) const { return row_columns[ row ]; }
+
+    /**
+     * Return the number of columns of the row with the most columns.
+     **/
+    int get_max_column_count() const { return columns.size(); }
+
+    /**
+     * Set the number of columns of row no. 'row'. New columns are empty.
+     **/
+    void set_column_count( int row, int count );
+
+    /**
+     * Return column no. 'column' of row no. 'row'. This is only valid
+     * until any value of that column is changed.
+     **/
+    string_ref get( int row, int column ) const
+        {
+            const Column & col = columns[ column ];
+
+            return string_ref( col.bytes.data() + col.offsets[ row ], col.sizes[ row ] );
+        }
+
+    /**
+     * Set column no. 'column' of row no. 'row' to 'value'. The row
+     * already has to have that column.
+     **/
+    void set( int row, int column, string_ref value );
+
+    /**
+     * Return the sizes of column no. 'column' of all rows; NO_VALUE for
+     * rows that do not have that column.
+     **/
+    const vector<uint32_t> & get_sizes( int column ) const
+        { return columns[ column ].sizes; }
+
+    /**
+     * Add the numbers of the rows that have 'value' in column no. 'column'
+     * to 'rows_ret'.
+     **/
+    void find( int column, string_ref value, vector<int> & rows_ret ) const;
+
+
+protected:
+
+    /**
+     * The values of one column of all rows.
+     **/
+    struct Column
+    {
+        Column(): garbage( 0 ) {}
+
+        string           bytes;
+        vector<uint32_t> offsets;  // in 'bytes', by row
+        vector<uint32_t> sizes;    // by row
+        size_t           garbage;  // bytes no longer used
+    };
+
+    /**
+     * Remove the unused bytes from column no. 'column'.
+     **/
+    void compact( int column );
+
+
+    //
+    // Data members
+    //
+
+    vector<Column> columns;
+    vector<int>    row_columns;    // -1 for removed rows
+    vector<int>    free_rows;
+};
+
+
+#endif // ColumnStore_h
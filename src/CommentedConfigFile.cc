@@ -5,13 +5,14 @@
  * License: GPL V2 - see file LICENSE for details
  **/
 
-#include <fstream>
 #include <iostream>
+#include <istream>
+#include <ostream>
 #include <algorithm>
-#include <boost/algorithm/string.hpp>
 
 #include "CommentedConfigFile.h"
 #include "Diff.h"
+#include "ParseCache.h"
 
 #define WHITESPACE " \t"
 
@@ -19,9 +20,171 @@ using std::cout;
 using std::endl;
 
 
+void CommentedConfigFile::Entry::set_modified( bool new_modified )
+{
+    modified = new_modified;
+
+    if ( modified )
+    {
+        clear_format_cache();
+
+        if ( parent )
+            parent->entry_modified( this );
+    }
+}
+
+
+const string_vec CommentedConfigFile::Entry::no_comments;
+const string     CommentedConfigFile::Entry::no_string;
+
+
+string CommentedConfigFile::Entry::get_orig_line() const
+{
+    if ( rare && ! rare->orig_line.empty() )
+        return rare->orig_line;
+
+    if ( get_line_comment().empty() )
+        return content;
+    else
+        return content + " " + get_line_comment();
+}
+
+
+size_t CommentedConfigFile::Entry::get_orig_line_size() const
+{
+    if ( rare && ! rare->orig_line.empty() )
+        return rare->orig_line.size();
+
+    if ( get_line_comment().empty() )
+        return content.size();
+    else
+        return content.size() + 1 + get_line_comment().size();
+}
+
+
+void CommentedConfigFile::Entry::append_orig_line( string & text ) const
+{
+    if ( rare && ! rare->orig_line.empty() )
+    {
+        text += rare->orig_line;
+        return;
+    }
+
+    text += content;
+
+    if ( ! get_line_comment().empty() )
+    {
+        text += ' ';
+        text += get_line_comment();
+    }
+}
+
+
+void CommentedConfigFile::Entry::set_orig_line( const string & line )
+{
+    // Store the line only if it cannot be reconstructed from the content
+    // and the line comment; this is the normal case, and it saves keeping
+    // a second copy of every line.
+
+    if ( rare )
+        rare->orig_line.clear();
+
+    if ( line != get_orig_line() )
+        get_rare_data().orig_line = line;
+}
+
+
+
+const string_vec & CommentedConfigFile::Snapshot::get_header_comments() const
+{
+    static const string_vec empty;
+
+    return header ? *header : empty;
+}
+
+
+const string_vec & CommentedConfigFile::Snapshot::get_footer_comments() const
+{
+    static const string_vec empty;
+
+    return footer ? *footer : empty;
+}
+
+
+const CommentedConfigFile::EntryImage *
+CommentedConfigFile::Snapshot::find_entry( const string & key ) const
+{
+    if ( keys )
+    {
+        KeyMap::const_iterator it = keys->find( key );
+
+        return it == keys->end() ? 0 : &get_entry( it->second );
+    }
+
+    for ( int i=0; i < get_entry_count(); ++i )
+    {
+        if ( get_entry( i ).key == key )
+            return &get_entry( i );
+    }
+
+    return 0;
+}
+
+
+string_vec CommentedConfigFile::Snapshot::format_lines() const
+{
+    string_vec lines = get_header_comments();
+
+    for ( int i=0; i < get_entry_count(); ++i )
+    {
+        const EntryImage & entry = get_entry( i );
+
+        if ( entry.valid )
+        {
+            lines.insert( lines.end(),
+                          entry.comment_before.begin(),
+                          entry.comment_before.end() );
+            lines.push_back( entry.line );
+        }
+    }
+
+    const string_vec & footer_comments = get_footer_comments();
+    lines.insert( lines.end(), footer_comments.begin(), footer_comments.end() );
+
+    return lines;
+}
+
+
+string_vec CommentedConfigFile::Snapshot::diff( const Snapshot & old_snapshot,
+                                                const Snapshot & new_snapshot )
+{
+    if ( old_snapshot.is_same_as( new_snapshot ) )
+        return string_vec();
+
+    return Diff::diff( old_snapshot.format_lines(), new_snapshot.format_lines() );
+}
+
+
+
+
 CommentedConfigFile::CommentedConfigFile():
     comment_marker( "#" ),
-    diff_enabled( false )
+    diff_enabled( false ),
+    verbatim_unchanged( false ),
+    format_cache( false ),
+    formatting_text( false ),
+    orig_lines_formatted( false ),
+    atomic_write( false ),
+    fsync_policy( FSYNC_FILE ),
+    skip_identical( false ),
+    write_skipped( false ),
+    modified( false ),
+    lazy_parse( false ),
+    parse_cache( 0 ),
+    disk_hash( 0 ),
+    disk_hash_valid( false ),
+    orig_on_disk( false ),
+    key_index_enabled( false )
 {
 }
 
@@ -36,20 +199,24 @@ CommentedConfigFile::Entry * CommentedConfigFile::get_entry( int index ) const
 {
     if ( index < 0 || index >= (int) entries.size() )
         return 0;
-    else
-        return entries[ index ];
+
+    ensure_parsed( entries[ index ] );
+
+    return entries[ index ];
 }
 
 
 int CommentedConfigFile::get_index_of( const Entry * wanted_entry ) const
 {
-    for ( size_t i=0; i < entries.size(); ++i )
-    {
-	if ( entries[i] == wanted_entry )
-	    return i;
-    }
+    if ( ! wanted_entry || wanted_entry->parent != this )
+        return -1;
+
+    int index = wanted_entry->index;
 
-    return -1;
+    if ( index < 0 || index >= (int) entries.size() || entries[ index ] != wanted_entry )
+        return -1;
+
+    return index;
 }
 
 
@@ -59,8 +226,12 @@ CommentedConfigFile::Entry * CommentedConfigFile::take( int index )
         return 0;
 
     Entry * entry = entries[ index ];
+    entry_removed( entry );
     entries.erase( entries.begin() + index );
+    renumber_entries( index );
     entry->set_parent( 0 );
+    entry->index = -1;
+    set_modified();
 
     return entry;
 }
@@ -91,6 +262,9 @@ void CommentedConfigFile::insert( int before, Entry * entry )
 {
     entries.insert( entries.begin() + before, entry );
     entry->set_parent( this );
+    renumber_entries( before );
+    entry_added( entry );
+    set_modified();
 }
 
 
@@ -98,243 +272,1504 @@ void CommentedConfigFile::append( Entry * entry )
 {
     entries.push_back( entry );
     entry->set_parent( this );
+    entry->index = entries.size() - 1;
+    entry_added( entry );
+    set_modified();
 }
 
 
-bool CommentedConfigFile::read( const string & filename )
+int CommentedConfigFile::remove_if( EntryPredicate predicate )
 {
-    this->filename = filename;
+    size_t dest = 0;
 
-    if ( filename.empty() )
-        return false;
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        Entry * entry = entries[i];
+        ensure_parsed( entry );
 
-    string     line;
-    string_vec lines;
-    std::ifstream file( filename );
+        if ( predicate( entry ) )
+        {
+            entry_removed( entry );
+            delete entry;
+        }
+        else
+        {
+            entries[ dest ] = entry;
+            entry->index = dest++;
+        }
+    }
 
-    while ( std::getline( file, line ) )
-        lines.push_back( line );
+    int removed = entries.size() - dest;
 
-    bool success = parse( lines );
+    if ( removed > 0 )
+    {
+        entries.resize( dest );
+        set_modified();
+    }
 
-    return success;
+    return removed;
 }
 
 
-bool CommentedConfigFile::write( const string & new_filename )
+void CommentedConfigFile::insert( int before, const vector<Entry *> & new_entries )
 {
-    string name = new_filename;
-
-    if ( new_filename.empty() )
-        name = this->filename;
-    else
-        this->filename = name;
-
-    if ( name.empty() ) // Support for mocking:
-        return true;    // Pretend everything worked just fine.
-
-    std::ofstream file( name, std::ofstream::out | std::ofstream::trunc );
-
-    if ( ! file.is_open() )
-        return false;
+    if ( new_entries.empty() )
+        return;
 
-    string_vec lines = format_lines();
+    entries.insert( entries.begin() + before,
+                    new_entries.begin(),
+                    new_entries.end() );
+    renumber_entries( before );
 
-    for ( size_t i=0; i < lines.size(); ++i )
-        file << lines[i] << "\n"; // no endl: Don't flush after every line
+    for ( size_t i=0; i < new_entries.size(); ++i )
+    {
+        new_entries[i]->set_parent( this );
+        entry_added( new_entries[i] );
+    }
 
-    return true;
+    set_modified();
 }
 
 
-bool CommentedConfigFile::parse( const string_vec & lines )
+bool CommentedConfigFile::reorder( const vector<int> & permutation )
 {
-    clear_all();
+    if ( permutation.size() != entries.size() )
+        return false;
 
-    int header_end    = find_header_comment_end( lines );
-    int footer_start  = find_footer_comment_start( lines, header_end + 1 );
-    int content_start = 0;
-    int content_end   = lines.size() - 1;
+    vector<Entry *> new_entries( entries.size(), (Entry *) 0 );
 
-    if ( header_end > -1 )
+    for ( size_t i=0; i < permutation.size(); ++i )
     {
-        for ( int i=0; i <= header_end; ++i )
-            header_comments.push_back( lines[i] );
+        int old_index = permutation[i];
 
-        content_start = header_end + 1;
-    }
+        if ( old_index < 0 || old_index >= (int) entries.size() ||
+             ! entries[ old_index ] )
+        {
+            // Out of range or used twice: Undo what we did so far
 
-    if ( footer_start > -1 )
-    {
-        for ( size_t i = footer_start; i < lines.size(); ++i )
-            footer_comments.push_back( lines[i] );
+            for ( size_t j=0; j < i; ++j )
+                entries[ permutation[j] ] = new_entries[j];
 
-        content_end = footer_start - 1;
-    }
+            return false;
+        }
 
-    bool success = parse_entries( lines, content_start, content_end );
+        new_entries[i] = entries[ old_index ];
+        entries[ old_index ] = 0;
+    }
 
-    if ( diff_enabled )
-        save_orig();
+    entries.swap( new_entries );
+    renumber_entries( 0 );
+    set_modified();
 
-    return success;
+    return true;
 }
 
 
-bool CommentedConfigFile::parse_entries( const string_vec & lines,
-                                         int from,
-                                         int end )
+void CommentedConfigFile::splice( int                   before,
+                                  CommentedConfigFile & other,
+                                  int                   from,
+                                  int                   count )
 {
-    string_vec comment_before;
-    bool success = true;
+    int end = count < 0 ? other.entries.size() :
+        std::min( from + count, (int) other.entries.size() );
 
-    for ( int i = from; i <= end; ++i )
-    {
-        const string & line = lines[i];
+    if ( from < 0 || from >= end )
+        return;
 
-        if ( is_empty_line( line ) || is_comment_line( line ) )
-            comment_before.push_back( line );
-        else // found a content line
-        {
-            CommentedConfigFile::Entry * entry = create_entry();
+    if ( &other == this )
+    {
+        // Moving entries within the same file is just a reordering
 
-            if ( ! entry )
-                throw std::runtime_error( "CommentedConfigFile::create_entry() returned NULL" );
+        if ( before >= from && before <= end ) // Nothing to move
+            return;
 
-            entry->set_comment_before( comment_before );
-            comment_before.clear();
-            string content;
-            string line_comment;
-            split_off_comment( line, content, line_comment );
-            entry->set_line_comment( line_comment );
-            bool ok = entry->parse( content, i+1 );
+        vector<int> permutation;
+        permutation.reserve( entries.size() );
 
-            if ( ok )
-                append( entry );
-            else
+        for ( int i=0; i <= (int) entries.size(); ++i )
+        {
+            if ( i == before )
             {
-                success = false;
-                delete entry;
+                for ( int j = from; j < end; ++j )
+                    permutation.push_back( j );
             }
+
+            if ( i < (int) entries.size() && ( i < from || i >= end ) )
+                permutation.push_back( i );
         }
+
+        reorder( permutation );
+        return;
     }
 
-    return success;
+    vector<Entry *>::iterator first = other.entries.begin() + from;
+    vector<Entry *>::iterator last  = other.entries.begin() + end;
+
+    for ( vector<Entry *>::iterator it = first; it != last; ++it )
+        other.entry_removed( *it );
+
+    vector<Entry *> moved( first, last );
+    other.entries.erase( first, last );
+    other.renumber_entries( from );
+    other.set_modified();
+
+    insert( before, moved );
 }
 
 
-int CommentedConfigFile::find_header_comment_end( const string_vec & lines )
+void CommentedConfigFile::set_modified( bool new_modified )
 {
-    int header_end      = -1;
-    int last_empty_line = -1;
+    modified = new_modified;
 
-    for ( int i=0; i < (int) lines.size(); ++i )
-    {
-        const string & line = lines[i];
+    if ( modified )
+        last_snapshot.entries.reset();
+}
 
-        if ( is_empty_line( line ) )
-            last_empty_line = i;
-        else if ( is_comment_line( line ) )
-            header_end = i;
-        else // found the first content line
-            break;
-    }
 
-    if ( last_empty_line > 0 )
-    {
-        header_end = last_empty_line;
+void CommentedConfigFile::renumber_entries( int from )
+{
+    for ( size_t i = std::max( from, 0 ); i < entries.size(); ++i )
+        entries[i]->index = i;
+}
 
-        // This covers two cases:
-        //
-        // - If there were empty lines and no more comment lines before the
-        //   first content line, the empty lines belong to the header comment.
-        //
-        // - If there were empty lines and then some more comment lines before
-        //   the first content line, the comments after the last empty line no
-        //   longer belong to the header comment, but to the first content
-        //   entry. So let's go back to that last empty line.
-    }
 
-    return header_end;
+void CommentedConfigFile::entry_added( Entry * entry )
+{
+    if ( key_index_enabled )
+        add_to_key_index( entry );
 }
 
 
-int CommentedConfigFile::find_footer_comment_start( const string_vec & lines,
-                                                    int from )
+void CommentedConfigFile::entry_removed( Entry * entry )
 {
-    int footer_start = -1;
+    if ( key_index_enabled )
+        remove_from_key_index( entry );
+}
 
-    for ( int i = lines.size()-1; i >= from; --i )
+
+void CommentedConfigFile::entry_modified( Entry * entry )
+{
+    set_modified();
+
+    if ( key_index_enabled )
     {
-        const string & line = lines[i];
+        // The key might have changed
 
-        if ( is_empty_line( line ) || is_comment_line( line ) )
-            footer_start = i;
-        else // found the last content line
-            break;
+        remove_from_key_index( entry );
+        add_to_key_index( entry );
     }
+}
 
-    return footer_start;
+
+void CommentedConfigFile::entries_cleared()
+{
+    key_index.clear();
 }
 
 
-string_vec CommentedConfigFile::format_lines()
+void CommentedConfigFile::add_to_key_index( Entry * entry )
 {
-    string_vec lines = header_comments;
+    ensure_parsed( entry );
+    string key = get_entry_key( entry );
 
-    for ( size_t i=0; i < entries.size(); ++i )
+    if ( ! key.empty() )
     {
-        Entry * entry = entries[i];
+        entry->get_rare_data().index_key = key;
+        key_index.insert( std::make_pair( key, entry ) );
+    }
+}
 
-        if ( entry->validate() )
-        {
-            for ( size_t j=0; j < entry->get_comment_before().size(); ++j )
-                lines.push_back( entry->get_comment_before()[j] );
 
-            string line = entry->format();
+void CommentedConfigFile::remove_from_key_index( Entry * entry )
+{
+    if ( entry->get_index_key().empty() )
+        return;
 
-            if ( ! entry->get_line_comment().empty() )
-                line += " " + entry->get_line_comment();
+    KeyIndexRange range = key_index.equal_range( entry->get_index_key() );
 
-            lines.push_back( line );
+    for ( KeyIndex::iterator it = range.first; it != range.second; ++it )
+    {
+        if ( it->second == entry )
+        {
+            key_index.erase( it );
+            break;
         }
     }
 
-    for ( size_t i=0; i < footer_comments.size(); ++i )
-        lines.push_back( footer_comments[i] );
-
-    return lines;
+    entry->rare->index_key.clear();
 }
 
 
-void CommentedConfigFile::clear_entries()
+void CommentedConfigFile::set_key_index_enabled( bool enabled )
 {
-    for ( size_t i=0; i < entries.size(); ++i )
-	delete entries[i];
-
-    entries.clear();
+    key_index_enabled = enabled;
+    rebuild_key_index();
 }
 
 
-void CommentedConfigFile::clear_all()
+void CommentedConfigFile::rebuild_key_index()
 {
-    clear_entries();
-    header_comments.clear();
-    footer_comments.clear();
+    key_index.clear();
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        if ( entries[i]->rare )
+            entries[i]->rare->index_key.clear();
+
+        if ( key_index_enabled )
+            add_to_key_index( entries[i] );
+    }
 }
 
 
-bool CommentedConfigFile::is_comment_line( const string & line )
+CommentedConfigFile::Entry *
+CommentedConfigFile::find_entry( const string & key ) const
 {
-    size_t pos = line.find_first_not_of( WHITESPACE );
+    Entry * result = 0;
 
-    if ( pos == string::npos ) // No non-whitespace character in line
-        return false;
+    if ( key_index_enabled )
+    {
+        KeyIndexConstRange range = key_index.equal_range( key );
+
+        for ( KeyIndex::const_iterator it = range.first; it != range.second; ++it )
+        {
+            if ( ! result || it->second->index < result->index )
+                result = it->second;
+        }
+    }
+    else
+    {
+        for ( size_t i=0; i < entries.size() && ! result; ++i )
+        {
+            ensure_parsed( entries[i] );
+
+            if ( get_entry_key( entries[i] ) == key )
+                result = entries[i];
+        }
+    }
+
+    return result;
+}
+
+
+vector<CommentedConfigFile::Entry *>
+CommentedConfigFile::find_entries( const string & key ) const
+{
+    vector<Entry *> result;
+
+    if ( key_index_enabled )
+    {
+        KeyIndexConstRange range = key_index.equal_range( key );
+
+        for ( KeyIndex::const_iterator it = range.first; it != range.second; ++it )
+            result.push_back( it->second );
+
+        std::sort( result.begin(), result.end(),
+                   []( Entry * a, Entry * b ) { return a->index < b->index; } );
+    }
+    else
+    {
+        for ( size_t i=0; i < entries.size(); ++i )
+        {
+            ensure_parsed( entries[i] );
+
+            if ( get_entry_key( entries[i] ) == key )
+                result.push_back( entries[i] );
+        }
+    }
+
+    return result;
+}
+
+
+bool CommentedConfigFile::read( const string & filename )
+{
+    this->filename = filename;
+
+    if ( filename.empty() )
+        return false;
+
+    if ( parse_cache && parse_cache->load( this, filename ) )
+        return true;
+
+    string   content;
+    FileStat stat;
+
+    if ( ! FileIO::read_file( filename, content, &stat ) )
+    {
+        content.clear();
+        stat = FileStat();
+    }
+
+    bool success = parse_file_content( filename, content, stat );
+
+    if ( success && parse_cache && stat.valid )
+        parse_cache->store( this );
+
+    return success;
+}
+
+
+bool CommentedConfigFile::parse_file_content( const string &   filename,
+                                              const string &   content,
+                                              const FileStat & stat )
+{
+    this->filename = filename;
+
+    string_vec lines;
+    FileIO::split_lines( content, lines );
+
+    bool success = parse( lines );
+
+    disk_stat       = stat;
+    orig_on_disk    = stat.valid;
+    set_disk_hash( content, stat.valid );
+
+    return success;
+}
+
+
+CommentedConfigFile::ReloadSummary
+CommentedConfigFile::reload( const string & new_filename )
+{
+    ReloadSummary summary;
+
+    if ( ! new_filename.empty() )
+        filename = new_filename;
+
+    string     content;
+    string_vec lines;
+    FileStat   stat;
+
+    if ( filename.empty() || ! FileIO::read_file( filename, content, &stat ) )
+    {
+        summary.success = false;
+        return summary;
+    }
+
+    if ( orig_on_disk && ! modified && stat == disk_stat )
+    {
+        // Nothing changed on disk, nothing changed in memory
+
+        summary.unchanged = entries.size();
+        return summary;
+    }
+
+    FileIO::split_lines( content, lines );
+
+    int header_end    = find_header_comment_end( lines );
+    int footer_start  = find_footer_comment_start( lines, header_end + 1 );
+    int content_start = header_end + 1;
+    int content_end   = footer_start > -1 ? footer_start - 1 : lines.size() - 1;
+
+    string_vec new_header( lines.begin(), lines.begin() + content_start );
+    string_vec new_footer( lines.begin() + content_end + 1, lines.end() );
+
+    summary.header_changed = ( new_header != header_comments );
+    summary.footer_changed = ( new_footer != footer_comments );
+    header_comments.swap( new_header );
+    footer_comments.swap( new_footer );
+
+
+    // Map the lines on disk of all unmodified entries to the entries.
+    // Modified entries cannot be reused: They no longer match what is on
+    // disk. Those lists are in reverse order so the first entry with a
+    // line is reused first.
+
+    std::unordered_map<string, vector<Entry *> > reusable;
+
+    if ( orig_lines_formatted )
+        prepare_formatting();
+
+    for ( int i = entries.size() - 1; i >= 0; --i )
+    {
+        if ( ! entries[i]->is_modified() )
+            reusable[ get_disk_line( entries[i] ) ].push_back( entries[i] );
+    }
+
+    vector<Entry *> new_entries;
+    vector<Entry *> kept;
+    string_vec      comment_before;
+
+    new_entries.reserve( entries.size() );
+
+    for ( int i = content_start; i <= content_end; ++i )
+    {
+        const string & line = lines[i];
+
+        if ( classify_line( line ) != CONTENT_LINE )
+        {
+            comment_before.push_back( line );
+            continue;
+        }
+
+        Entry * entry = 0;
+        std::unordered_map<string, vector<Entry *> >::iterator it =
+            reusable.find( line );
+
+        if ( it != reusable.end() && ! it->second.empty() )
+        {
+            entry = it->second.back();
+            it->second.pop_back();
+            kept.push_back( entry );
+
+            if ( orig_lines_formatted )
+                entry->set_orig_line( line );
+
+            if ( entry->get_comment_before() != comment_before )
+            {
+                entry->set_comment_before( comment_before );
+                entry->set_modified( false );
+                summary.comments_changed.push_back( entry );
+            }
+            else
+            {
+                ++summary.unchanged;
+            }
+        }
+        else
+        {
+            entry = create_parsed_entry( line, comment_before, i+1 );
+
+            if ( entry )
+                summary.added.push_back( entry );
+            else
+                summary.success = false;
+        }
+
+        comment_before.clear();
+
+        if ( entry )
+            new_entries.push_back( entry );
+    }
+
+
+    // Everything that was not reused is gone
+
+    for ( size_t i=0; i < kept.size(); ++i )
+        kept[i]->index = -1; // Mark as kept
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        Entry * entry = entries[i];
+
+        if ( entry->index != -1 )
+        {
+            summary.removed_lines.push_back( get_disk_line( entry ) );
+            entry_removed( entry );
+            delete entry;
+        }
+    }
+
+    entries.swap( new_entries );
+    renumber_entries( 0 );
+    last_snapshot        = Snapshot();
+    orig_lines_formatted = false;
+
+    for ( size_t i=0; i < summary.added.size(); ++i )
+    {
+        summary.added[i]->set_parent( this );
+        entry_added( summary.added[i] );
+    }
+
+    modified        = false;
+    disk_stat       = stat;
+    orig_on_disk    = true;
+    set_disk_hash( content, true );
+
+    if ( diff_enabled )
+        save_orig();
+
+    return summary;
+}
+
+
+bool CommentedConfigFile::write( const string & new_filename )
+{
+    string name     = new_filename;
+    string old_name = this->filename;
+
+    write_skipped = false;
+
+    if ( new_filename.empty() )
+        name = this->filename;
+    else
+        this->filename = name;
+
+    if ( name.empty() ) // Support for mocking:
+        return true;    // Pretend everything worked just fine.
+
+    if ( verbatim_unchanged && ! modified && orig_on_disk )
+    {
+        FileStat current;
+
+        if ( FileIO::stat( old_name, current ) && current == disk_stat )
+        {
+            // Nothing was changed since the file was read, and the file
+            // was not changed on disk either: No need to format anything.
+
+            FileStat target;
+
+            if ( FileIO::stat( name, target ) && target == disk_stat )
+            {
+                // Same file: It is already up to date.
+
+                write_skipped = true;
+                return true;
+            }
+
+            if ( ! FileIO::copy_file( old_name, name ) )
+            {
+                invalidate_disk_state();
+                return false;
+            }
+
+            FileIO::stat( name, disk_stat );
+
+            return true;
+        }
+    }
+
+    string   text;
+    uint64_t hash    = 0;
+    bool     success = true;
+
+    // Keep the offsets of the lines in 'text' for commit_entries()
+
+    formatting_text = true;
+    format_text( text );
+
+    if ( skip_identical )
+    {
+        hash = FileIO::hash( text );
+        write_skipped = is_identical_on_disk( name, text, hash );
+    }
+
+    if ( ! write_skipped )
+    {
+        if ( atomic_write )
+            success = FileIO::write_content_atomic( name, text, fsync_policy );
+        else
+            success = FileIO::write_content( name, text );
+    }
+
+    if ( success )
+    {
+        // What was just written is now what is on disk, so reload() can
+        // keep the entries
+
+        commit_entries( text );
+
+        FileIO::stat( name, disk_stat );
+        disk_hash       = hash;
+        disk_hash_valid = skip_identical && disk_stat.valid;
+        orig_on_disk    = disk_stat.valid;
+    }
+    else
+    {
+        invalidate_disk_state();
+    }
+
+    release_formatted_lines();
+
+    return success;
+}
+
+
+bool CommentedConfigFile::is_identical_on_disk( const string & name,
+                                                const string & text,
+                                                uint64_t       hash )
+{
+    FileStat target;
+
+    if ( ! FileIO::stat( name, target ) )
+        return false;
+
+    if ( target.size != (long long) text.size() )
+        return false;
+
+    if ( disk_hash_valid && target == disk_stat )
+    {
+        // We know the content of this file from when it was last read or
+        // written; no need to read it again.
+
+        return hash == disk_hash;
+    }
+
+    string content;
+
+    if ( ! FileIO::read_file( name, content ) )
+        return false;
+
+    // Comparing the hashes first is cheap since we have the hash of 'text'
+    // anyway; comparing the real content rules out a hash collision.
+
+    return FileIO::hash( content ) == hash && content == text;
+}
+
+
+void CommentedConfigFile::set_disk_hash( const string & content, bool valid )
+{
+    // Hashing all content is only worth it if anybody is going to use it
+
+    disk_hash_valid = valid && ( skip_identical || parse_cache );
+    disk_hash       = disk_hash_valid ? FileIO::hash( content ) : 0;
+}
+
+
+void CommentedConfigFile::invalidate_disk_state()
+{
+    disk_stat       = FileStat();
+    disk_hash_valid = false;
+    orig_on_disk    = false;
+}
+
+
+bool CommentedConfigFile::parse( const string_vec & lines )
+{
+    clear_all();
+
+    int header_end    = find_header_comment_end( lines );
+    int footer_start  = find_footer_comment_start( lines, header_end + 1 );
+    int content_start = 0;
+    int content_end   = lines.size() - 1;
+
+    if ( header_end > -1 )
+    {
+        for ( int i=0; i <= header_end; ++i )
+            header_comments.push_back( lines[i] );
+
+        content_start = header_end + 1;
+    }
+
+    if ( footer_start > -1 )
+    {
+        for ( size_t i = footer_start; i < lines.size(); ++i )
+            footer_comments.push_back( lines[i] );
+
+        content_end = footer_start - 1;
+    }
+
+    bool success = parse_entries( lines, content_start, content_end );
+    modified             = false;
+    orig_lines_formatted = false;
+    invalidate_disk_state();
+
+    if ( diff_enabled )
+        save_orig();
+
+    return success;
+}
+
+
+bool CommentedConfigFile::parse_entries( const string_vec & lines,
+                                         int from,
+                                         int end )
+{
+    string_vec comment_before;
+    bool success = true;
+
+    for ( int i = from; i <= end; ++i )
+    {
+        const string & line = lines[i];
+
+        if ( classify_line( line ) != CONTENT_LINE )
+            comment_before.push_back( line );
+        else // found a content line
+        {
+            Entry * entry = create_parsed_entry( line, comment_before, i+1 );
+            comment_before.clear();
+
+            if ( entry )
+                append( entry );
+            else
+                success = false;
+        }
+    }
+
+    return success;
+}
+
+
+CommentedConfigFile::Entry *
+CommentedConfigFile::create_parsed_entry( const string &     line,
+                                          const string_vec & comment_before,
+                                          int                line_no )
+{
+    Entry * entry = create_entry();
+
+    if ( ! entry )
+        throw std::runtime_error( "CommentedConfigFile::create_entry() returned NULL" );
+
+    entry->set_comment_before( comment_before );
+    string content;
+    string line_comment;
+    split_off_comment( line, content, line_comment );
+    entry->set_line_comment( line_comment );
+    entry->line_no = line_no;
+
+    if ( lazy_parse )
+    {
+        // Keep the raw content until somebody accesses this entry
+
+        entry->content      = content;
+        entry->parsed       = false;
+        entry->parse_failed = false;
+    }
+    else if ( ! entry->parse( content, line_no ) )
+    {
+        delete entry;
+        return 0;
+    }
+
+    entry->set_orig_line( line );
+    entry->set_modified( false );
+
+    return entry;
+}
+
+
+bool CommentedConfigFile::stream( std::istream & in,
+                                  std::ostream & out,
+                                  StreamFilter   filter )
+{
+    string_vec comment_block; // not yet known if header, entry or footer
+    string     line;
+    bool       in_header = true;
+    bool       success   = true;
+    int        line_no   = 0;
+
+    while ( std::getline( in, line ) )
+    {
+        ++line_no;
+
+        if ( classify_line( line ) != CONTENT_LINE )
+        {
+            comment_block.push_back( line );
+            continue;
+        }
+
+        if ( in_header )
+        {
+            // First content line: Now we know where the header ends
+
+            comment_block.push_back( line );
+            int header_end = find_header_comment_end( comment_block );
+            comment_block.pop_back();
+
+            for ( int i=0; i <= header_end; ++i )
+                out << comment_block[i] << '\n';
+
+            comment_block.erase( comment_block.begin(),
+                                 comment_block.begin() + header_end + 1 );
+            in_header = false;
+        }
+
+        Entry * entry = create_parsed_entry( line, comment_block, line_no );
+        comment_block.clear();
+
+        if ( entry && ! ensure_parsed( entry ) )
+        {
+            delete entry;
+            entry = 0;
+        }
+
+        if ( ! entry )
+        {
+            success = false;
+            continue;
+        }
+
+        vector<Entry *> insert_before;
+        bool keep = filter ? filter( entry, insert_before ) : true;
+
+        for ( size_t i=0; i < insert_before.size(); ++i )
+        {
+            stream_entry( out, insert_before[i] );
+            delete insert_before[i];
+        }
+
+        if ( keep )
+            stream_entry( out, entry );
+
+        delete entry;
+    }
+
+    // Whatever is left is the footer (or the header if there was no
+    // content line at all); either way it is written unchanged.
+
+    for ( size_t i=0; i < comment_block.size(); ++i )
+        out << comment_block[i] << '\n';
+
+    out.flush();
+
+    return success && ! out.fail();
+}
+
+
+void CommentedConfigFile::stream_entry( std::ostream & out, Entry * entry )
+{
+    string line;
+
+    if ( ! format_entry( entry, line ) )
+        return;
+
+    const string_vec & comment_before = entry->get_comment_before();
+
+    for ( size_t i=0; i < comment_before.size(); ++i )
+        out << comment_before[i] << '\n';
+
+    out << line << '\n';
+}
+
+
+bool CommentedConfigFile::parse_lazy_entry( Entry * entry ) const
+{
+    // Parse this just like parse_entries() would have done it, with the
+    // entry not yet in any file: Parsing is not a modification.
+
+    string orig_line = entry->get_orig_line();
+    string content;
+    content.swap( entry->content );
+
+    CommentedConfigFile * parent = entry->parent;
+    bool modified = entry->modified;
+
+    entry->parent       = 0;
+    entry->parsed       = true;
+    entry->parse_failed = ! entry->parse( content, entry->line_no );
+    entry->parent       = parent;
+
+    entry->set_orig_line( orig_line );
+    entry->clear_format_cache();
+    entry->modified = modified;
+
+    return ! entry->parse_failed;
+}
+
+
+bool CommentedConfigFile::parse_all()
+{
+    bool success = true;
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        if ( ! ensure_parsed( entries[i] ) )
+            success = false;
+    }
+
+    if ( ! success )
+    {
+        // Remove the failed entries as if they never had been there
+
+        bool was_modified = modified;
+
+        remove_if( []( Entry * entry ) { return entry->get_parse_failed(); } );
+        modified = was_modified;
+    }
+
+    return success;
+}
+
+
+int CommentedConfigFile::find_header_comment_end( const string_vec & lines )
+{
+    int header_end      = -1;
+    int last_empty_line = -1;
+
+    for ( int i=0; i < (int) lines.size(); ++i )
+    {
+        LineType type = classify_line( lines[i] );
+
+        if ( type == EMPTY_LINE )
+            last_empty_line = i;
+        else if ( type == COMMENT_LINE )
+            header_end = i;
+        else // found the first content line
+            break;
+    }
+
+    if ( last_empty_line > 0 )
+    {
+        header_end = last_empty_line;
+
+        // This covers two cases:
+        //
+        // - If there were empty lines and no more comment lines before the
+        //   first content line, the empty lines belong to the header comment.
+        //
+        // - If there were empty lines and then some more comment lines before
+        //   the first content line, the comments after the last empty line no
+        //   longer belong to the header comment, but to the first content
+        //   entry. So let's go back to that last empty line.
+    }
+
+    return header_end;
+}
+
+
+int CommentedConfigFile::find_footer_comment_start( const string_vec & lines,
+                                                    int from )
+{
+    int footer_start = -1;
+
+    for ( int i = lines.size()-1; i >= from; --i )
+    {
+        const string & line = lines[i];
+
+        if ( classify_line( line ) != CONTENT_LINE )
+            footer_start = i;
+        else // found the last content line
+            break;
+    }
+
+    return footer_start;
+}
+
+
+string_vec CommentedConfigFile::format_lines()
+{
+    prepare_formatting();
+
+    string_vec lines = header_comments;
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        Entry * entry = entries[i];
+        string  line;
+
+        if ( format_entry( entry, line ) )
+        {
+            for ( size_t j=0; j < entry->get_comment_before().size(); ++j )
+                lines.push_back( entry->get_comment_before()[j] );
+
+            lines.push_back( line );
+        }
+    }
+
+    for ( size_t i=0; i < footer_comments.size(); ++i )
+        lines.push_back( footer_comments[i] );
+
+    return lines;
+}
+
+
+void CommentedConfigFile::format_text( string & text_ret )
+{
+    prepare_formatting();
+
+    // Without the format cache, the lines formatted in the first pass are
+    // still cached until the end of the second pass. For write(), the
+    // start of the line of each entry is kept until it is committed.
+
+    bool keep_lines = formatting_text;
+    formatting_text = true;
+
+    if ( keep_lines )
+        line_starts.assign( entries.size(), string::npos );
+
+    // First pass: Find out which entries are written and how long all
+    // lines are
+
+    vector<size_t> line_sizes( entries.size() );
+    size_t size = 0;
+
+    for ( size_t i=0; i < header_comments.size(); ++i )
+        size += header_comments[i].size() + 1;
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        line_sizes[i] = get_entry_line_size( entries[i] );
+
+        if ( line_sizes[i] == string::npos )
+            continue;
+
+        const string_vec & comment_before = entries[i]->get_comment_before();
+
+        for ( size_t j=0; j < comment_before.size(); ++j )
+            size += comment_before[j].size() + 1;
+
+        size += line_sizes[i] + 1;
+    }
+
+    for ( size_t i=0; i < footer_comments.size(); ++i )
+        size += footer_comments[i].size() + 1;
+
+
+    // Second pass: Write everything into one buffer of exactly that size
+
+    text_ret.clear();
+    text_ret.reserve( size );
+
+    for ( size_t i=0; i < header_comments.size(); ++i )
+    {
+        text_ret += header_comments[i];
+        text_ret += '\n';
+    }
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        if ( line_sizes[i] == string::npos )
+            continue;
+
+        const string_vec & comment_before = entries[i]->get_comment_before();
+
+        for ( size_t j=0; j < comment_before.size(); ++j )
+        {
+            text_ret += comment_before[j];
+            text_ret += '\n';
+        }
+
+        if ( keep_lines )
+            line_starts[i] = text_ret.size();
+
+        append_entry_line( entries[i], text_ret );
+        text_ret += '\n';
+    }
+
+    for ( size_t i=0; i < footer_comments.size(); ++i )
+    {
+        text_ret += footer_comments[i];
+        text_ret += '\n';
+    }
+
+    if ( ! keep_lines )
+        release_formatted_lines();
+}
+
+
+void CommentedConfigFile::release_formatted_lines()
+{
+    formatting_text = false;
+    vector<size_t>().swap( line_starts );
+
+    if ( format_cache )
+        return;
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        if ( entries[i]->format_cached )
+        {
+            entries[i]->format_cached = false;
+            string().swap( entries[i]->formatted_line );
+        }
+    }
+}
+
+
+size_t CommentedConfigFile::get_entry_line_size( Entry * entry )
+{
+    if ( is_written_verbatim( entry ) )
+        return entry->get_orig_line_size();
+
+    if ( entry->format_cached )
+        return entry->formatted_line.size();
+
+    string line;
+
+    if ( ! format_entry( entry, line ) )
+        return string::npos;
+
+    return line.size();
+}
+
+
+void CommentedConfigFile::append_entry_line( Entry * entry, string & text )
+{
+    if ( is_written_verbatim( entry ) )
+    {
+        entry->append_orig_line( text );
+    }
+    else if ( entry->format_cached )
+    {
+        text += entry->formatted_line;
+    }
+    else // format_entry() of a derived class that does not cache
+    {
+        string line;
+        format_entry( entry, line );
+        text += line;
+    }
+}
+
+
+bool CommentedConfigFile::format_entry( Entry * entry, string & line_ret )
+{
+    if ( get_unformatted_line( entry, line_ret ) )
+        return true;
+
+    // Entries that do not pass validate() are not cached: They are
+    // checked again every time just like before.
+
+    if ( ! entry->validate() )
+        return false;
+
+    cache_formatted_line( entry, entry->format(), line_ret );
+
+    return true;
+}
+
+
+bool CommentedConfigFile::is_written_verbatim( Entry * entry ) const
+{
+    // Not parsed (yet): Write it back as it was
+
+    if ( ! entry->parsed || ( entry->parse_failed && ! entry->modified ) )
+        return true;
+
+    // After a write() without verbatim_unchanged, the original lines are
+    // no longer what is on disk
+
+    return verbatim_unchanged && ! orig_lines_formatted && ! entry->is_modified();
+}
+
+
+bool CommentedConfigFile::get_unformatted_line( Entry * entry, string & line_ret ) const
+{
+    if ( is_written_verbatim( entry ) )
+    {
+        line_ret = entry->get_orig_line();
+        return true;
+    }
+
+    if ( entry->format_cached )
+    {
+        line_ret = entry->formatted_line;
+        return true;
+    }
+
+    return false;
+}
+
+
+void CommentedConfigFile::cache_formatted_line( Entry *        entry,
+                                                const string & content,
+                                                string &       line_ret )
+{
+    entry->formatted_line = content;
+
+    if ( ! entry->get_line_comment().empty() )
+    {
+        entry->formatted_line += " ";
+        entry->formatted_line += entry->get_line_comment();
+    }
+
+    entry->format_cached = format_cache || formatting_text;
+    line_ret = entry->formatted_line;
+}
+
+
+void CommentedConfigFile::clear_format_cache()
+{
+    for ( size_t i=0; i < entries.size(); ++i )
+        entries[i]->clear_format_cache();
+
+    last_snapshot.entries.reset();
+}
+
+
+std::shared_ptr<const CommentedConfigFile::EntryImage>
+CommentedConfigFile::create_entry_image( Entry * entry )
+{
+    ensure_parsed( entry );
+    std::shared_ptr<EntryImage> image = std::make_shared<EntryImage>();
+
+    image->comment_before = entry->get_comment_before();
+    image->content        = entry->get_content();
+    image->line_comment   = entry->get_line_comment();
+    image->key            = get_entry_key( entry );
+    image->valid          = format_entry( entry, image->line );
+
+    return image;
+}
+
+
+CommentedConfigFile::Snapshot CommentedConfigFile::snapshot()
+{
+    if ( ! last_snapshot.header )
+        last_snapshot.header = std::make_shared<const string_vec>( header_comments );
+
+    if ( ! last_snapshot.footer )
+        last_snapshot.footer = std::make_shared<const string_vec>( footer_comments );
+
+    if ( ! last_snapshot.entries )
+    {
+        // This may clear the format cache and thus the images of all
+        // entries, e.g. if the column widths of a ColumnConfigFile change
+
+        prepare_formatting();
+
+        std::shared_ptr<Snapshot::EntryImageVec> images =
+            std::make_shared<Snapshot::EntryImageVec>();
+        images->reserve( entries.size() );
+
+        for ( size_t i=0; i < entries.size(); ++i )
+        {
+            Entry * entry = entries[i];
+
+            if ( ! entry->image )
+                entry->image = create_entry_image( entry );
+
+            images->push_back( entry->image );
+        }
+
+        last_snapshot.entries = images;
+    }
+
+    return last_snapshot;
+}
+
+
+void CommentedConfigFile::publish()
+{
+    std::shared_ptr<Snapshot> new_snapshot = std::make_shared<Snapshot>( snapshot() );
+    std::shared_ptr<const Snapshot> old_snapshot = published.load();
+
+    if ( old_snapshot && old_snapshot->entries == new_snapshot->entries )
+    {
+        // Same entries as last time: Reuse the key map
+
+        new_snapshot->keys = old_snapshot->keys;
+    }
+    else
+    {
+        std::shared_ptr<Snapshot::KeyMap> keys = std::make_shared<Snapshot::KeyMap>();
+        keys->reserve( new_snapshot->get_entry_count() );
+
+        for ( int i=0; i < new_snapshot->get_entry_count(); ++i )
+        {
+            const string & key = new_snapshot->get_entry( i ).key;
+
+            if ( ! key.empty() )
+                keys->insert( std::make_pair( key, i ) ); // keeps the first one
+        }
 
-    if ( pos == 0 )
-        return boost::starts_with( line, comment_marker );
+        new_snapshot->keys = keys;
+    }
+
+    published.store( new_snapshot );
+}
+
+
+bool CommentedConfigFile::write_snapshot( const Snapshot & snapshot,
+                                          const string &   new_filename )
+{
+    string name = new_filename.empty() ? filename : new_filename;
+
+    if ( name.empty() ) // Support for mocking:
+        return true;    // Pretend everything worked just fine.
+
+    string_vec lines = snapshot.format_lines();
+    bool success;
+
+    if ( atomic_write )
+        success = FileIO::write_file_atomic( name, lines, fsync_policy );
     else
-        return boost::starts_with( line.substr( pos ), comment_marker );
+        success = FileIO::write_file( name, lines );
+
+    if ( name == filename )
+    {
+        // Whatever is on disk now, it is no longer what we know about it
+
+        invalidate_disk_state();
+    }
+
+    return success;
+}
+
+
+bool CommentedConfigFile::rollback( const Snapshot & snapshot )
+{
+    // Entries that were not modified since the snapshot was taken still
+    // have the very same image as in the snapshot
+
+    std::unordered_map<const EntryImage *, Entry *> unchanged;
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        if ( entries[i]->image )
+            unchanged[ entries[i]->image.get() ] = entries[i];
+    }
+
+    vector<Entry *> new_entries;
+    vector<Entry *> created;
+
+    new_entries.reserve( snapshot.get_entry_count() );
+
+    for ( int i=0; i < snapshot.get_entry_count(); ++i )
+    {
+        const EntryImage & image = snapshot.get_entry( i );
+        std::unordered_map<const EntryImage *, Entry *>::iterator it =
+            unchanged.find( &image );
+
+        if ( it != unchanged.end() )
+        {
+            new_entries.push_back( it->second );
+            unchanged.erase( it );
+            continue;
+        }
+
+        // Parse the entry again from what would have been written. Entries
+        // that did not pass validate() were not written; use their content
+        // for them.
+
+        string line = image.line;
+
+        if ( ! image.valid )
+        {
+            line = image.content;
+
+            if ( ! image.line_comment.empty() )
+                line += " " + image.line_comment;
+        }
+
+        Entry * entry = create_parsed_entry( line, image.comment_before, -1 );
+
+        if ( ! entry )
+        {
+            for ( size_t j=0; j < created.size(); ++j )
+                delete created[j];
+
+            return false;
+        }
+
+        entry->set_modified();
+        created.push_back( entry );
+        new_entries.push_back( entry );
+    }
+
+
+    // Delete everything that is not in the snapshot
+
+    for ( size_t i=0; i < new_entries.size(); ++i )
+        new_entries[i]->index = -1; // Mark as kept
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        Entry * entry = entries[i];
+
+        if ( entry->index != -1 )
+        {
+            entry_removed( entry );
+            delete entry;
+        }
+    }
+
+    entries.swap( new_entries );
+    renumber_entries( 0 );
+
+    for ( size_t i=0; i < created.size(); ++i )
+    {
+        created[i]->set_parent( this );
+        entry_added( created[i] );
+    }
+
+    header_comments = snapshot.get_header_comments();
+    footer_comments = snapshot.get_footer_comments();
+
+    last_snapshot         = Snapshot();
+    last_snapshot.header  = snapshot.header;
+    last_snapshot.footer  = snapshot.footer;
+    modified              = true;
+
+    return true;
+}
+
+
+void CommentedConfigFile::commit_entries( const string & text )
+{
+    bool all_committed = true;
+
+    for ( size_t i=0; i < entries.size(); ++i )
+    {
+        Entry * entry = entries[i];
+
+        if ( is_written_verbatim( entry ) )
+            continue;
+
+        if ( i >= line_starts.size() || line_starts[i] == string::npos )
+        {
+            // Not written because it did not pass validate()
+
+            all_committed = false;
+            continue;
+        }
+
+        // Only the next write() with verbatim_unchanged writes the
+        // original line of an unmodified entry; without that, keep the
+        // one that was read and format the entry again in reload().
+
+        if ( verbatim_unchanged )
+        {
+            size_t start = line_starts[i];
+            size_t end   = text.find( '\n', start );
+
+            entry->set_orig_line( text.substr( start, end - start ) );
+        }
+
+        entry->set_modified( false );
+    }
+
+    orig_lines_formatted = ! verbatim_unchanged;
+
+    modified = ! all_committed;
+}
+
+
+string CommentedConfigFile::get_disk_line( Entry * entry )
+{
+    string line;
+
+    if ( ! orig_lines_formatted || is_written_verbatim( entry ) ||
+         ! format_entry( entry, line ) )
+    {
+        line = entry->get_orig_line();
+    }
+
+    return line;
+}
+
+
+void CommentedConfigFile::clear_entries()
+{
+    if ( ! entries.empty() )
+        set_modified();
+
+    for ( size_t i=0; i < entries.size(); ++i )
+	delete entries[i];
+
+    entries.clear();
+    entries_cleared();
+}
+
+
+void CommentedConfigFile::clear_all()
+{
+    clear_entries();
+    header_comments.clear();
+    footer_comments.clear();
+    last_snapshot = Snapshot();
+}
+
+
+CommentedConfigFile::LineType
+CommentedConfigFile::classify_line( const string & line )
+{
+    if ( is_empty_line( line ) )
+        return EMPTY_LINE;
+
+    return is_comment_line( line ) ? COMMENT_LINE : CONTENT_LINE;
+}
+
+
+bool CommentedConfigFile::is_comment_line( const string & line )
+{
+    size_t pos = line.find_first_not_of( WHITESPACE );
+
+    if ( pos == string::npos ) // No non-whitespace character in line
+        return false;
+
+    return line.compare( pos, comment_marker.size(), comment_marker ) == 0;
 }
 
 
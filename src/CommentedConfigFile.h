@@ -10,13 +10,24 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+#include <typeinfo>
+#include <unordered_map>
 #include <boost/noncopyable.hpp>
 
+#include "FileIO.h"
+#include "PublishedPtr.h"
+
 using std::string;
 using std::vector;
 
 typedef vector<string> string_vec;
 
+class ParseCache;
+
 
 /**
  * Utility class to read and write config files that might contain comments.
@@ -86,6 +97,25 @@ class CommentedConfigFile: private boost::noncopyable
 {
 public:
 
+    /**
+     * Immutable copy of one entry as it was when a snapshot was taken.
+     * Snapshots of a file share the images of all entries that did not
+     * change between them.
+     **/
+    class EntryImage
+    {
+    public:
+        EntryImage(): valid( false ) {}
+
+        string_vec comment_before;
+        string     content;
+        string     line_comment;
+        string     line;            // formatted line including line comment
+        string     key;             // see CommentedConfigFile::get_entry_key()
+        bool       valid;           // passed validate(), i.e. is written
+    };
+
+
     /**
      * Class representing one content line and the preceding comments.
      *
@@ -101,7 +131,13 @@ public:
 	 * parse() function which is not possible in the constructor.
 	 **/
 	Entry():
-	    parent(0)
+	    parent(0),
+            index(-1),
+	    modified(true),
+            parsed(true),
+            parse_failed(false),
+            format_cached(false),
+            line_no(-1)
 	    {}
 
 	/**
@@ -139,6 +175,28 @@ public:
 	virtual bool parse( const string & line, int line_no = -1 )
 	    { content = line; return true; }
 
+        /**
+         * Store everything that parse() derived from the line except the
+         * content, the comments and the line comment in 'fields_ret' for a
+         * ParseCache. Return 'true' if success, 'false' if this entry
+         * cannot be cached; then it is parsed again when it is loaded from
+         * the cache.
+         *
+         * Derived classes that override parse() should also override this
+         * and load_cache_fields(). This default implementation only
+         * supports plain Entry objects which have no fields.
+         **/
+        virtual bool save_cache_fields( string_vec & fields_ret ) const
+            { return typeid( *this ) == typeid( Entry ); }
+
+        /**
+         * Restore what save_cache_fields() stored in 'fields'. The content,
+         * the comments and the line comment are already restored when this
+         * is called. Return 'true' if success, 'false' if error.
+         **/
+        virtual bool load_cache_fields( const string_vec & fields )
+            { return typeid( *this ) == typeid( Entry ); }
+
         /**
          * Return the string content of this entry.
          **/
@@ -149,21 +207,31 @@ public:
          *
          * This should not normally be necessary; the default parse() function
          * does that implicitly.
+         *
+         * Derived classes that keep references into the content can
+         * override this.
          **/
-        void set_content( const string & new_content ) { content = new_content; }
+        virtual void set_content( const string & new_content )
+            { content = new_content; set_modified(); }
 
         /**
          * Return the comment block before this entry: Empty lines or lines
          * starting with the comment marker ("#") as their first non-whitspace
          * character.
          **/
-        const string_vec & get_comment_before() const { return comment_before; }
+        const string_vec & get_comment_before() const
+            { return rare ? rare->comment_before : no_comments; }
 
         /**
          * Set the comment block before this entry.
          **/
         void set_comment_before( const string_vec & new_comment_before )
-            { comment_before = new_comment_before; }
+            {
+                if ( rare || ! new_comment_before.empty() )
+                    get_rare_data().comment_before = new_comment_before;
+
+                set_modified();
+            }
 
         /**
          * Return the comment on the same line as this entry's content.
@@ -171,14 +239,76 @@ public:
          * This will usually be an empty string. If it is non-empty, it will
          * start with the comment marker ("#").
          **/
-        const string & get_line_comment() const { return line_comment; }
+        const string & get_line_comment() const
+            { return rare ? rare->line_comment : no_string; }
 
         /**
          * Set the comment on the same line as this entry's comment.
          * This string should start with the comment marker ("#").
          **/
         void set_line_comment( const string & new_comment )
-            { line_comment = new_comment; }
+            {
+                if ( rare || ! new_comment.empty() )
+                    get_rare_data().line_comment = new_comment;
+
+                set_modified();
+            }
+
+        /**
+         * Return 'true' if this entry was modified since the file was last
+         * read or written. Newly created entries are always considered
+         * modified.
+         **/
+        bool is_modified() const { return modified; }
+
+        /**
+         * Mark this entry as modified or unmodified. The setters of this
+         * class do that automatically. Derived classes that keep any data
+         * of their own that is used in format() or validate() should call
+         * this whenever that data changes if the parent has the format
+         * cache or verbatim_unchanged enabled.
+         *
+         * Marking an entry as modified also marks its parent as modified.
+         **/
+        void set_modified( bool new_modified = true );
+
+        /**
+         * Discard the cached result of format() without
+         * marking this entry as modified. The parent does this when
+         * anything changes that affects the formatting of all entries,
+         * e.g. the column widths in a ColumnConfigFile.
+         **/
+        void clear_format_cache() { format_cached = false; image.reset(); }
+
+        /**
+         * Return the line as it was last read from file, including any
+         * line comment. This is what is written back for unmodified
+         * entries if verbatim_unchanged is enabled in the parent; only in
+         * that case, it is also updated to what was written when the file
+         * is written.
+         **/
+        string get_orig_line() const;
+
+        /**
+         * Set the line as it was read from file. This is done
+         * automatically when parsing and, with verbatim_unchanged, when
+         * writing the file.
+         **/
+        void set_orig_line( const string & line );
+
+        /**
+         * Return 'true' if parse() was already called for this entry. This
+         * is only 'false' if lazy_parse is enabled in the parent and this
+         * entry was not accessed yet.
+         **/
+        bool is_parsed() const { return parsed; }
+
+        /**
+         * Return 'true' if parse() failed for this entry. This can only
+         * happen with lazy_parse enabled in the parent; otherwise such
+         * entries are not created at all.
+         **/
+        bool get_parse_failed() const { return parse_failed; }
 
         /**
          * Return the Parent CommentConfigFile or 0 if this entry is not
@@ -197,25 +327,269 @@ public:
          * Use outside of this only if you know what you are doing.
          **/
         void set_parent( CommentedConfigFile * new_parent )
-            { parent = new_parent; }
+            {
+                if ( new_parent != parent )
+                    clear_format_cache();
+
+                parent = new_parent;
+            }
 
     private:
 
+        friend class CommentedConfigFile;
+        friend class ParseCache;
+
+        /**
+         * Data that most entries do not have. It is only allocated for the
+         * entries that have any of it, so all others are one single
+         * allocation (plus their content if it is too long for the string
+         * itself).
+         **/
+        struct RareData
+        {
+            string_vec comment_before;
+            string     line_comment;   // at the end of the line
+            string     orig_line;      // only if not content + line_comment
+            string     index_key;      // key in the parent's key index
+        };
+
+        /**
+         * Return the rare data of this entry, allocating it if needed.
+         **/
+        RareData & get_rare_data()
+            {
+                if ( ! rare )
+                    rare.reset( new RareData() );
+
+                return *rare;
+            }
+
+        /**
+         * Return the size of get_orig_line() without assembling it.
+         **/
+        size_t get_orig_line_size() const;
+
+        /**
+         * Append get_orig_line() to 'text' without assembling it first.
+         **/
+        void append_orig_line( string & text ) const;
+
+        /**
+         * Return the key of this entry in the parent's key index.
+         **/
+        const string & get_index_key() const
+            { return rare ? rare->index_key : no_string; }
+
+        static const string_vec no_comments;
+        static const string     no_string;
+
+
 	//
 	// Data members
 	//
 
-	string_vec comment_before;
-	string	   line_comment;   // at the end of the line
 	string	   content;
 
 	CommentedConfigFile * parent;
+        int        index;          // in the parent's entries
+        bool       modified;
+        bool       parsed;         // false until accessed with lazy_parse
+        bool       parse_failed;
+        bool       format_cached;  // formatted_line is valid
+        int        line_no;        // for parsing it later
+
+        std::unique_ptr<RareData> rare;
+
+        string     formatted_line; // format() + line_comment
+
+        std::shared_ptr<const EntryImage> image; // for the next snapshot
     };
 
 
     //----------------------------------------------------------------------
 
 
+    /**
+     * Iterator over the entries. Dereferencing it returns the entry; with
+     * lazy_parse enabled, this parses the entry first if it was not parsed
+     * yet. That changes the entry, so with lazy_parse, iterating from
+     * several threads at the same time is not safe even though this is a
+     * const_iterator.
+     **/
+    class const_iterator
+    {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef Entry *                         value_type;
+        typedef ptrdiff_t                       difference_type;
+        typedef Entry * const *                 pointer;
+        typedef Entry *                         reference;
+
+        typedef vector<Entry *>::const_iterator base_iterator;
+
+        const_iterator(): file( 0 ) {}
+
+        const_iterator( const CommentedConfigFile * file, base_iterator it ):
+            file( file ),
+            it( it )
+            {}
+
+        Entry * operator*() const
+            { file->ensure_parsed( *it ); return *it; }
+
+        Entry * operator[]( difference_type n ) const { return *( *this + n ); }
+
+        const_iterator & operator++()    { ++it; return *this; }
+        const_iterator & operator--()    { --it; return *this; }
+        const_iterator   operator++(int) { const_iterator old( *this ); ++it; return old; }
+        const_iterator   operator--(int) { const_iterator old( *this ); --it; return old; }
+
+        const_iterator & operator+=( difference_type n ) { it += n; return *this; }
+        const_iterator & operator-=( difference_type n ) { it -= n; return *this; }
+
+        const_iterator operator+( difference_type n ) const
+            { return const_iterator( file, it + n ); }
+
+        const_iterator operator-( difference_type n ) const
+            { return const_iterator( file, it - n ); }
+
+        difference_type operator-( const const_iterator & other ) const
+            { return it - other.it; }
+
+        bool operator==( const const_iterator & other ) const { return it == other.it; }
+        bool operator!=( const const_iterator & other ) const { return it != other.it; }
+        bool operator< ( const const_iterator & other ) const { return it <  other.it; }
+
+    private:
+
+        const CommentedConfigFile * file;
+        base_iterator               it;
+    };
+
+
+    /**
+     * Summary of what reload() changed.
+     **/
+    class ReloadSummary
+    {
+    public:
+        ReloadSummary():
+            success( true ),
+            header_changed( false ),
+            footer_changed( false ),
+            unchanged( 0 )
+            {}
+
+        /**
+         * Return 'true' if anything changed at all.
+         **/
+        bool changed() const
+            {
+                return header_changed || footer_changed ||
+                    ! added.empty()   || ! comments_changed.empty() ||
+                    ! removed_lines.empty();
+            }
+
+        bool            success;           // file read and all lines parsed
+        bool            header_changed;
+        bool            footer_changed;
+        vector<Entry *> added;             // newly parsed entries
+        vector<Entry *> comments_changed;  // same content, other comments
+        string_vec      removed_lines;     // original lines of deleted entries
+        int             unchanged;         // number of untouched entries
+    };
+
+
+    /**
+     * Read-only point-in-time view of a CommentedConfigFile: Its header
+     * comments, entries and footer comments as they were when
+     * CommentedConfigFile::snapshot() was called. Changing the file
+     * afterwards does not affect the snapshot.
+     *
+     * Snapshots are cheap to copy and to keep around: They share everything
+     * that did not change between them, both with each other and with the
+     * file. Each entry image is only created once, and only for entries
+     * that were modified since the last snapshot.
+     *
+     * Snapshots are immutable, so they can be handed to other threads.
+     **/
+    class Snapshot
+    {
+    public:
+        /**
+         * Constructor for an empty snapshot.
+         **/
+        Snapshot() {}
+
+        /**
+         * Return the header comments.
+         **/
+        const string_vec & get_header_comments() const;
+
+        /**
+         * Return the footer comments.
+         **/
+        const string_vec & get_footer_comments() const;
+
+        /**
+         * Return the number of entries.
+         **/
+        int get_entry_count() const { return entries ? entries->size() : 0; }
+
+        /**
+         * Return the image of entry no. 'index'. 'index' has to be in the
+         * range 0 .. get_entry_count()-1.
+         **/
+        const EntryImage & get_entry( int index ) const
+            { return *( *entries )[ index ]; }
+
+        /**
+         * Return the first entry with key 'key' or 0 if there is none.
+         *
+         * This is a constant-time operation for snapshots returned by
+         * CommentedConfigFile::get_published(), a linear search otherwise.
+         **/
+        const EntryImage * find_entry( const string & key ) const;
+
+        /**
+         * Format the entire snapshot as string lines just like
+         * CommentedConfigFile::format_lines() did when it was taken.
+         **/
+        string_vec format_lines() const;
+
+        /**
+         * Return 'true' if this snapshot shares all its data with 'other',
+         * i.e. nothing was changed between them. This is a constant-time
+         * operation.
+         **/
+        bool is_same_as( const Snapshot & other ) const
+            {
+                return header  == other.header  &&
+                    entries == other.entries &&
+                    footer  == other.footer;
+            }
+
+        /**
+         * Diff snapshot 'new_snapshot' against 'old_snapshot'. The result is
+         * similar to the Linux/Unix "diff -u" command.
+         **/
+        static string_vec diff( const Snapshot & old_snapshot,
+                                const Snapshot & new_snapshot );
+
+    private:
+
+        friend class CommentedConfigFile;
+
+        typedef vector<std::shared_ptr<const EntryImage> > EntryImageVec;
+        typedef std::unordered_map<string, int>            KeyMap;
+
+        std::shared_ptr<const string_vec>    header;
+        std::shared_ptr<const EntryImageVec> entries;
+        std::shared_ptr<const string_vec>    footer;
+        std::shared_ptr<const KeyMap>        keys;  // key -> first index
+    };
+
+
     /**
      * Constructor.
      *
@@ -237,10 +611,56 @@ public:
      **/
     bool read( const string & filename );
 
+    /**
+     * Replace the current content with 'content' that was read from file
+     * 'filename' by the caller, e.g. with AsyncFileIO for many files at
+     * once. 'stat' is the stat() information of that file; if it is
+     * invalid, the file is considered not to exist, just like in read().
+     *
+     * Return 'true' if success, 'false' if error.
+     **/
+    bool parse_file_content( const string &   filename,
+                             const string &   content,
+                             const FileStat & stat );
+
+    /**
+     * Read 'filename' (or, if that is empty, the file that was last read)
+     * again, but unlike read(), keep all entries whose lines did not
+     * change, i.e. any pointers to them remain valid, and they are not
+     * parsed again. Only new or changed lines are parsed into new entries.
+     * Entries that were modified in memory are replaced with what is on
+     * disk.
+     *
+     * If the file was not changed on disk since it was last read or
+     * written and nothing was modified, this does nothing.
+     *
+     * If the file cannot be read, this does not change anything and
+     * returns a summary with 'success' set to 'false'.
+     **/
+    ReloadSummary reload( const string & filename = "" );
+
     /**
      * Write the contents to 'filename' or, if 'filename' is empty, to the
      * original file that was used in the constructor or during the last
      * read().
+     *
+     * If verbatim_unchanged is enabled and nothing was modified since the
+     * file was read, the file is not written at all if it is still
+     * unchanged on disk, or it is copied by the kernel if it is written to
+     * a different filename.
+     *
+     * If atomic_write is enabled, the content is written to a temporary
+     * file which is then renamed to 'filename', so the file is never seen
+     * partially written, not even after a crash.
+     *
+     * If skip_identical is enabled, the file is not written if it already
+     * has exactly the content that would be written. Use
+     * get_write_skipped() to find out if that was the case.
+     *
+     * After writing, all entries that were written are unmodified, and
+     * reload() keeps them as long as their lines on disk do not change.
+     * Each entry is only formatted once for this.
+     *
      * Return 'true' if success, 'false' if error.
      **/
     bool write( const string & filename = "" );
@@ -259,6 +679,265 @@ public:
      **/
     virtual string_vec format_lines();
 
+    /**
+     * Format the entire file into 'text_ret' exactly as write() writes it:
+     * The same lines as format_lines(), each one followed by a newline.
+     *
+     * The exact size is calculated first, and then all lines are written
+     * directly into that one buffer without any string for each line.
+     * Pass the same string again to reuse its memory.
+     **/
+    virtual void format_text( string & text_ret );
+
+    /**
+     * Callback for stream(): 'entry' is the entry that was just read and
+     * parsed, including its comment_before. The callback may modify it,
+     * and it may add new entries to 'insert_before' which are then written
+     * before it; ownership of them is transferred to stream(). Return
+     * 'false' to drop the entry (including its comments).
+     **/
+    typedef std::function<bool( Entry * entry,
+                                vector<Entry *> & insert_before )> StreamFilter;
+
+    /**
+     * Read lines from 'in', pass each entry to 'filter' and write the
+     * result to 'out' right away. This is meant for files that are too
+     * large to keep all entries in memory: Only one entry and the comment
+     * block before it are kept in memory at any time.
+     *
+     * Comments are attributed exactly like parse() does it; the header and
+     * footer comments are written unchanged. 'filter' may be empty to just
+     * copy (and reformat) everything. This does not change the entries,
+     * header or footer comments of this object; it only uses its settings
+     * and create_entry().
+     *
+     * Since the entries are not in any file while they are streamed,
+     * ColumnConfigFile entries are not padded.
+     *
+     * Return 'false' if any line could not be parsed or if writing to
+     * 'out' failed, 'true' otherwise.
+     **/
+    bool stream( std::istream & in, std::ostream & out, StreamFilter filter );
+
+    /**
+     * Return 'true' if anything was modified since the file was last read
+     * or written: Any entry, the order of entries, header or footer
+     * comments.
+     **/
+    bool is_modified() const { return modified; }
+
+    /**
+     * Mark the file as modified or unmodified. This is done automatically
+     * by all methods that change entries, header or footer comments.
+     **/
+    void set_modified( bool new_modified = true );
+
+    /**
+     * Take a snapshot of the current header comments, entries and footer
+     * comments. See class Snapshot.
+     *
+     * If nothing was changed since the last snapshot, this returns that one
+     * again without copying anything. Otherwise, only the entries that were
+     * modified since then are copied; all others are shared.
+     **/
+    Snapshot snapshot();
+
+    /**
+     * Write 'snapshot' to 'filename' or, if 'filename' is empty, to the
+     * file that was last read or written. This honors the atomic_write and
+     * fsync_policy settings. The current content of this file is not
+     * changed.
+     *
+     * Return 'true' if success, 'false' if error.
+     **/
+    bool write_snapshot( const Snapshot & snapshot, const string & filename = "" );
+
+    /**
+     * Go back to the state of 'snapshot': Restore the header comments, the
+     * entries and the footer comments. Entries that were not changed since
+     * the snapshot was taken are kept as they are; all others are deleted,
+     * and new entries are parsed from the snapshot's lines.
+     *
+     * If any of those lines cannot be parsed, nothing is changed, and this
+     * returns 'false'.
+     **/
+    bool rollback( const Snapshot & snapshot );
+
+    /**
+     * Take a snapshot and make it the one that get_published() returns.
+     *
+     * This is meant for one writer thread and any number of reader
+     * threads: The writer makes a batch of changes and then calls this to
+     * make them visible to the readers all at once. Readers never see a
+     * partially changed file, and they never wait for the writer to finish
+     * its changes or to take the snapshot.
+     *
+     * Neither side takes any lock: The snapshot pointer is exchanged with
+     * a PublishedPtr, so readers never wait for the writer or for each
+     * other, not even while the pointer is exchanged.
+     *
+     * Only the writer thread may use this object directly; readers may
+     * only use get_published().
+     **/
+    void publish();
+
+    /**
+     * Return the snapshot that was last published with publish() or 0 if
+     * there is none yet. This is safe to call from any thread at any time,
+     * and it never waits for a lock (see publish()).
+     *
+     * The snapshot remains valid as long as the caller holds the returned
+     * pointer, no matter what the writer does in the meantime; it is
+     * deleted when the last reader releases it.
+     **/
+    std::shared_ptr<const Snapshot> get_published() const
+        { return published.load(); }
+
+    /**
+     * Return 'true' if unmodified entries are written back exactly as they
+     * were read, i.e. only modified entries are formatted. This is not
+     * enabled by default.
+     **/
+    bool get_verbatim_unchanged() const { return verbatim_unchanged; }
+
+    /**
+     * Enable or disable writing unmodified entries exactly as they were
+     * read. Notice that this also means that a ColumnConfigFile will not
+     * realign the columns of unmodified entries.
+     **/
+    void set_verbatim_unchanged( bool enabled = true )
+        {
+            if ( enabled != verbatim_unchanged )
+            {
+                verbatim_unchanged = enabled;
+                clear_format_cache();
+            }
+        }
+
+    /**
+     * Return 'true' if the formatted line of each entry is cached until
+     * the entry is modified. This is not enabled by default.
+     **/
+    bool get_format_cache() const { return format_cache; }
+
+    /**
+     * Enable or disable caching the formatted line of each entry that
+     * passed validate() until the entry is modified, so formatting a large
+     * file again after changing a few entries only calls format() for
+     * those.
+     *
+     * Only enable this if all entries call Entry::set_modified() whenever
+     * anything changes that is used in their format() or validate(); the
+     * setters of Entry do that. Otherwise, stale lines are written.
+     *
+     * Even without this, format_text() formats each entry only once.
+     **/
+    void set_format_cache( bool enabled = true )
+        {
+            if ( enabled != format_cache )
+            {
+                format_cache = enabled;
+                clear_format_cache();
+            }
+        }
+
+    /**
+     * Return 'true' if entries are only parsed when they are first
+     * accessed. This is not enabled by default.
+     **/
+    bool get_lazy_parse() const { return lazy_parse; }
+
+    /**
+     * Enable or disable lazy parsing for subsequent read(), parse() and
+     * reload() operations.
+     *
+     * With lazy parsing, reading a file only splits it into entries and
+     * their comments; Entry::parse() is called only when an entry is
+     * first accessed with get_entry() or an iterator. Unparsed entries
+     * are written back exactly as they were read.
+     *
+     * Entries that fail to parse remain in the entries (see
+     * Entry::get_parse_failed()) and are also written back unchanged until
+     * parse_all() removes them.
+     *
+     * Notice that everything that needs the parsed data of all entries
+     * parses all of them: The key index, snapshots, find_entry() and
+     * remove_if(), and formatting a ColumnConfigFile.
+     *
+     * Notice also that the const accessors get_entry() and the
+     * const_iterator parse entries when they are first accessed, so with
+     * lazy parsing, they must not be used from several threads at the
+     * same time without a lock. Call parse_all() first to make them
+     * read-only again.
+     **/
+    void set_lazy_parse( bool enabled = true ) { lazy_parse = enabled; }
+
+    /**
+     * Parse all entries that were not parsed yet and remove all entries
+     * that could not be parsed, just like parse() does without lazy
+     * parsing. Use this to get all parse errors up front.
+     *
+     * Return 'true' if all entries could be parsed, 'false' if not.
+     **/
+    bool parse_all();
+
+    /**
+     * Return the parse cache that is used by read() or 0 if there is none.
+     **/
+    ParseCache * get_parse_cache() const { return parse_cache; }
+
+    /**
+     * Set a parse cache for read(): If the file did not change since it
+     * was cached, it is loaded from the cache instead of being parsed
+     * again; otherwise it is parsed and stored in the cache. This does not
+     * take over ownership of the cache. 0 means not to use any cache.
+     **/
+    void set_parse_cache( ParseCache * cache ) { parse_cache = cache; }
+
+    /**
+     * Return 'true' if write() replaces the file atomically by writing a
+     * temporary file in the same directory and renaming it. This is not
+     * enabled by default.
+     **/
+    bool get_atomic_write() const { return atomic_write; }
+
+    /**
+     * Enable or disable atomic writes.
+     **/
+    void set_atomic_write( bool enabled = true ) { atomic_write = enabled; }
+
+    /**
+     * Return what is synced to disk with atomic writes (default:
+     * FSYNC_FILE). See FsyncPolicy in FileIO.h.
+     **/
+    FsyncPolicy get_fsync_policy() const { return fsync_policy; }
+
+    /**
+     * Set what is synced to disk with atomic writes.
+     **/
+    void set_fsync_policy( FsyncPolicy policy ) { fsync_policy = policy; }
+
+    /**
+     * Return 'true' if write() compares the output with the existing file
+     * and leaves the file alone if they are identical. This is not enabled
+     * by default.
+     *
+     * This avoids changing the file's mtime, triggering inotify watchers
+     * and daemons that reload their config when anything changes.
+     **/
+    bool get_skip_identical() const { return skip_identical; }
+
+    /**
+     * Enable or disable skipping writes that would not change the file.
+     **/
+    void set_skip_identical( bool enabled = true ) { skip_identical = enabled; }
+
+    /**
+     * Return 'true' if the last write() did not actually write the file
+     * because it was already up to date.
+     **/
+    bool get_write_skipped() const { return write_skipped; }
+
     /**
      * Factory method to create one entry.
      *
@@ -281,15 +960,18 @@ public:
     /**
      * Return an iterator that points to the first entry.
      **/
-    vector<Entry *>::const_iterator begin() const { return entries.begin(); }
+    const_iterator begin() const { return const_iterator( this, entries.begin() ); }
 
     /**
      * Return an iterator that points one element after the last entry.
      **/
-    vector<Entry *>::const_iterator end()   const { return entries.end(); }
+    const_iterator end()   const { return const_iterator( this, entries.end() ); }
 
     /**
      * Return entry no. 'index' or 0 if 'index' is out of range.
+     *
+     * With lazy_parse enabled, this parses the entry if it was not parsed
+     * yet; see set_lazy_parse() about threads.
      **/
     Entry * get_entry( int index ) const;
 
@@ -312,9 +994,59 @@ public:
 
     /**
      * Return the index of 'entry' or -1 if there is no such entry.
+     *
+     * This is a constant-time operation: Each entry knows its own index.
      **/
     int get_index_of( const Entry * entry ) const;
 
+    /**
+     * Return the key of 'entry' for the key index.
+     *
+     * Derived classes can override this to return whatever identifies an
+     * entry, e.g. the mount point for /etc/fstab or the host name for
+     * /etc/hosts. Entries with an empty key are not added to the key index.
+     *
+     * This default implementation returns the content of the entry.
+     **/
+    virtual string get_entry_key( const Entry * entry ) const
+        { return entry->get_content(); }
+
+    /**
+     * Return 'true' if the key index is enabled. It is not enabled by
+     * default.
+     **/
+    bool get_key_index_enabled() const { return key_index_enabled; }
+
+    /**
+     * Enable or disable the key index. If enabled, a hash map from the key
+     * of each entry (see get_entry_key()) to the entry is maintained
+     * automatically whenever entries are added, removed, modified or
+     * parsed, so find_entry() is a constant-time operation.
+     **/
+    void set_key_index_enabled( bool enabled = true );
+
+    /**
+     * Return the entry with key 'key' or 0 if there is none. If there are
+     * several entries with that key, return the first one.
+     *
+     * If the key index is not enabled, this is a linear search.
+     **/
+    Entry * find_entry( const string & key ) const;
+
+    /**
+     * Return all entries with key 'key' in the order of the entries.
+     *
+     * If the key index is not enabled, this is a linear search.
+     **/
+    vector<Entry *> find_entries( const string & key ) const;
+
+    /**
+     * Rebuild the key index from scratch. This is only necessary if the
+     * key of an entry changed without the entry being marked as modified,
+     * e.g. if get_entry_key() uses data from outside the entry.
+     **/
+    void rebuild_key_index();
+
     /**
      * Take the entry with the specified index out of the entries and return
      * it. This is useful when rearranging the order of entries: Take it out
@@ -357,6 +1089,45 @@ public:
     CommentedConfigFile & operator<<( Entry * entry )
 	{ append( entry ); return *this; }
 
+    /**
+     * Predicate for entries for remove_if().
+     **/
+    typedef std::function<bool( Entry * entry )> EntryPredicate;
+
+    /**
+     * Remove all entries for which 'predicate' returns 'true' and delete
+     * them. Return the number of removed entries.
+     *
+     * This is done in one single pass over the entries, so it is much
+     * faster than removing many entries one by one.
+     **/
+    int remove_if( EntryPredicate predicate );
+
+    /**
+     * Insert all of 'new_entries' before index 'before'. This is the same
+     * as inserting them one by one, just much faster.
+     * This transfers ownership of the entries to this class.
+     **/
+    void insert( int before, const vector<Entry *> & new_entries );
+
+    /**
+     * Rearrange the entries so that the entry at index 'permutation[i]'
+     * moves to index 'i'. 'permutation' has to contain each index exactly
+     * once; if it does not, nothing is changed and this returns 'false'.
+     *
+     * Comments stay with their entries, just like with take() and
+     * insert().
+     **/
+    bool reorder( const vector<int> & permutation );
+
+    /**
+     * Move 'count' entries starting with index 'from' from 'other' to this
+     * file before index 'before'. If 'count' is -1, move all entries from
+     * 'from' to the end. Ownership of those entries is transferred to this
+     * class.
+     **/
+    void splice( int before, CommentedConfigFile & other, int from, int count = -1 );
+
     /**
      * Return the header comments (including empty lines).
      **/
@@ -367,7 +1138,11 @@ public:
      * with the comment marker ("#") as the first non-whitespace character.
      **/
     void set_header_comments( const string_vec & new_comments )
-        { header_comments = new_comments; }
+        {
+            header_comments = new_comments;
+            last_snapshot.header.reset();
+            modified = true;
+        }
 
     /**
      * Return the footer comments (including empty lines).
@@ -379,7 +1154,11 @@ public:
      * with the comment marker ("#") as the first non-whitespace character.
      **/
     void set_footer_comments( const string_vec & new_comments )
-        { footer_comments = new_comments; }
+        {
+            footer_comments = new_comments;
+            last_snapshot.footer.reset();
+            modified = true;
+        }
 
     /**
      * Get the last filename content was read from. This may be empty.
@@ -452,17 +1231,37 @@ public:
 
 protected:
 
+    /**
+     * Kind of a line as far as the parser is concerned.
+     **/
+    enum LineType
+    {
+        EMPTY_LINE,
+        COMMENT_LINE,
+        CONTENT_LINE
+    };
+
+    /**
+     * Return what kind of line 'line' is. The parser calls this once for
+     * each line.
+     *
+     * Derived classes can override this (and the methods below) with a
+     * faster implementation for a fixed comment marker; see
+     * BasicCommentedConfigFile.
+     **/
+    virtual LineType classify_line( const string & line );
+
     /**
      * Return 'true' if this is a comment line (not an empty line!), i.e. the
      * first nonblank character is the comment marker ("#" by default).
      **/
-    bool is_comment_line( const string & line );
+    virtual bool is_comment_line( const string & line );
 
     /**
      * Return 'true' if this is an empty line, i.e. there are no nonblank
      * characters.
      **/
-    bool is_empty_line( const string & line );
+    virtual bool is_empty_line( const string & line );
 
     /**
      * Split 'line' into a content and a comment part that are returned in
@@ -470,9 +1269,9 @@ protected:
      * empty, or it starts with the comment marker. 'content_ret' is stripped
      * of trailing whitespace.
      **/
-    void split_off_comment( const string & line,
-			    string & content_ret,
-			    string & comment_ret );
+    virtual void split_off_comment( const string & line,
+                                    string & content_ret,
+                                    string & comment_ret );
 
     /**
      * Strip all trailing whitespace from 'line'.
@@ -497,17 +1296,249 @@ protected:
      **/
     bool parse_entries( const string_vec & lines, int from, int end );
 
+    /**
+     * Create a new entry with create_entry(), set its comments and parse
+     * content line 'line' with line number 'line_no' into it. Return the
+     * new entry or 0 if it could not be parsed.
+     **/
+    Entry * create_parsed_entry( const string &     line,
+                                 const string_vec & comment_before,
+                                 int                line_no );
+
+    /**
+     * Parse 'entry' if that was not done yet because of lazy_parse.
+     * Return 'false' if it could not be parsed.
+     **/
+    bool ensure_parsed( Entry * entry ) const
+        { return entry->parsed ? ! entry->parse_failed : parse_lazy_entry( entry ); }
+
+    /**
+     * Parse 'entry' that was created with lazy_parse enabled.
+     **/
+    bool parse_lazy_entry( Entry * entry ) const;
+
+    /**
+     * Format one entry as a line including its line comment and return it
+     * in 'line_ret'. With verbatim_unchanged enabled, this returns the
+     * original line for unmodified entries.
+     *
+     * With the format cache enabled, the result of format() for an entry
+     * that passed validate() is cached in the entry until it is modified
+     * or its cache is cleared, so this is cheap for entries that did not
+     * change since the last call.
+     *
+     * Return 'false' if the entry should not be written because it did not
+     * pass its validate() check.
+     *
+     * Derived classes that know the exact type of their entries at compile
+     * time can override this to call validate() and format() without
+     * virtual dispatch; see TypedConfigFile. They should use
+     * get_unformatted_line() and cache_formatted_line() for everything
+     * else.
+     **/
+    virtual bool format_entry( Entry * entry, string & line_ret );
+
+    /**
+     * Return the line for 'entry' in 'line_ret' if it does not need to be
+     * formatted: If it was not parsed, if it is written verbatim, or if
+     * its formatted line is cached. Return 'false' if it needs to be
+     * validated and formatted.
+     **/
+    bool get_unformatted_line( Entry * entry, string & line_ret ) const;
+
+    /**
+     * Return 'true' if 'entry' is written as it was read: If it was not
+     * parsed, or if it is unmodified with verbatim_unchanged enabled.
+     **/
+    bool is_written_verbatim( Entry * entry ) const;
+
+    /**
+     * Return the size of the line of 'entry' without the newline for
+     * format_text(), or string::npos if it is not written because it does
+     * not pass its validate() check.
+     *
+     * Derived classes that can calculate the size of a line without
+     * formatting it can override this and append_entry_line().
+     **/
+    virtual size_t get_entry_line_size( Entry * entry );
+
+    /**
+     * Append the line of 'entry' to 'text' for format_text(). This is only
+     * called if get_entry_line_size() returned its size right before.
+     **/
+    virtual void append_entry_line( Entry * entry, string & text );
+
+    /**
+     * Add the line comment of 'entry' to 'content', the result of its
+     * format(), cache that as its formatted line and return it in
+     * 'line_ret'. Without the format cache, it is only kept until the end
+     * of the current format_text().
+     **/
+    void cache_formatted_line( Entry *        entry,
+                               const string & content,
+                               string &       line_ret );
+
+    /**
+     * Write 'entry' including its comment_before to 'out' if it passes
+     * validate().
+     **/
+    void stream_entry( std::ostream & out, Entry * entry );
+
+    /**
+     * Mark all entries that were written to 'text', the result of
+     * format_text(), as unmodified. This is done after successfully
+     * writing the file. The lines are taken from 'text', so nothing is
+     * formatted again; they only become the new original lines with
+     * verbatim_unchanged, which is the only case where they are written
+     * again as they are.
+     **/
+    void commit_entries( const string & text );
+
+    /**
+     * Return the line of 'entry' as it was last read from or written to
+     * file: Its original line, or if it was last written formatted and
+     * without verbatim_unchanged, its formatted line.
+     **/
+    string get_disk_line( Entry * entry );
+
+    /**
+     * Drop the formatted lines that were only kept for the current
+     * format_text() or write() unless the format cache is enabled.
+     **/
+    void release_formatted_lines();
+
+    /**
+     * Return 'true' if file 'name' already has the content 'text'.
+     * 'hash' is FileIO::hash() of 'text'.
+     *
+     * If the file was not changed on disk since it was last read or
+     * written, the hash of its content from that time is used; otherwise
+     * the file is read and compared.
+     **/
+    bool is_identical_on_disk( const string & name,
+                               const string & text,
+                               uint64_t       hash );
+
+    /**
+     * Remember the hash of 'content' that was just read from disk if
+     * 'valid' and if skip_identical or a parse cache needs it.
+     **/
+    void set_disk_hash( const string & content, bool valid );
+
+    /**
+     * Forget everything that is known about the file content on disk.
+     **/
+    void invalidate_disk_state();
+
+    /**
+     * Clear the format cache of all entries. Derived classes call this
+     * when anything changes that affects how all entries are formatted.
+     **/
+    void clear_format_cache();
+
+    /**
+     * Prepare formatting the entries. This is called by format_lines() and
+     * snapshot() before any entry is formatted.
+     *
+     * Derived classes can override this to update any formatting
+     * information that depends on all entries.
+     *
+     * This default implementation does nothing.
+     **/
+    virtual void prepare_formatting() {}
+
+    /**
+     * Create the image of 'entry' for a snapshot.
+     **/
+    std::shared_ptr<const EntryImage> create_entry_image( Entry * entry );
+
+    /**
+     * Notification that 'entry' was just added to the entries.
+     *
+     * Derived classes that maintain any data about all entries can
+     * override this, but they should call this base class method.
+     **/
+    virtual void entry_added( Entry * entry );
+
+    /**
+     * Notification that 'entry' is about to be removed from the entries.
+     * It is still in the entries and has its old index.
+     *
+     * Derived classes that maintain any data about all entries can
+     * override this, but they should call this base class method.
+     **/
+    virtual void entry_removed( Entry * entry );
+
+    /**
+     * Notification that 'entry' was modified.
+     *
+     * Derived classes that maintain any data about all entries can
+     * override this, but they should call this base class method.
+     **/
+    virtual void entry_modified( Entry * entry );
+
+    /**
+     * Notification that all entries were just deleted at once without
+     * entry_removed() for each of them.
+     *
+     * Derived classes that maintain any data about all entries can
+     * override this, but they should call this base class method.
+     **/
+    virtual void entries_cleared();
+
+    /**
+     * Update the index of the entries from 'from' to the end.
+     **/
+    void renumber_entries( int from );
+
+    /**
+     * Add 'entry' to the key index or remove it from there.
+     **/
+    void add_to_key_index( Entry * entry );
+    void remove_from_key_index( Entry * entry );
+
 
 private:
 
+    friend class ParseCache;
+
     string	    filename;
     string	    comment_marker;
     bool            diff_enabled;
+    bool            verbatim_unchanged;
+    bool            format_cache;
+    bool            formatting_text; // in format_text()
+    bool            orig_lines_formatted; // written lines != orig lines
+    bool            atomic_write;
+    FsyncPolicy     fsync_policy;
+    bool            skip_identical;
+    bool            write_skipped;
+    bool            modified;
+    bool            lazy_parse;
+    ParseCache *    parse_cache;
+
+    FileStat        disk_stat;      // 'filename' when last read / written
+    uint64_t        disk_hash;      // its content hash at that time
+    bool            disk_hash_valid;
+    bool            orig_on_disk;   // entries' orig lines are what is there
 
     string_vec	    header_comments;
     vector<Entry *> entries;
     string_vec	    footer_comments;
     string_vec      orig_lines;
+    vector<size_t>  line_starts;    // of the entries in the text of write()
+
+    typedef std::unordered_multimap<string, Entry *>        KeyIndex;
+    typedef std::pair<KeyIndex::iterator, KeyIndex::iterator> KeyIndexRange;
+    typedef std::pair<KeyIndex::const_iterator, KeyIndex::const_iterator>
+        KeyIndexConstRange;
+
+    bool            key_index_enabled;
+    KeyIndex        key_index;
+
+    Snapshot        last_snapshot;  // parts are reset when they change
+
+    PublishedPtr<Snapshot> published;
 
 };
 
@@ -0,0 +1,452 @@
+/**
+ * CompositeConfigFile.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <dirent.h>
+#include <errno.h>
+#include <glob.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <boost/algorithm/string.hpp>
+
+#include "CompositeConfigFile.h"
+#include "ThreadPool.h"
+
+#define WHITESPACE " \t"
+
+
+CompositeConfigFile::CompositeConfigFile():
+    thread_count( 0 )
+{
+}
+
+
+CompositeConfigFile::~CompositeConfigFile()
+{
+    clear();
+}
+
+
+void CompositeConfigFile::clear()
+{
+    for ( size_t i=0; i < files.size(); ++i )
+        delete files[i];
+
+    files.clear();
+    filenames.clear();
+    includes.clear();
+    file_depth.clear();
+    merged.clear();
+}
+
+
+CommentedConfigFile * CompositeConfigFile::get_file( int index ) const
+{
+    if ( index < 0 || index >= (int) files.size() )
+        return 0;
+    else
+        return files[ index ];
+}
+
+
+CommentedConfigFile::Entry * CompositeConfigFile::get_entry( int index ) const
+{
+    if ( index < 0 || index >= (int) merged.size() )
+        return 0;
+    else
+        return merged[ index ];
+}
+
+
+string CompositeConfigFile::get_source_filename( int index ) const
+{
+    CommentedConfigFile::Entry * entry = get_entry( index );
+
+    if ( ! entry || ! entry->get_parent() )
+        return "";
+
+    return entry->get_parent()->get_filename();
+}
+
+
+/**
+ * Return the real path of 'filename' with all symlinks resolved or
+ * 'filename' itself if that is not possible.
+ **/
+static string real_path( const string & filename )
+{
+    char * real_name = realpath( filename.c_str(), 0 );
+
+    if ( ! real_name )
+        return filename;
+
+    string result( real_name );
+    free( real_name );
+
+    return result;
+}
+
+
+bool CompositeConfigFile::read( const string & filename )
+{
+    clear();
+
+    files.push_back( create_file() );
+    filenames.push_back( filename );
+    includes.push_back( vector<Include>() );
+    file_depth.push_back( 0 );
+
+    std::set<string> seen;
+    seen.insert( real_path( filename ) );
+
+    ThreadPool  pool( thread_count );
+    vector<int> level( 1, 0 );
+    bool        success = true;
+
+    // Read one include level at a time: All files of a level are read in
+    // parallel, then their include directives tell us the next level.
+
+    while ( ! level.empty() )
+    {
+        vector<char> level_ok( level.size(), 0 );
+
+        for ( size_t i=0; i < level.size(); ++i )
+        {
+            CommentedConfigFile * file = files[ level[i] ];
+            const string &        name = filenames[ level[i] ];
+            char *                ok   = &level_ok[i];
+
+            pool.submit( [file, name, ok]() { *ok = file->read( name ); } );
+        }
+
+        pool.wait();
+
+        vector<int> next_level;
+
+        for ( size_t i=0; i < level.size(); ++i )
+        {
+            if ( ! level_ok[i] )
+                success = false;
+
+            int first_new = files.size();
+
+            if ( ! find_includes( level[i], seen ) )
+                success = false;
+
+            for ( int j = first_new; j < (int) files.size(); ++j )
+                next_level.push_back( j );
+        }
+
+        level.swap( next_level );
+    }
+
+    update_merged_entries();
+
+    return success;
+}
+
+
+bool CompositeConfigFile::write()
+{
+    bool success = true;
+
+    for ( size_t i=0; i < files.size(); ++i )
+    {
+        if ( files[i]->is_modified() && ! files[i]->write() )
+            success = false;
+    }
+
+    return success;
+}
+
+
+bool CompositeConfigFile::find_includes( int index, std::set<string> & seen )
+{
+    CommentedConfigFile * file = files[ index ];
+
+    // Collect all lines in the order of the file together with where the
+    // entries of anything they include go
+
+    struct Candidate
+    {
+        Candidate( const string & line, CommentedConfigFile::Entry * anchor, bool after ):
+            line( line ), anchor( anchor ), after( after ) {}
+
+        string                       line;
+        CommentedConfigFile::Entry * anchor;
+        bool                         after;
+    };
+
+    vector<Candidate> candidates;
+    CommentedConfigFile::Entry * first = file->get_entry( 0 );
+
+    for ( size_t i=0; i < file->get_header_comments().size(); ++i )
+        candidates.push_back( Candidate( file->get_header_comments()[i], first, false ) );
+
+    for ( int i=0; i < file->get_entry_count(); ++i )
+    {
+        CommentedConfigFile::Entry * entry = file->get_entry( i );
+
+        for ( size_t j=0; j < entry->get_comment_before().size(); ++j )
+            candidates.push_back( Candidate( entry->get_comment_before()[j], entry, false ) );
+
+        candidates.push_back( Candidate( entry->get_orig_line(), entry, true ) );
+    }
+
+    for ( size_t i=0; i < file->get_footer_comments().size(); ++i )
+        candidates.push_back( Candidate( file->get_footer_comments()[i], 0, false ) );
+
+
+    vector<Include> file_includes;
+    bool success = true;
+
+    for ( size_t i=0; i < candidates.size(); ++i )
+    {
+        string path;
+        bool   is_dir = false;
+
+        if ( ! parse_include( candidates[i].line, path, is_dir ) )
+            continue;
+
+        Include include;
+        include.anchor       = candidates[i].anchor;
+        include.after_anchor = candidates[i].after;
+
+        if ( ! resolve_include( path, is_dir, filenames[ index ],
+                                file_depth[ index ] + 1, seen, include ) )
+        {
+            success = false;
+        }
+
+        file_includes.push_back( include );
+    }
+
+    includes[ index ].swap( file_includes );
+
+    return success;
+}
+
+
+bool CompositeConfigFile::resolve_include( const string &     path,
+                                           bool               is_dir,
+                                           const string &     parent_filename,
+                                           int                depth,
+                                           std::set<string> & seen,
+                                           Include &          include )
+{
+    if ( depth > MAX_INCLUDE_DEPTH )
+        return false;
+
+    string full_path = path;
+
+    if ( ! boost::starts_with( path, "/" ) )
+    {
+        size_t pos = parent_filename.rfind( '/' );
+
+        if ( pos != string::npos )
+            full_path = parent_filename.substr( 0, pos + 1 ) + path;
+    }
+
+    string_vec names;
+    bool       success = true;
+
+    if ( is_dir )
+    {
+        DIR * dir = opendir( full_path.c_str() );
+
+        if ( ! dir )
+            return errno == ENOENT; // A missing directory is not an error
+
+        struct dirent * dir_entry;
+
+        while ( ( dir_entry = readdir( dir ) ) )
+        {
+            string name = dir_entry->d_name;
+            string fragment = full_path + "/" + name;
+            struct stat st;
+
+            if ( accept_fragment( full_path, name ) &&
+                 stat( fragment.c_str(), &st ) == 0 && S_ISREG( st.st_mode ) )
+            {
+                names.push_back( fragment );
+            }
+        }
+
+        closedir( dir );
+        std::sort( names.begin(), names.end() );
+    }
+    else if ( full_path.find_first_of( "*?[" ) != string::npos )
+    {
+        glob_t glob_result;
+        int    result = glob( full_path.c_str(), 0, 0, &glob_result );
+
+        if ( result == 0 )
+        {
+            for ( size_t i=0; i < glob_result.gl_pathc; ++i )
+                names.push_back( glob_result.gl_pathv[i] );
+        }
+        else if ( result != GLOB_NOMATCH )
+        {
+            success = false;
+        }
+
+        globfree( &glob_result );
+    }
+    else
+    {
+        struct stat st;
+
+        if ( stat( full_path.c_str(), &st ) != 0 )
+            return false;
+
+        names.push_back( full_path );
+    }
+
+    for ( size_t i=0; i < names.size(); ++i )
+    {
+        if ( ! seen.insert( real_path( names[i] ) ).second )
+        {
+            // Included twice or in a loop
+
+            success = false;
+            continue;
+        }
+
+        include.files.push_back( files.size() );
+
+        files.push_back( create_file() );
+        filenames.push_back( names[i] );
+        includes.push_back( vector<Include>() );
+        file_depth.push_back( depth );
+    }
+
+    return success;
+}
+
+
+bool CompositeConfigFile::parse_include( const string & line,
+                                         string &       path_ret,
+                                         bool &         is_dir_ret )
+{
+    size_t start = line.find_first_not_of( WHITESPACE );
+
+    if ( start == string::npos )
+        return false;
+
+    size_t end = line.find_first_of( WHITESPACE, start );
+
+    if ( end == string::npos )
+        return false;
+
+    string directive = line.substr( start, end - start );
+
+    if ( directive == "#include" || directive == "@include" )
+        is_dir_ret = false;
+    else if ( directive == "#includedir" || directive == "@includedir" )
+        is_dir_ret = true;
+    else
+        return false;
+
+    path_ret = boost::trim_copy( line.substr( end ) );
+
+    if ( path_ret.size() >= 2 &&
+         boost::starts_with( path_ret, "\"" ) && boost::ends_with( path_ret, "\"" ) )
+    {
+        path_ret = path_ret.substr( 1, path_ret.size() - 2 );
+    }
+
+    return ! path_ret.empty();
+}
+
+
+bool CompositeConfigFile::accept_fragment( const string & dir, const string & name )
+{
+    (void) dir;
+
+    if ( name.empty() || boost::starts_with( name, "." ) || boost::ends_with( name, "~" ) )
+        return false;
+
+    if ( boost::ends_with( name, ".rpmnew"   ) ||
+         boost::ends_with( name, ".rpmsave"  ) ||
+         boost::ends_with( name, ".rpmorig"  ) ||
+         boost::contains ( name, ".dpkg-"    ) )
+    {
+        return false;
+    }
+
+    return true;
+}
+
+
+void CompositeConfigFile::update_merged_entries()
+{
+    merged.clear();
+
+    if ( ! files.empty() )
+        merge_entries( 0 );
+}
+
+
+void CompositeConfigFile::merge_entries( int index )
+{
+    CommentedConfigFile *   file          = files[ index ];
+    const vector<Include> & file_includes = includes[ index ];
+
+    typedef std::unordered_map<const CommentedConfigFile::Entry *, vector<int> > AnchorMap;
+
+    AnchorMap    before;
+    AnchorMap    after;
+    vector<bool> done( file_includes.size(), false );
+
+    for ( size_t i=0; i < file_includes.size(); ++i )
+    {
+        const Include & include = file_includes[i];
+
+        if ( include.anchor )
+            ( include.after_anchor ? after : before )[ include.anchor ].push_back( i );
+    }
+
+    for ( int i=0; i < file->get_entry_count(); ++i )
+    {
+        CommentedConfigFile::Entry * entry = file->get_entry( i );
+
+        for ( int pass = 0; pass < 2; ++pass )
+        {
+            AnchorMap & anchors = pass == 0 ? before : after;
+            AnchorMap::const_iterator it = anchors.find( entry );
+
+            if ( pass == 1 )
+                merged.push_back( entry );
+
+            if ( it == anchors.end() )
+                continue;
+
+            for ( size_t j=0; j < it->second.size(); ++j )
+            {
+                const Include & include = file_includes[ it->second[j] ];
+
+                for ( size_t k=0; k < include.files.size(); ++k )
+                    merge_entries( include.files[k] );
+
+                done[ it->second[j] ] = true;
+            }
+        }
+    }
+
+    // Includes from the footer and those whose entry is gone
+
+    for ( size_t i=0; i < file_includes.size(); ++i )
+    {
+        if ( ! done[i] )
+        {
+            for ( size_t k=0; k < file_includes[i].files.size(); ++k )
+                merge_entries( file_includes[i].files[k] );
+        }
+    }
+}
@@ -0,0 +1,235 @@
+/**
+ * CompositeConfigFile.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef CompositeConfigFile_h
+#define CompositeConfigFile_h
+
+#include <set>
+#include <boost/noncopyable.hpp>
+
+#include "CommentedConfigFile.h"
+
+#define MAX_INCLUDE_DEPTH       16
+
+
+/**
+ * Config file that may include other files or whole directories of
+ * fragments, e.g. /etc/sudoers with "#includedir /etc/sudoers.d" or a
+ * daemon config that includes a conf.d directory.
+ *
+ * Each file (the main file and each fragment) is a CommentedConfigFile of
+ * its own which keeps its own comments. This class presents all their
+ * entries as one merged list in the order in which they take effect: The
+ * entries of an included file appear at the position of the include
+ * directive. Each entry still belongs to its own file; use
+ * Entry::get_parent() to find out which one.
+ *
+ * All files on the same include level are read in parallel by a pool of
+ * threads.
+ *
+ * This class is meant to be subclassed: Override create_file() to use a
+ * derived CommentedConfigFile class for the files, parse_include() to
+ * support other include directives, and accept_fragment() to change which
+ * files of an included directory are used.
+ *
+ * Example:
+ *
+ *     CompositeConfigFile sudoers;
+ *     sudoers.read( "/etc/sudoers" );
+ *
+ *     for ( int i=0; i < sudoers.get_entry_count(); ++i )
+ *     {
+ *         cout << sudoers.get_source_filename( i ) << ": "
+ *              << sudoers.get_entry( i )->get_content() << endl;
+ *     }
+ **/
+class CompositeConfigFile: private boost::noncopyable
+{
+public:
+
+    /**
+     * Constructor.
+     **/
+    CompositeConfigFile();
+
+    /**
+     * Destructor. This deletes all files and their entries.
+     **/
+    virtual ~CompositeConfigFile();
+
+    /**
+     * Read 'filename' and all files it includes (recursively) and replace
+     * the current content with them.
+     *
+     * Return 'true' if success, 'false' if any file could not be read or
+     * parsed, if an included file does not exist, or if a file is included
+     * more than once (which includes loops). Included directories that do
+     * not exist are not an error.
+     **/
+    bool read( const string & filename );
+
+    /**
+     * Write back all files that were modified since they were read.
+     * Files that were not modified are not touched at all.
+     *
+     * Return 'true' if success, 'false' if any file could not be written.
+     **/
+    bool write();
+
+    /**
+     * Clear and delete all files.
+     **/
+    void clear();
+
+    /**
+     * Return the number of files, including the main file.
+     **/
+    int get_file_count() const { return files.size(); }
+
+    /**
+     * Return file no. 'index' or 0 if 'index' is out of range. File no. 0
+     * is the main file; the included files follow in the order in which
+     * they were read.
+     **/
+    CommentedConfigFile * get_file( int index ) const;
+
+    /**
+     * Return the main file or 0 if nothing was read yet.
+     **/
+    CommentedConfigFile * get_main_file() const { return get_file( 0 ); }
+
+    /**
+     * Return the number of entries of all files together.
+     **/
+    int get_entry_count() const { return merged.size(); }
+
+    /**
+     * Return entry no. 'index' of the merged entries or 0 if 'index' is
+     * out of range.
+     **/
+    CommentedConfigFile::Entry * get_entry( int index ) const;
+
+    /**
+     * Return the name of the file that entry no. 'index' of the merged
+     * entries belongs to.
+     **/
+    string get_source_filename( int index ) const;
+
+    /**
+     * Return the merged entries.
+     **/
+    const vector<CommentedConfigFile::Entry *> & get_entries() const
+        { return merged; }
+
+    /**
+     * Build the merged entries again. This is done automatically by
+     * read(); call it after adding, removing or moving entries in any of
+     * the files.
+     **/
+    void update_merged_entries();
+
+    /**
+     * Return the number of threads used to read the files (default: 0, one
+     * for each CPU).
+     **/
+    int get_thread_count() const { return thread_count; }
+
+    /**
+     * Set the number of threads used to read the files.
+     **/
+    void set_thread_count( int count ) { thread_count = count; }
+
+
+protected:
+
+    /**
+     * One include directive of a file: The file or files it includes and
+     * where their entries go.
+     **/
+    struct Include
+    {
+        Include():
+            anchor( 0 ),
+            after_anchor( false )
+            {}
+
+        CommentedConfigFile::Entry * anchor;       // 0: at the end
+        bool                         after_anchor; // or before it
+        vector<int>                  files;        // indexes in 'files'
+    };
+
+    /**
+     * Factory method to create one file.
+     *
+     * Derived classes can override this to create their own derived
+     * CommentedConfigFile class, e.g. one that creates its own entries.
+     **/
+    virtual CommentedConfigFile * create_file() { return new CommentedConfigFile(); }
+
+    /**
+     * Check if 'line' is an include directive. If it is, return 'true' and
+     * the path it includes in 'path_ret', and set 'is_dir_ret' if it
+     * includes a whole directory.
+     *
+     * 'line' is any line of a file, including comment lines.
+     *
+     * This default implementation recognizes the sudoers directives
+     * "#include", "#includedir", "@include" and "@includedir". Included
+     * file names may contain shell wildcards.
+     **/
+    virtual bool parse_include( const string & line,
+                                string &       path_ret,
+                                bool &         is_dir_ret );
+
+    /**
+     * Return 'true' if file 'name' in included directory 'dir' should be
+     * used. This default implementation ignores hidden files, editor
+     * backup files ending with "~" and files left over by package managers
+     * (".rpmnew", ".rpmsave", ".dpkg-*").
+     **/
+    virtual bool accept_fragment( const string & dir, const string & name );
+
+    /**
+     * Find the include directives in file no. 'index' and add the files
+     * they include. 'seen' contains the real paths of all files so far.
+     * Return 'false' if there was any error.
+     **/
+    bool find_includes( int index, std::set<string> & seen );
+
+    /**
+     * Add the files that 'path' includes (relative to the directory of
+     * 'parent_filename') to 'include'. Return 'false' if there was any
+     * error.
+     **/
+    bool resolve_include( const string &     path,
+                          bool               is_dir,
+                          const string &     parent_filename,
+                          int                depth,
+                          std::set<string> & seen,
+                          Include &          include );
+
+    /**
+     * Add the entries of file no. 'index' and all files it includes to
+     * 'merged'.
+     **/
+    void merge_entries( int index );
+
+
+    //
+    // Data members
+    //
+
+    vector<CommentedConfigFile *>           files;
+    string_vec                              filenames;  // for each file
+    vector<vector<Include> >                includes;   // for each file
+    vector<int>                             file_depth; // for each file
+    vector<CommentedConfigFile::Entry *>    merged;
+    int                                     thread_count;
+};
+
+
+#endif // CompositeConfigFile_h
@@ -0,0 +1,506 @@
+/**
+ * ConfigFileWatcher.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <sys/inotify.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "ConfigFileWatcher.h"
+
+#define INOTIFY_BUFFER_SIZE     65536
+
+#ifdef __linux__
+#  define INOTIFY_EVENTS        ( IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+                                  IN_CREATE      | IN_DELETE )
+#endif
+
+using std::vector;
+
+typedef std::lock_guard<std::mutex>           Lock;
+typedef std::lock_guard<std::recursive_mutex> ReloadLock;
+
+
+ConfigFileWatcher::ConfigFileWatcher( int debounce_millisec ):
+    debounce_millisec( debounce_millisec ),
+    poll_interval_millisec( DEFAULT_POLL_INTERVAL_MILLISEC ),
+    force_polling( false ),
+    running( false ),
+    inotify_fd( -1 )
+{
+    wakeup_pipe[0] = -1;
+    wakeup_pipe[1] = -1;
+}
+
+
+ConfigFileWatcher::~ConfigFileWatcher()
+{
+    stop();
+}
+
+
+bool ConfigFileWatcher::add( CommentedConfigFile * file, Callback callback )
+{
+    if ( ! file || file->get_filename().empty() )
+        return false;
+
+    const string & filename = file->get_filename();
+    size_t pos = filename.rfind( '/' );
+
+    Watch watch;
+    watch.file     = file;
+    watch.callback = callback;
+    watch.dir      = pos == string::npos ? "." : ( pos == 0 ? "/" : filename.substr( 0, pos ) );
+    watch.path     = watch.dir + "/" + filename.substr( pos == string::npos ? 0 : pos + 1 );
+    FileIO::stat( filename, watch.last_stat );
+
+    remove( file ); // in case it is already watched
+
+    Lock lock( watches_mutex );
+
+    if ( inotify_fd >= 0 )
+        watch.wd = watch_dir( watch.dir );
+
+    watches[ file ] = watch;
+    files_by_path.insert( std::make_pair( watch.path, file ) );
+    wake_up();
+
+    return true;
+}
+
+
+void ConfigFileWatcher::remove( CommentedConfigFile * file )
+{
+    // Wait until the watcher thread is done with any reload
+
+    ReloadLock reload_lock( reload_mutex );
+    Lock lock( watches_mutex );
+
+    std::map<CommentedConfigFile *, Watch>::iterator it = watches.find( file );
+
+    if ( it == watches.end() )
+        return;
+
+    typedef std::multimap<string, CommentedConfigFile *>::iterator PathIterator;
+    std::pair<PathIterator, PathIterator> range = files_by_path.equal_range( it->second.path );
+
+    for ( PathIterator path_it = range.first; path_it != range.second; ++path_it )
+    {
+        if ( path_it->second == file )
+        {
+            files_by_path.erase( path_it );
+            break;
+        }
+    }
+
+    int wd = it->second.wd;
+    watches.erase( it );
+
+    if ( wd >= 0 )
+        release_dir_watch( wd );
+}
+
+
+int ConfigFileWatcher::get_watch_count() const
+{
+    Lock lock( watches_mutex );
+
+    return watches.size();
+}
+
+
+bool ConfigFileWatcher::start()
+{
+    if ( running )
+        return true;
+
+    if ( pipe( wakeup_pipe ) != 0 )
+        return false;
+
+    for ( int i=0; i < 2; ++i )
+    {
+        fcntl( wakeup_pipe[i], F_SETFL, O_NONBLOCK );
+        fcntl( wakeup_pipe[i], F_SETFD, FD_CLOEXEC );
+    }
+
+    {
+        Lock lock( watches_mutex );
+
+#ifdef __linux__
+        if ( ! force_polling )
+            inotify_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+#endif
+
+        std::map<CommentedConfigFile *, Watch>::iterator it;
+
+        for ( it = watches.begin(); it != watches.end(); ++it )
+        {
+            if ( inotify_fd >= 0 )
+                it->second.wd = watch_dir( it->second.dir );
+
+            // Catch changes between add() and start()
+            schedule( it->second );
+        }
+
+        last_poll = Clock::now();
+    }
+
+    running = true;
+    thread  = std::thread( &ConfigFileWatcher::run, this );
+
+    return true;
+}
+
+
+void ConfigFileWatcher::stop()
+{
+    if ( ! running )
+        return;
+
+    running = false;
+    wake_up();
+
+    if ( thread.joinable() )
+        thread.join();
+
+    Lock lock( watches_mutex );
+
+    if ( inotify_fd >= 0 )
+        ::close( inotify_fd ); // This removes all inotify watches
+
+    inotify_fd = -1;
+    dir_by_wd.clear();
+    wd_by_dir.clear();
+
+    std::map<CommentedConfigFile *, Watch>::iterator it;
+
+    for ( it = watches.begin(); it != watches.end(); ++it )
+        it->second.wd = -1;
+
+    for ( int i=0; i < 2; ++i )
+    {
+        ::close( wakeup_pipe[i] );
+        wakeup_pipe[i] = -1;
+    }
+}
+
+
+void ConfigFileWatcher::wake_up()
+{
+    if ( wakeup_pipe[1] >= 0 )
+    {
+        char byte = 0;
+        ssize_t result = ::write( wakeup_pipe[1], &byte, 1 );
+        (void) result; // If the pipe is full, the thread will wake up anyway
+    }
+}
+
+
+int ConfigFileWatcher::watch_dir( const string & dir )
+{
+#ifdef __linux__
+
+    std::map<string, int>::iterator it = wd_by_dir.find( dir );
+
+    if ( it != wd_by_dir.end() )
+        return it->second;
+
+    int wd = inotify_add_watch( inotify_fd, dir.c_str(), INOTIFY_EVENTS );
+
+    if ( wd >= 0 )
+    {
+        wd_by_dir[ dir ] = wd;
+        dir_by_wd[ wd  ] = dir;
+    }
+
+    return wd;
+
+#else
+
+    return -1;
+
+#endif
+}
+
+
+void ConfigFileWatcher::release_dir_watch( int wd )
+{
+    std::map<CommentedConfigFile *, Watch>::iterator it;
+
+    for ( it = watches.begin(); it != watches.end(); ++it )
+    {
+        if ( it->second.wd == wd )
+            return; // still in use
+    }
+
+#ifdef __linux__
+    if ( inotify_fd >= 0 )
+        inotify_rm_watch( inotify_fd, wd );
+#endif
+
+    wd_by_dir.erase( dir_by_wd[ wd ] );
+    dir_by_wd.erase( wd );
+}
+
+
+void ConfigFileWatcher::schedule( Watch & watch )
+{
+    // Debouncing: Every new event moves the deadline further away, so a
+    // burst of events results in only one reload.
+
+    watch.pending  = true;
+    watch.deadline = Clock::now() + std::chrono::milliseconds( debounce_millisec );
+}
+
+
+void ConfigFileWatcher::run()
+{
+    while ( running )
+    {
+        int timeout = reload_due_files();
+
+        {
+            Lock lock( watches_mutex );
+            bool need_polling = false;
+
+            std::map<CommentedConfigFile *, Watch>::iterator it;
+
+            for ( it = watches.begin(); it != watches.end() && ! need_polling; ++it )
+                need_polling = ( it->second.wd < 0 );
+
+            if ( need_polling )
+            {
+                Clock::time_point next_poll =
+                    last_poll + std::chrono::milliseconds( poll_interval_millisec );
+
+                int poll_timeout = std::chrono::duration_cast<std::chrono::milliseconds>
+                    ( next_poll - Clock::now() ).count();
+
+                if ( poll_timeout <= 0 )
+                {
+                    poll_files();
+                    last_poll    = Clock::now();
+                    poll_timeout = poll_interval_millisec;
+                }
+
+                if ( timeout < 0 || poll_timeout < timeout )
+                    timeout = poll_timeout;
+            }
+        }
+
+        struct pollfd fds[2];
+        int nfds = 0;
+
+        fds[ nfds ].fd     = wakeup_pipe[0];
+        fds[ nfds ].events = POLLIN;
+        ++nfds;
+
+        if ( inotify_fd >= 0 )
+        {
+            fds[ nfds ].fd     = inotify_fd;
+            fds[ nfds ].events = POLLIN;
+            ++nfds;
+        }
+
+        int result = poll( fds, nfds, timeout );
+
+        if ( result < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            break;
+        }
+
+        if ( fds[0].revents & POLLIN )
+        {
+            char buffer[ 256 ];
+
+            while ( ::read( wakeup_pipe[0], buffer, sizeof( buffer ) ) > 0 )
+                ;
+        }
+
+        if ( nfds > 1 && ( fds[1].revents & POLLIN ) )
+            process_inotify_events();
+    }
+}
+
+
+void ConfigFileWatcher::process_inotify_events()
+{
+#ifdef __linux__
+
+    char buffer[ INOTIFY_BUFFER_SIZE ]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    while ( true )
+    {
+        ssize_t len = ::read( inotify_fd, buffer, sizeof( buffer ) );
+
+        if ( len <= 0 )
+            break;
+
+        Lock lock( watches_mutex );
+
+        for ( char * ptr = buffer; ptr < buffer + len; )
+        {
+            const struct inotify_event * event = (const struct inotify_event *) ptr;
+            ptr += sizeof( struct inotify_event ) + event->len;
+
+            if ( event->mask & IN_Q_OVERFLOW )
+            {
+                // Events were lost: Check everything
+
+                std::map<CommentedConfigFile *, Watch>::iterator it;
+
+                for ( it = watches.begin(); it != watches.end(); ++it )
+                    schedule( it->second );
+
+                continue;
+            }
+
+            if ( event->mask & IN_IGNORED )
+            {
+                // The directory is gone: Fall back to polling its files
+
+                std::map<CommentedConfigFile *, Watch>::iterator it;
+
+                for ( it = watches.begin(); it != watches.end(); ++it )
+                {
+                    if ( it->second.wd == event->wd )
+                    {
+                        it->second.wd = -1;
+                        schedule( it->second );
+                    }
+                }
+
+                wd_by_dir.erase( dir_by_wd[ event->wd ] );
+                dir_by_wd.erase( event->wd );
+                continue;
+            }
+
+            if ( event->len == 0 )
+                continue;
+
+            std::map<int, string>::iterator dir_it = dir_by_wd.find( event->wd );
+
+            if ( dir_it == dir_by_wd.end() )
+                continue;
+
+            string path = dir_it->second + "/" + event->name;
+
+            typedef std::multimap<string, CommentedConfigFile *>::iterator PathIterator;
+            std::pair<PathIterator, PathIterator> range = files_by_path.equal_range( path );
+
+            for ( PathIterator it = range.first; it != range.second; ++it )
+                schedule( watches[ it->second ] );
+        }
+    }
+
+#endif
+}
+
+
+void ConfigFileWatcher::poll_files()
+{
+    // watches_mutex is already locked by the caller
+
+    std::map<CommentedConfigFile *, Watch>::iterator it;
+
+    for ( it = watches.begin(); it != watches.end(); ++it )
+    {
+        Watch & watch = it->second;
+
+        if ( watch.wd >= 0 )
+            continue;
+
+        FileStat current;
+        FileIO::stat( watch.path, current );
+
+        if ( current != watch.last_stat && ( current.valid || watch.last_stat.valid ) )
+        {
+            watch.last_stat = current;
+            schedule( watch );
+        }
+    }
+}
+
+
+int ConfigFileWatcher::reload_due_files()
+{
+    vector<CommentedConfigFile *> due;
+    int timeout = -1;
+
+    {
+        Lock lock( watches_mutex );
+        Clock::time_point now = Clock::now();
+
+        std::map<CommentedConfigFile *, Watch>::iterator it;
+
+        for ( it = watches.begin(); it != watches.end(); ++it )
+        {
+            Watch & watch = it->second;
+
+            if ( ! watch.pending )
+                continue;
+
+            if ( watch.deadline <= now )
+            {
+                watch.pending = false;
+                due.push_back( watch.file );
+            }
+            else
+            {
+                int millisec = std::chrono::duration_cast<std::chrono::milliseconds>
+                    ( watch.deadline - now ).count() + 1;
+
+                if ( timeout < 0 || millisec < timeout )
+                    timeout = millisec;
+            }
+        }
+    }
+
+    for ( size_t i=0; i < due.size(); ++i )
+    {
+        ReloadLock reload_lock( reload_mutex );
+        Callback   callback;
+        string     path;
+
+        {
+            Lock lock( watches_mutex );
+            std::map<CommentedConfigFile *, Watch>::iterator it = watches.find( due[i] );
+
+            if ( it == watches.end() ) // removed in the meantime
+                continue;
+
+            callback = it->second.callback;
+            path     = it->second.path;
+        }
+
+        CommentedConfigFile::ReloadSummary summary = due[i]->reload();
+
+        {
+            Lock lock( watches_mutex );
+            std::map<CommentedConfigFile *, Watch>::iterator it = watches.find( due[i] );
+
+            if ( it != watches.end() )
+                FileIO::stat( path, it->second.last_stat );
+        }
+
+        if ( callback && ( summary.changed() || ! summary.success ) )
+            callback( due[i], summary );
+    }
+
+    return timeout;
+}
@@ -0,0 +1,239 @@
+/**
+ * ConfigFileWatcher.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef ConfigFileWatcher_h
+#define ConfigFileWatcher_h
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <boost/noncopyable.hpp>
+
+#include "CommentedConfigFile.h"
+
+#define DEFAULT_DEBOUNCE_MILLISEC       200
+#define DEFAULT_POLL_INTERVAL_MILLISEC  2000
+
+
+/**
+ * Class to watch any number of CommentedConfigFile instances for changes
+ * on disk and reload() them automatically.
+ *
+ * On Linux, this uses inotify on the directories of the watched files, so
+ * it also notices when an editor writes a new file and renames it over the
+ * old one. Where inotify is not available, or if a directory cannot be
+ * watched, it falls back to polling the files with stat().
+ *
+ * Bursts of events for the same file are debounced: A file is only
+ * reloaded when there were no more events for it for the debounce time.
+ *
+ * All watching, reloading and calling the callbacks happens in one single
+ * background thread. This means that the application has to make sure
+ * that it does not access a watched file while it might be reloaded,
+ * e.g. by locking a mutex of its own in the callback and wherever it uses
+ * the file.
+ *
+ * Example:
+ *
+ *     ConfigFileWatcher watcher;
+ *     hosts.read( "/etc/hosts" );
+ *
+ *     watcher.add( &hosts,
+ *         []( CommentedConfigFile * file,
+ *             const CommentedConfigFile::ReloadSummary & summary )
+ *         {
+ *             cout << file->get_filename() << " changed" << endl;
+ *         });
+ *
+ *     watcher.start();
+ **/
+class ConfigFileWatcher: private boost::noncopyable
+{
+public:
+
+    /**
+     * Callback that is called after a watched file was reloaded because it
+     * changed on disk, or when reloading it failed (e.g. because it was
+     * removed). It is called from the watcher thread.
+     **/
+    typedef std::function<void( CommentedConfigFile * file,
+                                const CommentedConfigFile::ReloadSummary & summary )> Callback;
+
+    /**
+     * Constructor. This does not start watching yet; use start() for that.
+     **/
+    ConfigFileWatcher( int debounce_millisec = DEFAULT_DEBOUNCE_MILLISEC );
+
+    /**
+     * Destructor. This stops the watcher thread. It does not delete any of
+     * the watched files.
+     **/
+    virtual ~ConfigFileWatcher();
+
+    /**
+     * Start watching 'file'. It has to have a filename already, i.e. it
+     * should have been read before. 'callback' is called after every
+     * reload. The watcher does not take over ownership of 'file'.
+     *
+     * This can be called before or after start().
+     *
+     * Return 'true' if success, 'false' if error.
+     **/
+    bool add( CommentedConfigFile * file, Callback callback );
+
+    /**
+     * Stop watching 'file'. When this returns, the watcher thread does not
+     * use 'file' anymore, so it is safe to delete it.
+     **/
+    void remove( CommentedConfigFile * file );
+
+    /**
+     * Return the number of watched files.
+     **/
+    int get_watch_count() const;
+
+    /**
+     * Start the watcher thread. Return 'true' if success, 'false' if
+     * error.
+     **/
+    bool start();
+
+    /**
+     * Stop the watcher thread and wait until it is finished.
+     **/
+    void stop();
+
+    /**
+     * Return 'true' if the watcher thread is running.
+     **/
+    bool is_running() const { return running; }
+
+    /**
+     * Return 'true' if inotify is used, 'false' if all files are polled.
+     **/
+    bool get_using_inotify() const { return inotify_fd >= 0; }
+
+    /**
+     * Use stat() polling even if inotify is available. This has to be set
+     * before start().
+     **/
+    void set_force_polling( bool force = true ) { force_polling = force; }
+
+    /**
+     * Return the debounce time in milliseconds.
+     **/
+    int get_debounce_millisec() const { return debounce_millisec; }
+
+    /**
+     * Return the interval in milliseconds for polling files with stat().
+     **/
+    int get_poll_interval_millisec() const { return poll_interval_millisec; }
+
+    /**
+     * Set the interval in milliseconds for polling files with stat().
+     **/
+    void set_poll_interval_millisec( int millisec )
+        { poll_interval_millisec = millisec; }
+
+
+protected:
+
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Everything the watcher knows about one watched file.
+     **/
+    struct Watch
+    {
+        Watch():
+            file( 0 ),
+            pending( false ),
+            wd( -1 )
+            {}
+
+        CommentedConfigFile * file;
+        Callback              callback;
+        string                dir;
+        string                path;     // dir + "/" + base name
+        FileStat              last_stat;
+        bool                  pending;
+        Clock::time_point     deadline;
+        int                   wd;       // inotify watch of 'dir' or -1
+    };
+
+    /**
+     * The main loop of the watcher thread.
+     **/
+    void run();
+
+    /**
+     * Read and process all pending inotify events.
+     **/
+    void process_inotify_events();
+
+    /**
+     * stat() all files that are not watched by inotify and schedule a
+     * reload for those that changed.
+     **/
+    void poll_files();
+
+    /**
+     * Reload all files whose debounce time expired. Return the number of
+     * milliseconds until the next one expires or -1 if there is none.
+     **/
+    int reload_due_files();
+
+    /**
+     * Schedule a reload of 'watch' after the debounce time.
+     **/
+    void schedule( Watch & watch );
+
+    /**
+     * Add an inotify watch for directory 'dir' if there is none yet and
+     * return its watch descriptor, or -1 if error.
+     **/
+    int watch_dir( const string & dir );
+
+    /**
+     * Remove inotify watch 'wd' if no watched file uses it anymore.
+     **/
+    void release_dir_watch( int wd );
+
+    /**
+     * Wake up the watcher thread.
+     **/
+    void wake_up();
+
+
+    //
+    // Data members
+    //
+
+    int                 debounce_millisec;
+    int                 poll_interval_millisec;
+    bool                force_polling;
+    std::atomic<bool>   running;
+
+    int                 inotify_fd;
+    int                 wakeup_pipe[2];
+    std::thread         thread;
+
+    std::map<CommentedConfigFile *, Watch>          watches;
+    std::multimap<string, CommentedConfigFile *>    files_by_path;
+    std::map<int, string>                           dir_by_wd;
+    std::map<string, int>                           wd_by_dir;
+    Clock::time_point                               last_poll;
+
+    mutable std::mutex          watches_mutex;  // for everything above
+    std::recursive_mutex        reload_mutex;   // held while reloading
+};
+
+
+#endif // ConfigFileWatcher_h
@@ -0,0 +1,583 @@
+/**
+ * FileIO.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#endif
+
+#include <functional>
+
+#include "FileIO.h"
+
+#define READ_CHUNK_SIZE         65536
+#define FNV_PRIME               1099511628211ULL
+#define TEMP_FILE_ATTEMPTS      100
+
+#ifndef IOV_MAX
+#  define IOV_MAX               1024
+#endif
+
+
+bool FileStat::operator==( const FileStat & other ) const
+{
+    return valid && other.valid          &&
+        dev        == other.dev         &&
+        ino        == other.ino         &&
+        size       == other.size        &&
+        mtime_sec  == other.mtime_sec   &&
+        mtime_nsec == other.mtime_nsec;
+}
+
+
+static void fill_file_stat( const struct stat & st, FileStat & stat_ret )
+{
+    stat_ret.valid      = true;
+    stat_ret.dev        = st.st_dev;
+    stat_ret.ino        = st.st_ino;
+    stat_ret.size       = st.st_size;
+    stat_ret.mtime_sec  = st.st_mtim.tv_sec;
+    stat_ret.mtime_nsec = st.st_mtim.tv_nsec;
+}
+
+
+bool FileIO::stat( const string & filename, FileStat & stat_ret )
+{
+    struct stat st;
+
+    stat_ret = FileStat();
+
+    if ( ::stat( filename.c_str(), &st ) != 0 )
+        return false;
+
+    fill_file_stat( st, stat_ret );
+
+    return true;
+}
+
+
+bool FileIO::read_file( const string & filename,
+                        string &       content_ret,
+                        FileStat *     stat_ret )
+{
+    content_ret.clear();
+
+    if ( stat_ret )
+        *stat_ret = FileStat();
+
+    int fd = ::open( filename.c_str(), O_RDONLY | O_CLOEXEC );
+
+    if ( fd < 0 )
+        return false;
+
+    struct stat st;
+
+    if ( fstat( fd, &st ) == 0 )
+    {
+        if ( stat_ret )
+            fill_file_stat( st, *stat_ret );
+
+        if ( st.st_size > 0 )
+            content_ret.reserve( st.st_size );
+    }
+
+    char buffer[ READ_CHUNK_SIZE ];
+    bool success = true;
+
+    while ( true )
+    {
+        ssize_t len = ::read( fd, buffer, sizeof( buffer ) );
+
+        if ( len > 0 )
+            content_ret.append( buffer, len );
+        else if ( len == 0 )
+            break;
+        else if ( errno != EINTR )
+        {
+            success = false;
+            break;
+        }
+    }
+
+    ::close( fd );
+
+    return success;
+}
+
+
+void FileIO::split_lines( const string & content, string_vec & lines_ret )
+{
+    size_t start = 0;
+
+    while ( start < content.size() )
+    {
+        size_t pos = content.find( '\n', start );
+
+        if ( pos == string::npos )
+        {
+            lines_ret.push_back( content.substr( start ) );
+            break;
+        }
+
+        lines_ret.push_back( content.substr( start, pos - start ) );
+        start = pos + 1;
+    }
+}
+
+
+bool FileIO::write_all( int fd, const char * buffer, size_t size )
+{
+    while ( size > 0 )
+    {
+        ssize_t len = ::write( fd, buffer, size );
+
+        if ( len < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            return false;
+        }
+
+        buffer += len;
+        size   -= len;
+    }
+
+    return true;
+}
+
+
+bool FileIO::copy_file( const string & from, const string & to )
+{
+    int in_fd = ::open( from.c_str(), O_RDONLY | O_CLOEXEC );
+
+    if ( in_fd < 0 )
+        return false;
+
+    int out_fd = ::open( to.c_str(),
+                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                         0666 );
+    if ( out_fd < 0 )
+    {
+        ::close( in_fd );
+        return false;
+    }
+
+    bool done    = false;
+    bool success = true;
+
+#ifdef __linux__
+
+    struct stat st;
+
+    if ( fstat( in_fd, &st ) == 0 )
+    {
+        // Let the kernel do the copying. copy_file_range() can even share
+        // the data blocks on file systems that support reflinks; sendfile()
+        // works on older kernels and across file systems.
+
+        off_t remaining = st.st_size;
+        bool  use_copy_file_range = true;
+        bool  error = false;
+
+        while ( remaining > 0 )
+        {
+            ssize_t len = -1;
+
+            if ( use_copy_file_range )
+            {
+                len = copy_file_range( in_fd, 0, out_fd, 0, remaining, 0 );
+
+                if ( len < 0 && errno != EINTR )
+                {
+                    use_copy_file_range = false;
+                    continue;
+                }
+            }
+            else
+            {
+                len = sendfile( out_fd, in_fd, 0, remaining );
+
+                if ( len < 0 && errno != EINTR )
+                {
+                    error = true;
+                    break;
+                }
+            }
+
+            if ( len == 0 )
+            {
+                // End of file: Either it shrunk in the meantime, or this is
+                // a file the kernel cannot copy (e.g. in /proc).
+
+                error = ( remaining == st.st_size );
+                break;
+            }
+
+            if ( len > 0 )
+                remaining -= len;
+        }
+
+        // If the kernel could not copy anything at all, fall back to the
+        // read() / write() loop below. If it failed after copying some of
+        // the data, give up; we would have to reposition both files.
+
+        if ( ! error || remaining < st.st_size )
+        {
+            done    = true;
+            success = ! error;
+        }
+    }
+
+#endif
+
+    if ( ! done )
+    {
+        char buffer[ READ_CHUNK_SIZE ];
+
+        while ( success )
+        {
+            ssize_t len = ::read( in_fd, buffer, sizeof( buffer ) );
+
+            if ( len == 0 )
+                break;
+
+            if ( len < 0 )
+            {
+                if ( errno != EINTR )
+                    success = false;
+
+                continue;
+            }
+
+            success = write_all( out_fd, buffer, len );
+        }
+    }
+
+    ::close( in_fd );
+
+    if ( ::close( out_fd ) != 0 )
+        success = false;
+
+    return success;
+}
+
+
+size_t FileIO::output_size( const string_vec & lines )
+{
+    size_t size = lines.size(); // newlines
+
+    for ( size_t i=0; i < lines.size(); ++i )
+        size += lines[i].size();
+
+    return size;
+}
+
+
+bool FileIO::write_lines( int fd, const string_vec & lines )
+{
+    if ( lines.empty() )
+        return true;
+
+    if ( lines.size() * 2 > IOV_MAX )
+    {
+        // Too many lines for a single writev(): Assemble everything in one
+        // buffer of exactly the right size and write that in one go.
+
+        string buffer;
+        buffer.reserve( output_size( lines ) );
+
+        for ( size_t i=0; i < lines.size(); ++i )
+        {
+            buffer += lines[i];
+            buffer += '\n';
+        }
+
+        return write_all( fd, buffer.data(), buffer.size() );
+    }
+
+    static char newline = '\n';
+    vector<struct iovec> iov( lines.size() * 2 );
+
+    for ( size_t i=0; i < lines.size(); ++i )
+    {
+        iov[ 2*i   ].iov_base = const_cast<char *>( lines[i].data() );
+        iov[ 2*i   ].iov_len  = lines[i].size();
+        iov[ 2*i+1 ].iov_base = &newline;
+        iov[ 2*i+1 ].iov_len  = 1;
+    }
+
+    struct iovec * pos   = &iov[0];
+    int            count = iov.size();
+
+    while ( count > 0 )
+    {
+        ssize_t len = ::writev( fd, pos, count );
+
+        if ( len < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            return false;
+        }
+
+        // Skip what was written completely, then adjust a partially
+        // written iovec
+
+        while ( count > 0 && (size_t) len >= pos->iov_len )
+        {
+            len -= pos->iov_len;
+            ++pos;
+            --count;
+        }
+
+        if ( count > 0 )
+        {
+            pos->iov_base = (char *) pos->iov_base + len;
+            pos->iov_len -= len;
+        }
+    }
+
+    return true;
+}
+
+
+bool FileIO::write_file( const string & filename, const string_vec & lines )
+{
+    int fd = ::open( filename.c_str(),
+                     O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     0666 );
+    if ( fd < 0 )
+        return false;
+
+    bool success = write_lines( fd, lines );
+
+    if ( ::close( fd ) != 0 )
+        success = false;
+
+    return success;
+}
+
+
+bool FileIO::write_content( const string & filename, const string & content )
+{
+    int fd = ::open( filename.c_str(),
+                     O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     0666 );
+    if ( fd < 0 )
+        return false;
+
+    bool success = write_all( fd, content.data(), content.size() );
+
+    if ( ::close( fd ) != 0 )
+        success = false;
+
+    return success;
+}
+
+
+string FileIO::resolve_symlink( const string & filename )
+{
+    struct stat st;
+
+    if ( lstat( filename.c_str(), &st ) == 0 && S_ISLNK( st.st_mode ) )
+    {
+        char * real_name = realpath( filename.c_str(), 0 );
+
+        if ( real_name )
+        {
+            string result( real_name );
+            free( real_name );
+
+            return result;
+        }
+    }
+
+    return filename;
+}
+
+
+string FileIO::dir_name( const string & filename )
+{
+    size_t pos = filename.rfind( '/' );
+
+    if ( pos == string::npos )
+        return ".";
+
+    if ( pos == 0 )
+        return "/";
+
+    return filename.substr( 0, pos );
+}
+
+
+string FileIO::temp_name( const string & filename )
+{
+    string dir  = dir_name( filename );
+    string base = filename.substr( filename.rfind( '/' ) + 1 );
+    static unsigned counter = 0;
+
+    char suffix[ 64 ];
+    snprintf( suffix, sizeof( suffix ), ".%d.%u.%lx",
+              (int) getpid(),
+              __sync_fetch_and_add( &counter, 1 ),
+              (unsigned long) time( 0 ) );
+
+    return dir + "/." + base + suffix;
+}
+
+
+/**
+ * Create a new temporary file next to 'filename' and return its file
+ * descriptor, or -1 if error. The name of the file is returned in
+ * 'temp_name_ret'.
+ *
+ * Unlike mkstemp(), this creates the file with mode 0666 minus the umask
+ * just like any other new file.
+ **/
+static int create_temp_file( const string & filename, string & temp_name_ret )
+{
+    for ( int attempt = 0; attempt < TEMP_FILE_ATTEMPTS; ++attempt )
+    {
+        temp_name_ret = FileIO::temp_name( filename );
+
+        int fd = ::open( temp_name_ret.c_str(),
+                         O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                         0666 );
+
+        if ( fd >= 0 || errno != EEXIST )
+            return fd;
+    }
+
+    return -1;
+}
+
+
+bool FileIO::sync_dir( const string & dir )
+{
+    int fd = ::open( dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+    if ( fd < 0 )
+        return false;
+
+    bool success = ( fsync( fd ) == 0 );
+    ::close( fd );
+
+    return success;
+}
+
+
+void FileIO::copy_owner_and_mode( const string & filename, int fd )
+{
+    struct stat st;
+
+    if ( ::stat( filename.c_str(), &st ) == 0 )
+    {
+        int result = fchown( fd, st.st_uid, st.st_gid );
+        (void) result;
+        fchmod( fd, st.st_mode & 07777 );
+    }
+}
+
+
+/**
+ * Write a new file next to 'filename' with 'write_content', sync it
+ * according to 'fsync_policy' and rename it to 'filename'.
+ **/
+static bool replace_file( const string &                   filename,
+                          std::function<bool( int fd )>    write_content,
+                          FsyncPolicy                      fsync_policy )
+{
+    string target = FileIO::resolve_symlink( filename );
+    string temp_name;
+    int    fd = create_temp_file( target, temp_name );
+
+    if ( fd < 0 )
+        return false;
+
+    FileIO::copy_owner_and_mode( target, fd );
+
+    bool success = write_content( fd );
+
+    if ( success && fsync_policy != FSYNC_NONE )
+        success = ( fsync( fd ) == 0 );
+
+    if ( ::close( fd ) != 0 )
+        success = false;
+
+    if ( success )
+        success = ( ::rename( temp_name.c_str(), target.c_str() ) == 0 );
+
+    if ( ! success )
+    {
+        ::unlink( temp_name.c_str() );
+        return false;
+    }
+
+    if ( fsync_policy == FSYNC_FILE_AND_DIR )
+        success = FileIO::sync_dir( FileIO::dir_name( target ) );
+
+    return success;
+}
+
+
+bool FileIO::write_file_atomic( const string &     filename,
+                                const string_vec & lines,
+                                FsyncPolicy        fsync_policy )
+{
+    return replace_file( filename,
+                         [&lines]( int fd ) { return write_lines( fd, lines ); },
+                         fsync_policy );
+}
+
+
+bool FileIO::write_content_atomic( const string & filename,
+                                   const string & content,
+                                   FsyncPolicy    fsync_policy )
+{
+    return replace_file( filename,
+                         [&content]( int fd )
+                             { return write_all( fd, content.data(), content.size() ); },
+                         fsync_policy );
+}
+
+
+uint64_t FileIO::hash( const char * data, size_t size, uint64_t hash )
+{
+    for ( size_t i=0; i < size; ++i )
+    {
+        hash ^= (unsigned char) data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+
+uint64_t FileIO::hash_lines( const string_vec & lines )
+{
+    uint64_t result = FNV_OFFSET_BASIS;
+
+    for ( size_t i=0; i < lines.size(); ++i )
+    {
+        result = hash( lines[i].data(), lines[i].size(), result );
+        result = hash( "\n", 1, result );
+    }
+
+    return result;
+}
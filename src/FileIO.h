@@ -0,0 +1,231 @@
+/**
+ * FileIO.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef FileIO_h
+#define FileIO_h
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using std::string;
+using std::vector;
+
+typedef vector<string> string_vec;
+
+
+/**
+ * Identification of a file on disk as far as the stat() system call knows
+ * it: Device, inode, size and modification time.
+ *
+ * This is used to find out if a file was changed on disk since it was read.
+ **/
+struct FileStat
+{
+    FileStat():
+        valid( false ),
+        dev(0),
+        ino(0),
+        size(0),
+        mtime_sec(0),
+        mtime_nsec(0)
+        {}
+
+    bool operator==( const FileStat & other ) const;
+    bool operator!=( const FileStat & other ) const
+        { return ! ( *this == other ); }
+
+    bool               valid;
+    unsigned long long dev;
+    unsigned long long ino;
+    long long          size;
+    long long          mtime_sec;
+    long               mtime_nsec;
+};
+
+
+/**
+ * What to sync to disk when writing a file atomically:
+ *
+ * FSYNC_NONE:          Nothing; leave it to the kernel. After a crash, the
+ *                      file may be empty or incomplete on some file systems.
+ *
+ * FSYNC_FILE:          The new file content before it is renamed into
+ *                      place. After a crash, the file has either the old or
+ *                      the new content.
+ *
+ * FSYNC_FILE_AND_DIR:  Also the directory after the rename, so the new
+ *                      content is guaranteed to be there after a crash.
+ **/
+enum FsyncPolicy
+{
+    FSYNC_NONE,
+    FSYNC_FILE,
+    FSYNC_FILE_AND_DIR
+};
+
+
+/**
+ * Low-level file I/O helpers using plain POSIX system calls.
+ *
+ * All methods are static; there is no need to create an instance of this
+ * class.
+ **/
+class FileIO
+{
+public:
+
+    /**
+     * Read the complete content of file 'filename' into 'content_ret'. If
+     * 'stat_ret' is non-null, store the stat() information of the file
+     * that was read there; this is taken from the same file descriptor, so
+     * it matches the content even if the file is replaced during the read.
+     *
+     * Return 'true' if success, 'false' if error.
+     **/
+    static bool read_file( const string & filename,
+                           string &       content_ret,
+                           FileStat *     stat_ret = 0 );
+
+    /**
+     * Split 'content' into lines the same way std::getline() does: A
+     * newline at the very end does not start another (empty) line.
+     **/
+    static void split_lines( const string & content, string_vec & lines_ret );
+
+    /**
+     * Get the stat() information for 'filename'.
+     * Return 'true' if success, 'false' if error.
+     **/
+    static bool stat( const string & filename, FileStat & stat_ret );
+
+    /**
+     * Copy file 'from' to file 'to', truncating 'to' if it exists.
+     *
+     * On Linux this lets the kernel do the copying with copy_file_range()
+     * or sendfile(), so the content never has to be copied to user space.
+     * Elsewhere (or if the kernel refuses) this falls back to a plain
+     * read() / write() loop.
+     *
+     * Return 'true' if success, 'false' if error.
+     **/
+    static bool copy_file( const string & from, const string & to );
+
+    /**
+     * Write 'size' bytes from 'buffer' to file descriptor 'fd', retrying
+     * on short writes and EINTR. Return 'true' if success, 'false' if
+     * error.
+     **/
+    static bool write_all( int fd, const char * buffer, size_t size );
+
+    /**
+     * Write 'lines' to file descriptor 'fd', each one followed by a
+     * newline. This uses as few system calls as possible: A single
+     * writev() with the iovecs pointing directly to the strings in
+     * 'lines' if there are not too many lines, otherwise one write() of a
+     * buffer of exactly the output size.
+     *
+     * Return 'true' if success, 'false' if error.
+     **/
+    static bool write_lines( int fd, const string_vec & lines );
+
+    /**
+     * Return the exact number of bytes write_lines() will write for
+     * 'lines'.
+     **/
+    static size_t output_size( const string_vec & lines );
+
+    /**
+     * Write 'lines' to file 'filename', truncating it if it exists.
+     * Return 'true' if success, 'false' if error.
+     **/
+    static bool write_file( const string & filename, const string_vec & lines );
+
+    /**
+     * Write 'content' as it is to file 'filename', truncating it if it
+     * exists. Return 'true' if success, 'false' if error.
+     **/
+    static bool write_content( const string & filename, const string & content );
+
+    /**
+     * Write 'lines' to a temporary file in the same directory as
+     * 'filename', sync it according to 'fsync_policy' and rename it to
+     * 'filename'. Other processes will always see either the complete old
+     * or the complete new content, never a partially written file.
+     *
+     * The permissions of an existing file are preserved. If 'filename' is
+     * a symlink, the file it points to is replaced, not the symlink.
+     *
+     * Return 'true' if success, 'false' if error. In the error case, the
+     * original file is unchanged.
+     **/
+    static bool write_file_atomic( const string & filename,
+                                   const string_vec & lines,
+                                   FsyncPolicy fsync_policy = FSYNC_FILE );
+
+    /**
+     * Like write_file_atomic(), but write 'content' as it is.
+     **/
+    static bool write_content_atomic( const string & filename,
+                                      const string & content,
+                                      FsyncPolicy fsync_policy = FSYNC_FILE );
+
+    /**
+     * Return the name of the file that 'filename' points to if it is a
+     * symlink, or 'filename' itself if it is not.
+     **/
+    static string resolve_symlink( const string & filename );
+
+    /**
+     * Return the directory part of 'filename'.
+     **/
+    static string dir_name( const string & filename );
+
+    /**
+     * Return a name for a temporary file next to 'filename' that is
+     * unlikely to exist. It still has to be created with O_EXCL.
+     **/
+    static string temp_name( const string & filename );
+
+    /**
+     * Give the file open as 'fd' the owner (if we are allowed to) and the
+     * permissions of file 'filename' if that exists. This is used to
+     * replace a file with a new one.
+     **/
+    static void copy_owner_and_mode( const string & filename, int fd );
+
+    /**
+     * fsync() directory 'dir'. Return 'true' if success, 'false' if error.
+     **/
+    static bool sync_dir( const string & dir );
+
+    /**
+     * Return a 64 bit FNV-1a hash of 'size' bytes in 'data'. Pass the
+     * result of a previous call as 'hash' to continue hashing more data.
+     **/
+    static uint64_t hash( const char * data,
+                          size_t       size,
+                          uint64_t     hash = FNV_OFFSET_BASIS );
+
+    /**
+     * Return the hash of 'content'.
+     **/
+    static uint64_t hash( const string & content )
+        { return hash( content.data(), content.size() ); }
+
+    /**
+     * Return the hash of what write_lines() would write for 'lines'
+     * without assembling that output anywhere. This is the same as the
+     * hash of the content of a file written from 'lines'.
+     **/
+    static uint64_t hash_lines( const string_vec & lines );
+
+    static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+};
+
+
+#endif // FileIO_h
@@ -0,0 +1,613 @@
+/**
+ * ParseCache.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <typeinfo>
+
+#include "ParseCache.h"
+
+#define ALIGNMENT       8
+
+
+/**
+ * Return 'offset' rounded up to the next multiple of ALIGNMENT.
+ **/
+static size_t align( size_t offset )
+{
+    return ( offset + ALIGNMENT - 1 ) & ~( (size_t) ALIGNMENT - 1 );
+}
+
+
+ParseCache::ParseCache( const string & dir ):
+    dir( dir ),
+    verify_content( false ),
+    hits( 0 ),
+    misses( 0 )
+{
+    mkdir( dir.c_str(), 0755 );
+}
+
+
+ParseCache::~ParseCache()
+{
+}
+
+
+string ParseCache::cache_key( const string & filename )
+{
+    char * real_name = realpath( filename.c_str(), 0 );
+
+    if ( ! real_name )
+        return filename;
+
+    string result( real_name );
+    free( real_name );
+
+    return result;
+}
+
+
+string ParseCache::get_cache_filename( const string & filename ) const
+{
+    char name[ 32 ];
+    snprintf( name, sizeof( name ), "%016llx",
+              (unsigned long long) FileIO::hash( cache_key( filename ) ) );
+
+    return dir + "/" + name + PARSE_CACHE_SUFFIX;
+}
+
+
+bool ParseCache::load( CommentedConfigFile * file, const string & filename )
+{
+    FileStat stat;
+
+    if ( ! FileIO::stat( filename, stat ) )
+    {
+        ++misses;
+        return false;
+    }
+
+    string key = cache_key( filename );
+    int    fd  = ::open( get_cache_filename( filename ).c_str(), O_RDONLY | O_CLOEXEC );
+
+    if ( fd < 0 )
+    {
+        ++misses;
+        return false;
+    }
+
+    struct stat st;
+    void * data = MAP_FAILED;
+    size_t size = 0;
+
+    if ( fstat( fd, &st ) == 0 && st.st_size > 0 )
+    {
+        size = st.st_size;
+        data = mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+
+    ::close( fd );
+
+    if ( data == MAP_FAILED )
+    {
+        ++misses;
+        return false;
+    }
+
+    const char *   buffer = (const char *) data;
+    const Header * header = check_buffer( buffer, size );
+
+    bool valid = header &&
+        ( header->flags & CACHE_DISK_STATE ) &&
+        header->dev        == stat.dev       &&
+        header->ino        == stat.ino       &&
+        header->size       == stat.size      &&
+        header->mtime_sec  == stat.mtime_sec &&
+        header->mtime_nsec == stat.mtime_nsec;
+
+    if ( valid )
+    {
+        const char * path = buffer + header->strings_offset + header->path.offset;
+        valid = ( key.compare( 0, string::npos, path, header->path.size ) == 0 );
+    }
+
+    if ( valid && verify_content )
+    {
+        string   content;
+        FileStat content_stat;
+
+        valid = FileIO::read_file( filename, content, &content_stat ) &&
+            content_stat == stat &&
+            FileIO::hash( content ) == header->content_hash;
+    }
+
+    if ( valid )
+        valid = deserialize( file, buffer, size );
+
+    munmap( data, size );
+
+    if ( ! valid )
+    {
+        ++misses;
+        return false;
+    }
+
+    file->filename = filename;
+    ++hits;
+
+    return true;
+}
+
+
+bool ParseCache::store( CommentedConfigFile * file )
+{
+    if ( file->filename.empty()   ||
+         file->modified           ||
+         ! file->orig_on_disk     ||
+         ! file->disk_hash_valid  ||
+         ! file->disk_stat.valid )
+    {
+        return false;
+    }
+
+    string buffer;
+
+    if ( ! serialize( file, cache_key( file->filename ), buffer ) )
+        return false;
+
+    // Nobody is hurt if this is lost in a crash: It will just be parsed
+    // again.
+
+    return FileIO::write_content_atomic( get_cache_filename( file->filename ),
+                                         buffer, FSYNC_NONE );
+}
+
+
+void ParseCache::remove( const string & filename )
+{
+    unlink( get_cache_filename( filename ).c_str() );
+}
+
+
+bool ParseCache::serialize( CommentedConfigFile * file,
+                            const string &        key_filename,
+                            string &              buffer_ret )
+{
+    string              strings;
+    vector<StringRef>   refs;
+    vector<EntryRecord> records;
+    Header              header;
+
+    auto add_string = [&strings]( const string & str )
+        {
+            StringRef ref;
+            ref.offset = strings.size();
+            ref.size   = str.size();
+            strings   += str;
+
+            return ref;
+        };
+
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, PARSE_CACHE_MAGIC, sizeof( header.magic ) );
+
+    header.version      = PARSE_CACHE_VERSION;
+    header.header_size  = sizeof( Header );
+    header.dev          = file->disk_stat.dev;
+    header.ino          = file->disk_stat.ino;
+    header.size         = file->disk_stat.size;
+    header.mtime_sec    = file->disk_stat.mtime_sec;
+    header.mtime_nsec   = file->disk_stat.mtime_nsec;
+    header.content_hash = file->disk_hash;
+
+    if ( file->orig_on_disk && file->disk_hash_valid && ! file->modified )
+        header.flags |= CACHE_DISK_STATE;
+
+    header.path           = add_string( key_filename );
+    header.type_name      = add_string( typeid( *file ).name() );
+    header.comment_marker = add_string( file->comment_marker );
+
+    header.header_first = refs.size();
+    header.header_count = file->header_comments.size();
+
+    for ( size_t i=0; i < file->header_comments.size(); ++i )
+        refs.push_back( add_string( file->header_comments[i] ) );
+
+    header.footer_first = refs.size();
+    header.footer_count = file->footer_comments.size();
+
+    for ( size_t i=0; i < file->footer_comments.size(); ++i )
+        refs.push_back( add_string( file->footer_comments[i] ) );
+
+    records.reserve( file->entries.size() );
+    string_vec fields;
+
+    for ( size_t i=0; i < file->entries.size(); ++i )
+    {
+        CommentedConfigFile::Entry * entry = file->entries[i];
+        EntryRecord record;
+
+        memset( &record, 0, sizeof( record ) );
+        record.line_no = entry->line_no;
+
+        record.comment_first = refs.size();
+        const string_vec & comment_before = entry->get_comment_before();
+        record.comment_count = comment_before.size();
+
+        for ( size_t j=0; j < comment_before.size(); ++j )
+            refs.push_back( add_string( comment_before[j] ) );
+
+        fields.clear();
+        record.content      = add_string( entry->content );
+        record.line_comment = add_string( entry->get_line_comment() );
+
+        if ( entry->parsed && ! entry->parse_failed &&
+             entry->save_cache_fields( fields ) )
+        {
+            record.flags        = CACHE_ENTRY_FIELDS;
+            record.field_first  = refs.size();
+            record.field_count  = fields.size();
+            record.line         = add_string( entry->rare ? entry->rare->orig_line
+                                                                : entry->no_string );
+
+            for ( size_t j=0; j < fields.size(); ++j )
+                refs.push_back( add_string( fields[j] ) );
+        }
+        else
+        {
+            record.line = add_string( entry->get_orig_line() );
+        }
+
+        records.push_back( record );
+    }
+
+    size_t refs_offset    = align( sizeof( Header ) );
+    size_t entries_offset = align( refs_offset    + refs.size()    * sizeof( StringRef   ) );
+    size_t strings_offset = align( entries_offset + records.size() * sizeof( EntryRecord ) );
+    size_t total_size     = strings_offset + strings.size();
+
+    if ( total_size > UINT32_MAX )
+        return false;
+
+    header.refs_offset    = refs_offset;
+    header.ref_count      = refs.size();
+    header.entries_offset = entries_offset;
+    header.entry_count    = records.size();
+    header.strings_offset = strings_offset;
+    header.strings_size   = strings.size();
+    header.total_size     = total_size;
+
+    buffer_ret.assign( total_size, '\0' );
+    char * buffer = &buffer_ret[0];
+
+    memcpy( buffer, &header, sizeof( header ) );
+
+    if ( ! refs.empty() )
+        memcpy( buffer + refs_offset, &refs[0], refs.size() * sizeof( StringRef ) );
+
+    if ( ! records.empty() )
+        memcpy( buffer + entries_offset, &records[0], records.size() * sizeof( EntryRecord ) );
+
+    if ( ! strings.empty() )
+        memcpy( buffer + strings_offset, strings.data(), strings.size() );
+
+    return true;
+}
+
+
+const ParseCache::Header *
+ParseCache::check_buffer( const char * data, size_t size )
+{
+    if ( size < sizeof( Header ) || ( (uintptr_t) data ) % ALIGNMENT != 0 )
+        return 0;
+
+    const Header * header = (const Header *) data;
+
+    if ( memcmp( header->magic, PARSE_CACHE_MAGIC, sizeof( header->magic ) ) != 0 ||
+         header->version     != PARSE_CACHE_VERSION ||
+         header->header_size != sizeof( Header )    ||
+         header->total_size  >  size )
+    {
+        return 0;
+    }
+
+    // All offsets are 32 bit, so this cannot overflow in 64 bit arithmetic
+
+    uint64_t refs_end    = (uint64_t) header->refs_offset    + (uint64_t) header->ref_count   * sizeof( StringRef   );
+    uint64_t entries_end = (uint64_t) header->entries_offset + (uint64_t) header->entry_count * sizeof( EntryRecord );
+    uint64_t strings_end = (uint64_t) header->strings_offset + header->strings_size;
+
+    if ( header->refs_offset    < sizeof( Header )           ||
+         header->refs_offset    % ALIGNMENT != 0             ||
+         header->entries_offset % ALIGNMENT != 0             ||
+         refs_end               > header->entries_offset     ||
+         entries_end            > header->strings_offset     ||
+         strings_end            > header->total_size )
+    {
+        return 0;
+    }
+
+    uint32_t strings_size = header->strings_size;
+
+    auto valid_string = [strings_size]( const StringRef & ref )
+        {
+            return (uint64_t) ref.offset + ref.size <= strings_size;
+        };
+
+    auto valid_range = [header]( uint32_t first, uint32_t count )
+        {
+            return (uint64_t) first + count <= header->ref_count;
+        };
+
+    if ( ! valid_string( header->path )                                ||
+         ! valid_string( header->type_name )                           ||
+         ! valid_string( header->comment_marker )                      ||
+         ! valid_range ( header->header_first, header->header_count )  ||
+         ! valid_range ( header->footer_first, header->footer_count ) )
+    {
+        return 0;
+    }
+
+    const StringRef * refs = (const StringRef *) ( data + header->refs_offset );
+
+    for ( uint32_t i=0; i < header->ref_count; ++i )
+    {
+        if ( ! valid_string( refs[i] ) )
+            return 0;
+    }
+
+    const EntryRecord * records = (const EntryRecord *) ( data + header->entries_offset );
+
+    for ( uint32_t i=0; i < header->entry_count; ++i )
+    {
+        const EntryRecord & record = records[i];
+
+        if ( ! valid_range ( record.comment_first, record.comment_count ) ||
+             ! valid_range ( record.field_first,   record.field_count   ) ||
+             ! valid_string( record.content      )                        ||
+             ! valid_string( record.line_comment )                        ||
+             ! valid_string( record.line         ) )
+        {
+            return 0;
+        }
+    }
+
+    return header;
+}
+
+
+bool ParseCache::deserialize( CommentedConfigFile * file,
+                              const char *          data,
+                              size_t                size )
+{
+    const Header * header = check_buffer( data, size );
+
+    if ( ! header )
+        return false;
+
+    const char *        strings = data + header->strings_offset;
+    const StringRef *   refs    = (const StringRef *)   ( data + header->refs_offset    );
+    const EntryRecord * records = (const EntryRecord *) ( data + header->entries_offset );
+
+    auto get_string = [strings]( const StringRef & ref )
+        {
+            return string( strings + ref.offset, ref.size );
+        };
+
+    auto get_strings = [refs, &get_string]( uint32_t first, uint32_t count, string_vec & result )
+        {
+            result.clear();
+            result.reserve( count );
+
+            for ( uint32_t i=0; i < count; ++i )
+                result.push_back( get_string( refs[ first + i ] ) );
+        };
+
+    if ( get_string( header->type_name      ) != typeid( *file ).name() ||
+         get_string( header->comment_marker ) != file->comment_marker )
+    {
+        return false;
+    }
+
+
+    // Create all entries before anything is changed in 'file', so it is
+    // unchanged if any of them fails.
+
+    vector<CommentedConfigFile::Entry *> new_entries;
+    new_entries.reserve( header->entry_count );
+
+    string_vec comment_before;
+    string_vec fields;
+    bool       success = true;
+
+    for ( uint32_t i=0; i < header->entry_count && success; ++i )
+    {
+        const EntryRecord & record = records[i];
+        CommentedConfigFile::Entry * entry = 0;
+
+        get_strings( record.comment_first, record.comment_count, comment_before );
+
+        if ( record.flags & CACHE_ENTRY_FIELDS )
+        {
+            entry = file->create_entry();
+
+            if ( entry )
+            {
+                get_strings( record.field_first, record.field_count, fields );
+
+                entry->content = get_string( record.content );
+                entry->line_no = record.line_no;
+
+                if ( ! comment_before.empty() || record.line_comment.size > 0 || record.line.size > 0 )
+                {
+                    CommentedConfigFile::Entry::RareData & rare = entry->get_rare_data();
+
+                    rare.comment_before = comment_before;
+                    rare.line_comment   = get_string( record.line_comment );
+                    rare.orig_line      = get_string( record.line );
+                }
+
+                if ( ! entry->load_cache_fields( fields ) )
+                {
+                    delete entry;
+                    entry = 0;
+                }
+                else
+                {
+                    entry->modified = false;
+                }
+            }
+        }
+        else
+        {
+            entry = file->create_parsed_entry( get_string( record.line ),
+                                               comment_before,
+                                               record.line_no );
+        }
+
+        if ( entry )
+            new_entries.push_back( entry );
+        else
+            success = false;
+    }
+
+    if ( ! success )
+    {
+        for ( size_t i=0; i < new_entries.size(); ++i )
+            delete new_entries[i];
+
+        return false;
+    }
+
+    file->clear_all();
+    get_strings( header->header_first, header->header_count, file->header_comments );
+    get_strings( header->footer_first, header->footer_count, file->footer_comments );
+
+    for ( size_t i=0; i < new_entries.size(); ++i )
+        file->append( new_entries[i] );
+
+    file->filename = get_string( header->path );
+    file->modified = false;
+
+    if ( header->flags & CACHE_DISK_STATE )
+    {
+        FileStat stat;
+        stat.valid      = true;
+        stat.dev        = header->dev;
+        stat.ino        = header->ino;
+        stat.size       = header->size;
+        stat.mtime_sec  = header->mtime_sec;
+        stat.mtime_nsec = header->mtime_nsec;
+
+        file->disk_stat       = stat;
+        file->disk_hash       = header->content_hash;
+        file->disk_hash_valid = true;
+        file->orig_on_disk    = true;
+    }
+    else
+    {
+        file->invalidate_disk_state();
+    }
+
+    if ( file->diff_enabled )
+        file->save_orig();
+
+    return true;
+}
+
+
+
+ParseCache::View::View( const char * data, size_t size ):
+    data( 0 ),
+    size( 0 )
+{
+    if ( check_buffer( data, size ) )
+    {
+        this->data = data;
+        this->size = size;
+    }
+}
+
+
+ParseCache::View::string_ref ParseCache::View::get_filename() const
+{
+    return data ? get_string( header()->path ) : string_ref();
+}
+
+
+int ParseCache::View::get_header_comment_count() const
+{
+    return data ? header()->header_count : 0;
+}
+
+
+ParseCache::View::string_ref ParseCache::View::get_header_comment( int i ) const
+{
+    return get_string( refs()[ header()->header_first + i ] );
+}
+
+
+int ParseCache::View::get_footer_comment_count() const
+{
+    return data ? header()->footer_count : 0;
+}
+
+
+ParseCache::View::string_ref ParseCache::View::get_footer_comment( int i ) const
+{
+    return get_string( refs()[ header()->footer_first + i ] );
+}
+
+
+int ParseCache::View::get_entry_count() const
+{
+    return data ? header()->entry_count : 0;
+}
+
+
+ParseCache::View::string_ref ParseCache::View::get_content( int entry ) const
+{
+    return get_string( record( entry ).content );
+}
+
+
+ParseCache::View::string_ref ParseCache::View::get_line_comment( int entry ) const
+{
+    return get_string( record( entry ).line_comment );
+}
+
+
+int ParseCache::View::get_comment_count( int entry ) const
+{
+    return record( entry ).comment_count;
+}
+
+
+ParseCache::View::string_ref ParseCache::View::get_comment( int entry, int i ) const
+{
+    return get_string( refs()[ record( entry ).comment_first + i ] );
+}
+
+
+int ParseCache::View::get_field_count( int entry ) const
+{
+    return record( entry ).field_count;
+}
+
+
+ParseCache::View::string_ref ParseCache::View::get_field( int entry, int i ) const
+{
+    return get_string( refs()[ record( entry ).field_first + i ] );
+}
@@ -0,0 +1,329 @@
+/**
+ * ParseCache.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef ParseCache_h
+#define ParseCache_h
+
+#include <atomic>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include "CommentedConfigFile.h"
+
+#define PARSE_CACHE_MAGIC       "CCFCACHE"
+#define PARSE_CACHE_VERSION     2
+#define PARSE_CACHE_SUFFIX      ".ccfc"
+
+
+/**
+ * Persistent cache of parsed config files, so a program that reads the
+ * same files at every start does not have to parse them again as long as
+ * they did not change.
+ *
+ * For each file, the cache directory contains one cache file with the
+ * header comments, the entries with their comments and line comments, and
+ * the footer comments in a compact binary format. That format only uses
+ * offsets, no pointers, so it is used directly from a read-only mmap() of
+ * the cache file.
+ *
+ * A cache file is only used if the path, device, inode, size and
+ * modification time of the config file are still the same as when it was
+ * cached. Optionally, the content hash is also checked; that still needs
+ * to read the file, but it saves parsing it.
+ *
+ * The entries are restored with the Entry::save_cache_fields() and
+ * Entry::load_cache_fields() virtual methods. Entries that do not support
+ * that are parsed again from their original line, so derived entry
+ * classes are always handled correctly, even if they do not know about
+ * this cache.
+ *
+ * This class is thread-safe: Several threads can load and store files at
+ * the same time.
+ *
+ * Example:
+ *
+ *     ParseCache cache( "/var/cache/myagent" );
+ *     CommentedConfigFile file;
+ *
+ *     file.set_parse_cache( &cache );
+ *     file.read( "/etc/myagent.conf" ); // Parsed only if changed
+ **/
+class ParseCache: private boost::noncopyable
+{
+public:
+
+    /**
+     * Constructor. 'dir' is the directory for the cache files. It is
+     * created if it does not exist yet.
+     **/
+    ParseCache( const string & dir );
+
+    /**
+     * Destructor.
+     **/
+    virtual ~ParseCache();
+
+    /**
+     * Return the directory for the cache files.
+     **/
+    const string & get_dir() const { return dir; }
+
+    /**
+     * Return 'true' if the content hash of a file is checked before its
+     * cache file is used (default: 'false').
+     **/
+    bool get_verify_content() const { return verify_content; }
+
+    /**
+     * Enable or disable checking the content hash. This reads every file,
+     * but it also catches changes that did not change the size and the
+     * modification time.
+     **/
+    void set_verify_content( bool enabled = true ) { verify_content = enabled; }
+
+    /**
+     * Replace the content of 'file' with the cached content of 'filename'
+     * if there is a valid cache file for it. This is what read() does if
+     * the file has a parse cache.
+     *
+     * Return 'true' if the file was loaded from the cache, 'false' if it
+     * has to be read and parsed.
+     **/
+    bool load( CommentedConfigFile * file, const string & filename );
+
+    /**
+     * Write a cache file for 'file' which has to be unchanged since it was
+     * read. read() does this after parsing a file if it has a parse cache.
+     *
+     * Return 'true' if success, 'false' if error.
+     **/
+    bool store( CommentedConfigFile * file );
+
+    /**
+     * Remove the cache file for 'filename'.
+     **/
+    void remove( const string & filename );
+
+    /**
+     * Return the name of the cache file for 'filename'.
+     **/
+    string get_cache_filename( const string & filename ) const;
+
+    /**
+     * Return the number of load() calls that used the cache or that did
+     * not find a valid cache file, respectively.
+     **/
+    int get_hits()   const { return hits;   }
+    int get_misses() const { return misses; }
+
+    /**
+     * Serialize the content of 'file' into 'buffer_ret' in the cache
+     * format. 'key_filename' is the path that is stored in the buffer;
+     * the stat() information and the content hash are taken from the
+     * state of 'file' when it was read. If 'file' was modified since then,
+     * the buffer is not marked as what is on disk, so load() will not
+     * accept it.
+     *
+     * Return 'true' if success, 'false' if the file is too large for the
+     * cache format.
+     **/
+    static bool serialize( CommentedConfigFile * file,
+                           const string &        key_filename,
+                           string &              buffer_ret );
+
+    /**
+     * Replace the content of 'file' with the content serialized in the
+     * 'size' bytes at 'data'. The buffer is checked completely before
+     * anything is changed, so this can safely be used for data from disk
+     * or shared memory. The data have to be aligned to 8 bytes.
+     *
+     * Return 'true' if success, 'false' if the buffer is invalid or was
+     * created for a different file class.
+     **/
+    static bool deserialize( CommentedConfigFile * file,
+                             const char *          data,
+                             size_t                size );
+
+
+protected:
+
+    /**
+     * Reference to a string in the string area of a cache buffer.
+     **/
+    struct StringRef
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    /**
+     * Fixed-size part of a cache buffer. It is followed by the string
+     * reference table, the entry table and the string area.
+     **/
+    struct Header
+    {
+        char      magic[8];
+        uint32_t  version;
+        uint32_t  header_size;      // sizeof( Header ) to catch ABI changes
+        uint64_t  total_size;
+
+        uint64_t  dev;
+        uint64_t  ino;
+        int64_t   size;
+        int64_t   mtime_sec;
+        int64_t   mtime_nsec;
+        uint64_t  content_hash;
+
+        StringRef path;
+        StringRef type_name;        // typeid() of the file class
+        StringRef comment_marker;
+
+        uint32_t  header_first;     // in the reference table
+        uint32_t  header_count;
+        uint32_t  footer_first;
+        uint32_t  footer_count;
+
+        uint32_t  refs_offset;
+        uint32_t  ref_count;
+        uint32_t  entries_offset;
+        uint32_t  entry_count;
+        uint32_t  strings_offset;
+        uint32_t  strings_size;
+
+        uint32_t  flags;
+        uint32_t  reserved;
+    };
+
+    enum HeaderFlags
+    {
+        CACHE_DISK_STATE = 0x01     // content is what is on disk
+    };
+
+    /**
+     * One entry in the entry table.
+     *
+     * Entries with CACHE_ENTRY_FIELDS are restored with
+     * load_cache_fields(); all others are parsed again from 'line'. The
+     * content and the line comment are stored for all of them for View.
+     **/
+    struct EntryRecord
+    {
+        uint32_t  flags;
+        int32_t   line_no;
+        uint32_t  comment_first;    // in the reference table
+        uint32_t  comment_count;
+        uint32_t  field_first;      // in the reference table
+        uint32_t  field_count;
+        StringRef content;
+        StringRef line_comment;
+        StringRef line;             // orig line (if fields: only if it
+                                    // cannot be reconstructed)
+    };
+
+    enum EntryFlags
+    {
+        CACHE_ENTRY_FIELDS = 0x01
+    };
+
+    /**
+     * Return the header of the serialized content in the 'size' bytes at
+     * 'data' if all of it is consistent, 0 if not.
+     **/
+    static const Header * check_buffer( const char * data, size_t size );
+
+    /**
+     * Return the path that 'filename' is stored with in the cache.
+     **/
+    static string cache_key( const string & filename );
+
+
+public:
+
+    /**
+     * Read-only access to a buffer in the cache format without copying
+     * anything, e.g. in a cache file or a shared memory segment that is
+     * mapped into memory. All strings point directly into the buffer, so
+     * they are only valid as long as it is.
+     *
+     * The fields of an entry are what its save_cache_fields() stored,
+     * e.g. the columns of a ColumnConfigFile entry. Entries that do not
+     * support that have no fields.
+     **/
+    class View
+    {
+    public:
+
+        typedef boost::string_ref string_ref;
+
+        /**
+         * Constructor. 'data' has to be aligned to 8 bytes. If the
+         * buffer is not consistent, the view is invalid and empty.
+         **/
+        View( const char * data, size_t size );
+
+        /**
+         * Return 'true' if the buffer is consistent.
+         **/
+        bool is_valid() const { return data != 0; }
+
+        /**
+         * Return the buffer.
+         **/
+        const char * get_data() const { return data; }
+        size_t       get_size() const { return size; }
+
+        /**
+         * Return the path of the file that was serialized.
+         **/
+        string_ref get_filename() const;
+
+        int        get_header_comment_count() const;
+        string_ref get_header_comment( int i ) const;
+
+        int        get_footer_comment_count() const;
+        string_ref get_footer_comment( int i ) const;
+
+        int        get_entry_count() const;
+        string_ref get_content     ( int entry ) const;
+        string_ref get_line_comment( int entry ) const;
+
+        int        get_comment_count( int entry ) const;
+        string_ref get_comment      ( int entry, int i ) const;
+
+        int        get_field_count( int entry ) const;
+        string_ref get_field      ( int entry, int i ) const;
+
+    private:
+
+        const Header *      header()  const { return (const Header *) data; }
+        const StringRef *   refs()    const
+            { return (const StringRef *) ( data + header()->refs_offset ); }
+        const EntryRecord & record( int entry ) const
+            { return ( (const EntryRecord *) ( data + header()->entries_offset ) )[ entry ]; }
+
+        string_ref get_string( const StringRef & ref ) const
+            { return string_ref( data + header()->strings_offset + ref.offset, ref.size ); }
+
+        const char * data;  // 0 if invalid
+        size_t       size;
+    };
+
+
+protected:
+
+    //
+    // Data members
+    //
+
+    string              dir;
+    bool                verify_content;
+    std::atomic<int>    hits;
+    std::atomic<int>    misses;
+};
+
+
+#endif // ParseCache_h
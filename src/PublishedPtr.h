@@ -0,0 +1,207 @@
+/**
+ * PublishedPtr.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef PublishedPtr_h
+#define PublishedPtr_h
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+
+/**
+ * Shared pointer to an immutable object that one writer thread replaces
+ * from time to time and any number of reader threads get a copy of,
+ * without any lock on either side.
+ *
+ * std::atomic_load() and std::atomic_store() on a shared_ptr are not
+ * lock-free (libstdc++ uses a global pool of mutexes for them), so readers
+ * would wait for the writer and for each other. Here, the shared_ptr is
+ * kept in a holder object that is never changed once it is published, and
+ * the writer only exchanges an atomic raw pointer to the holder. Each
+ * reader announces the holder it is about to copy the shared_ptr from in
+ * a hazard pointer, and the writer only deletes replaced holders that no
+ * reader announced.
+ *
+ * load() never waits: It only retries if the writer replaced the pointer
+ * in the very moment it was read. Copying the shared_ptr then just
+ * increments its reference count atomically.
+ *
+ * store() must only be called from one thread at a time.
+ **/
+template<class T>
+class PublishedPtr: private boost::noncopyable
+{
+public:
+
+    /**
+     * Constructor. load() returns 0 until something is stored.
+     **/
+    PublishedPtr():
+        current( 0 ),
+        hazards( 0 )
+        {}
+
+    /**
+     * Destructor. No reader may use this any more.
+     **/
+    ~PublishedPtr()
+        {
+            delete current.load();
+
+            for ( size_t i=0; i < retired.size(); ++i )
+                delete retired[i];
+
+            HazardRecord * record = hazards.load();
+
+            while ( record )
+            {
+                HazardRecord * next = record->next;
+                delete record;
+                record = next;
+            }
+        }
+
+    /**
+     * Return the pointer that was last stored or 0 if there is none yet.
+     * This is safe to call from any thread at any time.
+     **/
+    std::shared_ptr<const T> load() const
+        {
+            HazardRecord * record = acquire_record();
+            const Holder * holder = current.load();
+
+            while ( true )
+            {
+                record->hazard.store( holder );
+                const Holder * again = current.load();
+
+                if ( again == holder )
+                    break;
+
+                holder = again; // Replaced in the meantime: Try that one
+            }
+
+            std::shared_ptr<const T> ptr;
+
+            if ( holder )
+                ptr = holder->ptr;
+
+            record->hazard.store( 0 );
+            record->active.store( false, std::memory_order_release );
+
+            return ptr;
+        }
+
+    /**
+     * Replace the pointer with 'ptr'. Readers that still use the old one
+     * keep it until they release it.
+     **/
+    void store( const std::shared_ptr<const T> & ptr )
+        {
+            const Holder * old_holder = current.exchange( new Holder( ptr ) );
+
+            if ( old_holder )
+                retired.push_back( old_holder );
+
+            reclaim();
+        }
+
+
+private:
+
+    /**
+     * Published shared_ptr; never changed once it is published.
+     **/
+    struct Holder
+    {
+        Holder( const std::shared_ptr<const T> & ptr ): ptr( ptr ) {}
+
+        std::shared_ptr<const T> ptr;
+    };
+
+    /**
+     * Hazard pointer of one reader. Records are never deleted before this
+     * object; a reader uses any one that is not active.
+     **/
+    struct HazardRecord
+    {
+        HazardRecord(): hazard( 0 ), active( true ), next( 0 ) {}
+
+        std::atomic<const Holder *> hazard;
+        std::atomic<bool>           active;
+        HazardRecord *              next;
+    };
+
+    /**
+     * Find a record that is not active and make it active, or add a new
+     * one if all of them are in use.
+     **/
+    HazardRecord * acquire_record() const
+        {
+            for ( HazardRecord * record = hazards.load(); record; record = record->next )
+            {
+                bool inactive = false;
+
+                if ( ! record->active.load( std::memory_order_relaxed ) &&
+                     record->active.compare_exchange_strong( inactive, true ) )
+                {
+                    return record;
+                }
+            }
+
+            HazardRecord * record = new HazardRecord();
+            record->next = hazards.load();
+
+            while ( ! hazards.compare_exchange_weak( record->next, record ) )
+                ;
+
+            return record;
+        }
+
+    /**
+     * Delete the replaced holders that no reader is about to use.
+     **/
+    void reclaim()
+        {
+            std::vector<const Holder *> in_use;
+
+            for ( HazardRecord * record = hazards.load(); record; record = record->next )
+            {
+                const Holder * holder = record->hazard.load();
+
+                if ( holder )
+                    in_use.push_back( holder );
+            }
+
+            size_t kept = 0;
+
+            for ( size_t i=0; i < retired.size(); ++i )
+            {
+                if ( std::find( in_use.begin(), in_use.end(), retired[i] ) != in_use.end() )
+                    retired[ kept++ ] = retired[i];
+                else
+                    delete retired[i];
+            }
+
+            retired.resize( kept );
+        }
+
+
+    //
+    // Data members
+    //
+
+    std::atomic<const Holder *>                 current;
+    mutable std::atomic<HazardRecord *>         hazards;
+    std::vector<const Holder *>                 retired; // only by the writer
+};
+
+
+#endif // PublishedPtr_h
@@ -0,0 +1,412 @@
+/**
+ * SharedConfig.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "SharedConfig.h"
+
+
+/**
+ * Content of the control segment. The generation is only accessed with
+ * atomic operations; it is the only thing that ever changes.
+ **/
+struct SharedConfigControl
+{
+    char     magic[8];
+    uint64_t generation;
+};
+
+
+/**
+ * Return the name of the shared memory segment for 'generation' of
+ * 'name', or of the control segment for generation 0.
+ **/
+static string segment_name( const string & name, uint64_t generation = 0 )
+{
+    if ( generation == 0 )
+        return "/" + name;
+
+    return "/" + name + "." + std::to_string( generation );
+}
+
+
+/**
+ * Map the control segment open as 'fd'. Return 0 if error.
+ **/
+static SharedConfigControl * map_control( int fd, bool writable )
+{
+    void * data = mmap( 0, sizeof( SharedConfigControl ),
+                        writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                        MAP_SHARED, fd, 0 );
+
+    return data == MAP_FAILED ? 0 : (SharedConfigControl *) data;
+}
+
+
+
+
+SharedConfigPublisher::SharedConfigPublisher( const string & name ):
+    name( name ),
+    mode( 0600 ),
+    control( 0 )
+{
+}
+
+
+SharedConfigPublisher::~SharedConfigPublisher()
+{
+    if ( control )
+        munmap( control, sizeof( SharedConfigControl ) );
+}
+
+
+bool SharedConfigPublisher::open_control()
+{
+    if ( control )
+        return true;
+
+    string control_name = segment_name( name );
+    int    fd = shm_open( control_name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode );
+
+    if ( fd < 0 && errno == EEXIST )
+    {
+        // Left over from a previous publisher: Only use it if that was the
+        // same user, not somebody who wants to feed subscribers with
+        // content of their own
+
+        fd = shm_open( control_name.c_str(), O_RDWR | O_CLOEXEC, 0 );
+    }
+
+    if ( fd < 0 )
+        return false;
+
+    struct stat st;
+    bool   created = false;
+
+    if ( fstat( fd, &st ) != 0 || st.st_uid != geteuid() || fchmod( fd, mode ) != 0 )
+    {
+        close( fd );
+        return false;
+    }
+
+    if ( st.st_size < (off_t) sizeof( SharedConfigControl ) )
+    {
+        if ( ftruncate( fd, sizeof( SharedConfigControl ) ) != 0 )
+        {
+            close( fd );
+            return false;
+        }
+
+        created = true;
+    }
+
+    control = map_control( fd, true );
+    close( fd );
+
+    if ( ! control )
+        return false;
+
+    if ( created || memcmp( control->magic, SHARED_CONFIG_MAGIC, sizeof( control->magic ) ) != 0 )
+    {
+        __atomic_store_n( &control->generation, 0, __ATOMIC_RELEASE );
+        memcpy( control->magic, SHARED_CONFIG_MAGIC, sizeof( control->magic ) );
+    }
+
+    return true;
+}
+
+
+uint64_t SharedConfigPublisher::get_generation() const
+{
+    return control ? __atomic_load_n( &control->generation, __ATOMIC_ACQUIRE ) : 0;
+}
+
+
+bool SharedConfigPublisher::publish( CommentedConfigFile * file )
+{
+    if ( ! open_control() )
+        return false;
+
+    string buffer;
+
+    if ( ! ParseCache::serialize( file, file->get_filename(), buffer ) )
+        return false;
+
+    uint64_t old_generation = get_generation();
+    uint64_t new_generation = old_generation;
+    string   new_name;
+    int      fd = -1;
+
+    for ( int attempt = 0; fd < 0 && attempt < SHARED_CONFIG_UPDATE_ATTEMPTS; ++attempt )
+    {
+        new_name = segment_name( name, ++new_generation );
+        fd = shm_open( new_name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode );
+
+        if ( fd < 0 && errno == EEXIST )
+        {
+            // Left over from a publisher that crashed before it could
+            // publish it. If it belongs to somebody else, it cannot be
+            // unlinked in the sticky /dev/shm: Skip that generation.
+
+            if ( shm_unlink( new_name.c_str() ) == 0 )
+                fd = shm_open( new_name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode );
+        }
+        else if ( fd < 0 )
+        {
+            return false;
+        }
+    }
+
+    if ( fd < 0 )
+        return false;
+
+    // Not restricted by the umask, so the content is exactly as readable
+    // as intended
+
+    bool success = fchmod( fd, mode ) == 0 &&
+        ftruncate( fd, buffer.size() ) == 0 &&
+        FileIO::write_all( fd, buffer.data(), buffer.size() );
+
+    close( fd );
+
+    if ( ! success )
+    {
+        shm_unlink( new_name.c_str() );
+        return false;
+    }
+
+    // Only now subscribers can see the new segment, and it is complete
+
+    __atomic_store_n( &control->generation, new_generation, __ATOMIC_RELEASE );
+
+    if ( old_generation > 0 )
+        shm_unlink( segment_name( name, old_generation ).c_str() );
+
+    return true;
+}
+
+
+void SharedConfigPublisher::remove()
+{
+    open_control();
+    uint64_t generation = get_generation();
+
+    if ( generation > 0 )
+        shm_unlink( segment_name( name, generation ).c_str() );
+
+    shm_unlink( segment_name( name ).c_str() );
+
+    if ( control )
+    {
+        // Tell subscribers to look for the control segment of a new
+        // publisher; this one is unlinked and will never change again
+
+        __atomic_store_n( &control->generation, 0, __ATOMIC_RELEASE );
+        munmap( control, sizeof( SharedConfigControl ) );
+        control = 0;
+    }
+}
+
+
+
+
+SharedConfigSubscriber::SharedConfigSubscriber( const string & name ):
+    name( name ),
+    control( 0 ),
+    control_dev( 0 ),
+    control_ino( 0 ),
+    control_uid( 0 ),
+    control_replaced( false ),
+    generation( 0 )
+{
+}
+
+
+SharedConfigSubscriber::~SharedConfigSubscriber()
+{
+    close_control();
+}
+
+
+bool SharedConfigSubscriber::open_control()
+{
+    if ( control )
+        return true;
+
+    int fd = shm_open( segment_name( name ).c_str(), O_RDONLY | O_CLOEXEC, 0 );
+
+    if ( fd < 0 )
+        return false;
+
+    struct stat st;
+
+    if ( fstat( fd, &st ) == 0 && st.st_size >= (off_t) sizeof( SharedConfigControl ) )
+    {
+        control     = map_control( fd, false );
+        control_dev = st.st_dev;
+        control_ino = st.st_ino;
+        control_uid = st.st_uid;
+    }
+
+    close( fd );
+
+    if ( control && memcmp( control->magic, SHARED_CONFIG_MAGIC, sizeof( control->magic ) ) != 0 )
+    {
+        // Not initialized yet: Try again next time
+
+        munmap( control, sizeof( SharedConfigControl ) );
+        control = 0;
+    }
+
+    return control != 0;
+}
+
+
+void SharedConfigSubscriber::close_control()
+{
+    if ( control )
+    {
+        munmap( control, sizeof( SharedConfigControl ) );
+        control = 0;
+    }
+}
+
+
+bool SharedConfigSubscriber::reopen_control()
+{
+    if ( ! control )
+        return false;
+
+    int fd = shm_open( segment_name( name ).c_str(), O_RDONLY | O_CLOEXEC, 0 );
+
+    if ( fd < 0 )
+    {
+        // Removed, and there is no new publisher yet: Whatever is opened
+        // next time is the control segment of a new publisher
+
+        close_control();
+        control_replaced = true;
+
+        return false;
+    }
+
+    struct stat st;
+    bool   same = fstat( fd, &st ) == 0 &&
+        st.st_dev == control_dev && st.st_ino == control_ino;
+
+    close( fd );
+
+    if ( same )
+        return false;
+
+    close_control();
+
+    // The generations of the new publisher start again at 1, so they
+    // can't be compared with the one that is attached
+
+    control_replaced = true;
+
+    return open_control();
+}
+
+
+uint64_t SharedConfigSubscriber::get_published_generation()
+{
+    if ( ! open_control() )
+        return 0;
+
+    uint64_t latest = __atomic_load_n( &control->generation, __ATOMIC_ACQUIRE );
+
+    if ( latest == 0 && reopen_control() )
+        latest = __atomic_load_n( &control->generation, __ATOMIC_ACQUIRE );
+
+    return latest;
+}
+
+
+bool SharedConfigSubscriber::update()
+{
+    for ( int attempt = 0; attempt < SHARED_CONFIG_UPDATE_ATTEMPTS; ++attempt )
+    {
+        uint64_t latest = get_published_generation();
+
+        if ( latest == 0 || ( latest == generation && ! control_replaced ) )
+            return false;
+
+        int fd = shm_open( segment_name( name, latest ).c_str(), O_RDONLY | O_CLOEXEC, 0 );
+
+        if ( fd < 0 )
+        {
+            // A newer generation was published in the meantime, and this
+            // one is already gone, or the publisher was removed and there
+            // is a new one: Try again with the current control segment.
+
+            reopen_control();
+            continue;
+        }
+
+        struct stat st;
+        void * data = MAP_FAILED;
+        size_t size = 0;
+
+        // Only trust segments of the same owner as the control segment:
+        // Anybody can create a segment with the name of the next
+        // generation.
+
+        if ( fstat( fd, &st ) == 0 && st.st_size > 0 && st.st_uid == control_uid )
+        {
+            size = st.st_size;
+            data = mmap( 0, size, PROT_READ, MAP_SHARED, fd, 0 );
+        }
+
+        close( fd );
+
+        if ( data == MAP_FAILED )
+            return false;
+
+        ParseCache::View * new_view = new ParseCache::View( (const char *) data, size );
+
+        if ( ! new_view->is_valid() )
+        {
+            delete new_view;
+            munmap( data, size );
+
+            return false;
+        }
+
+        std::shared_ptr<const ParseCache::View> ptr( new_view,
+            [data, size]( const ParseCache::View * view )
+            {
+                delete view;
+                munmap( data, size );
+            } );
+
+        std::atomic_store( &view, ptr );
+        generation       = latest;
+        control_replaced = false;
+
+        return true;
+    }
+
+    return false;
+}
+
+
+bool SharedConfigSubscriber::copy_to( CommentedConfigFile * file ) const
+{
+    std::shared_ptr<const ParseCache::View> current = get_view();
+
+    if ( ! current )
+        return false;
+
+    return ParseCache::deserialize( file, current->get_data(), current->get_size() );
+}
@@ -0,0 +1,248 @@
+/**
+ * SharedConfig.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef SharedConfig_h
+#define SharedConfig_h
+
+#include <atomic>
+#include <memory>
+#include <sys/types.h>
+#include <boost/noncopyable.hpp>
+
+#include "ParseCache.h"
+
+#define SHARED_CONFIG_MAGIC             "CCFSHARE"
+#define SHARED_CONFIG_UPDATE_ATTEMPTS   100
+
+
+/**
+ * Layout of the control segment; defined in SharedConfig.cc.
+ **/
+struct SharedConfigControl;
+
+
+/**
+ * Publisher of a CommentedConfigFile in POSIX shared memory, so any number
+ * of processes can use it with a SharedConfigSubscriber without parsing it
+ * themselves, and without each of them having a copy of its content.
+ *
+ * Each call to publish() puts the file into a new shared memory segment in
+ * the ParseCache format, which only uses offsets and is never changed once
+ * it is published, and then increments the generation counter in a small
+ * control segment. Subscribers check that counter to find new versions;
+ * the segment of the previous version is unlinked, but it stays valid for
+ * subscribers that still use it until they detach from it.
+ *
+ * With name "myagent-hosts", the segments are /dev/shm/myagent-hosts for
+ * the control segment and /dev/shm/myagent-hosts.<generation> for the
+ * content.
+ *
+ * There must only be one publisher for a name at the same time. The
+ * segments are only readable by the same user unless set_mode() says
+ * otherwise. Subscribers only use generations that were created by the
+ * owner of the control segment.
+ *
+ * Example:
+ *
+ *     SharedConfigPublisher publisher( "myagent-hosts" );
+ *     hosts.read( "/etc/hosts" );
+ *     publisher.publish( &hosts );
+ **/
+class SharedConfigPublisher: private boost::noncopyable
+{
+public:
+
+    /**
+     * Constructor. 'name' is the name of the shared memory segments
+     * without any slash.
+     **/
+    SharedConfigPublisher( const string & name );
+
+    /**
+     * Destructor. This does not remove the published file; use remove()
+     * for that.
+     **/
+    virtual ~SharedConfigPublisher();
+
+    /**
+     * Return the name of the shared memory segments.
+     **/
+    const string & get_name() const { return name; }
+
+    /**
+     * Set the permissions of the shared memory segments, e.g. 0644 to let
+     * every local user read the content. The default is 0600, i.e. only
+     * subscribers running as the same user can read it. Call this before
+     * the first publish().
+     *
+     * Use the permissions of the published file or stricter ones: Anybody
+     * who can read the segments can read the complete file.
+     **/
+    void set_mode( mode_t new_mode ) { mode = new_mode & 0666; }
+
+    /**
+     * Return the permissions of the shared memory segments.
+     **/
+    mode_t get_mode() const { return mode; }
+
+    /**
+     * Publish the current content of 'file' as the next generation.
+     * Return 'true' if success, 'false' if error.
+     **/
+    bool publish( CommentedConfigFile * file );
+
+    /**
+     * Return the generation that was last published or 0 if there is
+     * none.
+     **/
+    uint64_t get_generation() const;
+
+    /**
+     * Remove the shared memory segments. Subscribers that are attached to
+     * a generation can still use it. Subscribers notice this and switch to
+     * the control segment of the next publisher with the same name.
+     **/
+    void remove();
+
+
+protected:
+
+    /**
+     * Open or create the control segment. An existing one is only used if
+     * it belongs to the effective user of this process. Return 'true' if
+     * success, 'false' if error.
+     **/
+    bool open_control();
+
+
+    //
+    // Data members
+    //
+
+    string                  name;
+    mode_t                  mode;
+    SharedConfigControl *   control;
+};
+
+
+/**
+ * Subscriber to a CommentedConfigFile that a SharedConfigPublisher
+ * published, typically in another process.
+ *
+ * The content is accessed with a ParseCache::View directly in the shared
+ * memory segment; nothing is copied or parsed. update() attaches to the
+ * latest generation if there is a new one. get_view() can be called from
+ * any thread, and each view stays valid as long as there is a shared_ptr
+ * to it, no matter how many new generations are published in the
+ * meantime.
+ *
+ * update() must only be called from one thread at a time.
+ *
+ * Example:
+ *
+ *     SharedConfigSubscriber subscriber( "myagent-hosts" );
+ *     subscriber.update();
+ *
+ *     std::shared_ptr<const ParseCache::View> hosts = subscriber.get_view();
+ *
+ *     for ( int i=0; hosts && i < hosts->get_entry_count(); ++i )
+ *         cout << hosts->get_content( i ) << endl;
+ **/
+class SharedConfigSubscriber: private boost::noncopyable
+{
+public:
+
+    /**
+     * Constructor. 'name' is the name that was used for the publisher.
+     * This does not attach to anything yet; use update() for that.
+     **/
+    SharedConfigSubscriber( const string & name );
+
+    /**
+     * Destructor. Views that are still in use stay valid.
+     **/
+    virtual ~SharedConfigSubscriber();
+
+    /**
+     * Return the name of the shared memory segments.
+     **/
+    const string & get_name() const { return name; }
+
+    /**
+     * Attach to the latest published generation if it is newer than the
+     * current one or if it comes from a new publisher after the previous
+     * one was removed. Return 'true' if a new generation was attached,
+     * 'false' if there is no new one or if error.
+     **/
+    bool update();
+
+    /**
+     * Return the view of the generation that is currently attached or 0
+     * if there is none.
+     **/
+    std::shared_ptr<const ParseCache::View> get_view() const
+        { return std::atomic_load( &view ); }
+
+    /**
+     * Return the generation that is currently attached or 0 if there is
+     * none.
+     **/
+    uint64_t get_generation() const { return generation; }
+
+    /**
+     * Return the latest published generation or 0 if there is none. This
+     * is cheap enough to be polled to find out when to call update().
+     **/
+    uint64_t get_published_generation();
+
+    /**
+     * Replace the content of 'file' with a copy of the generation that is
+     * currently attached, e.g. to modify it. Return 'true' if success,
+     * 'false' if error.
+     **/
+    bool copy_to( CommentedConfigFile * file ) const;
+
+
+protected:
+
+    /**
+     * Open the control segment if it is not open yet. Return 'true' if
+     * success, 'false' if error.
+     **/
+    bool open_control();
+
+    /**
+     * Unmap the control segment if it is open.
+     **/
+    void close_control();
+
+    /**
+     * Check if the control segment was removed or replaced by a new
+     * publisher since it was opened, and if so, open the current one.
+     * Return 'true' if a different control segment is open now, 'false'
+     * if it is still the same one or if there is none.
+     **/
+    bool reopen_control();
+
+
+    //
+    // Data members
+    //
+
+    string                  name;
+    SharedConfigControl *   control;
+    dev_t                   control_dev;
+    ino_t                   control_ino;
+    uid_t                   control_uid;
+    bool                    control_replaced;
+    std::atomic<uint64_t>   generation;
+
+    std::shared_ptr<const ParseCache::View> view; // only via atomic_load/store
+};
+
+
+#endif // SharedConfig_h
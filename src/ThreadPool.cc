@@ -0,0 +1,163 @@
+/**
+ * ThreadPool.cc
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+typedef std::unique_lock<std::mutex> Lock;
+
+
+// The pool and the worker index of the current thread if it is a worker
+// thread
+
+static thread_local ThreadPool * current_pool   = 0;
+static thread_local int          current_worker = -1;
+
+
+ThreadPool::ThreadPool( int thread_count ):
+    next_worker( 0 ),
+    unfinished( 0 ),
+    queued( 0 ),
+    stopping( false )
+{
+    if ( thread_count <= 0 )
+        thread_count = std::max( 1U, std::thread::hardware_concurrency() );
+
+    for ( int i=0; i < thread_count; ++i )
+        workers.push_back( std::unique_ptr<Worker>( new Worker() ) );
+
+    // Start the threads only after all queues exist: They steal from each
+    // other right away
+
+    for ( int i=0; i < thread_count; ++i )
+        workers[i]->thread = std::thread( &ThreadPool::run, this, i );
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+
+    {
+        Lock lock( mutex );
+        stopping = true;
+    }
+
+    task_available.notify_all();
+
+    for ( size_t i=0; i < workers.size(); ++i )
+        workers[i]->thread.join();
+}
+
+
+void ThreadPool::submit( Task task )
+{
+    int index = current_pool == this ?
+        current_worker : next_worker++ % workers.size();
+
+    ++unfinished;
+
+    {
+        std::lock_guard<std::mutex> lock( workers[ index ]->mutex );
+        workers[ index ]->tasks.push_back( task );
+    }
+
+    {
+        Lock lock( mutex );
+        ++queued;
+    }
+
+    task_available.notify_one();
+}
+
+
+void ThreadPool::wait()
+{
+    Lock lock( mutex );
+
+    while ( unfinished > 0 )
+        all_done.wait( lock );
+}
+
+
+bool ThreadPool::take_task( int index, Task & task_ret )
+{
+    {
+        // Our own queue: The newest task first
+
+        Worker & worker = *workers[ index ];
+        std::lock_guard<std::mutex> lock( worker.mutex );
+
+        if ( ! worker.tasks.empty() )
+        {
+            task_ret = worker.tasks.back();
+            worker.tasks.pop_back();
+
+            return true;
+        }
+    }
+
+    for ( size_t i=1; i < workers.size(); ++i )
+    {
+        // Somebody else's queue: The oldest task first
+
+        Worker & victim = *workers[ ( index + i ) % workers.size() ];
+        std::lock_guard<std::mutex> lock( victim.mutex );
+
+        if ( ! victim.tasks.empty() )
+        {
+            task_ret = victim.tasks.front();
+            victim.tasks.pop_front();
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void ThreadPool::run( int index )
+{
+    current_pool   = this;
+    current_worker = index;
+
+    while ( true )
+    {
+        Task task;
+
+        if ( take_task( index, task ) )
+        {
+            {
+                Lock lock( mutex );
+                --queued;
+            }
+
+            task();
+
+            if ( --unfinished == 0 )
+            {
+                Lock lock( mutex );
+                all_done.notify_all();
+            }
+
+            continue;
+        }
+
+        Lock lock( mutex );
+
+        // 'queued' may still be > 0 if another worker took a task, but did
+        // not count it yet; then we just try again.
+
+        while ( queued == 0 && ! stopping )
+            task_available.wait( lock );
+
+        if ( queued == 0 && stopping )
+            return;
+    }
+}
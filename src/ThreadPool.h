@@ -0,0 +1,119 @@
+/**
+ * ThreadPool.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+
+/**
+ * Pool of worker threads with work stealing.
+ *
+ * Each worker thread has a task queue of its own. Tasks submitted from
+ * outside the pool are distributed round-robin over those queues; tasks
+ * that a task submits go to the queue of the worker thread that runs it.
+ * A worker takes the newest task from its own queue first (which is most
+ * likely to still have its data in the CPU cache); when its queue is
+ * empty, it steals the oldest task from another worker's queue.
+ *
+ * Example:
+ *
+ *     ThreadPool pool;
+ *
+ *     for ( size_t i=0; i < files.size(); ++i )
+ *         pool.submit( [&files, i]() { files[i]->read( names[i] ); } );
+ *
+ *     pool.wait();
+ **/
+class ThreadPool: private boost::noncopyable
+{
+public:
+
+    typedef std::function<void()> Task;
+
+    /**
+     * Constructor. This starts 'thread_count' worker threads or, if that
+     * is 0, one for each CPU.
+     **/
+    ThreadPool( int thread_count = 0 );
+
+    /**
+     * Destructor. This waits for all pending tasks and then stops the
+     * worker threads.
+     **/
+    virtual ~ThreadPool();
+
+    /**
+     * Add a task. This may also be called from within a task.
+     *
+     * Tasks must not throw exceptions.
+     **/
+    void submit( Task task );
+
+    /**
+     * Wait until all tasks that were submitted so far are done, including
+     * any tasks they submit. This must not be called from within a task.
+     **/
+    void wait();
+
+    /**
+     * Return the number of worker threads.
+     **/
+    int get_thread_count() const { return workers.size(); }
+
+
+protected:
+
+    /**
+     * Task queue of one worker thread.
+     **/
+    struct Worker
+    {
+        std::thread         thread;
+        std::deque<Task>    tasks;
+        std::mutex          mutex;  // for 'tasks'
+    };
+
+    /**
+     * The main loop of worker thread no. 'index'.
+     **/
+    void run( int index );
+
+    /**
+     * Take a task for worker no. 'index' from its own queue or, if that is
+     * empty, steal one from another worker. Return 'false' if there is
+     * none.
+     **/
+    bool take_task( int index, Task & task_ret );
+
+
+    //
+    // Data members
+    //
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::atomic<unsigned>       next_worker;    // for round-robin
+    std::atomic<int>            unfinished;     // queued or running
+
+    int                         queued;
+    bool                        stopping;
+    std::mutex                  mutex;          // for 'queued' and 'stopping'
+    std::condition_variable     task_available;
+    std::condition_variable     all_done;
+};
+
+
+#endif // ThreadPool_h
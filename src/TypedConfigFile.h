@@ -0,0 +1,271 @@
+/**
+ * TypedConfigFile.h
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#ifndef TypedConfigFile_h
+#define TypedConfigFile_h
+
+#include <type_traits>
+
+#include "ColumnConfigFile.h"
+
+
+/**
+ * Variant of a CommentedConfigFile class (by default CommentedConfigFile
+ * itself, but also ColumnConfigFile or any other derived class) whose
+ * entries are all of type 'EntryT', which is known at compile time.
+ *
+ * get_entry(), the iterators, append() and insert() use 'EntryT' directly,
+ * so there is no need for any dynamic_cast. When formatting, validate(),
+ * format() and (with a ColumnConfigFile) populate_columns() of 'EntryT' are
+ * called without virtual dispatch, so the compiler can inline them.
+ *
+ * This requires that all entries are really of type 'EntryT', not of any
+ * class derived from it: They are created with create_entry(), and the
+ * append() and insert() methods of this class only accept 'EntryT'.
+ *
+ * Example:
+ *
+ *     class FstabEntry: public ColumnConfigFile::Entry
+ *     {
+ *         ...
+ *     };
+ *
+ *     TypedConfigFile<FstabEntry, ColumnConfigFile> fstab;
+ *     fstab.read( "/etc/fstab" );
+ *
+ *     for ( FstabEntry * entry: fstab )
+ *         ...
+ **/
+template<class EntryT, class Base = CommentedConfigFile>
+class TypedConfigFile: public Base
+{
+    static_assert( std::is_base_of<typename Base::Entry, EntryT>::value,
+                   "EntryT has to be derived from Base::Entry" );
+
+public:
+
+    typedef EntryT Entry;
+
+    /**
+     * Iterator over the entries that returns them as 'EntryT'.
+     **/
+    class const_iterator
+    {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef EntryT *                        value_type;
+        typedef ptrdiff_t                       difference_type;
+        typedef EntryT * const *                pointer;
+        typedef EntryT *                        reference;
+
+        typedef CommentedConfigFile::const_iterator base_iterator;
+
+        const_iterator() {}
+        const_iterator( base_iterator it ): it( it ) {}
+
+        EntryT * operator*() const { return static_cast<EntryT *>( *it ); }
+        EntryT * operator[]( difference_type n ) const { return *( *this + n ); }
+
+        const_iterator & operator++()    { ++it; return *this; }
+        const_iterator & operator--()    { --it; return *this; }
+        const_iterator   operator++(int) { const_iterator old( *this ); ++it; return old; }
+        const_iterator   operator--(int) { const_iterator old( *this ); --it; return old; }
+
+        const_iterator & operator+=( difference_type n ) { it += n; return *this; }
+        const_iterator & operator-=( difference_type n ) { it -= n; return *this; }
+
+        const_iterator operator+( difference_type n ) const { return const_iterator( it + n ); }
+        const_iterator operator-( difference_type n ) const { return const_iterator( it - n ); }
+
+        difference_type operator-( const const_iterator & other ) const
+            { return it - other.it; }
+
+        bool operator==( const const_iterator & other ) const { return it == other.it; }
+        bool operator!=( const const_iterator & other ) const { return it != other.it; }
+        bool operator< ( const const_iterator & other ) const { return it <  other.it; }
+
+    private:
+
+        base_iterator it;
+    };
+
+
+    /**
+     * Constructor.
+     **/
+    TypedConfigFile() {}
+
+    /**
+     * Destructor.
+     **/
+    virtual ~TypedConfigFile() {}
+
+    /**
+     * Factory method to create one entry.
+     *
+     * Reimplemented from CommentedConfigFile.
+     **/
+    virtual EntryT * create_entry() { return new EntryT(); }
+
+    /**
+     * Return entry no. 'index' or 0 if 'index' is out of range.
+     **/
+    EntryT * get_entry( int index ) const
+        { return static_cast<EntryT *>( CommentedConfigFile::get_entry( index ) ); }
+
+    /**
+     * Return an iterator that points to the first entry.
+     **/
+    const_iterator begin() const { return const_iterator( CommentedConfigFile::begin() ); }
+
+    /**
+     * Return an iterator that points one element after the last entry.
+     **/
+    const_iterator end()   const { return const_iterator( CommentedConfigFile::end() ); }
+
+    /**
+     * Append 'entry' at the end of the entries.
+     * This transfers ownership of the entry to this class.
+     **/
+    void append( EntryT * entry ) { CommentedConfigFile::append( entry ); }
+
+    /**
+     * Same as append(), for chaining.
+     **/
+    TypedConfigFile & operator<<( EntryT * entry )
+        { append( entry ); return *this; }
+
+    /**
+     * Insert 'entry' before index 'before'.
+     * This transfers ownership of the entry to this class.
+     **/
+    void insert( int before, EntryT * entry )
+        { CommentedConfigFile::insert( before, entry ); }
+
+    /**
+     * Remove entry no. 'index' and return it without deleting it.
+     * Ownership is transferred to the caller.
+     **/
+    EntryT * take( int index )
+        { return static_cast<EntryT *>( CommentedConfigFile::take( index ) ); }
+
+
+protected:
+
+    /**
+     * 'true' if 'Base' is a ColumnConfigFile.
+     **/
+    typedef std::is_base_of<ColumnConfigFile, Base> IsColumnFile;
+
+    /**
+     * 'true' if 'EntryT' uses the format() of ColumnConfigFile::Entry,
+     * which can then be called with this file as its parent.
+     **/
+    typedef std::integral_constant<bool,
+        IsColumnFile::value &&
+        std::is_same<decltype( &EntryT::format ),
+                     string ( ColumnConfigFile::Entry::* )()>::value> IsColumnFormat;
+
+    /**
+     * Reimplemented from CommentedConfigFile.
+     **/
+    virtual bool format_entry( CommentedConfigFile::Entry * entry, string & line_ret )
+        {
+            if ( this->get_unformatted_line( entry, line_ret ) )
+                return true;
+
+            EntryT * typed_entry = static_cast<EntryT *>( entry );
+
+            if ( ! typed_entry->EntryT::validate() )
+                return false;
+
+            this->cache_formatted_line( entry,
+                                        format_content( typed_entry, IsColumnFormat() ),
+                                        line_ret );
+            return true;
+        }
+
+    /**
+     * Reimplemented from CommentedConfigFile.
+     **/
+    virtual size_t get_entry_line_size( CommentedConfigFile::Entry * entry )
+        { return get_entry_line_size( entry, IsColumnFormat() ); }
+
+    /**
+     * Reimplemented from CommentedConfigFile.
+     **/
+    virtual void append_entry_line( CommentedConfigFile::Entry * entry, string & text )
+        { append_entry_line( entry, text, IsColumnFormat() ); }
+
+    /**
+     * Reimplemented from ColumnConfigFile. This is also a virtual function
+     * with other base classes, but it is never called then.
+     **/
+    virtual void populate_columns_of_all()
+        { populate_columns_of_all( IsColumnFile() ); }
+
+    /**
+     * Reimplemented from ColumnConfigFile.
+     **/
+    virtual void populate_columns_of( const vector<ColumnConfigFile::Entry *> & pending )
+        { populate_columns_of( pending, IsColumnFile() ); }
+
+    void populate_columns_of_all( std::false_type ) {}
+
+    void populate_columns_of_all( std::true_type )
+        {
+            for ( int i=0; i < this->get_entry_count(); ++i )
+                get_entry( i )->EntryT::populate_columns();
+        }
+
+    void populate_columns_of( const vector<ColumnConfigFile::Entry *> & pending, std::false_type ) {}
+
+    void populate_columns_of( const vector<ColumnConfigFile::Entry *> & pending, std::true_type )
+        {
+            for ( size_t i=0; i < pending.size(); ++i )
+            {
+                if ( pending[i] )
+                    static_cast<EntryT *>( pending[i] )->EntryT::populate_columns();
+            }
+        }
+
+    string format_content( EntryT * entry, std::false_type )
+        { return entry->EntryT::format(); }
+
+    string format_content( EntryT * entry, std::true_type )
+        { return entry->format_columns( this ); }
+
+    size_t get_entry_line_size( CommentedConfigFile::Entry * entry, std::false_type )
+        { return Base::get_entry_line_size( entry ); }
+
+    size_t get_entry_line_size( CommentedConfigFile::Entry * entry, std::true_type )
+        {
+            if ( this->is_written_verbatim( entry ) )
+                return Base::get_entry_line_size( entry );
+
+            EntryT * typed_entry = static_cast<EntryT *>( entry );
+
+            if ( ! typed_entry->EntryT::validate() )
+                return string::npos;
+
+            return this->get_column_line_size( typed_entry );
+        }
+
+    void append_entry_line( CommentedConfigFile::Entry * entry, string & text, std::false_type )
+        { Base::append_entry_line( entry, text ); }
+
+    void append_entry_line( CommentedConfigFile::Entry * entry, string & text, std::true_type )
+        {
+            if ( this->is_written_verbatim( entry ) )
+                Base::append_entry_line( entry, text );
+            else
+                this->append_column_line( static_cast<EntryT *>( entry ), text );
+        }
+};
+
+
+#endif // TypedConfigFile_h
@@ -0,0 +1,78 @@
+/**
+ * ccf_batch_main.cc
+ *
+ * Remove all entries that contain a string from any number of config files
+ * in parallel and print the diffs.
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <iostream>
+#include <string>
+#include <string.h>
+
+#include "BatchProcessor.h"
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+
+void usage()
+{
+    cerr << "\nUsage: ccf_batch [-w] [-a] <string> <file> [<file>...]\n"
+         << "\n  -w  write the files back (default: only show the diffs)"
+         << "\n  -a  read the files in batches with io_uring where available\n"
+         << endl;
+    exit( 1 );
+}
+
+
+int main( int argc, char *argv[] )
+{
+    int  arg      = 1;
+    bool write    = false;
+    bool async_io = false;
+
+    while ( arg < argc && argv[ arg ][0] == '-' )
+    {
+        if ( strcmp( argv[ arg ], "-w" ) == 0 )
+            write = true;
+        else if ( strcmp( argv[ arg ], "-a" ) == 0 )
+            async_io = true;
+        else
+            usage();
+
+        ++arg;
+    }
+
+    if ( argc - arg < 2 )
+        usage();
+
+    string     unwanted = argv[ arg++ ];
+    string_vec filenames( argv + arg, argv + argc );
+
+    BatchProcessor batch;
+    batch.set_write_enabled( write );
+    batch.set_async_io( async_io );
+    batch.set_result_callback( []( const BatchProcessor::Result & result )
+        {
+            if ( ! result.success )
+                cerr << result.filename << ": Failed" << endl;
+
+            for ( size_t i=0; i < result.diff.size(); ++i )
+                cout << result.diff[i] << endl;
+        } );
+
+    bool success = batch.run( filenames, [&unwanted]( CommentedConfigFile * file )
+        {
+            file->remove_if( [&unwanted]( CommentedConfigFile::Entry * entry )
+                { return entry->get_content().find( unwanted ) != string::npos; } );
+
+            return true;
+        } );
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+/**
+ * ccf_include_main.cc
+ *
+ * Read a config file with all the files it includes and print the merged
+ * entries together with the file each one comes from.
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <iostream>
+#include <string>
+
+#include "CompositeConfigFile.h"
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+
+void usage()
+{
+    cerr << "\nUsage: ccf_include <file>\n" << endl;
+    exit( 1 );
+}
+
+
+int main( int argc, char *argv[] )
+{
+    if ( argc != 2 )
+        usage();
+
+    CompositeConfigFile file;
+    bool success = file.read( argv[1] );
+
+    cout << "Read " << file.get_file_count() << " files with "
+         << file.get_entry_count() << " entries" << endl;
+
+    for ( int i=0; i < file.get_entry_count(); ++i )
+    {
+        cout << file.get_source_filename( i ) << ": "
+             << file.get_entry( i )->get_content() << endl;
+    }
+
+    if ( ! success )
+    {
+        cerr << "There were errors" << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * ccf_membench_main.cc
+ *
+ * Measure the memory that parsed entries of a large fstab-style file need.
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <iostream>
+#include <string>
+#include <new>
+#include <atomic>
+#include <stdlib.h>
+
+#include "ColumnConfigFile.h"
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+
+// Every allocation is counted with its requested size, which is stored in
+// front of the memory that is returned
+
+static std::atomic<long> heap_bytes( 0 );
+static std::atomic<long> heap_blocks( 0 );
+
+#define HEADER_SIZE 16
+
+
+void * operator new( size_t size )
+{
+    char * block = (char *) malloc( size + HEADER_SIZE );
+
+    if ( ! block )
+        throw std::bad_alloc();
+
+    *(size_t *) block = size;
+    heap_bytes  += size;
+    heap_blocks += 1;
+
+    return block + HEADER_SIZE;
+}
+
+
+void operator delete( void * ptr ) noexcept
+{
+    if ( ! ptr )
+        return;
+
+    char * block = (char *) ptr - HEADER_SIZE;
+    heap_bytes  -= *(size_t *) block;
+    heap_blocks -= 1;
+
+    free( block );
+}
+
+
+void * operator new[]( size_t size )       { return operator new( size ); }
+void operator delete[]( void * ptr ) noexcept { operator delete( ptr ); }
+
+
+void usage()
+{
+    cerr << "\nUsage: ccf_membench [<entries>]\n" << endl;
+    exit( 1 );
+}
+
+
+/**
+ * Return 'count' fstab-style lines. Every tenth entry has a comment before
+ * it, and every twentieth a line comment.
+ **/
+string_vec fstab_lines( int count )
+{
+    static const char * types[]   = { "ext4", "xfs", "btrfs", "swap", "nfs" };
+    static const char * options[] = { "defaults", "noatime,nodiratime",
+                                      "errors=remount-ro", "sw", "ro,nofail" };
+    string_vec lines;
+
+    lines.push_back( "# /etc/fstab: static file system information." );
+    lines.push_back( "" );
+
+    for ( int i=0; i < count; ++i )
+    {
+        string line = "UUID=" + std::to_string( 10000000 + i ) + "-f00d-4b1d"
+            + "  /srv/data" + std::to_string( i )
+            + "  " + types[ i % 5 ]
+            + "  " + options[ i % 5 ]
+            + "  0  " + std::to_string( i % 3 );
+
+        if ( i % 10 == 0 )
+            lines.push_back( "# Volume " + std::to_string( i ) );
+
+        if ( i % 20 == 0 )
+            line += "  # line comment";
+
+        lines.push_back( line );
+    }
+
+    return lines;
+}
+
+
+/**
+ * Parse 'lines' with or without columnar storage and report the heap
+ * memory that the file needs per entry.
+ **/
+void measure( const string_vec & lines, int count, bool columnar )
+{
+    long bytes_before  = heap_bytes;
+    long blocks_before = heap_blocks;
+
+    ColumnConfigFile * file = new ColumnConfigFile();
+    file->set_columnar_storage( columnar );
+    file->parse( lines );
+
+    long bytes  = heap_bytes  - bytes_before;
+    long blocks = heap_blocks - blocks_before;
+
+    cout << ( columnar ? "Columnar storage:" : "Row storage:" ) << endl;
+    cout << "  Heap bytes per entry:     " << (double) bytes  / count << endl;
+    cout << "  Heap blocks per entry:    " << (double) blocks / count << endl;
+
+    delete file;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    int count = 200000;
+
+    if ( argc > 2 )
+        usage();
+
+    if ( argc == 2 )
+    {
+        count = atoi( argv[1] );
+
+        if ( count <= 0 )
+            usage();
+    }
+
+    string_vec lines = fstab_lines( count );
+
+    cout << "Entries:                    " << count << endl;
+    cout << "sizeof( Entry ):            " << sizeof( CommentedConfigFile::Entry ) << endl;
+    cout << "sizeof( ColumnConfigFile::Entry ): " << sizeof( ColumnConfigFile::Entry ) << endl;
+
+    // The column store comes on top of what the entries need: Columnar
+    // storage is for scanning columns, not for saving memory
+
+    measure( lines, count, false );
+    measure( lines, count, true  );
+
+    return 0;
+}
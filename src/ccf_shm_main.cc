@@ -0,0 +1,104 @@
+/**
+ * ccf_shm_main.cc
+ *
+ * Publish a config file in shared memory or show what is published there.
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "SharedConfig.h"
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+
+void usage()
+{
+    cerr << "\nUsage: ccf_shm publish <name> <file>"
+         << "\n       ccf_shm show    <name>"
+         << "\n       ccf_shm remove  <name>\n"
+         << endl;
+    exit( 1 );
+}
+
+
+int publish( const string & name, const string & filename )
+{
+    CommentedConfigFile   file;
+    SharedConfigPublisher publisher( name );
+    struct stat           st;
+
+    // Nobody should be able to read it from shared memory who cannot read
+    // the file itself
+
+    if ( stat( filename.c_str(), &st ) == 0 )
+        publisher.set_mode( st.st_mode );
+
+    if ( ! file.read( filename ) || ! publisher.publish( &file ) )
+    {
+        cerr << "Publishing " << filename << " failed" << endl;
+        return 1;
+    }
+
+    cout << "Published " << filename << " as generation "
+         << publisher.get_generation() << endl;
+
+    return 0;
+}
+
+
+int show( const string & name )
+{
+    SharedConfigSubscriber subscriber( name );
+
+    if ( ! subscriber.update() )
+    {
+        cerr << "Nothing published as " << name << endl;
+        return 1;
+    }
+
+    std::shared_ptr<const ParseCache::View> view = subscriber.get_view();
+
+    cout << view->get_filename() << " generation "
+         << subscriber.get_generation() << ":" << endl;
+
+    for ( int i=0; i < view->get_entry_count(); ++i )
+    {
+        cout << view->get_content( i );
+
+        if ( ! view->get_line_comment( i ).empty() )
+            cout << " " << view->get_line_comment( i );
+
+        cout << endl;
+    }
+
+    return 0;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    if ( argc == 4 && strcmp( argv[1], "publish" ) == 0 )
+        return publish( argv[2], argv[3] );
+
+    if ( argc == 3 && strcmp( argv[1], "show" ) == 0 )
+        return show( argv[2] );
+
+    if ( argc == 3 && strcmp( argv[1], "remove" ) == 0 )
+    {
+        SharedConfigPublisher( argv[2] ).remove();
+        return 0;
+    }
+
+    usage();
+
+    return 1;
+}
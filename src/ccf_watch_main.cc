@@ -0,0 +1,90 @@
+/**
+ * ccf_watch_main.cc
+ *
+ * Watch config files for changes and print a diff whenever they change.
+ *
+ * Author:  Stefan Hundhammer <Stefan.Hundhammer@gmx.de>
+ * License: GPL V2 - see file LICENSE for details
+ **/
+
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "CommentedConfigFile.h"
+#include "ConfigFileWatcher.h"
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+
+void usage();
+void file_changed( CommentedConfigFile * file,
+                   const CommentedConfigFile::ReloadSummary & summary );
+
+
+void usage()
+{
+    cerr << "\nUsage: ccf_watch <file> [<file>...]\n" << endl;
+    exit( 1 );
+}
+
+
+void file_changed( CommentedConfigFile * file,
+                   const CommentedConfigFile::ReloadSummary & summary )
+{
+    if ( ! summary.success )
+    {
+        cout << file->get_filename() << ": Can't read" << endl;
+        return;
+    }
+
+    cout << file->get_filename() << ": "
+         << summary.added.size()            << " added, "
+         << summary.removed_lines.size()    << " removed, "
+         << summary.comments_changed.size() << " with changed comments, "
+         << summary.unchanged               << " unchanged"
+         << endl;
+
+    string_vec diff = file->diff();
+
+    for ( size_t i=0; i < diff.size(); ++i )
+        cout << diff[i] << endl;
+
+    // Make this the reference for the next diff
+    file->save_orig();
+}
+
+
+int main( int argc, char *argv[] )
+{
+    if ( argc < 2 )
+        usage();
+
+    vector<CommentedConfigFile *> files;
+    ConfigFileWatcher watcher;
+
+    for ( int i=1; i < argc; ++i )
+    {
+        CommentedConfigFile * file = new CommentedConfigFile();
+        file->read( argv[i] );
+        file->save_orig();
+        files.push_back( file );
+        watcher.add( file, file_changed );
+    }
+
+    if ( ! watcher.start() )
+    {
+        cerr << "Can't start watching" << endl;
+        return 1;
+    }
+
+    cout << "Watching " << watcher.get_watch_count() << " files using "
+         << ( watcher.get_using_inotify() ? "inotify" : "polling" )
+         << endl;
+
+    while ( true )
+        pause();
+}
@@ -0,0 +1,220 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE async_io
+
+#include <boost/test/unit_test.hpp>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AsyncFileIO.h"
+
+
+BOOST_AUTO_TEST_CASE( read_and_write_files )
+{
+    AsyncFileIO subject( 4 ); // less than the number of files
+
+    vector<AsyncFileIO::WriteRequest> write_requests;
+
+    for ( int i=0; i < 10; ++i )
+    {
+        AsyncFileIO::WriteRequest request( "async-io-test-" + std::to_string( i ) );
+        request.lines = { "# File " + std::to_string( i ), "", "aaa" };
+
+        if ( i == 0 )
+            request.lines.clear();
+
+        write_requests.push_back( request );
+    }
+
+    BOOST_CHECK_EQUAL( subject.write_files( write_requests ), true );
+
+    for ( size_t i=0; i < write_requests.size(); ++i )
+    {
+        FileStat stat;
+        FileIO::stat( write_requests[i].filename, stat );
+
+        BOOST_CHECK_EQUAL( write_requests[i].success, true );
+        BOOST_CHECK( write_requests[i].stat == stat );
+        BOOST_CHECK_EQUAL( stat.size, FileIO::output_size( write_requests[i].lines ) );
+    }
+
+    vector<AsyncFileIO::ReadRequest> read_requests;
+
+    for ( size_t i=0; i < write_requests.size(); ++i )
+        read_requests.push_back( AsyncFileIO::ReadRequest( write_requests[i].filename ) );
+
+    read_requests.push_back( AsyncFileIO::ReadRequest( "/nonexistent/async-io-test" ) );
+
+    BOOST_CHECK_EQUAL( subject.read_files( read_requests ), false );
+
+    for ( size_t i=0; i < write_requests.size(); ++i )
+    {
+        string_vec lines;
+        FileIO::split_lines( read_requests[i].content, lines );
+
+        BOOST_CHECK_EQUAL( read_requests[i].success, true );
+        BOOST_CHECK( read_requests[i].stat == write_requests[i].stat );
+        BOOST_CHECK( lines == write_requests[i].lines );
+    }
+
+    BOOST_CHECK_EQUAL( read_requests.back().success, false );
+    BOOST_CHECK_EQUAL( read_requests.back().error, ENOENT );
+    BOOST_CHECK_EQUAL( read_requests.back().stat.valid, false );
+
+    for ( size_t i=0; i < write_requests.size(); ++i )
+        remove( write_requests[i].filename.c_str() );
+}
+
+
+BOOST_AUTO_TEST_CASE( read_large_file )
+{
+    AsyncFileIO subject;
+    string_vec  lines;
+
+    for ( int i=0; i < 50000; ++i )
+        lines.push_back( "line " + std::to_string( i ) );
+
+    string filename = "async-io-test-large";
+    BOOST_CHECK_EQUAL( FileIO::write_file( filename, lines ), true );
+
+    vector<AsyncFileIO::ReadRequest> requests;
+    requests.push_back( AsyncFileIO::ReadRequest( filename ) );
+
+    string content;
+    FileIO::read_file( filename, content );
+
+    BOOST_CHECK_EQUAL( subject.read_files( requests ), true );
+    BOOST_CHECK_EQUAL( requests[0].content.size(), content.size() );
+    BOOST_CHECK( requests[0].content == content );
+
+    remove( filename.c_str() );
+}
+
+
+BOOST_AUTO_TEST_CASE( write_files_atomic )
+{
+    AsyncFileIO subject;
+
+    FileIO::write_file( "async-io-test-target", { "old" } );
+    chmod( "async-io-test-target", 0600 );
+    remove( "async-io-test-link" );
+    BOOST_CHECK_EQUAL( symlink( "async-io-test-target", "async-io-test-link" ), 0 );
+
+    vector<AsyncFileIO::WriteRequest> requests;
+    requests.push_back( AsyncFileIO::WriteRequest( "async-io-test-link" ) );
+    requests.push_back( AsyncFileIO::WriteRequest( "async-io-test-new" ) );
+    requests.push_back( AsyncFileIO::WriteRequest( "/nonexistent/async-io-test" ) );
+
+    requests[0].lines = { "new", "content" };
+    requests[1].lines = { "more" };
+
+    BOOST_CHECK_EQUAL( subject.write_files( requests, true, FSYNC_FILE_AND_DIR ), false );
+    BOOST_CHECK_EQUAL( requests[0].success, true );
+    BOOST_CHECK_EQUAL( requests[1].success, true );
+    BOOST_CHECK_EQUAL( requests[2].success, false );
+    BOOST_CHECK( requests[2].error != 0 );
+
+    // The symlink is still there, and the file it points to was replaced
+
+    struct stat st;
+    BOOST_CHECK_EQUAL( lstat( "async-io-test-link", &st ), 0 );
+    BOOST_CHECK( S_ISLNK( st.st_mode ) );
+    BOOST_CHECK_EQUAL( stat( "async-io-test-target", &st ), 0 );
+    BOOST_CHECK_EQUAL( st.st_mode & 0777, 0600 );
+
+    string content;
+    FileIO::read_file( "async-io-test-target", content );
+    BOOST_CHECK_EQUAL( content, "new\ncontent\n" );
+
+    FileIO::read_file( "async-io-test-new", content );
+    BOOST_CHECK_EQUAL( content, "more\n" );
+
+    remove( "async-io-test-link" );
+    remove( "async-io-test-target" );
+    remove( "async-io-test-new" );
+}
+
+
+/**
+ * Return the file descriptor of the io_uring instance of this process or
+ * -1 if there is none.
+ **/
+static int find_ring_fd()
+{
+    for ( int fd = 0; fd < 1024; ++fd )
+    {
+        string path = "/proc/self/fd/" + std::to_string( fd );
+        char   target[ 256 ];
+        ssize_t len = readlink( path.c_str(), target, sizeof( target ) - 1 );
+
+        if ( len > 0 && string( target, len ) == "anon_inode:[io_uring]" )
+            return fd;
+    }
+
+    return -1;
+}
+
+
+BOOST_AUTO_TEST_CASE( ring_failure )
+{
+    vector<AsyncFileIO::WriteRequest> write_requests;
+    vector<AsyncFileIO::ReadRequest>  read_requests;
+
+    for ( int i=0; i < 5; ++i )
+    {
+        AsyncFileIO::WriteRequest request( "async-io-test-ring-" + std::to_string( i ) );
+        request.lines = { "# File " + std::to_string( i ), "aaa" };
+        write_requests.push_back( request );
+        read_requests.push_back( AsyncFileIO::ReadRequest( request.filename ) );
+    }
+
+    for ( int pass = 0; pass < 2; ++pass )
+    {
+        AsyncFileIO subject;
+
+        if ( ! subject.get_using_io_uring() )
+            break; // Nothing to break
+
+        // Let io_uring_enter() fail for good by replacing the descriptor
+        // of the ring with one of something else
+
+        int ring_fd = find_ring_fd();
+        BOOST_REQUIRE( ring_fd >= 0 );
+
+        int null_fd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+        BOOST_REQUIRE( dup2( null_fd, ring_fd ) == ring_fd );
+        close( null_fd );
+
+        if ( pass == 0 )
+        {
+            BOOST_CHECK_EQUAL( subject.write_files( write_requests ), true );
+
+            for ( size_t i=0; i < write_requests.size(); ++i )
+            {
+                BOOST_CHECK_EQUAL( write_requests[i].success, true );
+                BOOST_CHECK_EQUAL( write_requests[i].error, 0 );
+                BOOST_CHECK( write_requests[i].stat.valid );
+            }
+        }
+        else
+        {
+            BOOST_CHECK_EQUAL( subject.read_files( read_requests ), true );
+
+            for ( size_t i=0; i < read_requests.size(); ++i )
+            {
+                string_vec lines;
+                FileIO::split_lines( read_requests[i].content, lines );
+
+                BOOST_CHECK_EQUAL( read_requests[i].success, true );
+                BOOST_CHECK_EQUAL( read_requests[i].error, 0 );
+                BOOST_CHECK( lines == write_requests[i].lines );
+            }
+        }
+
+        BOOST_CHECK_EQUAL( subject.get_using_io_uring(), false );
+    }
+
+    for ( size_t i=0; i < write_requests.size(); ++i )
+        remove( write_requests[i].filename.c_str() );
+}
@@ -0,0 +1,183 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE batch
+
+#include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <fstream>
+#include <stdio.h>
+
+#include "BatchProcessor.h"
+#include "ThreadPool.h"
+
+
+void write_lines( const string & filename, const string_vec & lines )
+{
+    std::ofstream file( filename );
+
+    for ( size_t i=0; i < lines.size(); ++i )
+        file << lines[i] << "\n";
+}
+
+
+string_vec read_lines( const string & filename )
+{
+    std::ifstream file( filename );
+    string_vec    lines;
+    string        line;
+
+    while ( std::getline( file, line ) )
+        lines.push_back( line );
+
+    return lines;
+}
+
+
+BOOST_AUTO_TEST_CASE( thread_pool )
+{
+    std::atomic<int> sum( 0 );
+
+    {
+        ThreadPool pool( 4 );
+        BOOST_CHECK_EQUAL( pool.get_thread_count(), 4 );
+
+        // Tasks that submit more tasks
+
+        for ( int i=0; i < 100; ++i )
+        {
+            pool.submit( [&pool, &sum]()
+                {
+                    for ( int j=0; j < 10; ++j )
+                        pool.submit( [&sum]() { ++sum; } );
+
+                    ++sum;
+                } );
+        }
+
+        pool.wait();
+        BOOST_CHECK_EQUAL( sum, 1100 );
+
+        pool.submit( [&sum]() { ++sum; } );
+    }
+
+    // The destructor waits for the remaining tasks
+
+    BOOST_CHECK_EQUAL( sum, 1101 );
+}
+
+
+BOOST_AUTO_TEST_CASE( batch_processor )
+{
+    string_vec filenames;
+
+    for ( int i=0; i < 40; ++i )
+    {
+        string filename = "batch-test-" + std::to_string( i );
+        write_lines( filename, { "# File " + std::to_string( i ), "", "aaa", "bbb" } );
+        filenames.push_back( filename );
+    }
+
+    filenames.push_back( "/nonexistent/batch-test" );
+
+    BatchProcessor     subject( 4 );
+    std::atomic<int>   callbacks( 0 );
+
+    subject.set_max_in_flight( 3 );
+    subject.set_result_callback( [&callbacks]( const BatchProcessor::Result & result )
+        { ++callbacks; } );
+
+    bool success = subject.run( filenames, []( CommentedConfigFile * file )
+        {
+            int number = 0;
+
+            if ( ! file->get_header_comments().empty() )
+                number = atoi( file->get_header_comments()[0].substr( 7 ).c_str() );
+
+            if ( number == 13 )
+                return false;
+
+            if ( number % 2 == 0 )
+            {
+                CommentedConfigFile::Entry * entry = new CommentedConfigFile::Entry();
+                entry->set_content( "ccc" );
+                file->append( entry );
+            }
+
+            return true;
+        } );
+
+    const vector<BatchProcessor::Result> & results = subject.get_results();
+
+    BOOST_CHECK_EQUAL( success, false );
+    BOOST_CHECK_EQUAL( callbacks, 41 );
+    BOOST_CHECK_EQUAL( results.size(), 41 );
+    BOOST_CHECK_EQUAL( subject.get_failed_count(), 2 );
+
+    BOOST_CHECK_EQUAL( results[0].filename, "batch-test-0" );
+    BOOST_CHECK_EQUAL( results[0].success, true );
+    BOOST_CHECK_EQUAL( results[0].modified, true );
+    BOOST_CHECK_EQUAL( results[0].written, true );
+    BOOST_CHECK_EQUAL( results[0].diff.empty(), false );
+    BOOST_CHECK_EQUAL( results[0].diff.back(), "+ccc" );
+    BOOST_CHECK( read_lines( "batch-test-0" ) == string_vec( { "# File 0", "", "aaa", "bbb", "ccc" } ) );
+
+    BOOST_CHECK_EQUAL( results[1].success, true );
+    BOOST_CHECK_EQUAL( results[1].modified, false );
+    BOOST_CHECK_EQUAL( results[1].written, false );
+    BOOST_CHECK( results[1].diff.empty() );
+
+    BOOST_CHECK_EQUAL( results[13].success, false );
+    BOOST_CHECK_EQUAL( results[13].failed_stage, BatchProcessor::STAGE_TRANSFORM );
+    BOOST_CHECK_EQUAL( results[13].written, false );
+
+    BOOST_CHECK_EQUAL( results[40].success, false );
+    BOOST_CHECK_EQUAL( results[40].failed_stage, BatchProcessor::STAGE_WRITE );
+
+    for ( int i=0; i < 40; ++i )
+        remove( filenames[i].c_str() );
+}
+
+
+BOOST_AUTO_TEST_CASE( batch_processor_async_io )
+{
+    string_vec filenames;
+
+    for ( int i=0; i < 20; ++i )
+    {
+        string filename = "batch-async-test-" + std::to_string( i );
+        write_lines( filename, { "aaa", "bbb" } );
+        filenames.push_back( filename );
+    }
+
+    filenames.push_back( "/nonexistent/batch-test" );
+
+    BatchProcessor subject( 4 );
+    subject.set_max_in_flight( 6 );
+    subject.set_async_io();
+
+    bool success = subject.run( filenames, []( CommentedConfigFile * file )
+        {
+            file->remove_if( []( CommentedConfigFile::Entry * entry )
+                { return entry->get_content() == "aaa"; } );
+            return true;
+        } );
+
+    const vector<BatchProcessor::Result> & results = subject.get_results();
+
+    BOOST_CHECK_EQUAL( success, true );
+    BOOST_CHECK_EQUAL( subject.get_failed_count(), 0 );
+
+    for ( int i=0; i < 20; ++i )
+    {
+        BOOST_CHECK_EQUAL( results[i].success, true );
+        BOOST_CHECK_EQUAL( results[i].written, true );
+        BOOST_CHECK( read_lines( filenames[i] ) == string_vec( { "bbb" } ) );
+    }
+
+    // Missing files are read as empty files, just like with read()
+
+    BOOST_CHECK_EQUAL( results[20].success, true );
+    BOOST_CHECK_EQUAL( results[20].modified, false );
+
+    for ( int i=0; i < 20; ++i )
+        remove( filenames[i].c_str() );
+}
@@ -0,0 +1,636 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE columns
+
+#include <boost/test/unit_test.hpp>
+
+#include "ColumnConfigFile.h"
+
+
+/**
+ * Calculate the column widths of 'file' the slow way by looking at all
+ * column items of all entries.
+ **/
+vector<int> expected_widths( ColumnConfigFile & file )
+{
+    vector<int> widths;
+
+    if ( ! file.get_pad_columns() )
+        return widths;
+
+    for ( int i=0; i < file.get_entry_count(); ++i )
+    {
+        ColumnConfigFile::Entry * entry = file.get_entry( i );
+
+        if ( ! entry )
+            continue;
+
+        if ( entry->get_column_count() > (int) widths.size() )
+            widths.resize( entry->get_column_count() );
+
+        for ( int col=0; col < entry->get_column_count(); ++col )
+        {
+            int width = entry->get_column_ref( col ).size();
+            int max   = file.get_max_column_width( col );
+
+            if ( max == 0 || width <= max )
+                widths[ col ] = std::max( widths[ col ], width );
+        }
+    }
+
+    return widths;
+}
+
+
+/**
+ * Check that the incrementally maintained column widths of 'file' are the
+ * same as when calculating them from scratch.
+ **/
+void check_widths( ColumnConfigFile & file )
+{
+    vector<int> expected = expected_widths( file );
+
+    for ( size_t col=0; col < expected.size() + 2; ++col )
+    {
+        int width = col < expected.size() ? expected[ col ] : 0;
+        BOOST_CHECK_EQUAL( file.get_column_width( col ), width );
+    }
+}
+
+
+/**
+ * Check the column widths and that the output is the same as that of a
+ * file that is parsed from scratch.
+ **/
+void check_output( ColumnConfigFile & file )
+{
+    string_vec lines = file.format_lines();
+    check_widths( file );
+
+    ColumnConfigFile fresh;
+    fresh.parse( lines );
+
+    BOOST_CHECK( fresh.format_lines() == lines );
+}
+
+
+/**
+ * fstab-like entry that keeps its mount point (column 1) in a member and
+ * only puts it back into the columns in populate_columns(), so a changed
+ * mount point changes the width of a column in the middle of the line.
+ **/
+class MountEntry: public ColumnConfigFile::Entry
+{
+public:
+
+    virtual bool parse( const string & line, int line_no = -1 )
+        {
+            ColumnConfigFile::Entry::parse( line, line_no );
+            mount_point = get_column( 1 );
+
+            return true;
+        }
+
+    virtual void populate_columns() { set_column( 1, mount_point ); }
+
+    void set_mount_point( const string & new_mount_point )
+        { mount_point = new_mount_point; set_modified(); }
+
+    string mount_point;
+};
+
+
+class MountConfigFile: public ColumnConfigFile
+{
+public:
+
+    virtual MountEntry * create_entry() { return new MountEntry(); }
+
+    MountEntry * get_mount( int i ) { return static_cast<MountEntry *>( get_entry( i ) ); }
+};
+
+
+string_vec mounts = { "sda1 / ext4", "sda2 /var ext4", "sdb1 /srv xfs" };
+
+
+string_vec input = {
+    "# /etc/fstab",
+    "",
+    "/dev/sda1  /      ext4  defaults  0  1",
+    "/dev/sda2  none   swap  sw        0  0",
+    "# data",
+    "/dev/sdb1  /data  xfs   noatime   0  2 # line comment",
+    "",
+    "# footer"
+};
+
+
+BOOST_AUTO_TEST_CASE( widths_set_column )
+{
+    ColumnConfigFile file;
+    file.parse( input );
+    check_output( file );
+
+    file.get_entry( 1 )->set_column( 1, "/very/long/mount/point" );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 22 );
+
+    file.get_entry( 1 )->set_column( 1, "/x" );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 5 );
+
+    file.get_entry( 0 )->add_column( "extra" );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 6 ), 5 );
+
+    file.get_entry( 2 )->parse( "/dev/sdc1  /backup  btrfs  defaults  0  2" );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 2 ), 5 );
+}
+
+
+BOOST_AUTO_TEST_CASE( widths_max_column_width )
+{
+    ColumnConfigFile file;
+    file.parse( input );
+    file.set_max_column_width( 1, 10 );
+
+    file.get_entry( 1 )->set_column( 1, "/very/long/mount/point" );
+    check_widths( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 5 );
+
+    file.set_max_column_width( 1, 0 );
+    check_widths( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 22 );
+
+    file.set_pad_columns( false );
+    check_widths( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 0 );
+
+    file.set_pad_columns( true );
+    check_widths( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 22 );
+}
+
+
+BOOST_AUTO_TEST_CASE( widths_insert_remove )
+{
+    ColumnConfigFile file;
+    file.parse( input );
+    check_output( file );
+
+    ColumnConfigFile::Entry * entry = file.create_entry();
+    entry->parse( "/dev/disk/by-label/work  /work  ext4  defaults  0  2" );
+    file.insert( 1, entry );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 0 ), 23 );
+
+    // Changing an entry that is no longer in the file must not affect it
+
+    entry = static_cast<ColumnConfigFile::Entry *>( file.take( 1 ) );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 0 ), 9 );
+
+    entry->set_column( 0, "/dev/disk/by-label/much-longer" );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 0 ), 9 );
+
+    file.append( entry );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 0 ), 30 );
+
+    file.remove( 3 );
+    check_output( file );
+
+    file.remove_if( []( CommentedConfigFile::Entry * entry )
+                    { return entry->get_content().find( "swap" ) != string::npos; } );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 5 );
+
+    file.clear_entries();
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 0 ), 0 );
+
+    file.parse( input );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 0 ), 9 );
+}
+
+
+BOOST_AUTO_TEST_CASE( widths_lazy_parse )
+{
+    ColumnConfigFile file;
+    file.set_lazy_parse();
+    file.parse( input );
+    check_output( file );
+
+    ColumnConfigFile other;
+    other.set_lazy_parse();
+    other.parse( string_vec { "/dev/disk/by-uuid/0123  /srv  nfs  ro  0  0" } );
+
+    file.splice( 0, other, 0 );
+    check_output( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 0 ), 22 );
+    BOOST_CHECK_EQUAL( other.get_column_width( 0 ), 0 );
+}
+
+
+BOOST_AUTO_TEST_CASE( widths_populate_columns )
+{
+    MountConfigFile file;
+    file.parse( mounts );
+    check_widths( file );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 4 );
+
+    // The columns are only populated when they are needed
+
+    file.get_mount( 2 )->set_mount_point( "/srv/data" );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 9 );
+    check_widths( file );
+
+    string_vec lines = file.format_lines();
+    BOOST_CHECK_EQUAL( lines[0], "sda1  /          ext4" );
+    BOOST_CHECK_EQUAL( lines[2], "sdb1  /srv/data  xfs" );
+
+    file.get_mount( 2 )->set_mount_point( "/srv" );
+    BOOST_CHECK_EQUAL( file.format_lines()[0], "sda1  /     ext4" );
+    check_widths( file );
+}
+
+
+BOOST_AUTO_TEST_CASE( widths_populate_all )
+{
+    MountConfigFile file;
+    file.parse( mounts );
+    BOOST_CHECK_EQUAL( file.format_lines()[0], "sda1  /     ext4" );
+
+    // Entries that change their fields without set_modified() are not
+    // populated again by default
+
+    MountEntry * entry = file.get_mount( 2 );
+    entry->mount_point = "/srv/data";
+    BOOST_CHECK_EQUAL( file.format_lines()[2], "sdb1  /srv  xfs" );
+
+    entry->set_modified();
+    BOOST_CHECK_EQUAL( file.format_lines()[2], "sdb1  /srv/data  xfs" );
+    check_widths( file );
+
+    // With populate_all they are
+
+    file.set_populate_all();
+    entry->mount_point = "/srv/backup";
+    BOOST_CHECK_EQUAL( file.format_lines()[2], "sdb1  /srv/backup  xfs" );
+    check_widths( file );
+}
+
+
+BOOST_AUTO_TEST_CASE( column_store )
+{
+    ColumnStore store;
+
+    int row0 = store.add_row();
+    int row1 = store.add_row();
+
+    store.set_column_count( row0, 2 );
+    store.set_column_count( row1, 3 );
+    store.set( row0, 0, "aaa" );
+    store.set( row0, 1, "b" );
+    store.set( row1, 2, "cc" );
+
+    BOOST_CHECK_EQUAL( store.get_max_column_count(), 3 );
+    BOOST_CHECK_EQUAL( store.get( row0, 0 ), "aaa" );
+    BOOST_CHECK_EQUAL( store.get( row1, 0 ), "" );
+    BOOST_CHECK_EQUAL( store.get( row1, 2 ), "cc" );
+    BOOST_CHECK_EQUAL( store.get_sizes( 2 )[ row0 ], ColumnStore::NO_VALUE );
+
+    // Values from the same column
+
+    store.set( row1, 0, store.get( row0, 0 ) );
+    BOOST_CHECK_EQUAL( store.get( row1, 0 ), "aaa" );
+
+    // Growing values until the column is compacted
+
+    for ( int i=0; i < 1000; ++i )
+        store.set( row0, 1, string( 100 + i % 10, 'x' ) );
+
+    BOOST_CHECK_EQUAL( store.get( row0, 1 ), string( 109, 'x' ) );
+    BOOST_CHECK_EQUAL( store.get( row0, 0 ), "aaa" );
+
+    vector<int> rows;
+    store.find( 0, "aaa", rows );
+    BOOST_CHECK( rows == vector<int>( { row0, row1 } ) );
+
+    store.remove_row( row0 );
+    BOOST_CHECK_EQUAL( store.add_row(), row0 );
+    BOOST_CHECK_EQUAL( store.get_column_count( row0 ), 0 );
+
+    rows.clear();
+    store.find( 0, "aaa", rows );
+    BOOST_CHECK( rows == vector<int>( { row1 } ) );
+}
+
+
+BOOST_AUTO_TEST_CASE( columnar_storage )
+{
+    ColumnConfigFile expected;
+    ColumnConfigFile file;
+
+    expected.parse( input );
+    file.parse( input );
+    file.set_columnar_storage();
+
+    BOOST_CHECK( file.get_columnar_storage() );
+    BOOST_CHECK_EQUAL( file.get_entry( 2 )->get_column( 1 ), "/data" );
+    BOOST_CHECK( file.format_lines() == expected.format_lines() );
+
+    file.get_entry( 1 )->set_column( 1, "/very/long/mount/point" );
+    expected.get_entry( 1 )->set_column( 1, "/very/long/mount/point" );
+    file.get_entry( 0 )->add_column( "extra" );
+    expected.get_entry( 0 )->add_column( "extra" );
+    file.get_entry( 2 )->parse( "/dev/sdc1  /backup  btrfs  defaults  0  2" );
+    expected.get_entry( 2 )->parse( "/dev/sdc1  /backup  btrfs  defaults  0  2" );
+
+    BOOST_CHECK( file.format_lines() == expected.format_lines() );
+    check_widths( file );
+
+    // Entries that leave the file take their columns with them
+
+    ColumnConfigFile::Entry * entry = static_cast<ColumnConfigFile::Entry *>( file.take( 1 ) );
+    BOOST_CHECK_EQUAL( entry->get_column( 1 ), "/very/long/mount/point" );
+    BOOST_CHECK_EQUAL( file.get_entry( 1 )->get_column( 1 ), "/backup" );
+    check_output( file );
+
+    file.insert( 0, entry );
+    entry = file.create_entry();
+    entry->parse( "/dev/sdd1  /data  xfs  defaults  0  2" );
+    file.append( entry );
+    check_output( file );
+
+    vector<ColumnConfigFile::Entry *> found = file.find_entries( 3, "defaults" );
+    BOOST_CHECK_EQUAL( found.size(), 3 );
+    BOOST_CHECK( found[0] == file.get_entry( 1 ) );
+    BOOST_CHECK( found[1] == file.get_entry( 2 ) );
+    BOOST_CHECK( found[2] == file.get_entry( 3 ) );
+
+    BOOST_CHECK_EQUAL( file.replace_in_column( 3, "defaults", "noatime" ), 3 );
+    BOOST_CHECK( file.find_entries( 3, "defaults" ).empty() );
+    BOOST_CHECK_EQUAL( file.find_entries( 3, "noatime" ).size(), 3 );
+    check_output( file );
+
+    string_vec lines = file.format_lines();
+    file.set_columnar_storage( false );
+    BOOST_CHECK( ! file.get_columnar_storage() );
+    BOOST_CHECK( file.format_lines() == lines );
+    BOOST_CHECK_EQUAL( file.find_entries( 3, "noatime" ).size(), 3 );
+}
+
+
+BOOST_AUTO_TEST_CASE( columnar_lazy_parse )
+{
+    MountConfigFile file;
+    file.set_lazy_parse();
+    file.set_columnar_storage();
+    file.parse( mounts );
+
+    BOOST_CHECK_EQUAL( file.find_entries( 1, "/var" ).size(), 1 );
+    BOOST_CHECK_EQUAL( file.get_column_width( 1 ), 4 );
+
+    file.get_mount( 2 )->set_mount_point( "/srv/data" );
+    BOOST_CHECK_EQUAL( file.format_lines()[2], "sdb1  /srv/data  xfs" );
+    check_widths( file );
+
+    file.clear_entries();
+    BOOST_CHECK( file.find_entries( 1, "/var" ).empty() );
+
+    file.parse( string_vec { "sdc1 /mnt ext4" } );
+    BOOST_CHECK_EQUAL( file.find_entries( 1, "/mnt" ).size(), 1 );
+    check_widths( file );
+}
+
+
+/**
+ * Find the entries with 'value' in column no. 'column' the slow way.
+ **/
+vector<ColumnConfigFile::Entry *> expected_entries( ColumnConfigFile & file,
+                                                    int                column,
+                                                    const string &     value )
+{
+    vector<ColumnConfigFile::Entry *> result;
+
+    for ( int i=0; i < file.get_entry_count(); ++i )
+    {
+        ColumnConfigFile::Entry * entry = file.get_entry( i );
+
+        if ( column < entry->get_column_count() && entry->get_column( column ) == value )
+            result.push_back( entry );
+    }
+
+    return result;
+}
+
+
+BOOST_AUTO_TEST_CASE( column_index )
+{
+    ColumnConfigFile file;
+    file.parse( input );
+
+    BOOST_CHECK( file.add_column_index( 3 ) );
+    BOOST_CHECK( file.has_column_index( 3 ) );
+    BOOST_CHECK( ! file.has_column_index( 2 ) );
+    BOOST_CHECK( file.find_entry( 3, "sw" ) == file.get_entry( 1 ) );
+    BOOST_CHECK( file.find_entry( 3, "nosuchvalue" ) == 0 );
+
+    file.get_entry( 1 )->set_column( 3, "noatime" );
+    BOOST_CHECK( file.find_entry( 3, "sw" ) == 0 );
+    BOOST_CHECK( file.find_entries( 3, "noatime" ) == expected_entries( file, 3, "noatime" ) );
+    BOOST_CHECK_EQUAL( file.find_entries( 3, "noatime" ).size(), 2 );
+
+    ColumnConfigFile::Entry * entry = file.create_entry();
+    entry->parse( "/dev/sdc1  /home  ext4  noatime  0  2" );
+    file.insert( 0, entry );
+    BOOST_CHECK( file.find_entry( 3, "noatime" ) == entry );
+    BOOST_CHECK( file.find_entries( 3, "noatime" ) == expected_entries( file, 3, "noatime" ) );
+
+    // Entries that are taken out of the file are no longer found, even
+    // when they are changed afterwards
+
+    file.take( 0 );
+    BOOST_CHECK_EQUAL( file.find_entries( 3, "noatime" ).size(), 2 );
+    entry->set_column( 3, "defaults" );
+    BOOST_CHECK_EQUAL( file.find_entries( 3, "defaults" ).size(), 1 );
+    delete entry;
+
+    file.get_entry( 2 )->parse( "/dev/sdb1  /data  xfs  defaults  0  2" );
+    BOOST_CHECK( file.find_entries( 3, "defaults" ) == expected_entries( file, 3, "defaults" ) );
+    BOOST_CHECK_EQUAL( file.find_entries( 3, "defaults" ).size(), 2 );
+
+    file.remove( 2 );
+    BOOST_CHECK( file.find_entries( 3, "defaults" ) == expected_entries( file, 3, "defaults" ) );
+
+    // The index survives parsing the file again
+
+    file.parse( input );
+    BOOST_CHECK( file.has_column_index( 3 ) );
+    BOOST_CHECK( file.find_entry( 3, "sw" ) == file.get_entry( 1 ) );
+    BOOST_CHECK( file.find_entries( 3, "noatime" ) == expected_entries( file, 3, "noatime" ) );
+
+    file.remove_column_index( 3 );
+    BOOST_CHECK( ! file.has_column_index( 3 ) );
+    BOOST_CHECK( file.find_entry( 3, "sw" ) == file.get_entry( 1 ) );
+
+    // The key index of the base class is still there
+
+    BOOST_CHECK( file.find_entry( "nosuchkey" ) == 0 );
+}
+
+
+BOOST_AUTO_TEST_CASE( unique_column_index )
+{
+    ColumnConfigFile file;
+    file.parse( input );
+
+    BOOST_CHECK( ! file.add_column_index( 4, ColumnConfigFile::UNIQUE_HASH_INDEX ) );
+    BOOST_CHECK( ! file.has_column_index( 4 ) );
+    BOOST_CHECK_EQUAL( file.get_duplicate_count( 4 ), -1 );
+
+    BOOST_CHECK( file.add_column_index( 0, ColumnConfigFile::UNIQUE_HASH_INDEX ) );
+    BOOST_CHECK_EQUAL( file.get_duplicate_count( 0 ), 0 );
+    BOOST_CHECK( file.find_entry( 0, "/dev/sdb1" ) == file.get_entry( 2 ) );
+
+    file.get_entry( 1 )->set_column( 0, "/dev/sda1" );
+    BOOST_CHECK_EQUAL( file.get_duplicate_count( 0 ), 1 );
+    BOOST_CHECK_EQUAL( file.find_entries( 0, "/dev/sda1" ).size(), 2 );
+
+    ColumnConfigFile::Entry * entry = file.create_entry();
+    entry->parse( "/dev/sda1  /home  ext4  defaults  0  2" );
+    file.append( entry );
+    BOOST_CHECK_EQUAL( file.get_duplicate_count( 0 ), 2 );
+
+    file.remove( 0 );
+    BOOST_CHECK_EQUAL( file.get_duplicate_count( 0 ), 1 );
+    file.get_entry( 0 )->set_column( 0, "/dev/sda2" );
+    BOOST_CHECK_EQUAL( file.get_duplicate_count( 0 ), 0 );
+    BOOST_CHECK( file.find_entry( 0, "/dev/sda1" ) == entry );
+}
+
+
+BOOST_AUTO_TEST_CASE( ordered_column_index )
+{
+    ColumnConfigFile indexed;
+    ColumnConfigFile plain;
+    string_vec lines = { "b 2", "a 1", "ab 3", "c 4", "abc 5", "a 6", "bb 7" };
+
+    indexed.parse( lines );
+    plain.parse( lines );
+    BOOST_CHECK( indexed.add_column_index( 0, ColumnConfigFile::ORDERED_INDEX ) );
+
+    vector<ColumnConfigFile::Entry *> found = indexed.find_range( 0, "a", "b" );
+    BOOST_CHECK_EQUAL( found.size(), 4 );
+    BOOST_CHECK( found[0] == indexed.get_entry( 1 ) );
+    BOOST_CHECK( found[3] == indexed.get_entry( 5 ) );
+
+    BOOST_CHECK( indexed.find_range( 0, "b", "a" ).empty() );
+    BOOST_CHECK_EQUAL( indexed.find_prefix( 0, "ab" ).size(), 2 );
+    BOOST_CHECK_EQUAL( indexed.find_prefix( 0, "" ).size(), lines.size() );
+    BOOST_CHECK( indexed.find_entries( 0, "a" ) == expected_entries( indexed, 0, "a" ) );
+
+    indexed.get_entry( 0 )->set_column( 0, "aa" );
+    plain.get_entry( 0 )->set_column( 0, "aa" );
+
+    // Without an index, the same queries just scan all entries
+
+    const char * ranges[][2] = { { "a", "b" }, { "aa", "abd" }, { "b", "z" }, { "", "a" } };
+
+    for ( size_t i=0; i < sizeof( ranges ) / sizeof( ranges[0] ); ++i )
+    {
+        found = indexed.find_range( 0, ranges[i][0], ranges[i][1] );
+        vector<ColumnConfigFile::Entry *> expected = plain.find_range( 0, ranges[i][0], ranges[i][1] );
+        BOOST_CHECK_EQUAL( found.size(), expected.size() );
+
+        for ( size_t j=0; j < found.size() && j < expected.size(); ++j )
+            BOOST_CHECK_EQUAL( indexed.get_index_of( found[j] ), plain.get_index_of( expected[j] ) );
+    }
+
+    BOOST_CHECK_EQUAL( indexed.find_prefix( 0, "a" ).size(), plain.find_prefix( 0, "a" ).size() );
+    BOOST_CHECK_EQUAL( indexed.find_prefix( 0, "b" ).size(), plain.find_prefix( 0, "b" ).size() );
+}
+
+
+BOOST_AUTO_TEST_CASE( column_index_lazy_columnar )
+{
+    MountConfigFile file;
+    file.set_lazy_parse();
+    file.set_columnar_storage();
+    file.parse( mounts );
+
+    BOOST_CHECK( file.add_column_index( 1 ) );
+    BOOST_CHECK( file.add_column_index( 0, ColumnConfigFile::ORDERED_INDEX ) );
+    BOOST_CHECK( file.find_entry( 1, "/var" ) == file.get_entry( 1 ) );
+    BOOST_CHECK_EQUAL( file.find_prefix( 0, "sda" ).size(), 2 );
+
+    file.get_mount( 2 )->set_mount_point( "/srv/data" );
+    BOOST_CHECK( file.find_entry( 1, "/srv" ) == 0 );
+    BOOST_CHECK( file.find_entry( 1, "/srv/data" ) == file.get_entry( 2 ) );
+    check_widths( file );
+
+    file.parse( string_vec { "sdc1 /mnt ext4", "sdc2 /opt ext4" } );
+    BOOST_CHECK( file.find_entry( 1, "/opt" ) == file.get_entry( 1 ) );
+    BOOST_CHECK_EQUAL( file.find_range( 0, "sdc2", "sdd" ).size(), 1 );
+    check_output( file );
+}
+
+
+string join_lines( const string_vec & lines )
+{
+    string text;
+
+    for ( size_t i=0; i < lines.size(); ++i )
+        text += lines[i] + "\n";
+
+    return text;
+}
+
+
+void check_text( ColumnConfigFile & file )
+{
+    string text;
+    file.format_text( text );
+
+    BOOST_CHECK_EQUAL( text, join_lines( file.format_lines() ) );
+}
+
+
+BOOST_AUTO_TEST_CASE( format_text )
+{
+    string_vec lines = input;
+    lines.push_back( "  leading  whitespace" );
+    lines.push_back( "trailing whitespace  " );
+    lines.push_back( "/dev/disk/by-label/very-long-name  /srv  nfs  ro  0  0" );
+
+    ColumnConfigFile file;
+    file.parse( lines );
+    check_text( file );
+
+    file.get_entry( 0 )->set_column( 1, "/mnt" );
+    file.get_entry( 1 )->set_line_comment( "# new line comment" );
+    check_text( file );
+
+    file.set_max_column_width( 0, 10 );
+    check_text( file );
+
+    file.set_pad_columns( false );
+    check_text( file );
+
+    file.set_pad_columns( true );
+    file.set_columnar_storage();
+    file.get_entry( 2 )->add_column( "extra" );
+    check_text( file );
+
+    file.set_verbatim_unchanged( true );
+    check_text( file );
+
+    MountConfigFile mount_file;
+    mount_file.parse( mounts );
+    mount_file.get_entry( 0 )->set_line_comment( "# root" );
+    mount_file.get_mount( 2 )->set_mount_point( "/srv/data" );
+    check_text( mount_file );
+}
@@ -0,0 +1,134 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE composite
+
+#include <boost/test/unit_test.hpp>
+#include <fstream>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "CompositeConfigFile.h"
+
+
+#define TEST_DIR "composite-test"
+
+
+void write_lines( const string & filename, const string_vec & lines )
+{
+    std::ofstream file( filename );
+
+    for ( size_t i=0; i < lines.size(); ++i )
+        file << lines[i] << "\n";
+}
+
+
+string_vec read_lines( const string & filename )
+{
+    std::ifstream file( filename );
+    string_vec    lines;
+    string        line;
+
+    while ( std::getline( file, line ) )
+        lines.push_back( line );
+
+    return lines;
+}
+
+
+string merged_contents( const CompositeConfigFile & file )
+{
+    string result;
+
+    for ( int i=0; i < file.get_entry_count(); ++i )
+    {
+        if ( ! result.empty() )
+            result += " ";
+
+        result += file.get_entry( i )->get_content();
+    }
+
+    return result;
+}
+
+
+BOOST_AUTO_TEST_CASE( composite )
+{
+    mkdir( TEST_DIR,         0755 );
+    mkdir( TEST_DIR "/conf.d", 0755 );
+
+    write_lines( TEST_DIR "/main", {
+            "# Main file",
+            "",
+            "main1",
+            "#includedir conf.d",
+            "main2",
+            "@include extra",
+            "main3",
+            "",
+            "#include last"
+        } );
+
+    write_lines( TEST_DIR "/conf.d/20-second", { "second" } );
+    write_lines( TEST_DIR "/conf.d/10-first",  { "first1", "#include ../nested", "first2" } );
+    write_lines( TEST_DIR "/conf.d/30-ignored~", { "ignored" } );
+    write_lines( TEST_DIR "/extra",  { "extra" } );
+    write_lines( TEST_DIR "/nested", { "# Nested", "nested" } );
+    write_lines( TEST_DIR "/last",   { "last" } );
+
+    CompositeConfigFile subject;
+    subject.set_thread_count( 3 );
+
+    BOOST_CHECK_EQUAL( subject.read( TEST_DIR "/main" ), true );
+    BOOST_CHECK_EQUAL( subject.get_file_count(), 6 );
+    BOOST_CHECK_EQUAL( merged_contents( subject ),
+                       "main1 first1 nested first2 second main2 @include extra extra main3 last" );
+
+    BOOST_CHECK_EQUAL( subject.get_source_filename( 0 ), TEST_DIR "/main" );
+    BOOST_CHECK_EQUAL( subject.get_source_filename( 1 ), TEST_DIR "/conf.d/10-first" );
+    BOOST_CHECK_EQUAL( subject.get_source_filename( 2 ), TEST_DIR "/conf.d/../nested" );
+    BOOST_CHECK_EQUAL( subject.get_source_filename( 4 ), TEST_DIR "/conf.d/20-second" );
+    BOOST_CHECK_EQUAL( subject.get_source_filename( 9 ), TEST_DIR "/last" );
+
+
+    // Only modified fragments are written back
+
+    write_lines( TEST_DIR "/extra", { "changed on disk" } );
+    subject.get_entry( 4 )->set_content( "modified" );
+
+    BOOST_CHECK_EQUAL( subject.write(), true );
+    BOOST_CHECK( read_lines( TEST_DIR "/conf.d/20-second" ) == string_vec( { "modified" } ) );
+    BOOST_CHECK( read_lines( TEST_DIR "/extra" ) == string_vec( { "changed on disk" } ) );
+
+
+    // Entries added to a fragment show up after update_merged_entries()
+
+    CommentedConfigFile::Entry * entry = new CommentedConfigFile::Entry();
+    entry->set_content( "new" );
+    subject.get_file( 0 )->insert( 1, entry );
+    subject.update_merged_entries();
+
+    BOOST_CHECK_EQUAL( merged_contents( subject ),
+                       "main1 new first1 nested first2 modified main2 @include extra extra main3 last" );
+
+
+    // Include loops and missing files are errors, missing directories are not
+
+    write_lines( TEST_DIR "/nested", { "#include ../main", "#includedir nonexistent", "nested" } );
+    BOOST_CHECK_EQUAL( subject.read( TEST_DIR "/main" ), false );
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 10 );
+
+    write_lines( TEST_DIR "/nested", { "#includedir nonexistent", "nested" } );
+    BOOST_CHECK_EQUAL( subject.read( TEST_DIR "/main" ), true );
+
+    unlink( TEST_DIR "/last" );
+    BOOST_CHECK_EQUAL( subject.read( TEST_DIR "/main" ), false );
+
+    unlink( TEST_DIR "/conf.d/10-first" );
+    unlink( TEST_DIR "/conf.d/20-second" );
+    unlink( TEST_DIR "/conf.d/30-ignored~" );
+    unlink( TEST_DIR "/extra" );
+    unlink( TEST_DIR "/nested" );
+    unlink( TEST_DIR "/main" );
+    rmdir( TEST_DIR "/conf.d" );
+    rmdir( TEST_DIR );
+}
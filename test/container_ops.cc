@@ -6,6 +6,11 @@
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #define protected public
 #define private   public
@@ -83,3 +88,297 @@ BOOST_AUTO_TEST_CASE( container_operations )
     BOOST_CHECK_EQUAL( subject.empty(), true );
     BOOST_CHECK_EQUAL( subject.get_entry_count(), 0 );
 }
+
+
+BOOST_AUTO_TEST_CASE( key_index )
+{
+    string_vec input = {
+        "aaa",
+        "bbb",
+        "ccc",
+        "bbb",
+        "ddd"
+    };
+
+    CommentedConfigFile subject;
+    subject.set_key_index_enabled();
+    subject.parse( input );
+
+    CommentedConfigFile::Entry * entry_a = subject.get_entry(0);
+    CommentedConfigFile::Entry * entry_b = subject.get_entry(1);
+    CommentedConfigFile::Entry * entry_b2 = subject.get_entry(3);
+
+    BOOST_CHECK_EQUAL( subject.find_entry( "aaa" ), entry_a );
+    BOOST_CHECK_EQUAL( subject.find_entry( "bbb" ), entry_b );
+    BOOST_CHECK_EQUAL( subject.find_entry( "xxx" ), (void *) 0 );
+    BOOST_CHECK_EQUAL( subject.find_entries( "bbb" ).size(), 2 );
+    BOOST_CHECK_EQUAL( subject.find_entries( "bbb" )[1], entry_b2 );
+    BOOST_CHECK_EQUAL( subject.get_index_of( entry_b2 ), 3 );
+
+    // Modifying an entry updates its key
+
+    entry_a->set_content( "xxx" );
+    BOOST_CHECK_EQUAL( subject.find_entry( "aaa" ), (void *) 0 );
+    BOOST_CHECK_EQUAL( subject.find_entry( "xxx" ), entry_a );
+
+    // Taking and re-inserting entries keeps indexes and key index consistent
+
+    subject.remove( entry_b );
+    BOOST_CHECK_EQUAL( subject.find_entry( "bbb" ), entry_b2 );
+    BOOST_CHECK_EQUAL( subject.get_index_of( entry_b2 ), 2 );
+
+    CommentedConfigFile::Entry * entry = subject.take( 0 );
+    BOOST_CHECK_EQUAL( subject.find_entry( "xxx" ), (void *) 0 );
+    BOOST_CHECK_EQUAL( subject.get_index_of( entry ), -1 );
+    BOOST_CHECK_EQUAL( subject.get_index_of( entry_b2 ), 1 );
+
+    subject.insert( 2, entry );
+    BOOST_CHECK_EQUAL( subject.find_entry( "xxx" ), entry );
+    BOOST_CHECK_EQUAL( subject.get_index_of( entry ), 2 );
+    BOOST_CHECK_EQUAL( subject.get_index_of( entry_b2 ), 1 );
+    BOOST_CHECK_EQUAL( subject.get_index_of( subject.get_entry(3) ), 3 );
+
+    // Without the index, the same lookups work by linear search
+
+    subject.set_key_index_enabled( false );
+    BOOST_CHECK_EQUAL( subject.find_entry( "xxx" ), entry );
+    BOOST_CHECK_EQUAL( subject.find_entries( "bbb" ).size(), 1 );
+}
+
+
+string contents( const CommentedConfigFile & file )
+{
+    string result;
+
+    for ( int i=0; i < file.get_entry_count(); ++i )
+    {
+        CommentedConfigFile::Entry * entry = file.get_entry( i );
+
+        BOOST_CHECK_EQUAL( entry->get_parent(), &file );
+        BOOST_CHECK_EQUAL( file.get_index_of( entry ), i );
+        result += entry->get_content();
+    }
+
+    return result;
+}
+
+
+BOOST_AUTO_TEST_CASE( bulk_operations )
+{
+    string_vec input = { "a", "b", "c", "d", "e", "f" };
+
+    CommentedConfigFile subject;
+    subject.set_key_index_enabled();
+    subject.parse( input );
+
+    int removed = subject.remove_if( []( CommentedConfigFile::Entry * entry )
+        { return entry->get_content() == "b" || entry->get_content() == "e"; } );
+
+    BOOST_CHECK_EQUAL( removed, 2 );
+    BOOST_CHECK_EQUAL( contents( subject ), "acdf" );
+    BOOST_CHECK_EQUAL( subject.find_entry( "b" ), (void *) 0 );
+    BOOST_CHECK_EQUAL( subject.find_entry( "f" ), subject.get_entry( 3 ) );
+
+    vector<CommentedConfigFile::Entry *> new_entries;
+
+    for ( int i=0; i < 2; ++i )
+    {
+        new_entries.push_back( new CommentedConfigFile::Entry() );
+        new_entries.back()->set_content( i == 0 ? "x" : "y" );
+    }
+
+    subject.insert( 1, new_entries );
+    BOOST_CHECK_EQUAL( contents( subject ), "axycdf" );
+    BOOST_CHECK_EQUAL( subject.find_entry( "y" ), subject.get_entry( 2 ) );
+
+    BOOST_CHECK_EQUAL( subject.reorder( { 5, 4, 3, 2, 1, 0 } ), true );
+    BOOST_CHECK_EQUAL( contents( subject ), "fdcyxa" );
+
+    BOOST_CHECK_EQUAL( subject.reorder( { 0, 0, 1, 2, 3, 4 } ), false );
+    BOOST_CHECK_EQUAL( subject.reorder( { 0, 1 } ), false );
+    BOOST_CHECK_EQUAL( contents( subject ), "fdcyxa" );
+
+    // Within the same file
+
+    subject.splice( 0, subject, 3, 2 );
+    BOOST_CHECK_EQUAL( contents( subject ), "yxfdca" );
+
+    subject.splice( 6, subject, 0, 1 );
+    BOOST_CHECK_EQUAL( contents( subject ), "xfdcay" );
+
+    // Between two files
+
+    CommentedConfigFile other;
+    other.set_key_index_enabled();
+    other.parse( input );
+
+    subject.splice( 1, other, 2 );
+    BOOST_CHECK_EQUAL( contents( subject ), "xcdeffdcay" );
+    BOOST_CHECK_EQUAL( contents( other ), "ab" );
+    BOOST_CHECK_EQUAL( other.find_entry( "e" ), (void *) 0 );
+    BOOST_CHECK_EQUAL( subject.find_entries( "f" ).size(), 2 );
+    BOOST_CHECK_EQUAL( subject.find_entries( "f" )[0], subject.get_entry( 4 ) );
+}
+
+
+BOOST_AUTO_TEST_CASE( snapshots )
+{
+    string_vec input = { "# header", "", "a", "# comment b", "b", "c # line comment", "", "# footer" };
+
+    CommentedConfigFile subject;
+    subject.parse( input );
+
+    CommentedConfigFile::Snapshot orig = subject.snapshot();
+
+    BOOST_CHECK_EQUAL( orig.get_entry_count(), 3 );
+    BOOST_CHECK_EQUAL( orig.get_entry( 2 ).content, "c" );
+    BOOST_CHECK_EQUAL( orig.get_entry( 2 ).line, "c # line comment" );
+    BOOST_CHECK( orig.format_lines() == input );
+
+    // Nothing changed: The very same snapshot
+
+    BOOST_CHECK( subject.snapshot().is_same_as( orig ) );
+
+
+    // Only the modified entry gets a new image
+
+    subject.get_entry( 1 )->set_content( "bb" );
+    subject.append( new CommentedConfigFile::Entry() );
+    subject.get_entry( 3 )->set_content( "d" );
+
+    CommentedConfigFile::Snapshot changed = subject.snapshot();
+
+    BOOST_CHECK( ! changed.is_same_as( orig ) );
+    BOOST_CHECK_EQUAL( changed.get_entry_count(), 4 );
+    BOOST_CHECK_EQUAL( &changed.get_entry( 0 ), &orig.get_entry( 0 ) );
+    BOOST_CHECK_NE   ( &changed.get_entry( 1 ), &orig.get_entry( 1 ) );
+    BOOST_CHECK_EQUAL( &changed.get_entry( 2 ), &orig.get_entry( 2 ) );
+    BOOST_CHECK( changed.header == orig.header );
+    BOOST_CHECK( changed.footer == orig.footer );
+    BOOST_CHECK_EQUAL( contents( subject ), "abbcd" );
+
+    // The old snapshot is not affected
+
+    BOOST_CHECK_EQUAL( orig.get_entry( 1 ).content, "b" );
+    BOOST_CHECK( orig.format_lines() == input );
+
+    string_vec diff = CommentedConfigFile::Snapshot::diff( orig, changed );
+    BOOST_CHECK( std::find( diff.begin(), diff.end(), "-b"  ) != diff.end() );
+    BOOST_CHECK( std::find( diff.begin(), diff.end(), "+bb" ) != diff.end() );
+    BOOST_CHECK( std::find( diff.begin(), diff.end(), "+d"  ) != diff.end() );
+    BOOST_CHECK( CommentedConfigFile::Snapshot::diff( orig, orig ).empty() );
+
+
+    // Rollback keeps the unchanged entries
+
+    subject.set_header_comments( { "# new header" } );
+    CommentedConfigFile::Entry * entry_a = subject.get_entry( 0 );
+    CommentedConfigFile::Entry * entry_c = subject.get_entry( 2 );
+
+    BOOST_CHECK_EQUAL( subject.rollback( orig ), true );
+    BOOST_CHECK_EQUAL( contents( subject ), "abc" );
+    BOOST_CHECK_EQUAL( subject.get_entry( 0 ), entry_a );
+    BOOST_CHECK_EQUAL( subject.get_entry( 2 ), entry_c );
+    BOOST_CHECK( subject.get_entry( 1 )->get_comment_before() == string_vec( { "# comment b" } ) );
+    BOOST_CHECK( subject.format_lines() == input );
+    BOOST_CHECK( subject.is_modified() );
+
+    // ...and back to the changed version
+
+    BOOST_CHECK_EQUAL( subject.rollback( changed ), true );
+    BOOST_CHECK_EQUAL( contents( subject ), "abbcd" );
+    BOOST_CHECK( subject.format_lines() == changed.format_lines() );
+
+
+    // Writing a snapshot does not change the file
+
+    char tmpname[] = "/tmp/ccf-snapshot-XXXXXX";
+    int fd = mkstemp( tmpname );
+    BOOST_REQUIRE( fd >= 0 );
+    close( fd );
+
+    BOOST_CHECK_EQUAL( subject.write_snapshot( orig, tmpname ), true );
+
+    CommentedConfigFile reread;
+    reread.read( tmpname );
+    BOOST_CHECK( reread.format_lines() == input );
+    BOOST_CHECK_EQUAL( contents( subject ), "abbcd" );
+
+    unlink( tmpname );
+}
+
+
+BOOST_AUTO_TEST_CASE( publish )
+{
+    string_vec input = { "key0 0", "key1 0", "key2 0", "key3 0" };
+
+    CommentedConfigFile subject;
+    subject.parse( input );
+
+    BOOST_CHECK( ! subject.get_published() );
+
+    subject.publish();
+    std::shared_ptr<const CommentedConfigFile::Snapshot> first = subject.get_published();
+
+    BOOST_REQUIRE( first );
+    BOOST_CHECK_EQUAL( first->get_entry_count(), 4 );
+    BOOST_CHECK_EQUAL( first->find_entry( "key2 0" ), &first->get_entry( 2 ) );
+    BOOST_CHECK_EQUAL( first->find_entry( "nonexistent" ), (void *) 0 );
+
+    // The readers must always see all entries with the same version
+
+    std::atomic<bool> done( false );
+    std::atomic<int>  inconsistent( 0 );
+    std::atomic<int>  reads( 0 );
+    vector<std::thread> readers;
+
+    for ( int i=0; i < 4; ++i )
+    {
+        readers.push_back( std::thread( [&]()
+            {
+                while ( ! done || reads < 100 )
+                {
+                    std::shared_ptr<const CommentedConfigFile::Snapshot> snapshot =
+                        subject.get_published();
+                    string version = snapshot->get_entry( 0 ).content.substr( 5 );
+
+                    for ( int j=1; j < snapshot->get_entry_count(); ++j )
+                    {
+                        if ( snapshot->get_entry( j ).content.substr( 5 ) != version )
+                            ++inconsistent;
+                    }
+
+                    ++reads;
+                }
+            } ) );
+    }
+
+    for ( int version = 1; version <= 200; ++version )
+    {
+        for ( int j=0; j < subject.get_entry_count(); ++j )
+        {
+            CommentedConfigFile::Entry * entry = subject.get_entry( j );
+            entry->set_content( entry->get_content().substr( 0, 5 ) + std::to_string( version ) );
+        }
+
+        subject.publish();
+    }
+
+    done = true;
+
+    for ( size_t i=0; i < readers.size(); ++i )
+        readers[i].join();
+
+    BOOST_CHECK_EQUAL( inconsistent, 0 );
+    BOOST_CHECK_EQUAL( subject.get_published()->get_entry( 3 ).content, "key3 200" );
+    BOOST_CHECK( subject.get_published()->find_entry( "key1 200" ) );
+
+    // Old snapshots stay valid as long as somebody holds them, and not
+    // longer
+
+    BOOST_CHECK_EQUAL( first->get_entry( 3 ).content, "key3 0" );
+
+    std::weak_ptr<const CommentedConfigFile::Snapshot> weak_first = first;
+    first.reset();
+    BOOST_CHECK( weak_first.expired() );
+}
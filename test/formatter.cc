@@ -6,6 +6,7 @@
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #define protected public
 #define private   public
@@ -94,3 +95,321 @@ BOOST_AUTO_TEST_CASE( write_to_file )
     BOOST_CHECK_EQUAL( success, false );
 }
 
+
+BOOST_AUTO_TEST_CASE( verbatim_unchanged )
+{
+    string_vec input = test_data();
+    input.insert( input.begin() + 17, "entry 05   content    # odd spacing" );
+
+    string filename = "formatter-verbatim-test.out";
+
+    {
+        std::ofstream file( filename );
+
+        for ( size_t i=0; i < input.size(); ++i )
+            file << input[i] << "\n";
+    }
+
+    CommentedConfigFile subject;
+    subject.set_verbatim_unchanged();
+    subject.read( filename );
+
+    BOOST_CHECK_EQUAL( subject.is_modified(), false );
+    BOOST_CHECK_EQUAL( subject.get_entry(5)->get_orig_line(), input[17] );
+
+    // Nothing changed: The file is not touched, but still reported as success
+
+    BOOST_CHECK_EQUAL( subject.write(), true );
+    BOOST_CHECK_EQUAL( subject.is_modified(), false );
+
+    // Copying to a different file copies the original bytes
+
+    string copy_name = "formatter-verbatim-copy.out";
+    BOOST_CHECK_EQUAL( subject.write( copy_name ), true );
+
+    string_vec lines = read_lines( copy_name );
+    BOOST_CHECK_EQUAL( input.size(), lines.size() );
+
+    for ( size_t i=0; i < input.size(); ++i )
+        BOOST_CHECK_EQUAL( input[i], lines[i] );
+
+    // Only the modified entry is formatted
+
+    subject.get_entry(0)->set_content( "entry 00 changed" );
+    BOOST_CHECK_EQUAL( subject.is_modified(), true );
+    BOOST_CHECK_EQUAL( subject.get_entry(0)->is_modified(), true );
+    BOOST_CHECK_EQUAL( subject.get_entry(1)->is_modified(), false );
+
+    BOOST_CHECK_EQUAL( subject.write( filename ), true );
+    BOOST_CHECK_EQUAL( subject.is_modified(), false );
+    BOOST_CHECK_EQUAL( subject.get_entry(0)->is_modified(), false );
+
+    input[7] = "entry 00 changed";
+    lines = read_lines( filename );
+    BOOST_CHECK_EQUAL( input.size(), lines.size() );
+
+    for ( size_t i=0; i < input.size(); ++i )
+        BOOST_CHECK_EQUAL( input[i], lines[i] );
+
+    remove( filename.c_str() );
+    remove( copy_name.c_str() );
+}
+
+
+BOOST_AUTO_TEST_CASE( atomic_write )
+{
+    string_vec input = test_data();
+
+    // Enough entries to exceed what fits into a single writev()
+
+    for ( int i=0; i < 1000; ++i )
+        input.insert( input.end() - 3, "generated entry" );
+
+    CommentedConfigFile subject;
+    subject.parse( input );
+    subject.set_atomic_write();
+    subject.set_fsync_policy( FSYNC_FILE_AND_DIR );
+
+    string filename = "formatter-atomic-test.out";
+    remove( filename.c_str() );
+
+    BOOST_CHECK_EQUAL( subject.write( filename ), true );
+    chmod( filename.c_str(), 0640 );
+
+    subject.get_entry(0)->set_content( "entry 00 changed" );
+    input[7] = "entry 00 changed";
+
+    BOOST_CHECK_EQUAL( subject.write( filename ), true );
+
+    string_vec lines = read_lines( filename );
+    BOOST_CHECK_EQUAL( input.size(), lines.size() );
+
+    for ( size_t i=0; i < input.size(); ++i )
+        BOOST_CHECK_EQUAL( input[i], lines[i] );
+
+    struct stat st;
+    BOOST_CHECK_EQUAL( stat( filename.c_str(), &st ), 0 );
+    BOOST_CHECK_EQUAL( st.st_mode & 0777, 0640 );
+
+    remove( filename.c_str() );
+
+    BOOST_CHECK_EQUAL( subject.write( "/wrglbrmpf/doesntexist/x.out" ), false );
+}
+
+
+BOOST_AUTO_TEST_CASE( skip_identical )
+{
+    string_vec input = test_data();
+    string filename = "formatter-skip-test.out";
+
+    CommentedConfigFile subject;
+    subject.parse( input );
+    subject.set_skip_identical();
+
+    remove( filename.c_str() );
+    BOOST_CHECK_EQUAL( subject.write( filename ), true );
+    BOOST_CHECK_EQUAL( subject.get_write_skipped(), false );
+
+    // Unchanged since the last write: Uses the hash from that write
+
+    BOOST_CHECK_EQUAL( subject.write(), true );
+    BOOST_CHECK_EQUAL( subject.get_write_skipped(), true );
+
+    // Same content, but a different file: Compares against its content
+
+    CommentedConfigFile other;
+    other.parse( input );
+    other.set_skip_identical();
+
+    BOOST_CHECK_EQUAL( other.write( filename ), true );
+    BOOST_CHECK_EQUAL( other.get_write_skipped(), true );
+
+    other.get_entry(0)->set_content( "entry 00 has changed" );
+    BOOST_CHECK_EQUAL( other.write( filename ), true );
+    BOOST_CHECK_EQUAL( other.get_write_skipped(), false );
+
+    // Changed on disk behind the first subject's back
+
+    BOOST_CHECK_EQUAL( subject.write(), true );
+    BOOST_CHECK_EQUAL( subject.get_write_skipped(), false );
+
+    string_vec lines = read_lines( filename );
+    BOOST_CHECK_EQUAL( input.size(), lines.size() );
+
+    for ( size_t i=0; i < input.size(); ++i )
+        BOOST_CHECK_EQUAL( input[i], lines[i] );
+
+    // Read without skip_identical: No hash of the content was kept, so
+    // the content on disk is compared
+
+    CommentedConfigFile reader;
+    reader.read( filename );
+    reader.set_skip_identical();
+
+    BOOST_CHECK_EQUAL( reader.write(), true );
+    BOOST_CHECK_EQUAL( reader.get_write_skipped(), true );
+
+    remove( filename.c_str() );
+}
+
+
+class CountingEntry: public CommentedConfigFile::Entry
+{
+public:
+    static int format_count;
+
+    virtual string format()
+        { ++format_count; return CommentedConfigFile::Entry::format(); }
+};
+
+int CountingEntry::format_count = 0;
+
+
+class CountingConfigFile: public CommentedConfigFile
+{
+public:
+    virtual Entry * create_entry() { return new CountingEntry(); }
+};
+
+
+BOOST_AUTO_TEST_CASE( format_cache )
+{
+    string_vec input = test_data();
+
+    CountingConfigFile subject;
+    subject.set_format_cache();
+    subject.parse( input );
+
+    CountingEntry::format_count = 0;
+    string_vec output = subject.format_lines();
+    BOOST_CHECK_EQUAL( CountingEntry::format_count, 5 );
+
+    // Nothing changed: Everything comes from the cache
+
+    output = subject.format_lines();
+    subject.diff();
+    BOOST_CHECK_EQUAL( CountingEntry::format_count, 5 );
+
+    subject.get_entry(2)->set_content( "entry 02 changed" );
+    output = subject.format_lines();
+    BOOST_CHECK_EQUAL( CountingEntry::format_count, 6 );
+    BOOST_CHECK_EQUAL( output[14], "entry 02 changed" );
+
+    subject.get_entry(1)->set_line_comment( "# new line comment" );
+    output = subject.format_lines();
+    BOOST_CHECK_EQUAL( CountingEntry::format_count, 7 );
+    BOOST_CHECK_EQUAL( output[9], "entry 01 content # new line comment" );
+}
+
+
+/**
+ * Entry that formats a field of its own and does not call set_modified()
+ * when it changes.
+ **/
+class KeyValueEntry: public CountingEntry
+{
+public:
+    virtual string format() { CountingEntry::format(); return "key=" + value; }
+
+    string value;
+};
+
+
+class KeyValueConfigFile: public CommentedConfigFile
+{
+public:
+    virtual Entry * create_entry() { return new KeyValueEntry(); }
+};
+
+
+BOOST_AUTO_TEST_CASE( no_format_cache )
+{
+    KeyValueConfigFile subject;
+    subject.parse( string_vec { "a", "b" } );
+
+    KeyValueEntry * entry = static_cast<KeyValueEntry *>( subject.get_entry( 0 ) );
+    entry->value = "old";
+    BOOST_CHECK_EQUAL( subject.format_lines()[0], "key=old" );
+
+    entry->value = "new";
+    BOOST_CHECK_EQUAL( subject.format_lines()[0], "key=new" );
+
+    // format_text() still formats each entry only once
+
+    string text;
+    CountingEntry::format_count = 0;
+    entry->value = "newer";
+    subject.format_text( text );
+    BOOST_CHECK_EQUAL( text, "key=newer\nkey=\n" );
+    BOOST_CHECK_EQUAL( CountingEntry::format_count, 2 );
+
+    entry->value = "newest";
+    subject.format_text( text );
+    BOOST_CHECK_EQUAL( text, "key=newest\nkey=\n" );
+}
+
+
+string join_lines( const string_vec & lines )
+{
+    string text;
+
+    for ( size_t i=0; i < lines.size(); ++i )
+        text += lines[i] + "\n";
+
+    return text;
+}
+
+
+/**
+ * Entry that is not written if its content contains "skip".
+ **/
+class SkippingEntry: public CountingEntry
+{
+public:
+    virtual bool validate()
+        { return get_content().find( "skip" ) == string::npos; }
+};
+
+
+class SkippingConfigFile: public CommentedConfigFile
+{
+public:
+    virtual Entry * create_entry() { return new SkippingEntry(); }
+};
+
+
+BOOST_AUTO_TEST_CASE( format_text )
+{
+    string_vec input = test_data();
+    string     text;
+
+    SkippingConfigFile subject;
+    subject.set_format_cache();
+    subject.parse( input );
+    subject.format_text( text );
+
+    BOOST_CHECK_EQUAL( text, join_lines( input ) );
+
+    // Formatted lines come from the cache
+
+    CountingEntry::format_count = 0;
+    subject.get_entry(2)->set_content( "entry 02 skip" );
+    subject.get_entry(3)->set_content( "entry 03 changed" );
+    subject.format_text( text );
+
+    BOOST_CHECK_EQUAL( CountingEntry::format_count, 1 );
+    BOOST_CHECK_EQUAL( text, join_lines( subject.format_lines() ) );
+    BOOST_CHECK( text.find( "entry 02" ) == string::npos );
+    BOOST_CHECK( text.find( "# entry 02 comment 00" ) == string::npos );
+
+    subject.set_verbatim_unchanged( true );
+    subject.get_entry(1)->set_line_comment( "# new line comment" );
+    subject.format_text( text );
+    BOOST_CHECK_EQUAL( text, join_lines( subject.format_lines() ) );
+
+    CommentedConfigFile lazy;
+    lazy.set_lazy_parse();
+    lazy.parse( input );
+    lazy.format_text( text );
+    BOOST_CHECK_EQUAL( text, join_lines( input ) );
+}
@@ -0,0 +1,237 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE parse_cache
+
+#include <boost/test/unit_test.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ColumnConfigFile.h"
+#include "ParseCache.h"
+
+#define CACHE_DIR "parse-cache-test.d"
+
+
+string_vec test_data()
+{
+    string_vec lines = {
+        "# header 00",
+        "",
+        "# entry 00 comment 00",
+        "aaa   1 # line comment 00",
+        "bbb 2",
+        "",
+        "# entry 02 comment 00",
+        "ccc 3",
+        "",
+        "# footer 00"
+    };
+
+    return lines;
+}
+
+
+/**
+ * Entry with a field of its own that does not know anything about the
+ * parse cache.
+ **/
+class NumberEntry: public CommentedConfigFile::Entry
+{
+public:
+
+    NumberEntry(): number( -1 ) {}
+
+    virtual bool parse( const string & line, int line_no = -1 )
+        {
+            set_content( line );
+            number = atoi( line.substr( 4 ).c_str() );
+
+            return true;
+        }
+
+    int number;
+};
+
+
+class NumberConfigFile: public CommentedConfigFile
+{
+public:
+
+    virtual Entry * create_entry() { return new NumberEntry(); }
+};
+
+
+void clean_up( const string & filename, ParseCache & cache )
+{
+    cache.remove( filename );
+    remove( filename.c_str() );
+}
+
+
+BOOST_AUTO_TEST_CASE( cache_hit_and_miss )
+{
+    ParseCache cache( CACHE_DIR );
+    string     filename = "parse-cache-test.conf";
+
+    FileIO::write_file( filename, test_data() );
+    cache.remove( filename );
+
+    CommentedConfigFile first;
+    first.set_parse_cache( &cache );
+
+    BOOST_CHECK_EQUAL( first.read( filename ), true );
+    BOOST_CHECK_EQUAL( cache.get_misses(), 1 );
+    BOOST_CHECK_EQUAL( access( cache.get_cache_filename( filename ).c_str(), R_OK ), 0 );
+
+    CommentedConfigFile second;
+    second.set_parse_cache( &cache );
+    second.set_diff_enabled();
+
+    BOOST_CHECK_EQUAL( second.read( filename ), true );
+    BOOST_CHECK_EQUAL( cache.get_hits(), 1 );
+
+    BOOST_CHECK_EQUAL( second.get_filename(), filename );
+    BOOST_CHECK_EQUAL( second.is_modified(), false );
+    BOOST_CHECK_EQUAL( second.get_entry_count(), 3 );
+    BOOST_CHECK_EQUAL( second.get_entry(0)->get_content(), "aaa   1" );
+    BOOST_CHECK_EQUAL( second.get_entry(0)->get_line_comment(), "# line comment 00" );
+    BOOST_CHECK_EQUAL( second.get_entry(0)->is_modified(), false );
+    BOOST_CHECK( second.get_entry(2)->get_comment_before() ==
+                 string_vec( { "", "# entry 02 comment 00" } ) );
+    BOOST_CHECK( second.get_header_comments() == string_vec( { "# header 00", "" } ) );
+    BOOST_CHECK( second.get_footer_comments() == string_vec( { "", "# footer 00" } ) );
+    BOOST_CHECK( second.format_lines() == first.format_lines() );
+    BOOST_CHECK( second.diff().empty() );
+
+    // Writing it back unchanged knows the content on disk without reading it
+
+    second.set_skip_identical();
+    BOOST_CHECK_EQUAL( second.write(), true );
+    BOOST_CHECK_EQUAL( second.get_write_skipped(), true );
+
+
+    // A changed file is parsed again
+
+    string_vec lines = test_data();
+    lines[4] = "bbb 2222";
+    FileIO::write_file( filename, lines );
+
+    CommentedConfigFile third;
+    third.set_parse_cache( &cache );
+
+    BOOST_CHECK_EQUAL( third.read( filename ), true );
+    BOOST_CHECK_EQUAL( cache.get_hits(), 1 );
+    BOOST_CHECK_EQUAL( cache.get_misses(), 2 );
+    BOOST_CHECK_EQUAL( third.get_entry(1)->get_content(), "bbb 2222" );
+
+    clean_up( filename, cache );
+}
+
+
+BOOST_AUTO_TEST_CASE( column_config_file )
+{
+    ParseCache cache( CACHE_DIR );
+    string     filename = "parse-cache-test.columns";
+
+    FileIO::write_file( filename, test_data() );
+    cache.remove( filename );
+
+    ColumnConfigFile first;
+    first.set_parse_cache( &cache );
+    first.read( filename );
+
+    ColumnConfigFile second;
+    second.set_parse_cache( &cache );
+
+    BOOST_CHECK_EQUAL( second.read( filename ), true );
+    BOOST_CHECK_EQUAL( cache.get_hits(), 1 );
+    BOOST_CHECK_EQUAL( second.get_entry(0)->get_column_count(), 2 );
+    BOOST_CHECK_EQUAL( second.get_entry(0)->get_column(0), "aaa" );
+    BOOST_CHECK_EQUAL( second.get_entry(0)->get_column(1), "1" );
+    BOOST_CHECK( second.format_lines() == first.format_lines() );
+
+    // A cache file for a different class is not used
+
+    CommentedConfigFile plain;
+    plain.set_parse_cache( &cache );
+
+    BOOST_CHECK_EQUAL( plain.read( filename ), true );
+    BOOST_CHECK_EQUAL( cache.get_hits(), 1 );
+    BOOST_CHECK_EQUAL( plain.get_entry(0)->get_content(), "aaa   1" );
+
+    clean_up( filename, cache );
+}
+
+
+BOOST_AUTO_TEST_CASE( entries_without_cache_support )
+{
+    ParseCache cache( CACHE_DIR );
+    string     filename = "parse-cache-test.numbers";
+
+    FileIO::write_file( filename, test_data() );
+    cache.remove( filename );
+
+    NumberConfigFile first;
+    first.set_parse_cache( &cache );
+    first.read( filename );
+
+    NumberConfigFile second;
+    second.set_parse_cache( &cache );
+
+    BOOST_CHECK_EQUAL( second.read( filename ), true );
+    BOOST_CHECK_EQUAL( cache.get_hits(), 1 );
+    BOOST_CHECK_EQUAL( second.get_entry_count(), 3 );
+    BOOST_CHECK_EQUAL( dynamic_cast<NumberEntry *>( second.get_entry(0) )->number, 1 );
+    BOOST_CHECK_EQUAL( dynamic_cast<NumberEntry *>( second.get_entry(2) )->number, 3 );
+    BOOST_CHECK_EQUAL( second.get_entry(2)->is_modified(), false );
+    BOOST_CHECK( second.format_lines() == first.format_lines() );
+
+    clean_up( filename, cache );
+}
+
+
+BOOST_AUTO_TEST_CASE( invalid_cache_files )
+{
+    ParseCache cache( CACHE_DIR );
+    string     filename = "parse-cache-test.corrupt";
+
+    FileIO::write_file( filename, test_data() );
+    cache.remove( filename );
+
+    CommentedConfigFile first;
+    first.set_parse_cache( &cache );
+    first.read( filename );
+
+    string buffer;
+    BOOST_CHECK_EQUAL( FileIO::read_file( cache.get_cache_filename( filename ), buffer ), true );
+
+    // Truncated, or with a string reference out of range
+
+    vector<string> corrupt = { buffer.substr( 0, buffer.size() / 2 ), buffer };
+    corrupt[1].replace( 72, 4, "\xff\xff\xff\x7f" ); // Header::path.offset
+
+    for ( size_t i=0; i < corrupt.size(); ++i )
+    {
+        FileIO::write_content_atomic( cache.get_cache_filename( filename ), corrupt[i] );
+
+        CommentedConfigFile subject;
+        subject.set_parse_cache( &cache );
+
+        BOOST_CHECK_EQUAL( subject.read( filename ), true );
+        BOOST_CHECK_EQUAL( cache.get_hits(), 0 );
+        BOOST_CHECK( subject.format_lines() == first.format_lines() );
+    }
+
+    // deserialize() leaves the file alone if the buffer is invalid
+
+    vector<uint64_t> aligned( corrupt[1].size() / 8 + 1 );
+    memcpy( &aligned[0], corrupt[1].data(), corrupt[1].size() );
+
+    BOOST_CHECK_EQUAL( ParseCache::deserialize( &first, (const char *) &aligned[0],
+                                                corrupt[1].size() ), false );
+    BOOST_CHECK_EQUAL( first.get_entry_count(), 3 );
+
+    clean_up( filename, cache );
+    rmdir( CACHE_DIR );
+}
@@ -3,6 +3,9 @@
 #define BOOST_TEST_MODULE commented-config-file
 
 #include <boost/test/unit_test.hpp>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
 
 #define protected public
 #define private   public
@@ -158,20 +161,20 @@ BOOST_AUTO_TEST_CASE( parser_with_entry_comments )
     BOOST_CHECK_EQUAL( subject.get_content(3), string( "entry 03 content" ) );
     BOOST_CHECK_EQUAL( subject.get_content(4), string( "entry 04 content" ) );
 
-    BOOST_CHECK_EQUAL( subject.get_entry(0)->line_comment.empty(), true );
-    BOOST_CHECK_EQUAL( subject.get_entry(1)->line_comment, string( "# entry 01 line comment  " ) );
-    BOOST_CHECK_EQUAL( subject.get_entry(2)->line_comment.empty(), true );
+    BOOST_CHECK_EQUAL( subject.get_entry(0)->get_line_comment().empty(), true );
+    BOOST_CHECK_EQUAL( subject.get_entry(1)->get_line_comment(), string( "# entry 01 line comment  " ) );
+    BOOST_CHECK_EQUAL( subject.get_entry(2)->get_line_comment().empty(), true );
 
-    string_vec & comment = subject.get_entry(0)->comment_before;
+    string_vec comment = subject.get_entry(0)->get_comment_before();
     BOOST_CHECK_EQUAL( comment.size(), 2 );
     BOOST_CHECK_EQUAL( comment[0], input[ 5 ] );
     BOOST_CHECK_EQUAL( comment[1], input[ 6 ] );
 
-    comment = subject.get_entry(1)->comment_before;
+    comment = subject.get_entry(1)->get_comment_before();
     BOOST_CHECK_EQUAL( comment.size(), 1 );
     BOOST_CHECK_EQUAL( comment[0], input[ 8 ] );
 
-    comment = subject.get_entry(2)->comment_before;
+    comment = subject.get_entry(2)->get_comment_before();
     BOOST_CHECK_EQUAL( comment.size(), 4 );
     BOOST_CHECK_EQUAL( comment[0], input[ 10 ] );
     BOOST_CHECK_EQUAL( comment[1], input[ 11 ] );
@@ -179,3 +182,418 @@ BOOST_AUTO_TEST_CASE( parser_with_entry_comments )
     BOOST_CHECK_EQUAL( comment[3], input[ 13 ] );
 }
 
+
+
+BOOST_AUTO_TEST_CASE( rare_data )
+{
+    string_vec input = {
+        "aaa",
+        "# comment",
+        "bbb",
+        "ccc # line comment",
+        "ddd"
+    };
+
+    CommentedConfigFile subject;
+    subject.parse( input );
+
+    // Only entries with comments need their rare data
+
+    BOOST_CHECK( ! subject.get_entry(0)->rare );
+    BOOST_CHECK(   subject.get_entry(1)->rare );
+    BOOST_CHECK(   subject.get_entry(2)->rare );
+    BOOST_CHECK( ! subject.get_entry(3)->rare );
+
+    BOOST_CHECK_EQUAL( subject.get_entry(0)->get_comment_before().empty(), true );
+    BOOST_CHECK_EQUAL( subject.get_entry(1)->get_comment_before()[0], "# comment" );
+    BOOST_CHECK_EQUAL( subject.get_entry(2)->get_line_comment(), "# line comment" );
+
+    subject.get_entry(3)->set_line_comment( "# new" );
+    BOOST_CHECK( subject.get_entry(3)->rare );
+    BOOST_CHECK( subject.format_lines().back() == "ddd # new" );
+}
+
+
+void write_lines( const string & filename, const string_vec & lines )
+{
+    std::ofstream file( filename );
+
+    for ( size_t i=0; i < lines.size(); ++i )
+        file << lines[i] << "\n";
+}
+
+
+BOOST_AUTO_TEST_CASE( reload )
+{
+    string_vec input = {
+        /** 00 **/  "# header 00",
+        /** 01 **/  "",
+        /** 02 **/  "aaa",
+        /** 03 **/  "# bbb comment",
+        /** 04 **/  "bbb",
+        /** 05 **/  "ccc # line comment",
+        /** 06 **/  "ddd",
+        /** 07 **/  "",
+        /** 08 **/  "# footer 00"
+    };
+
+    string filename = "parser-reload-test.txt";
+    write_lines( filename, input );
+
+    CommentedConfigFile subject;
+    subject.read( filename );
+
+    CommentedConfigFile::Entry * entry_a = subject.get_entry(0);
+    CommentedConfigFile::Entry * entry_b = subject.get_entry(1);
+    CommentedConfigFile::Entry * entry_c = subject.get_entry(2);
+
+    // Unchanged file: Nothing to do
+
+    CommentedConfigFile::ReloadSummary summary = subject.reload();
+    BOOST_CHECK_EQUAL( summary.success, true );
+    BOOST_CHECK_EQUAL( summary.changed(), false );
+    BOOST_CHECK_EQUAL( summary.unchanged, 4 );
+
+    string_vec changed = {
+        /** 00 **/  "# header 00",
+        /** 01 **/  "",
+        /** 02 **/  "# new comment",
+        /** 03 **/  "bbb",
+        /** 04 **/  "new",
+        /** 05 **/  "aaa",
+        /** 06 **/  "ccc # line comment",
+        /** 07 **/  "",
+        /** 08 **/  "# new footer"
+    };
+
+    write_lines( filename, changed );
+    summary = subject.reload();
+
+    BOOST_CHECK_EQUAL( summary.success, true );
+    BOOST_CHECK_EQUAL( summary.changed(), true );
+    BOOST_CHECK_EQUAL( summary.header_changed, false );
+    BOOST_CHECK_EQUAL( summary.footer_changed, true );
+    BOOST_CHECK_EQUAL( summary.unchanged, 2 );
+    BOOST_CHECK_EQUAL( summary.added.size(), 1 );
+    BOOST_CHECK_EQUAL( summary.comments_changed.size(), 1 );
+    BOOST_CHECK_EQUAL( summary.removed_lines.size(), 1 );
+    BOOST_CHECK_EQUAL( summary.removed_lines[0], "ddd" );
+
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 4 );
+    BOOST_CHECK_EQUAL( subject.get_entry(0), entry_b );
+    BOOST_CHECK_EQUAL( subject.get_entry(1), summary.added[0] );
+    BOOST_CHECK_EQUAL( subject.get_entry(2), entry_a );
+    BOOST_CHECK_EQUAL( subject.get_entry(3), entry_c );
+    BOOST_CHECK_EQUAL( subject.get_content(1), "new" );
+    BOOST_CHECK_EQUAL( subject.get_index_of( entry_c ), 3 );
+    BOOST_CHECK_EQUAL( entry_b->get_comment_before().size(), 1 );
+    BOOST_CHECK_EQUAL( entry_b->get_comment_before()[0], "# new comment" );
+    BOOST_CHECK_EQUAL( subject.is_modified(), false );
+
+    string_vec output = subject.format_lines();
+    BOOST_CHECK_EQUAL( output.size(), changed.size() );
+
+    for ( size_t i=0; i < changed.size(); ++i )
+        BOOST_CHECK_EQUAL( output[i], changed[i] );
+
+    remove( filename.c_str() );
+
+    summary = subject.reload();
+    BOOST_CHECK_EQUAL( summary.success, false );
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 4 );
+}
+
+
+BOOST_AUTO_TEST_CASE( reload_after_write )
+{
+    string filename = "parser-reload-write-test.txt";
+    write_lines( filename, string_vec { "aaa", "bbb", "ccc" } );
+
+    CommentedConfigFile subject;
+    subject.read( filename );
+
+    CommentedConfigFile::Entry * entry_b = subject.get_entry(1);
+    entry_b->set_content( "BBB" );
+    BOOST_CHECK( subject.write() );
+    BOOST_CHECK_EQUAL( subject.is_modified(), false );
+    BOOST_CHECK_EQUAL( entry_b->is_modified(), false );
+    BOOST_CHECK_EQUAL( entry_b->get_orig_line(), "BBB" );
+
+    // Reloading what was just written keeps everything
+
+    CommentedConfigFile::ReloadSummary summary = subject.reload();
+    BOOST_CHECK_EQUAL( summary.success, true );
+    BOOST_CHECK_EQUAL( summary.changed(), false );
+    BOOST_CHECK_EQUAL( subject.get_entry(1), entry_b );
+
+    // So does a change of another line on disk
+
+    write_lines( filename, string_vec { "aaa", "BBB", "dddd" } );
+    summary = subject.reload();
+    BOOST_CHECK_EQUAL( summary.added.size(), 1 );
+    BOOST_CHECK_EQUAL( summary.removed_lines.size(), 1 );
+    BOOST_CHECK_EQUAL( summary.removed_lines[0], "ccc" );
+    BOOST_CHECK_EQUAL( subject.get_entry(1), entry_b );
+
+    remove( filename.c_str() );
+}
+
+
+/**
+ * Entry that counts how often it is formatted and formats its content
+ * differently from how it was read.
+ **/
+class UpperEntry: public CommentedConfigFile::Entry
+{
+public:
+    virtual string format()
+        {
+            ++format_count;
+            string line = get_content();
+
+            for ( size_t i=0; i < line.size(); ++i )
+                line[i] = toupper( line[i] );
+
+            return line;
+        }
+
+    static int format_count;
+};
+
+int UpperEntry::format_count = 0;
+
+
+class UpperConfigFile: public CommentedConfigFile
+{
+public:
+    virtual Entry * create_entry() { return new UpperEntry(); }
+};
+
+
+BOOST_AUTO_TEST_CASE( write_formats_once )
+{
+    string filename = "parser-write-format-test.txt";
+    write_lines( filename, string_vec { "aaa", "bbb", "ccc" } );
+
+    UpperConfigFile subject;
+    subject.read( filename );
+    CommentedConfigFile::Entry * entry_b = subject.get_entry(1);
+    entry_b->set_content( "bbbb" );
+
+    UpperEntry::format_count = 0;
+    BOOST_CHECK( subject.write() );
+    BOOST_CHECK_EQUAL( UpperEntry::format_count, 3 );
+    BOOST_CHECK_EQUAL( subject.is_modified(), false );
+
+    // Without verbatim_unchanged, the lines that were read are kept
+
+    BOOST_CHECK_EQUAL( entry_b->get_orig_line(), "bbbb" );
+
+    // reload() finds the entries by the lines that were written
+
+    CommentedConfigFile::ReloadSummary summary = subject.reload();
+    BOOST_CHECK_EQUAL( summary.changed(), false );
+    BOOST_CHECK_EQUAL( subject.get_entry(1), entry_b );
+
+    write_lines( filename, string_vec { "AAA", "BBBB", "ddd" } );
+    summary = subject.reload();
+    BOOST_CHECK_EQUAL( summary.added.size(), 1 );
+    BOOST_CHECK_EQUAL( summary.removed_lines.size(), 1 );
+    BOOST_CHECK_EQUAL( summary.removed_lines[0], "CCC" );
+    BOOST_CHECK_EQUAL( subject.get_entry(1), entry_b );
+
+    // With verbatim_unchanged, only the modified entry is formatted, and
+    // it is committed from the text that was written
+
+    subject.set_verbatim_unchanged();
+    subject.get_entry(2)->set_content( "eee" );
+
+    UpperEntry::format_count = 0;
+    BOOST_CHECK( subject.write() );
+    BOOST_CHECK_EQUAL( UpperEntry::format_count, 1 );
+    BOOST_CHECK_EQUAL( subject.get_entry(2)->get_orig_line(), "EEE" );
+
+    summary = subject.reload();
+    BOOST_CHECK_EQUAL( summary.changed(), false );
+    BOOST_CHECK_EQUAL( UpperEntry::format_count, 1 );
+
+    remove( filename.c_str() );
+}
+
+
+/**
+ * Entry that counts how often it is parsed and fails for "bad" lines.
+ **/
+class LazyEntry: public CommentedConfigFile::Entry
+{
+public:
+    virtual bool parse( const string & line, int line_no = -1 )
+        {
+            ++parse_count;
+            set_content( "parsed " + line );
+
+            return line != "bad";
+        }
+
+    static int parse_count;
+};
+
+int LazyEntry::parse_count = 0;
+
+
+class LazyConfigFile: public CommentedConfigFile
+{
+public:
+    virtual Entry * create_entry() { return new LazyEntry(); }
+};
+
+
+BOOST_AUTO_TEST_CASE( lazy_parse )
+{
+    string_vec input = { "# header", "", "a", "# comment", "bad", "c # line comment" };
+
+    LazyConfigFile subject;
+    subject.set_lazy_parse();
+    LazyEntry::parse_count = 0;
+
+    BOOST_CHECK_EQUAL( subject.parse( input ), true );
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 3 );
+    BOOST_CHECK_EQUAL( LazyEntry::parse_count, 0 );
+
+    // Unparsed entries are written back as they are
+
+    BOOST_CHECK( subject.format_lines() == input );
+    BOOST_CHECK_EQUAL( LazyEntry::parse_count, 0 );
+
+    CommentedConfigFile::Entry * entry = subject.get_entry( 2 );
+
+    BOOST_CHECK_EQUAL( LazyEntry::parse_count, 1 );
+    BOOST_CHECK_EQUAL( entry->is_parsed(), true );
+    BOOST_CHECK_EQUAL( entry->get_content(), "parsed c" );
+    BOOST_CHECK_EQUAL( entry->get_line_comment(), "# line comment" );
+    BOOST_CHECK_EQUAL( entry->get_orig_line(), "c # line comment" );
+    BOOST_CHECK_EQUAL( entry->is_modified(), false );
+    BOOST_CHECK_EQUAL( subject.is_modified(), false );
+    BOOST_CHECK_EQUAL( subject.entries[0]->is_parsed(), false );
+
+    // Accessing it again does not parse it again
+
+    subject.get_entry( 2 );
+    BOOST_CHECK_EQUAL( LazyEntry::parse_count, 1 );
+
+    // Iterators parse what they access
+
+    int count = 0;
+
+    for ( CommentedConfigFile::const_iterator it = subject.begin(); it != subject.end(); ++it )
+    {
+        BOOST_CHECK_EQUAL( (*it)->is_parsed(), true );
+        ++count;
+    }
+
+    BOOST_CHECK_EQUAL( count, 3 );
+    BOOST_CHECK_EQUAL( LazyEntry::parse_count, 3 );
+    BOOST_CHECK_EQUAL( subject.get_entry( 1 )->get_parse_failed(), true );
+    BOOST_CHECK_EQUAL( subject.format_lines()[4], "bad" );
+
+    // parse_all() gets rid of the entries that could not be parsed
+
+    BOOST_CHECK_EQUAL( subject.parse_all(), false );
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 2 );
+    BOOST_CHECK_EQUAL( subject.get_entry( 1 ), entry );
+    BOOST_CHECK_EQUAL( subject.parse_all(), true );
+    BOOST_CHECK_EQUAL( LazyEntry::parse_count, 3 );
+
+    // Without lazy parsing, everything is parsed right away
+
+    subject.set_lazy_parse( false );
+    LazyEntry::parse_count = 0;
+
+    BOOST_CHECK_EQUAL( subject.parse( input ), false );
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 2 );
+    BOOST_CHECK_EQUAL( LazyEntry::parse_count, 3 );
+}
+
+
+string_vec stream_lines( CommentedConfigFile &             file,
+                         const string_vec &                input,
+                         CommentedConfigFile::StreamFilter filter,
+                         bool *                            success_ret = 0 )
+{
+    std::stringstream in;
+    std::stringstream out;
+
+    for ( size_t i=0; i < input.size(); ++i )
+        in << input[i] << "\n";
+
+    bool success = file.stream( in, out, filter );
+
+    if ( success_ret )
+        *success_ret = success;
+
+    string_vec lines;
+    string     line;
+
+    while ( std::getline( out, line ) )
+        lines.push_back( line );
+
+    return lines;
+}
+
+
+BOOST_AUTO_TEST_CASE( stream )
+{
+    vector<string_vec> inputs = {
+        { "# header", "", "# comment a", "a", "b # line comment", "", "c", "# footer" },
+        { "# comment a", "a", "b" },
+        { "", "# comment a", "a", "" },
+        { "# only", "", "# comments" },
+        { "a" },
+        {}
+    };
+
+    // Without a filter, the result has to be the same as with parse()
+
+    for ( size_t i=0; i < inputs.size(); ++i )
+    {
+        CommentedConfigFile subject;
+        CommentedConfigFile parsed;
+        parsed.parse( inputs[i] );
+
+        BOOST_CHECK( stream_lines( subject, inputs[i], 0 ) == parsed.format_lines() );
+    }
+
+    string_vec input = inputs[0];
+    CommentedConfigFile subject;
+
+    string_vec output = stream_lines( subject, input,
+        []( CommentedConfigFile::Entry * entry, vector<CommentedConfigFile::Entry *> & insert_before )
+        {
+            if ( entry->get_content() == "a" )
+                return false;
+
+            if ( entry->get_content() == "c" )
+            {
+                CommentedConfigFile::Entry * new_entry = new CommentedConfigFile::Entry();
+                new_entry->set_content( "new" );
+                new_entry->set_comment_before( { "# new comment" } );
+                insert_before.push_back( new_entry );
+                entry->set_content( "cc" );
+            }
+
+            return true;
+        } );
+
+    string_vec expected = { "# header", "", "b # line comment", "# new comment", "new", "", "cc", "# footer" };
+    BOOST_CHECK( output == expected );
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 0 );
+
+    // Lines that cannot be parsed are dropped, just like with parse()
+
+    LazyConfigFile lazy;
+    bool success = true;
+    output = stream_lines( lazy, { "a", "bad", "c" }, 0, &success );
+
+    BOOST_CHECK_EQUAL( success, false );
+    BOOST_CHECK( output == string_vec( { "parsed a", "parsed c" } ) );
+}
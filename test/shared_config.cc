@@ -0,0 +1,252 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE shared_config
+
+#include <boost/test/unit_test.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "ColumnConfigFile.h"
+#include "SharedConfig.h"
+
+
+string_vec test_data()
+{
+    string_vec lines = {
+        "# header 00",
+        "",
+        "# entry 00 comment 00",
+        "aaa   1 # line comment 00",
+        "bbb 2",
+        "",
+        "# footer 00"
+    };
+
+    return lines;
+}
+
+
+string test_name()
+{
+    return "ccf-shared-config-test-" + std::to_string( getpid() );
+}
+
+
+BOOST_AUTO_TEST_CASE( publish_and_subscribe )
+{
+    ColumnConfigFile file;
+    file.parse( test_data() );
+
+    SharedConfigPublisher  publisher ( test_name() );
+    SharedConfigSubscriber subscriber( test_name() );
+
+    BOOST_CHECK_EQUAL( subscriber.update(), false );
+    BOOST_CHECK( ! subscriber.get_view() );
+
+    BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+    BOOST_CHECK_EQUAL( publisher.get_generation(), 1 );
+    BOOST_CHECK_EQUAL( subscriber.get_published_generation(), 1 );
+
+    BOOST_CHECK_EQUAL( subscriber.update(), true );
+    BOOST_CHECK_EQUAL( subscriber.update(), false );
+    BOOST_CHECK_EQUAL( subscriber.get_generation(), 1 );
+
+    std::shared_ptr<const ParseCache::View> view = subscriber.get_view();
+
+    BOOST_CHECK_EQUAL( view->get_entry_count(), 2 );
+    BOOST_CHECK_EQUAL( view->get_content( 0 ), "aaa   1" );
+    BOOST_CHECK_EQUAL( view->get_line_comment( 0 ), "# line comment 00" );
+    BOOST_CHECK_EQUAL( view->get_comment_count( 0 ), 1 );
+    BOOST_CHECK_EQUAL( view->get_comment( 0, 0 ), "# entry 00 comment 00" );
+    BOOST_CHECK_EQUAL( view->get_field_count( 1 ), 2 );
+    BOOST_CHECK_EQUAL( view->get_field( 1, 0 ), "bbb" );
+    BOOST_CHECK_EQUAL( view->get_field( 1, 1 ), "2" );
+    BOOST_CHECK_EQUAL( view->get_header_comment_count(), 2 );
+    BOOST_CHECK_EQUAL( view->get_footer_comment( 1 ), "# footer 00" );
+
+
+    // Next generation: The old view stays valid
+
+    file.get_entry( 1 )->set_column( 1, "22" );
+    BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+    BOOST_CHECK_EQUAL( subscriber.update(), true );
+    BOOST_CHECK_EQUAL( subscriber.get_generation(), 2 );
+
+    BOOST_CHECK_EQUAL( view->get_field( 1, 1 ), "2" );
+    BOOST_CHECK_EQUAL( subscriber.get_view()->get_field( 1, 1 ), "22" );
+
+    ColumnConfigFile copy;
+    BOOST_CHECK_EQUAL( subscriber.copy_to( &copy ), true );
+    BOOST_CHECK( copy.format_lines() == file.format_lines() );
+    BOOST_CHECK_EQUAL( copy.get_entry( 1 )->get_column( 1 ), "22" );
+
+    publisher.remove();
+    BOOST_CHECK_EQUAL( view->get_content( 1 ), "bbb 2" );
+
+    SharedConfigSubscriber late_subscriber( test_name() );
+    BOOST_CHECK_EQUAL( late_subscriber.update(), false );
+}
+
+
+BOOST_AUTO_TEST_CASE( new_publisher )
+{
+    ColumnConfigFile file;
+    file.parse( test_data() );
+
+    SharedConfigSubscriber subscriber( test_name() );
+
+    {
+        SharedConfigPublisher publisher( test_name() );
+
+        BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+        BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+        BOOST_CHECK_EQUAL( subscriber.update(), true );
+        BOOST_CHECK_EQUAL( subscriber.get_generation(), 2 );
+
+        publisher.remove();
+    }
+
+    // No publisher: The attached generation stays valid
+
+    BOOST_CHECK_EQUAL( subscriber.get_published_generation(), 0 );
+    BOOST_CHECK_EQUAL( subscriber.update(), false );
+    BOOST_CHECK_EQUAL( subscriber.get_view()->get_field( 1, 1 ), "2" );
+
+
+    // A new publisher starts again with generation 1 and then gets to the
+    // same generation as the old one
+
+    SharedConfigPublisher publisher( test_name() );
+    file.get_entry( 1 )->set_column( 1, "22" );
+
+    BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+    BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+    BOOST_CHECK_EQUAL( publisher.get_generation(), 2 );
+    BOOST_CHECK_EQUAL( subscriber.get_published_generation(), 2 );
+
+    BOOST_CHECK_EQUAL( subscriber.update(), true );
+    BOOST_CHECK_EQUAL( subscriber.update(), false );
+    BOOST_CHECK_EQUAL( subscriber.get_generation(), 2 );
+    BOOST_CHECK_EQUAL( subscriber.get_view()->get_field( 1, 1 ), "22" );
+
+
+    // Removed and replaced without the subscriber polling in between
+
+    publisher.remove();
+    file.get_entry( 1 )->set_column( 1, "333" );
+    BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+
+    BOOST_CHECK_EQUAL( subscriber.update(), true );
+    BOOST_CHECK_EQUAL( subscriber.get_generation(), 1 );
+    BOOST_CHECK_EQUAL( subscriber.get_view()->get_field( 1, 1 ), "333" );
+
+    publisher.remove();
+}
+
+
+/**
+ * Return the permissions of shared memory segment 'name' or -1 if there is
+ * no such segment.
+ **/
+int segment_mode( const string & name )
+{
+    struct stat st;
+
+    if ( stat( ( "/dev/shm/" + name ).c_str(), &st ) != 0 )
+        return -1;
+
+    return st.st_mode & 0777;
+}
+
+
+BOOST_AUTO_TEST_CASE( segment_permissions )
+{
+    ColumnConfigFile file;
+    file.parse( test_data() );
+
+    {
+        SharedConfigPublisher publisher( test_name() );
+        BOOST_CHECK_EQUAL( publisher.get_mode(), 0600 );
+        BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+        BOOST_CHECK_EQUAL( segment_mode( test_name() ), 0600 );
+        BOOST_CHECK_EQUAL( segment_mode( test_name() + ".1" ), 0600 );
+        publisher.remove();
+    }
+
+    {
+        SharedConfigPublisher publisher( test_name() );
+        publisher.set_mode( 0640 );
+        BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+        BOOST_CHECK_EQUAL( segment_mode( test_name() ), 0640 );
+        BOOST_CHECK_EQUAL( segment_mode( test_name() + ".1" ), 0640 );
+        publisher.remove();
+    }
+
+    if ( geteuid() != 0 ) // Only root can create a segment for somebody else
+        return;
+
+    // A control segment of another user is not used
+
+    string control_name = "/" + test_name();
+    int fd = shm_open( control_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644 );
+    BOOST_REQUIRE( fd >= 0 );
+    BOOST_CHECK_EQUAL( fchown( fd, 65534, 65534 ), 0 );
+    close( fd );
+
+    {
+        SharedConfigPublisher publisher( test_name() );
+        BOOST_CHECK_EQUAL( publisher.publish( &file ), false );
+    }
+
+    shm_unlink( control_name.c_str() );
+
+    // Subscribers do not use a generation of another user
+
+    SharedConfigPublisher  publisher ( test_name() );
+    SharedConfigSubscriber subscriber( test_name() );
+    BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+
+    string generation_name = control_name + ".1";
+    fd = shm_open( generation_name.c_str(), O_RDWR, 0 );
+    BOOST_REQUIRE( fd >= 0 );
+    BOOST_CHECK_EQUAL( fchown( fd, 65534, 65534 ), 0 );
+    close( fd );
+
+    BOOST_CHECK_EQUAL( subscriber.update(), false );
+    BOOST_CHECK( ! subscriber.get_view() );
+
+    publisher.remove();
+}
+
+
+BOOST_AUTO_TEST_CASE( other_process )
+{
+    CommentedConfigFile file;
+    file.parse( test_data() );
+
+    string                name = test_name(); // not in the child
+    SharedConfigPublisher publisher( name );
+    BOOST_CHECK_EQUAL( publisher.publish( &file ), true );
+
+    pid_t pid = fork();
+
+    if ( pid == 0 )
+    {
+        SharedConfigSubscriber subscriber( name );
+        bool ok = subscriber.update() &&
+            subscriber.get_view()->get_entry_count() == 2 &&
+            subscriber.get_view()->get_content( 1 ) == "bbb 2";
+
+        _exit( ok ? 0 : 1 );
+    }
+
+    int status = -1;
+    waitpid( pid, &status, 0 );
+
+    BOOST_CHECK( WIFEXITED( status ) );
+    BOOST_CHECK_EQUAL( WEXITSTATUS( status ), 0 );
+
+    publisher.remove();
+}
@@ -3,10 +3,14 @@
 #define BOOST_TEST_MODULE commented-config-file
 
 #include <boost/test/unit_test.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 
 #define protected public
 #define private   public
 #include "CommentedConfigFile.h"
+#include "ColumnConfigFile.h"
+#include "BasicCommentedConfigFile.h"
 
 
 BOOST_AUTO_TEST_CASE( comment_lines )
@@ -95,3 +99,198 @@ BOOST_AUTO_TEST_CASE( split_line )
 }
 
 
+
+
+struct SlashCommentTraits
+{
+    typedef CharSequence<'/', '/'>  CommentMarker;
+    typedef CharSet<' ', '\t'>      Whitespace;
+};
+
+
+BOOST_AUTO_TEST_CASE( traits_same_as_runtime )
+{
+    string_vec lines = {
+        "", "   ", " \t \t", "#", " \t#", "###", "# Text", "x",
+        "content # comment", "content   # comment  ", "content   #",
+        "content  ", "    # comment\t", "a#b", "#a b  "
+    };
+
+    CommentedConfigFile                         runtime;
+    BasicCommentedConfigFile<HashCommentTraits> subject;
+
+    BOOST_CHECK_EQUAL( subject.get_comment_marker(), "#" );
+
+    for ( const string & line: lines )
+    {
+        BOOST_CHECK_EQUAL( subject.classify_line( line ), runtime.classify_line( line ) );
+        BOOST_CHECK_EQUAL( subject.is_comment_line( line ), runtime.is_comment_line( line ) );
+        BOOST_CHECK_EQUAL( subject.is_empty_line( line ), runtime.is_empty_line( line ) );
+
+        string content, comment;
+        string expected_content, expected_comment;
+
+        subject.split_off_comment( line, content, comment );
+        runtime.split_off_comment( line, expected_content, expected_comment );
+
+        BOOST_CHECK_EQUAL( content, expected_content );
+        BOOST_CHECK_EQUAL( comment, expected_comment );
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE( traits_slash_comments )
+{
+    BasicCommentedConfigFile<SlashCommentTraits> subject;
+
+    BOOST_CHECK_EQUAL( subject.get_comment_marker(), "//" );
+    BOOST_CHECK_EQUAL( subject.is_comment_line( "// Text" ), true );
+    BOOST_CHECK_EQUAL( subject.is_comment_line( " \t//"  ), true );
+    BOOST_CHECK_EQUAL( subject.is_comment_line( "/"       ), false );
+    BOOST_CHECK_EQUAL( subject.is_comment_line( "# Text"  ), false );
+
+    string content, comment;
+
+    subject.split_off_comment( "a/b c // comment", content, comment );
+    BOOST_CHECK_EQUAL( content, "a/b c" );
+    BOOST_CHECK_EQUAL( comment, "// comment" );
+
+    subject.split_off_comment( "a/b/", content, comment );
+    BOOST_CHECK_EQUAL( content, "a/b/" );
+    BOOST_CHECK_EQUAL( comment, "" );
+}
+
+
+BOOST_AUTO_TEST_CASE( traits_column_config_file )
+{
+    string_vec input = {
+        "# header",
+        "",
+        "# comment",
+        "aaa   bb  c # line comment",
+        "dd e    ffff",
+        "",
+        "# footer"
+    };
+
+    ColumnConfigFile runtime;
+    BasicCommentedConfigFile<HashCommentTraits, ColumnConfigFile> subject;
+
+    runtime.parse( input );
+    subject.parse( input );
+
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 2 );
+    BOOST_CHECK_EQUAL( subject.get_header_comments().size(), 2 );
+    BOOST_CHECK_EQUAL( subject.get_footer_comments().size(), 2 );
+    BOOST_CHECK_EQUAL( subject.get_entry( 0 )->get_column_count(), 3 );
+    BOOST_CHECK( subject.format_lines() == runtime.format_lines() );
+}
+
+
+
+
+
+BOOST_AUTO_TEST_CASE( find_columns )
+{
+    string_vec lines = {
+        "",
+        "a",
+        "  ",
+        "aaa bbb ccc",
+        "  aaa\tbbb  ",
+        "/dev/disk/by-label/Ubuntu\t /\text4  errors=remount-ro\t 0  1",
+        "0123456789abcde f0123456789abcd \t\t ef0123456789abcdef01234 ",
+        "                 x                                ",
+        "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\tx"
+    };
+
+    for ( const string & line: lines )
+    {
+        string_vec expected;
+        boost::split( expected, line, boost::is_any_of( " \t" ), boost::token_compress_on );
+
+        ColumnConfigFile::ColumnSpanVec spans;
+        ColumnConfigFile::find_columns( line, spans );
+
+        string_vec columns;
+
+        for ( const ColumnConfigFile::ColumnSpan & span: spans )
+            columns.push_back( line.substr( span.offset, span.size ) );
+
+        BOOST_CHECK_EQUAL( columns.size(), expected.size() );
+        BOOST_CHECK( columns == expected );
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE( column_spans )
+{
+    ColumnConfigFile::Entry entry;
+    entry.parse( "aaa  bb c" );
+
+    BOOST_CHECK_EQUAL( entry.get_column_count(), 3 );
+    BOOST_CHECK( ! entry.owned_columns );
+    BOOST_CHECK_EQUAL( entry.get_column_ref( 1 ), "bb" );
+    BOOST_CHECK( entry.get_column_ref( 1 ).data() == entry.get_content().data() + 5 );
+
+    // Setting the same value does not copy anything
+
+    entry.set_column( 1, "bb" );
+    BOOST_CHECK( ! entry.owned_columns );
+
+    entry.set_column( 1, "xx" );
+    BOOST_CHECK( entry.owned_columns );
+    BOOST_CHECK_EQUAL( entry.get_column( 0 ), "aaa" );
+    BOOST_CHECK_EQUAL( entry.get_column( 1 ), "xx" );
+    BOOST_CHECK_EQUAL( entry.format(), "aaa  xx  c" );
+
+    // The content is independent of the columns
+
+    ColumnConfigFile::Entry other;
+    other.parse( "a b" );
+    other.set_content( "new content" );
+
+    BOOST_CHECK_EQUAL( other.get_column_count(), 2 );
+    BOOST_CHECK_EQUAL( other.get_column( 1 ), "b" );
+}
+
+
+/**
+ * Column entry with colon-separated columns like in /etc/passwd.
+ **/
+class ColonEntry: public ColumnConfigFile::Entry
+{
+protected:
+    virtual string_vec split( const string & line ) const
+        {
+            string_vec fields;
+            boost::split( fields, line, boost::is_any_of( ":" ) );
+
+            return fields;
+        }
+};
+
+
+class PlainDerivedEntry: public ColumnConfigFile::Entry
+{
+};
+
+
+BOOST_AUTO_TEST_CASE( split_override )
+{
+    ColonEntry colon_entry;
+    colon_entry.parse( "root:x:0:0:root user:/root:/bin/bash" );
+
+    BOOST_CHECK_EQUAL( colon_entry.get_column_count(), 7 );
+    BOOST_CHECK_EQUAL( colon_entry.get_column( 4 ), "root user" );
+    BOOST_CHECK_EQUAL( colon_entry.get_column( 6 ), "/bin/bash" );
+
+    // Derived classes that do not override split() still get spans
+
+    PlainDerivedEntry derived_entry;
+    derived_entry.parse( "aaa  bb c" );
+
+    BOOST_CHECK_EQUAL( derived_entry.get_column_count(), 3 );
+    BOOST_CHECK_EQUAL( derived_entry.get_column( 1 ), "bb" );
+    BOOST_CHECK( ! derived_entry.owned_columns );
+}
@@ -0,0 +1,196 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE typed
+
+#include <boost/test/unit_test.hpp>
+
+#include "TypedConfigFile.h"
+
+
+/**
+ * Entry with a key and a value, separated by "=". Entries with an empty
+ * value are not written.
+ **/
+class KeyValueEntry: public CommentedConfigFile::Entry
+{
+public:
+
+    virtual bool parse( const string & line, int line_no = -1 )
+        {
+            size_t pos = line.find( '=' );
+
+            if ( pos == string::npos )
+                return false;
+
+            key   = line.substr( 0, pos );
+            value = line.substr( pos + 1 );
+            set_content( line );
+
+            return true;
+        }
+
+    virtual bool validate() { return ! value.empty(); }
+
+    virtual string format() { return key + "=" + value; }
+
+    void set_value( const string & new_value ) { value = new_value; set_modified(); }
+
+    string key;
+    string value;
+};
+
+
+/**
+ * Column entry that keeps its first column as a number and puts it back
+ * into the columns in populate_columns().
+ **/
+class CountEntry: public ColumnConfigFile::Entry
+{
+public:
+
+    CountEntry(): count( 0 ) {}
+
+    virtual bool parse( const string & line, int line_no = -1 )
+        {
+            ColumnConfigFile::Entry::parse( line, line_no );
+            count = std::stoi( get_column( 0 ) );
+
+            return true;
+        }
+
+    virtual void populate_columns() { set_column( 0, std::to_string( count ) ); }
+
+    void set_count( int new_count ) { count = new_count; set_modified(); }
+
+    int count;
+};
+
+
+class CountConfigFile: public ColumnConfigFile
+{
+public:
+
+    virtual CountEntry * create_entry() { return new CountEntry(); }
+};
+
+
+BOOST_AUTO_TEST_CASE( typed_entries )
+{
+    string_vec input = {
+        "# header",
+        "",
+        "a=1",
+        "# comment b",
+        "b=2 # line comment",
+        "c=3"
+    };
+
+    TypedConfigFile<KeyValueEntry> subject;
+    subject.parse( input );
+
+    BOOST_CHECK_EQUAL( subject.get_entry_count(), 3 );
+    BOOST_CHECK_EQUAL( subject.get_entry( 1 )->key,   "b" );
+    BOOST_CHECK_EQUAL( subject.get_entry( 1 )->value, "2" );
+    BOOST_CHECK( subject.get_entry( 3 ) == 0 );
+
+    string keys;
+
+    for ( KeyValueEntry * entry: subject )
+        keys += entry->key;
+
+    BOOST_CHECK_EQUAL( keys, "abc" );
+    BOOST_CHECK( subject.format_lines() == input );
+
+    // validate() and format() of KeyValueEntry are used
+
+    subject.get_entry( 0 )->set_value( "" );
+    subject.get_entry( 2 )->set_value( "33" );
+
+    KeyValueEntry * entry = new KeyValueEntry();
+    entry->parse( "d=4" );
+    subject << entry;
+
+    string_vec expected = {
+        "# header",
+        "",
+        "# comment b",
+        "b=2 # line comment",
+        "c=33",
+        "d=4"
+    };
+
+    BOOST_CHECK( subject.format_lines() == expected );
+
+    entry = subject.take( 3 );
+    BOOST_CHECK_EQUAL( entry->key, "d" );
+    delete entry;
+}
+
+
+BOOST_AUTO_TEST_CASE( typed_columns )
+{
+    string_vec input = {
+        "# header",
+        "",
+        "aaa   bb  c # line comment",
+        "dd e    ffff",
+        "",
+        "# footer"
+    };
+
+    ColumnConfigFile expected;
+    TypedConfigFile<ColumnConfigFile::Entry, ColumnConfigFile> subject;
+
+    expected.parse( input );
+    subject.parse( input );
+
+    BOOST_CHECK_EQUAL( subject.get_entry( 1 )->get_column( 2 ), "ffff" );
+    BOOST_CHECK( subject.format_lines() == expected.format_lines() );
+
+    subject.get_entry( 1 )->set_column( 0, "dddddd" );
+    expected.get_entry( 1 )->set_column( 0, "dddddd" );
+    BOOST_CHECK( subject.format_lines() == expected.format_lines() );
+
+    string subject_text;
+    string expected_text;
+    subject.format_text( subject_text );
+    expected.format_text( expected_text );
+    BOOST_CHECK_EQUAL( subject_text, expected_text );
+
+    subject.set_pad_columns( false );
+    expected.set_pad_columns( false );
+    BOOST_CHECK( subject.format_lines() == expected.format_lines() );
+}
+
+
+BOOST_AUTO_TEST_CASE( typed_populate_columns )
+{
+    string_vec input = {
+        "1 one",
+        "22 two",
+        "3 three"
+    };
+
+    CountConfigFile                               expected;
+    TypedConfigFile<CountEntry, ColumnConfigFile> subject;
+
+    expected.parse( input );
+    subject.parse( input );
+
+    BOOST_CHECK( subject.format_lines() == expected.format_lines() );
+
+    subject.get_entry( 2 )->set_count( 333 );
+    static_cast<CountEntry *>( expected.get_entry( 2 ) )->set_count( 333 );
+
+    string_vec lines = subject.format_lines();
+
+    BOOST_CHECK( lines == expected.format_lines() );
+    BOOST_CHECK_EQUAL( lines[2], "333  three" );
+    BOOST_CHECK_EQUAL( lines[0], "1    one" );
+
+    // Typed pass over all entries
+
+    subject.set_populate_all();
+    subject.get_entry( 1 )->count = 4444;
+    BOOST_CHECK_EQUAL( subject.format_lines()[1], "4444  two" );
+    BOOST_CHECK_EQUAL( subject.get_column_width( 0 ), 4 );
+}
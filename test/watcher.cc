@@ -0,0 +1,113 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE watcher
+
+#include <boost/test/unit_test.hpp>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <stdio.h>
+
+#include "ConfigFileWatcher.h"
+
+
+void write_lines( const string & filename, const string_vec & lines )
+{
+    // Like an editor: Write a new file and rename it over the old one
+
+    string temp_name = filename + ".tmp";
+
+    {
+        std::ofstream file( temp_name );
+
+        for ( size_t i=0; i < lines.size(); ++i )
+            file << lines[i] << "\n";
+    }
+
+    rename( temp_name.c_str(), filename.c_str() );
+}
+
+
+/**
+ * Helper to wait for a number of callbacks from the watcher thread.
+ **/
+class CallbackCounter
+{
+public:
+    CallbackCounter(): count(0), added(0) {}
+
+    void callback( CommentedConfigFile * file,
+                   const CommentedConfigFile::ReloadSummary & summary )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        ++count;
+        added += summary.added.size();
+        cond.notify_all();
+    }
+
+    bool wait_for( int wanted_count )
+    {
+        std::unique_lock<std::mutex> lock( mutex );
+
+        return cond.wait_for( lock, std::chrono::seconds( 10 ),
+                              [&]() { return count >= wanted_count; } );
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cond;
+    int                     count;
+    int                     added;
+};
+
+
+void check_watcher( bool force_polling )
+{
+    string filename = force_polling ? "watcher-poll-test.txt" : "watcher-inotify-test.txt";
+    write_lines( filename, { "aaa", "bbb" } );
+
+    CommentedConfigFile subject;
+    subject.read( filename );
+    CommentedConfigFile::Entry * entry_a = subject.get_entry(0);
+
+    CallbackCounter counter;
+    ConfigFileWatcher watcher( 50 );
+    watcher.set_force_polling( force_polling );
+    watcher.set_poll_interval_millisec( 20 );
+
+    using namespace std::placeholders;
+    BOOST_CHECK_EQUAL( watcher.add( &subject, std::bind( &CallbackCounter::callback, &counter, _1, _2 ) ), true );
+    BOOST_CHECK_EQUAL( watcher.start(), true );
+    BOOST_CHECK_EQUAL( watcher.get_using_inotify(), ! force_polling );
+
+    // A burst of changes results in one reload
+
+    write_lines( filename, { "aaa", "bbb", "ccc" } );
+    write_lines( filename, { "aaa", "bbb", "ccc", "dddd" } );
+
+    BOOST_CHECK_EQUAL( counter.wait_for( 1 ), true );
+
+    {
+        std::lock_guard<std::mutex> lock( counter.mutex );
+
+        BOOST_CHECK_EQUAL( subject.get_entry_count(), 4 );
+        BOOST_CHECK_EQUAL( subject.get_entry(0), entry_a );
+    }
+
+    watcher.remove( &subject );
+    BOOST_CHECK_EQUAL( watcher.get_watch_count(), 0 );
+    watcher.stop();
+
+    BOOST_CHECK_EQUAL( counter.added, 2 );
+    remove( filename.c_str() );
+}
+
+
+BOOST_AUTO_TEST_CASE( watch_with_inotify )
+{
+    check_watcher( false );
+}
+
+
+BOOST_AUTO_TEST_CASE( watch_with_polling )
+{
+    check_watcher( true );
+}